@@ -0,0 +1,118 @@
+//
+//  BSONColumnarDecoder.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+#import "BSONTypes.h"
+
+@class BSONDocument;
+
+/**
+ One field of a batch of documents decoded by <code>BSONColumnarDecoder</code>, stored as a
+ contiguous C array with one entry per document.
+
+ The storage depends on the column's type:
+ - <code>BSONTypeDouble</code>: <code>-doubleValues</code>
+ - <code>BSONTypeLong</code>: <code>-int64Values</code>
+ - <code>BSONTypeDate</code>: <code>-int64Values</code>, in milliseconds since 1970
+ - <code>BSONTypeInteger</code>: <code>-int32Values</code>
+ - <code>BSONTypeBoolean</code>: <code>-boolValues</code>
+ - <code>BSONTypeString</code>: <code>-stringBytes</code>, the UTF-8 bytes of every value one after
+   another without terminators, and <code>-stringOffsets</code>, where value <i>i</i> runs from
+   <code>stringOffsets[i]</code> to <code>stringOffsets[i + 1]</code>
+
+ The other accessors return <code>NULL</code>. The pointers are valid until the decoder appends
+ more documents or removes them.
+
+ Where a document has no value of the column's type at its key path, the value is zero (or empty)
+ and the document's bit in <code>-nullBitmap</code> is set.
+ */
+@interface BSONColumn : NSObject
+
+@property (retain, readonly) NSString *keyPath;
+@property (assign, readonly) BSONType type;
+@property (assign, readonly) NSUInteger count;
+
+/**
+ Bit <i>i</i> % 8 of byte <i>i</i> / 8 is set if document <i>i</i> has no value for the column.
+ */
+- (const uint8_t *) nullBitmap NS_RETURNS_INNER_POINTER;
+- (BOOL) isNullAtIndex:(NSUInteger) index;
+
+- (const double *) doubleValues NS_RETURNS_INNER_POINTER;
+- (const int64_t *) int64Values NS_RETURNS_INNER_POINTER;
+- (const int32_t *) int32Values NS_RETURNS_INNER_POINTER;
+- (const BOOL *) boolValues NS_RETURNS_INNER_POINTER;
+- (const NSUInteger *) stringOffsets NS_RETURNS_INNER_POINTER;
+- (const char *) stringBytes NS_RETURNS_INNER_POINTER;
+
+/**
+ Returns a new string for the value at <i>index</i> of a string column, or <code>nil</code> for
+ a null.
+ */
+- (NSString *) stringAtIndex:(NSUInteger) index;
+
+@end
+
+/**
+ Decodes selected fields of many documents into columns of unboxed values, without creating an
+ object for each value. Suited to reading a few numeric, date or string fields from a large
+ result set.
+
+ Add a column for each field, giving a key path, which may use dots to reach into embedded
+ documents and arrays (<code>address.zip</code>, <code>scores.0</code>), and the BSON type
+ expected there. Then append documents. Each document adds one row to every column. A value of
+ another type is treated as missing, except that <code>BSONTypeLong</code> and
+ <code>BSONTypeDouble</code> columns also accept <code>BSONTypeInteger</code> values, and
+ <code>BSONTypeString</code> columns accept <code>BSONTypeSymbol</code> values. If a key appears
+ more than once, the first value is used.
+
+ To decode a large result set in batches, call <code>-removeAllRows</code> after processing each
+ batch. The columns keep their storage for the next one.
+ */
+@interface BSONColumnarDecoder : NSObject
+
+/**
+ Adds a column and returns it. Raises <code>NSInvalidArgumentException</code> for a type which
+ isn't supported, and must be called before any documents are appended.
+ */
+- (BSONColumn *) addColumnWithKeyPath:(NSString *) keyPath type:(BSONType) type;
+
+- (void) appendDocument:(BSONDocument *) document;
+/**
+ Appends each <code>BSONDocument</code> in <i>documents</i>, which may be an array or an
+ enumerator such as a <code>MongoCursor</code>, and returns the number appended.
+ */
+- (NSUInteger) appendDocuments:(id <NSFastEnumeration>) documents;
+/**
+ Appends up to <i>maximumCount</i> documents from <i>enumerator</i>, and returns the number
+ appended, which is less than <i>maximumCount</i> only if the enumerator ran out.
+ */
+- (NSUInteger) appendDocumentsFromEnumerator:(NSEnumerator *) enumerator maximumCount:(NSUInteger) maximumCount;
+
+/**
+ Empties the columns, keeping their storage.
+ */
+- (void) removeAllRows;
+
+- (BSONColumn *) columnForKeyPath:(NSString *) keyPath;
+
+@property (retain, readonly) NSArray *columns;
+@property (assign, readonly) NSUInteger count;
+
+@end
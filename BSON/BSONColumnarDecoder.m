@@ -0,0 +1,355 @@
+//
+//  BSONColumnarDecoder.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSONColumnarDecoder.h"
+#import "BSON_PrivateInterfaces.h"
+#import "BSON_Helper.h"
+
+#define BSONColumnMinimumCapacity 64
+
+// A document's row is written in place: first every column gets a null, then one pass over the
+// document fills the columns whose key paths it finds.
+
+typedef struct {
+    BSONType type;
+    /** The key path's components, each NUL-terminated, owned by the column's compiled key path */
+    const char * const *components;
+    NSUInteger componentCount;
+    /** Bytes per value, or 0 for strings */
+    size_t valueSize;
+    void *values;
+    uint8_t *nullBitmap;
+    NSUInteger *offsets;
+    char *bytes;
+    NSUInteger byteCapacity;
+    NSUInteger count;
+    NSUInteger capacity;
+} BSONColumnStorage;
+
+static size_t BSONColumnValueSize(BSONType type) {
+    switch (type) {
+        case BSONTypeDouble: return sizeof(double);
+        case BSONTypeLong:
+        case BSONTypeDate: return sizeof(int64_t);
+        case BSONTypeInteger: return sizeof(int32_t);
+        case BSONTypeBoolean: return sizeof(BOOL);
+        default: return 0;
+    }
+}
+
+static void BSONColumnStorageGrow(BSONColumnStorage *storage) {
+    NSUInteger capacity = storage->capacity ? storage->capacity * 2 : BSONColumnMinimumCapacity;
+    storage->nullBitmap = realloc(storage->nullBitmap, (capacity + 7) / 8);
+    if (storage->valueSize)
+        storage->values = realloc(storage->values, capacity * storage->valueSize);
+    else {
+        storage->offsets = realloc(storage->offsets, (capacity + 1) * sizeof(NSUInteger));
+        if (!storage->capacity) storage->offsets[0] = 0;
+    }
+    storage->capacity = capacity;
+}
+
+static inline void BSONColumnStorageAppendNull(BSONColumnStorage *storage) {
+    NSUInteger row = storage->count++;
+    storage->nullBitmap[row >> 3] |= (uint8_t) (1 << (row & 7));
+    if (storage->valueSize)
+        memset((char *) storage->values + row * storage->valueSize, 0, storage->valueSize);
+    else
+        storage->offsets[row + 1] = storage->offsets[row];
+}
+
+static inline void BSONColumnStorageAppendBytes(BSONColumnStorage *storage, const char *bytes, NSUInteger length) {
+    NSUInteger used = storage->offsets[storage->count - 1];
+    if (used + length > storage->byteCapacity) {
+        NSUInteger capacity = storage->byteCapacity ? storage->byteCapacity : 1024;
+        while (capacity < used + length) capacity *= 2;
+        storage->bytes = realloc(storage->bytes, capacity);
+        storage->byteCapacity = capacity;
+    }
+    memcpy(storage->bytes + used, bytes, length);
+    storage->offsets[storage->count] = used + length;
+}
+
+/**
+ Stores the iterator's current value in the last row, if it has the column's type. Returns
+ <code>YES</code> if it stored one.
+ */
+static inline BOOL BSONColumnStorageSetValue(BSONColumnStorage *storage, bson_type type, const bson_iterator *iterator) {
+    void *slot = (char *) storage->values + (storage->count - 1) * storage->valueSize;
+    switch (storage->type) {
+        case BSONTypeDouble:
+            if (BSON_DOUBLE == type) *(double *) slot = bson_iterator_double_raw(iterator);
+            else if (BSON_INT == type) *(double *) slot = bson_iterator_int_raw(iterator);
+            else return NO;
+            break;
+        case BSONTypeLong:
+            if (BSON_LONG == type) *(int64_t *) slot = bson_iterator_long_raw(iterator);
+            else if (BSON_INT == type) *(int64_t *) slot = bson_iterator_int_raw(iterator);
+            else return NO;
+            break;
+        case BSONTypeDate:
+            if (BSON_DATE != type) return NO;
+            *(int64_t *) slot = bson_iterator_date(iterator);
+            break;
+        case BSONTypeInteger:
+            if (BSON_INT != type) return NO;
+            *(int32_t *) slot = bson_iterator_int_raw(iterator);
+            break;
+        case BSONTypeBoolean:
+            if (BSON_BOOL != type) return NO;
+            *(BOOL *) slot = bson_iterator_bool_raw(iterator) ? YES : NO;
+            break;
+        case BSONTypeString:
+            if (BSON_STRING != type && BSON_SYMBOL != type) return NO;
+            BSONColumnStorageAppendBytes(storage, bson_iterator_string(iterator),
+                                         bson_iterator_string_len(iterator) - 1);
+            break;
+        default:
+            return NO;
+    }
+    NSUInteger row = storage->count - 1;
+    storage->nullBitmap[row >> 3] &= (uint8_t) ~(1 << (row & 7));
+    return YES;
+}
+
+/**
+ Scans the elements of one document at <i>depth</i> in the key paths, for the columns in
+ <i>active</i> which haven't found a value yet.
+ */
+static void BSONColumnarScan(bson_iterator *iterator, NSUInteger depth,
+                             BSONColumnStorage **storages, BOOL *found,
+                             const NSUInteger *active, NSUInteger activeCount) {
+    NSUInteger nested[activeCount];
+    NSUInteger remaining = activeCount;
+    bson_type type;
+    while (remaining && (type = bson_iterator_next(iterator))) {
+        const char *key = bson_iterator_key(iterator);
+        NSUInteger nestedCount = 0;
+        for (NSUInteger i = 0; i < activeCount; ++i) {
+            NSUInteger column = active[i];
+            if (found[column]) continue;
+            BSONColumnStorage *storage = storages[column];
+            if (strcmp(storage->components[depth], key)) continue;
+            if (depth + 1 < storage->componentCount)
+                nested[nestedCount++] = column;
+            else {
+                // Whether or not the value has the column's type, later duplicates are ignored
+                BSONColumnStorageSetValue(storage, type, iterator);
+                found[column] = YES;
+                --remaining;
+            }
+        }
+        if (nestedCount && (BSON_OBJECT == type || BSON_ARRAY == type)) {
+            bson_iterator subiterator;
+            bson_iterator_subiterator(iterator, &subiterator);
+            BSONColumnarScan(&subiterator, depth + 1, storages, found, nested, nestedCount);
+        }
+    }
+}
+
+#pragma mark - BSONColumn
+
+@interface BSONColumn () {
+    @public
+    BSONColumnStorage _storage;
+}
+@property (retain) NSString *keyPath;
+@property (retain) BSONCompiledKeyPath *compiledKeyPath;
+@end
+
+@implementation BSONColumn
+
+- (id) initWithCompiledKeyPath:(BSONCompiledKeyPath *) compiledKeyPath type:(BSONType) type {
+    if (self = [super init]) {
+        self.keyPath = compiledKeyPath.string;
+        self.compiledKeyPath = compiledKeyPath;
+        _storage.type = type;
+        _storage.valueSize = BSONColumnValueSize(type);
+        _storage.components = [compiledKeyPath components];
+        _storage.componentCount = compiledKeyPath.componentCount;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    free(_storage.values);
+    free(_storage.nullBitmap);
+    free(_storage.offsets);
+    free(_storage.bytes);
+    maybe_release(_keyPath);
+    maybe_release(_compiledKeyPath);
+    super_dealloc;
+}
+
+- (BSONType) type { return _storage.type; }
+- (NSUInteger) count { return _storage.count; }
+
+- (const uint8_t *) nullBitmap { return _storage.nullBitmap; }
+
+- (BOOL) isNullAtIndex:(NSUInteger) index {
+    NSParameterAssert(index < _storage.count);
+    return 0 != (_storage.nullBitmap[index >> 3] & (1 << (index & 7)));
+}
+
+- (const double *) doubleValues {
+    return BSONTypeDouble == _storage.type ? _storage.values : NULL;
+}
+- (const int64_t *) int64Values {
+    return BSONTypeLong == _storage.type || BSONTypeDate == _storage.type ? _storage.values : NULL;
+}
+- (const int32_t *) int32Values {
+    return BSONTypeInteger == _storage.type ? _storage.values : NULL;
+}
+- (const BOOL *) boolValues {
+    return BSONTypeBoolean == _storage.type ? _storage.values : NULL;
+}
+- (const NSUInteger *) stringOffsets {
+    return BSONTypeString == _storage.type ? _storage.offsets : NULL;
+}
+- (const char *) stringBytes {
+    return BSONTypeString == _storage.type ? _storage.bytes : NULL;
+}
+
+- (NSString *) stringAtIndex:(NSUInteger) index {
+    NSParameterAssert(BSONTypeString == _storage.type);
+    if ([self isNullAtIndex:index]) return nil;
+    NSString *result = [[NSString alloc] initWithBytes:_storage.bytes + _storage.offsets[index]
+                                                length:_storage.offsets[index + 1] - _storage.offsets[index]
+                                              encoding:NSUTF8StringEncoding];
+    maybe_autorelease_and_return(result);
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"<%@: %p> %@ (%@), %lu values",
+            [[self class] description], self, self.keyPath, NSStringFromBSONType(self.type),
+            (unsigned long) self.count];
+}
+
+@end
+
+#pragma mark - BSONColumnarDecoder
+
+@interface BSONColumnarDecoder ()
+@property (retain) NSMutableArray *privateColumns;
+@end
+
+@implementation BSONColumnarDecoder {
+    /**
+     The columns' storage, and scratch space for a row, kept in C arrays for the scan.
+     */
+    BSONColumnStorage **_storages;
+    BOOL *_found;
+    NSUInteger *_allColumns;
+    NSUInteger _rowCount;
+}
+
+- (id) init {
+    if (self = [super init]) {
+        self.privateColumns = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void) dealloc {
+    free(_storages);
+    free(_found);
+    free(_allColumns);
+    maybe_release(_privateColumns);
+    super_dealloc;
+}
+
+- (NSArray *) columns {
+    return [NSArray arrayWithArray:self.privateColumns];
+}
+
+- (BSONColumn *) columnForKeyPath:(NSString *) keyPath {
+    for (BSONColumn *column in self.privateColumns)
+        if ([column.keyPath isEqualToString:keyPath]) return column;
+    return nil;
+}
+
+- (BSONColumn *) addColumnWithKeyPath:(NSString *) keyPath type:(BSONType) type {
+    NSParameterAssert(keyPath != nil);
+    NSParameterAssert(0 == self.count);
+    if (!BSONColumnValueSize(type) && BSONTypeString != type)
+        [NSException raise:NSInvalidArgumentException
+                    format:@"Columns of type %@ aren't supported", NSStringFromBSONType(type)];
+
+    // Splits the key path as other key path lookups do, raising if it can't be converted to UTF-8
+    BSONCompiledKeyPath *compiledKeyPath = [BSONCompiledKeyPath keyPathWithString:keyPath];
+    BSONColumn *column = [[BSONColumn alloc] initWithCompiledKeyPath:compiledKeyPath type:type];
+    [self.privateColumns addObject:column];
+    maybe_release(column);
+
+    NSUInteger columnCount = [self.privateColumns count];
+    _storages = realloc(_storages, columnCount * sizeof(BSONColumnStorage *));
+    _found = realloc(_found, columnCount * sizeof(BOOL));
+    _allColumns = realloc(_allColumns, columnCount * sizeof(NSUInteger));
+    _storages[columnCount - 1] = &column->_storage;
+    _allColumns[columnCount - 1] = columnCount - 1;
+    return column;
+}
+
+- (NSUInteger) count { return _rowCount; }
+
+- (void) appendDocument:(BSONDocument *) document {
+    NSParameterAssert(document != nil);
+    NSUInteger columnCount = [self.privateColumns count];
+    for (NSUInteger i = 0; i < columnCount; ++i) {
+        BSONColumnStorage *storage = _storages[i];
+        if (storage->count == storage->capacity) BSONColumnStorageGrow(storage);
+        BSONColumnStorageAppendNull(storage);
+        _found[i] = NO;
+    }
+    if (columnCount) {
+        bson_iterator iterator;
+        bson_iterator_init(&iterator, [document bsonValue]);
+        BSONColumnarScan(&iterator, 0, _storages, _found, _allColumns, columnCount);
+    }
+    ++_rowCount;
+}
+
+- (NSUInteger) appendDocuments:(id <NSFastEnumeration>) documents {
+    NSUInteger count = 0;
+    for (BSONDocument *document in documents) {
+        [self appendDocument:document];
+        ++count;
+    }
+    return count;
+}
+
+- (NSUInteger) appendDocumentsFromEnumerator:(NSEnumerator *) enumerator maximumCount:(NSUInteger) maximumCount {
+    NSUInteger count = 0;
+    while (count < maximumCount) @autoreleasepool {
+        BSONDocument *document = [enumerator nextObject];
+        if (!document) break;
+        [self appendDocument:document];
+        ++count;
+    }
+    return count;
+}
+
+- (void) removeAllRows {
+    NSUInteger columnCount = [self.privateColumns count];
+    for (NSUInteger i = 0; i < columnCount; ++i)
+        _storages[i]->count = 0;
+    _rowCount = 0;
+}
+
+@end
@@ -0,0 +1,39 @@
+//
+//  BSONCompiledKeyPath.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ A dotted key path, such as <code>address.zip</code> or <code>scores.0</code>, prepared for
+ repeated lookups with <code>-[BSONIterator valueTypeForCompiledKeyPath:]</code> and
+ <code>-[BSONDocument objectForCompiledKeyPath:]</code>. The path is split and converted to UTF-8
+ once, and each component's hash is computed so that the first can be found through a wide
+ document's key index.
+
+ Compiled key paths are immutable, and may be shared between threads.
+ */
+@interface BSONCompiledKeyPath : NSObject <NSCopying>
+
++ (BSONCompiledKeyPath *) keyPathWithString:(NSString *) keyPath;
+- (id) initWithString:(NSString *) keyPath;
+
+@property (retain, readonly) NSString *string;
+@property (assign, readonly) NSUInteger componentCount;
+
+@end
@@ -0,0 +1,106 @@
+//
+//  BSONCompiledKeyPath.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSONCompiledKeyPath.h"
+#import "BSON_PrivateInterfaces.h"
+#import "BSON_Helper.h"
+#import "BSON_KeyTable.h"
+
+@interface BSONCompiledKeyPath ()
+@property (retain) NSString *string;
+@end
+
+@implementation BSONCompiledKeyPath {
+    /**
+     The pointers to the components, followed by the components themselves, NUL-terminated, in
+     one allocation.
+     */
+    char **_components;
+    uint32_t *_hashes;
+}
+
++ (BSONCompiledKeyPath *) keyPathWithString:(NSString *) keyPath {
+    BSONCompiledKeyPath *result = [[self alloc] initWithString:keyPath];
+    maybe_autorelease_and_return(result);
+}
+
+- (id) initWithString:(NSString *) keyPath {
+    NSParameterAssert(keyPath != nil);
+    if (self = [super init]) {
+        NSString *string = [keyPath copy];
+        self.string = string;
+        maybe_release(string);
+        
+        const char *bsonKeyPath = [keyPath bsonString];
+        if (!bsonKeyPath)
+            [NSException raise:NSInvalidArgumentException format:@"Key path %@ can't be converted to UTF-8", keyPath];
+        size_t length = strlen(bsonKeyPath);
+        _componentCount = 1;
+        for (const char *p = bsonKeyPath; *p; ++p)
+            if ('.' == *p) ++_componentCount;
+        
+        // The dots are replaced by terminators
+        _components = malloc(_componentCount * sizeof(char *) + length + 1);
+        _hashes = malloc(_componentCount * sizeof(uint32_t));
+        char *bytes = (char *) (_components + _componentCount);
+        memcpy(bytes, bsonKeyPath, length + 1);
+        NSUInteger component = 0;
+        _components[component++] = bytes;
+        for (char *p = bytes; *p; ++p)
+            if ('.' == *p) {
+                *p = '\0';
+                _components[component++] = p + 1;
+            }
+        for (NSUInteger i = 0; i < _componentCount; ++i) {
+            size_t componentLength;
+            _hashes[i] = BSONHashKeyBytes(_components[i], &componentLength);
+        }
+    }
+    return self;
+}
+
+- (void) dealloc {
+    free(_components);
+    free(_hashes);
+    maybe_release(_string);
+    super_dealloc;
+}
+
+- (id) copyWithZone:(NSZone *) zone {
+    return maybe_retain(self);
+}
+
+- (const char * const *) components { return (const char * const *) _components; }
+- (const uint32_t *) hashes { return _hashes; }
+
+- (BOOL) isEqual:(id) object {
+    if (self == object) return YES;
+    if (![object isKindOfClass:[BSONCompiledKeyPath class]]) return NO;
+    return [self.string isEqualToString:[object string]];
+}
+
+- (NSUInteger) hash {
+    return [self.string hash];
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"<%@: %p> %@", [[self class] description], self, self.string];
+}
+
+@end
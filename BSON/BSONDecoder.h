@@ -37,6 +37,7 @@ typedef enum {
 @class BSONIterator;
 @class BSONDocument;
 @class BSONObjectID;
+@class BSONDecodingSession;
 @class NSManagedObjectContext;
 @class NSImage;
 
@@ -161,6 +162,12 @@ typedef enum {
 @interface BSONDecoder : NSCoder
 
 - (BSONDecoder *) initWithDocument:(BSONDocument *) document;
+/**
+ Initializes a decoder which takes keys, small numbers and short strings from <i>session</i>,
+ which may be shared with the decoders for related documents. See
+ <code>BSONDecodingSession</code>.
+ */
+- (BSONDecoder *) initWithDocument:(BSONDocument *) document session:(BSONDecodingSession *) session;
 - (BSONDecoder *) initWithData:(NSData *) data;
 
 + (NSDictionary *) decodeDictionaryWithDocument:(BSONDocument *) document;
@@ -168,15 +175,48 @@ typedef enum {
 + (NSDictionary *) decodeDictionaryWithData:(NSData *) data;
 + (NSDictionary *) decodeDictionaryWithClass:(Class) classForDecoder data:(NSData *) data;
 
++ (NSDictionary *) decodeDictionaryWithKeyPaths:(id <NSFastEnumeration>) keyPaths document:(BSONDocument *) document;
+
 + (id) decodeObjectWithClass:(Class) classForDecoder document:(BSONDocument *) document;
 + (id) decodeObjectWithClass:(Class) classForDecoder data:(NSData *) data;
 + (id) decodeManagedObjectWithClass:(Class) classForDecoder
                             context:(NSManagedObjectContext *) context
                                data:(NSData *) data;
 
+/**
+ Decodes each document in <i>documents</i> as with <code>+decodeObjectWithClass:document:</code>,
+ returning the objects in the same order. With a <i>classForDecoder</i> of <code>nil</code>, returns
+ dictionaries.
+ 
+ The documents are decoded concurrently on up to <i>maximumConcurrency</i> threads, or one per
+ active processor if <i>maximumConcurrency</i> is 0. Pass 1 to decode them one after another on
+ the calling thread. Each thread decodes with its own <code>BSONDecodingSession</code>, and
+ decoding an object must not depend on shared mutable state. If a document can't be decoded, the
+ batch stops and the exception is raised on the calling thread.
+ */
++ (NSArray *) decodeObjectsWithClass:(Class) classForDecoder
+                           documents:(NSArray *) documents
+                  maximumConcurrency:(NSUInteger) maximumConcurrency;
++ (NSArray *) decodeDictionariesWithDocuments:(NSArray *) documents;
+
 - (NSDictionary *) decodeDictionary;
 - (NSDictionary *) decodeDictionaryWithClass:(Class) classForDecoder;
 - (id) decodeObjectWithClass:(Class) classForDecoder;
+/**
+ Decodes only the values at <i>keyPaths</i>, which may be an array or set of
+ <code>NSString</code> or <code>BSONCompiledKeyPath</code> objects, skipping everything else
+ without creating objects for it. Like a MongoDB projection, it's useful when only a few fields
+ of a large document are needed.
+
+ Key paths use dots to reach into embedded documents and arrays, as in
+ <code>-[BSONIterator valueTypeForKeyPath:]</code>. The result contains each value found, along
+ with the embedded documents and arrays which lead to it, holding only the selected items. An
+ array element is selected by its index (<code>scores.0</code>), and the resulting array holds the
+ selected elements in their original order, without gaps. A key path which reaches a value that
+ isn't a document or array before its last component selects nothing. If a key path and a longer
+ one beginning with it are both given, the whole value at the shorter key path is decoded.
+ */
+- (NSDictionary *) decodeDictionaryWithKeyPaths:(id <NSFastEnumeration>) keyPaths;
 
 - (NSDictionary *) decodeDictionaryForKey:(NSString *) key;
 - (NSDictionary *) decodeDictionaryForKey:(NSString *) key withClass:(Class) classForDecoder;
@@ -215,10 +255,23 @@ typedef enum {
  */
 + (id) objectForUndefined;
 
+/**
+ Returns <i>object</i>, or a copy of it, in which no string or data refers to the bytes of the
+ document it was decoded from. Dictionaries and arrays are copied only when something inside them
+ has to be, and an <code>OrderedDictionary</code> keeps its order. Embedded <code>BSONDocument</code> objects, which always refer
+ to their document, are returned as they are.
+ */
++ (id) detachedObject:(id) object;
+
 @property (retain) NSObject<BSONDecoderDelegate> * delegate;
 @property (retain) NSManagedObjectContext * managedObjectContext;
 @property (assign) BSONDecoderBehaviorOnNull behaviorOnNull;
 @property (assign) BSONDecoderBehaviorOnUndefined behaviorOnUndefined;
 @property (assign) NSZone * objectZone;
+/**
+ If <code>YES</code>, long strings and binary data are decoded as objects which point into the
+ document instead of copying it. See <code>-[BSONIterator referencesDocumentBytes]</code>.
+ */
+@property (assign) BOOL referencesDocumentBytes;
 
 @end
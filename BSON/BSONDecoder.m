@@ -20,18 +20,35 @@
 #import "BSONDecoder.h"
 #import "bson.h"
 #import "BSONIterator.h"
+#import "BSONCompiledKeyPath.h"
 #import "BSONCoding.h"
 #import "BSON_PrivateInterfaces.h"
 #import "BSON_Helper.h"
+#import "BSON_KeyPath.h"
+#import "BSON_ReferencedValues.h"
 #import "OrderedDictionary.h"
 
+typedef struct {
+    const char * const *components;
+    NSUInteger componentCount;
+} BSONDecoderKeyPath;
+
 @interface BSONDecoder ()
 @property (retain) BSONIterator *iterator;
-@property (retain) NSMutableArray *iteratorStack;
-@property (retain) NSMutableArray *privateKeyPathComponents;
 @end
 
-@implementation BSONDecoder
+@implementation BSONDecoder {
+    /**
+     The keys of the objects being decoded, which is also the key path passed to the delegate.
+     Always read directly rather than through a property, so that it isn't retained in passing.
+     */
+    BSONKeyPathStack *_keyPath;
+    /**
+     Set by the top-level decoding methods when neither the delegate nor the decoded classes
+     have any hooks, so that dictionaries and arrays can be decoded without the bookkeeping.
+     */
+    BOOL _decodesWithoutHooks;
+}
 
 #pragma mark - Initialization
 
@@ -39,13 +56,18 @@
     self = [super init];
     if (self) {
         self.iterator = [document iterator];
-        self.iteratorStack = [NSMutableArray array];
-        self.privateKeyPathComponents = [NSMutableArray array];
+        _keyPath = [[BSONKeyPathStack alloc] init];
         self.objectZone = NSDefaultMallocZone();
     }
     return self;
 }
 
+- (BSONDecoder *) initWithDocument:(BSONDocument *) document session:(BSONDecodingSession *) session {
+    self = [self initWithDocument:document];
+    if (self) self.iterator.session = session;
+    return self;
+}
+
 - (BSONDecoder *) initWithData:(NSData *) data {
     return [self initWithDocument:[BSONDocument documentWithData:data]];
 }
@@ -54,8 +76,7 @@
     maybe_release(_delegate);
     maybe_release(_managedObjectContext);
     maybe_release(_iterator);
-    maybe_release(_iteratorStack);
-    maybe_release(_privateKeyPathComponents);
+    maybe_release(_keyPath);
     super_dealloc;
 }
 
@@ -108,6 +129,96 @@
     maybe_retain_autorelease_and_return(result);
 }
 
++ (NSDictionary *) decodeDictionaryWithKeyPaths:(id <NSFastEnumeration>) keyPaths document:(BSONDocument *) document {
+    BSONDecoder *decoder = [[self alloc] initWithDocument:document];
+    NSDictionary *result = [decoder decodeDictionaryWithKeyPaths:keyPaths];
+    maybe_release(decoder);
+    maybe_retain_autorelease_and_return(result);
+}
+
+#pragma mark - Batch decoding
+
+//
+// The documents are split into chunks, which the workers take in turn from a shared counter, so
+// that no more than the requested number of threads ever run and a slow chunk doesn't hold up the
+// rest. Each worker decodes its chunks with a session of its own, and writes each result at its
+// document's index in a C array, which needs no lock.
+//
+
+#define BSONBatchDecodingChunkSize 16
+
++ (NSArray *) decodeDictionariesWithDocuments:(NSArray *) documents {
+    return [self decodeObjectsWithClass:nil documents:documents maximumConcurrency:0];
+}
+
++ (NSArray *) decodeObjectsWithClass:(Class) classForDecoder
+                           documents:(NSArray *) documents
+                  maximumConcurrency:(NSUInteger) maximumConcurrency {
+    NSParameterAssert(documents);
+    NSUInteger count = documents.count;
+    
+    CFTypeRef *results = calloc(count ? count : 1, sizeof(CFTypeRef));
+    if (!results)
+        [NSException raise:NSMallocException format:@"Can't allocate results for %lu objects", (unsigned long) count];
+    __block NSException *failure = nil;
+    __block NSUInteger failureIndex = NSNotFound;
+    __block volatile BOOL failed = NO;
+    __block volatile NSUInteger nextChunk = 0;
+    NSObject *failureLock = [[NSObject alloc] init];
+    NSUInteger chunkCount = (count + BSONBatchDecodingChunkSize - 1) / BSONBatchDecodingChunkSize;
+    
+    void (^work)(size_t) = ^(size_t worker) {
+        BSONDecodingSession *session = [[BSONDecodingSession alloc] init];
+        NSUInteger chunk;
+        while (!failed && (chunk = __sync_fetch_and_add(&nextChunk, 1)) < chunkCount) {
+            NSUInteger end = MIN(count, (chunk + 1) * BSONBatchDecodingChunkSize);
+            for (NSUInteger i = chunk * BSONBatchDecodingChunkSize; i < end && !failed; ++i) @autoreleasepool {
+                BSONDecoder *decoder = [[self alloc] initWithDocument:[documents objectAtIndex:i] session:session];
+                @try {
+                    id object = [decoder decodeObjectWithClass:classForDecoder];
+                    if (!object)
+                        [NSException raise:NSInvalidUnarchiveOperationException
+                                    format:@"Couldn't decode document %lu", (unsigned long) i];
+                    results[i] = CFRetain((__bridge CFTypeRef) object);
+                } @catch (NSException *exception) {
+                    @synchronized(failureLock) {
+                        if (i < failureIndex) {
+                            maybe_release(failure);
+                            failure = maybe_retain(exception);
+                            failureIndex = i;
+                        }
+                        failed = YES;
+                    }
+                } @finally {
+                    maybe_release(decoder);
+                }
+            }
+        }
+        maybe_release(session);
+    };
+    
+    NSUInteger workerCount = maximumConcurrency ? maximumConcurrency : [[NSProcessInfo processInfo] activeProcessorCount];
+    workerCount = MIN(workerCount, chunkCount);
+    if (workerCount < 2)
+        work(0);
+    else
+        dispatch_apply(workerCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), work);
+    maybe_release(failureLock);
+    
+    NSArray *result = nil;
+    if (!failed)
+        result = (__bridge_transfer NSArray *) CFArrayCreate(NULL, results, count, &kCFTypeArrayCallBacks);
+    for (NSUInteger i = 0; i < count; ++i)
+        if (results[i]) CFRelease(results[i]);
+    free(results);
+    
+    if (failed) {
+        maybe_autorelease_void(failure);
+        @throw failure;
+    }
+    maybe_autorelease_and_return(result);
+}
+
 #pragma mark - Decoding top-level objects
 
 - (NSDictionary *) decodeDictionary {
@@ -116,6 +227,7 @@
 
 - (NSDictionary *) decodeDictionaryWithClass:(Class) classForDecoder {
     id result = nil;
+    _decodesWithoutHooks = ![self _hasDecodingHooks];
     @try {
         result = [self _decodeExposedDictionaryWithClassOrNil:classForDecoder];
     }
@@ -125,11 +237,13 @@
             NSLog(@"Raised while decoding: %@", exception);
         } else @throw;
     }
+    if (_decodesWithoutHooks) return result;
     return [self _postDecodingHelper:result keyOrNil:nil topLevel:YES];
 }
 
 - (id) decodeObjectWithClass:(Class) classForDecoder {
     id result = nil;
+    _decodesWithoutHooks = ![self _hasDecodingHooks];
     @try {
         result = [self _decodeExposedCustomObjectWithClassOrNil:classForDecoder];
     }
@@ -142,25 +256,63 @@
     return [self _postDecodingHelper:result keyOrNil:nil topLevel:YES];
 }
 
+- (NSDictionary *) decodeDictionaryWithKeyPaths:(id <NSFastEnumeration>) keyPaths {
+    NSParameterAssert(keyPaths != nil);
+    NSMutableArray *compiledKeyPaths = [NSMutableArray array];
+    for (id keyPath in keyPaths)
+        [compiledKeyPaths addObject:[keyPath isKindOfClass:[BSONCompiledKeyPath class]]
+         ? keyPath
+         : [BSONCompiledKeyPath keyPathWithString:keyPath]];
+    NSUInteger count = [compiledKeyPaths count];
+    if (!count) return [OrderedDictionary dictionary];
+    
+    BSONDecoderKeyPath *projection = malloc(count * sizeof(BSONDecoderKeyPath));
+    NSUInteger *active = malloc(count * sizeof(NSUInteger));
+    for (NSUInteger i = 0; i < count; ++i) {
+        BSONCompiledKeyPath *keyPath = [compiledKeyPaths objectAtIndex:i];
+        projection[i].components = [keyPath components];
+        projection[i].componentCount = [keyPath componentCount];
+        active[i] = i;
+    }
+    
+    id result = nil;
+    _decodesWithoutHooks = ![self _hasDecodingHooks];
+    @try {
+        result = [self _decodeExposedItemsAsArray:NO projection:projection depth:0 active:active count:count];
+    }
+    @catch (NSException *exception) {
+        if (BSONException == exception.name) {
+            // result will not be set
+            NSLog(@"Raised while decoding: %@", exception);
+        } else @throw;
+    }
+    @finally {
+        free(projection);
+        free(active);
+    }
+    if (_decodesWithoutHooks) return result;
+    return [self _postDecodingHelper:result keyOrNil:nil topLevel:YES];
+}
+
 #pragma mark - Exposing internal objects
 
+// Embedded documents and arrays are decoded by moving the iterator in and out of them, which
+// doesn't create an object for each one
+
 - (void) _exposeKey:(NSString *)key asArray:(BOOL) asArray {
-    [self.iteratorStack addObject:self.iterator];
-    if (asArray)
-        self.iterator = [self.iterator sequentialSubIteratorValue];
-    else
-        self.iterator = [self.iterator embeddedDocumentIteratorValue];
-    [self.privateKeyPathComponents addObject:key];
+    [self.iterator enterEmbeddedObject];
+    [self _prepareKeyPathForWriting];
+    [_keyPath pushKey:key];
 }
 
 - (void) _closeInternalObject {
-    if (![self.iteratorStack count])
+    if (![self.iterator depth])
         [NSException raise:NSInvalidUnarchiveOperationException
                     format:@"-leaveInternalObject called too many times (without matching call to -enterInternalObjectAsArray:)"];
     
-    self.iterator = [self.iteratorStack lastObject];
-    [self.iteratorStack removeLastObject];
-    [self.privateKeyPathComponents removeLastObject];
+    [self.iterator leaveEmbeddedObject];
+    [self _prepareKeyPathForWriting];
+    [_keyPath popKey];
 }
 
 - (NSDictionary *) decodeDictionaryForKey:(NSString *) key {
@@ -211,6 +363,8 @@
 }
 
 - (NSDictionary *) _decodeExposedDictionaryWithClassOrNil:(Class) classForDecoder {
+    if (!classForDecoder && _decodesWithoutHooks)
+        return [self _fastDecodeExposedItemsOfIterator:self.iterator asArray:NO];
     OrderedDictionary *dictionary = [OrderedDictionary dictionary];
     while ([self.iterator next])
         [dictionary setObject:[self _decodeCurrentObjectWithClassOrNil:classForDecoder]
@@ -219,6 +373,8 @@
 }
 
 - (NSArray *) _decodeExposedArrayWithClassOrNil:(Class) classForDecoder {
+    if (!classForDecoder && _decodesWithoutHooks)
+        return [self _fastDecodeExposedItemsOfIterator:self.iterator asArray:YES];
     NSMutableArray *array = [NSMutableArray array];
     while ([self.iterator next])
         [array addObject:[self _decodeCurrentObjectWithClassOrNil:classForDecoder]];
@@ -227,31 +383,163 @@
 
 - (id) _decodeCurrentObjectWithClassOrNil:(Class) classForDecoder {
     id result = nil;
-    if ([self _decodingHelper:&result]) return result;
+    if ([self _decodingHelper:&result forValueType:[self.iterator valueType]]) return result;
     
+    NSString *key = [self.iterator key];
     if (![self.iterator isArray] && ![self.iterator isEmbeddedDocument]) {
         result = [self.iterator objectValue];
         
     } else if (classForDecoder) {
-        [self _exposeKey:[self.iterator key] asArray:NO];
+        [self _exposeKey:key asArray:NO];
         result = [self _decodeExposedCustomObjectWithClassOrNil:classForDecoder];
         [self _closeInternalObject];
         
     } else if ([self.iterator isEmbeddedDocument]) {
-        [self _exposeKey:[self.iterator key] asArray:NO];
+        [self _exposeKey:key asArray:NO];
         result = [self _decodeExposedDictionaryWithClassOrNil:nil];
         [self _closeInternalObject];        
         
     } else {
-        [self _exposeKey:[self.iterator key] asArray:YES];
+        [self _exposeKey:key asArray:YES];
         result = [self _decodeExposedArrayWithClassOrNil:nil];
         [self _closeInternalObject];        
     }
     
-    return [self _postDecodingHelper:result keyOrNil:[self.iterator key] topLevel:NO];
+    return [self _postDecodingHelper:result keyOrNil:key topLevel:NO];
 }
 
 
+#pragma mark - Decoding exposed objects without hooks
+
+// When there's no delegate hook to call and none of the classes the decoder creates implements
+// an awake method, -_postDecodingHelper:... would return each object unchanged. In that case
+// dictionaries and arrays are decoded in a tight loop, which skips the key path and the selector
+// probes on every value.
+//
+// Whether that holds is checked once at the start of each top-level decoding method. The
+// classes are checked once per process. Foundation's value classes inherit NSObject's
+// -awakeAfterUsingCoder:, which returns self, so an override only counts when it's replaced.
+
+static BOOL BSONDecodedClassesHaveAwakeHooks(void) {
+    static BOOL result;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        Class classes[] = {
+            [NSString class], [NSNumber class], [NSDate class], [NSData class], [NSNull class],
+            [NSArray class], [OrderedDictionary class], [BSONObjectID class],
+            [BSONRegularExpression class], [BSONTimestamp class], [BSONCode class],
+            [BSONCodeWithScope class], [BSONSymbol class]
+        };
+        IMP inherited = [NSObject instanceMethodForSelector:@selector(awakeAfterUsingCoder:)];
+        for (NSUInteger i = 0; i < sizeof(classes) / sizeof(Class); ++i) {
+            if ([classes[i] instancesRespondToSelector:@selector(awakeAfterUsingBSONDecoder:)]
+                || [classes[i] instanceMethodForSelector:@selector(awakeAfterUsingCoder:)] != inherited)
+                result = YES;
+        }
+    });
+    return result;
+}
+
+- (BOOL) _hasDecodingHooks {
+    NSObject<BSONDecoderDelegate> *delegate = self.delegate;
+    if (delegate
+        && ([delegate respondsToSelector:@selector(decoder:didDecodeObject:forKeyPath:)]
+            || [delegate respondsToSelector:@selector(decoder:willReplaceObject:withObject:forKeyPath:)]
+            || [delegate respondsToSelector:@selector(decoder:classToSubstituteForObjectID:forKeyPath:)]
+            || [delegate respondsToSelector:@selector(decoderWillFinish:)]))
+        return YES;
+    return BSONDecodedClassesHaveAwakeHooks();
+}
+
+- (id) _fastDecodeCurrentValueOfIterator:(BSONIterator *) iterator type:(BSONType) type {
+    id value = nil;
+    if (BSONTypeEmbeddedDocument == type || BSONTypeArray == type) {
+        [iterator enterEmbeddedObject];
+        value = [self _fastDecodeExposedItemsOfIterator:iterator asArray:BSONTypeArray == type];
+        [iterator leaveEmbeddedObject];
+    } else if (![self _decodingHelper:&value forValueType:type])
+        value = [iterator objectValue];
+    return value;
+}
+
+- (id) _fastDecodeExposedItemsOfIterator:(BSONIterator *) iterator asArray:(BOOL) asArray {
+    NSMutableArray *array = asArray ? [NSMutableArray array] : nil;
+    OrderedDictionary *dictionary = asArray ? nil : [OrderedDictionary dictionary];
+    BSONType type;
+    while ((type = [iterator next])) {
+        id value = [self _fastDecodeCurrentValueOfIterator:iterator type:type];
+        if (asArray)
+            [array addObject:value];
+        else
+            [dictionary setObject:value forKey:[iterator key]];
+    }
+    return asArray ? [NSArray arrayWithArray:array] : dictionary;
+}
+
+#pragma mark - Decoding selected key paths
+
+// Like BSONColumnarScan(), each level is scanned for the key paths whose components so far
+// match, in active. A key path which ends at the level selects the whole value. The others are
+// followed into the embedded object, if the value is one, and every other element is stepped
+// over using its length, without creating an object for it.
+
+- (id) _decodeExposedItemsAsArray:(BOOL) asArray
+                       projection:(const BSONDecoderKeyPath *) projection
+                            depth:(NSUInteger) depth
+                           active:(const NSUInteger *) active
+                            count:(NSUInteger) activeCount {
+    NSMutableArray *array = asArray ? [NSMutableArray array] : nil;
+    OrderedDictionary *dictionary = asArray ? nil : [OrderedDictionary dictionary];
+    BSONIterator *iterator = self.iterator;
+    NSUInteger nested[activeCount];
+    BSONType type;
+    while ((type = [iterator next])) {
+        const char *bsonKey = bson_iterator_key([iterator nativeIteratorValue]);
+        NSUInteger nestedCount = 0;
+        BOOL selected = NO;
+        for (NSUInteger i = 0; i < activeCount; ++i) {
+            const BSONDecoderKeyPath *keyPath = &projection[active[i]];
+            if (strcmp(keyPath->components[depth], bsonKey)) continue;
+            if (depth + 1 == keyPath->componentCount) {
+                selected = YES;
+                break;
+            }
+            nested[nestedCount++] = active[i];
+        }
+        
+        id value = nil;
+        if (selected) {
+            if (_decodesWithoutHooks)
+                value = [self _fastDecodeCurrentValueOfIterator:iterator type:type];
+            else
+                value = [self _decodeCurrentObjectWithClassOrNil:nil];
+        } else if (nestedCount && (BSONTypeEmbeddedDocument == type || BSONTypeArray == type)) {
+            NSString *key = _decodesWithoutHooks ? nil : [iterator key];
+            if (key)
+                [self _exposeKey:key asArray:BSONTypeArray == type];
+            else
+                [iterator enterEmbeddedObject];
+            value = [self _decodeExposedItemsAsArray:BSONTypeArray == type
+                                          projection:projection
+                                               depth:depth + 1
+                                              active:nested
+                                               count:nestedCount];
+            if (key) {
+                [self _closeInternalObject];
+                value = [self _postDecodingHelper:value keyOrNil:key topLevel:NO];
+            } else
+                [iterator leaveEmbeddedObject];
+        } else
+            continue;
+        
+        if (asArray)
+            [array addObject:value];
+        else
+            [dictionary setObject:value forKey:[iterator key]];
+    }
+    return asArray ? [NSArray arrayWithArray:array] : dictionary;
+}
+
 #pragma mark - Basic decoding methods
 
 - (id) decodeObjectForKey:(NSString *) key {
@@ -449,8 +737,8 @@
 
 #pragma mark - Helper methods for -decode... methods
 
-- (BOOL) _decodingHelper:(id*) result {
-    if (BSONTypeNull == [self.iterator valueType]) {
+- (BOOL) _decodingHelper:(id*) result forValueType:(BSONType) valueType {
+    if (BSONTypeNull == valueType) {
         switch(self.behaviorOnNull) {
             case BSONReturnNSNull:
                 *result = [NSNull null]; return YES;
@@ -460,7 +748,7 @@
                 [NSException raise:NSInvalidUnarchiveOperationException
                             format:@"Tried to decode null value with BSONRaiseExceptionOnNull set"];
         }
-    } else if (BSONTypeUndefined == [self.iterator valueType]) {
+    } else if (BSONTypeUndefined == valueType) {
         switch(self.behaviorOnUndefined) {
             case BSONReturnBSONUndefined:
                 *result = [BSONDecoder objectForUndefined]; return YES;
@@ -481,7 +769,7 @@
     if (![self.iterator containsValueForKey:key]) {
         result = nil; return YES;
     }
-    return [self _decodingHelper:result];
+    return [self _decodingHelper:result forValueType:[self.iterator valueType]];
 }
 
 - (BOOL) _decodingHelperForKey:(NSString *) key
@@ -530,7 +818,7 @@
     if ([object isKindOfClass:[BSONObjectID class]]) {
         if (!classForObjectID
             && [self.delegate respondsToSelector:@selector(decoder:classToSubstituteForObjectID:forKeyPath:)])
-            classForObjectID = [self.delegate decoder:self classToSubstituteForObjectID:object forKeyPath:[self _keyPathComponentsAddingKeyOrNil:key]];
+            classForObjectID = [self.delegate decoder:self classToSubstituteForObjectID:object forKeyPath:BSONDelegateKeyPath(key)];
         
         if (classForObjectID) {
             if ([classForObjectID respondsToSelector:@selector(instanceForObjectID:decoder:)])
@@ -548,11 +836,11 @@
         object = maybe_autorelease([maybe_retain(object) awakeAfterUsingCoder:self]);
     
     if ([self.delegate respondsToSelector:@selector(decoder:didDecodeObject:forKeyPath:)])
-        object = [self.delegate decoder:self didDecodeObject:object forKeyPath:[self _keyPathComponentsAddingKeyOrNil:key]];
+        object = [self.delegate decoder:self didDecodeObject:object forKeyPath:BSONDelegateKeyPath(key)];
     
     if (originalObject != object
         && [self.delegate respondsToSelector:@selector(decoder:willReplaceObject:withObject:forKeyPath:)])
-        [self.delegate decoder:self willReplaceObject:originalObject withObject:object forKeyPath:[self _keyPathComponentsAddingKeyOrNil:key]];
+        [self.delegate decoder:self willReplaceObject:originalObject withObject:object forKeyPath:BSONDelegateKeyPath(key)];
     
     if (topLevel && [self.delegate respondsToSelector:@selector(decoderWillFinish:)])
         [self.delegate decoderWillFinish:self];
@@ -584,14 +872,38 @@
     return [BSONIterator objectForUndefined];
 }
 
++ (id) detachedObject:(id) object {
+    return BSONDetachedObject(object);
+}
+
+- (BOOL) referencesDocumentBytes { return self.iterator.referencesDocumentBytes; }
+- (void) setReferencesDocumentBytes:(BOOL) referencesDocumentBytes {
+    self.iterator.referencesDocumentBytes = referencesDocumentBytes;
+}
+
 - (NSArray *) keyPathComponents {
-    maybe_autorelease_and_return([self.privateKeyPathComponents copy]);
+    return [_keyPath pushedKeys];
+}
+
+/**
+ Replaces the key path stack with a copy if a delegate kept a reference to it.
+ */
+- (void) _prepareKeyPathForWriting {
+    if ([_keyPath hasEscaped]) {
+        BSONKeyPathStack *copy = [_keyPath copyForWriting];
+        maybe_release(_keyPath);
+        _keyPath = copy;
+    }
 }
 
-- (NSArray *) _keyPathComponentsAddingKeyOrNil:(NSString *) key {
-    NSArray *result = [self keyPathComponents];
-    if (key) result = [result arrayByAddingObject:key];
-    return result.count ? result : nil;
+/**
+ Sets <i>key</i> as the last component of the key path, returning <code>NO</code> if the key path
+ is empty.
+ */
+- (BOOL) _prepareKeyPathForDelegateAddingKeyOrNil:(NSString *) key {
+    [self _prepareKeyPathForWriting];
+    [_keyPath setPendingKey:key];
+    return [_keyPath count] > 0;
 }
 
 #pragma mark - Unsupported unkeyed encoding methods
@@ -0,0 +1,62 @@
+//
+//  BSONDecodingSession.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Caches objects which recur from one document to the next while decoding a set of related
+ documents, such as the results of a query, so that each distinct key, small integer and short
+ string is allocated once for the whole set instead of once per document.
+
+ The session holds:
+ - Keys which don't fit in the process-wide key table, up to 64 bytes long
+ - <code>NSNumber</code> objects for 32- and 64-bit integers from -128 to 1023
+ - Short string values, up to 32 bytes long
+
+ The key and string caches are direct-mapped, so the session's memory use is fixed: when two
+ different strings land in the same slot, the newer one replaces the older. Values which repeat
+ often, like enumeration-style fields, tend to stay cached.
+
+ To use a session, pass it to <code>-[BSONDecoder initWithDocument:session:]</code> or set it
+ on a <code>BSONIterator</code>. Iterators for embedded documents and arrays inherit their
+ parent's session. <code>MongoCursor</code> creates one for the documents it returns.
+
+ A session may be shared by many decoders, one at a time. It isn't safe to use the same session
+ on more than one thread at once.
+ */
+@interface BSONDecodingSession : NSObject
+
++ (BSONDecodingSession *) session;
+
+/**
+ Releases the cached objects.
+ */
+- (void) removeAllObjects;
+
+/**
+ The number of requests the session answered with a cached object.
+ */
+@property (readonly) NSUInteger hitCount;
+
+/**
+ The number of requests for which the session created a new object.
+ */
+@property (readonly) NSUInteger missCount;
+
+@end
@@ -0,0 +1,191 @@
+//
+//  BSONDecodingSession.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSONDecodingSession.h"
+#import "BSON_PrivateInterfaces.h"
+#import "BSON_Helper.h"
+#import "BSON_KeyTable.h"
+
+#define BSONSessionKeySlotCount 256 // power of two
+#define BSONSessionMaxKeyLength 64
+#define BSONSessionStringSlotCount 1024 // power of two
+#define BSONSessionMaxStringLength 32
+#define BSONSessionMinNumber -128
+#define BSONSessionMaxNumber 1023
+#define BSONSessionNumberCount (BSONSessionMaxNumber - BSONSessionMinNumber + 1)
+
+// The key and string caches are direct-mapped: each slot holds one string, and a lookup which
+// finds a different string in the slot replaces it.
+
+typedef struct {
+    CFStringRef string;
+    uint32_t hash;
+    uint32_t length;
+} BSONSessionSlot;
+
+typedef struct {
+    BSONSessionSlot *slots;
+    /** The UTF-8 bytes of each slot's string, <code>maxLength</code> bytes per slot */
+    char *bytes;
+    NSUInteger slotCount;
+    size_t maxLength;
+} BSONSessionTable;
+
+static void BSONSessionTableInit(BSONSessionTable *table, NSUInteger slotCount, size_t maxLength) {
+    table->slots = calloc(slotCount, sizeof(BSONSessionSlot));
+    table->bytes = malloc(slotCount * maxLength);
+    table->slotCount = slotCount;
+    table->maxLength = maxLength;
+}
+
+static void BSONSessionTableDestroy(BSONSessionTable *table) {
+    if (!table->slots) return;
+    for (NSUInteger i = 0; i < table->slotCount; ++i)
+        if (table->slots[i].string) CFRelease(table->slots[i].string);
+    free(table->slots);
+    free(table->bytes);
+    table->slots = NULL;
+    table->bytes = NULL;
+}
+
+static inline CFStringRef BSONSessionTableFind(BSONSessionTable *table, const char *bsonString, size_t length, uint32_t hash) {
+    NSUInteger i = hash & (table->slotCount - 1);
+    BSONSessionSlot *slot = &table->slots[i];
+    if (slot->string && slot->hash == hash && slot->length == length
+        && 0 == memcmp(table->bytes + i * table->maxLength, bsonString, length))
+        return slot->string;
+    return NULL;
+}
+
+// Takes ownership of string
+static inline void BSONSessionTableStore(BSONSessionTable *table, CFStringRef string, const char *bsonString, size_t length, uint32_t hash) {
+    NSUInteger i = hash & (table->slotCount - 1);
+    BSONSessionSlot *slot = &table->slots[i];
+    if (slot->string) CFRelease(slot->string);
+    slot->string = string;
+    slot->hash = hash;
+    slot->length = (uint32_t) length;
+    memcpy(table->bytes + i * table->maxLength, bsonString, length);
+}
+
+@implementation BSONDecodingSession {
+    /**
+     Allocated on first use.
+     */
+    BSONSessionTable _keys;
+    BSONSessionTable _strings;
+    CFTypeRef *_ints;
+    CFTypeRef *_longs;
+}
+
++ (BSONDecodingSession *) session {
+    BSONDecodingSession *result = [[self alloc] init];
+    maybe_autorelease_and_return(result);
+}
+
+- (void) dealloc {
+    [self removeAllObjects];
+    super_dealloc;
+}
+
+- (void) removeAllObjects {
+    BSONSessionTableDestroy(&_keys);
+    BSONSessionTableDestroy(&_strings);
+    if (_ints) {
+        for (NSUInteger i = 0; i < BSONSessionNumberCount; ++i)
+            if (_ints[i]) CFRelease(_ints[i]);
+        free(_ints);
+        _ints = NULL;
+    }
+    if (_longs) {
+        for (NSUInteger i = 0; i < BSONSessionNumberCount; ++i)
+            if (_longs[i]) CFRelease(_longs[i]);
+        free(_longs);
+        _longs = NULL;
+    }
+}
+
+#pragma mark - Cached objects
+
+- (NSString *) keyForBSONString:(const char *) bsonString {
+    size_t length;
+    uint32_t hash = BSONHashKeyBytes(bsonString, &length);
+    if (length > BSONSessionMaxKeyLength) return BSONInternedKeyForBSONString(bsonString);
+    if (!_keys.slots) BSONSessionTableInit(&_keys, BSONSessionKeySlotCount, BSONSessionMaxKeyLength);
+
+    CFStringRef result = BSONSessionTableFind(&_keys, bsonString, length, hash);
+    if (result)
+        ++_hitCount;
+    else {
+        NSString *key = BSONInternedKeyForBSONString(bsonString);
+        // Not valid UTF-8
+        if (!key) return nil;
+        result = CFRetain((__bridge CFStringRef) key);
+        BSONSessionTableStore(&_keys, result, bsonString, length, hash);
+        ++_missCount;
+    }
+    maybe_retain_autorelease_and_return((__bridge NSString *) result);
+}
+
+- (NSString *) stringForBSONString:(const char *) bsonString length:(size_t) maximumLength {
+    if (maximumLength > BSONSessionMaxStringLength) return [NSString stringWithBSONString:bsonString];
+    size_t length;
+    uint32_t hash = BSONHashKeyBytes(bsonString, &length);
+    if (!_strings.slots) BSONSessionTableInit(&_strings, BSONSessionStringSlotCount, BSONSessionMaxStringLength);
+
+    CFStringRef result = BSONSessionTableFind(&_strings, bsonString, length, hash);
+    if (result)
+        ++_hitCount;
+    else {
+        result = CFStringCreateWithBytes(NULL, (const UInt8 *) bsonString, length, kCFStringEncodingUTF8, false);
+        // Not valid UTF-8
+        if (!result) return nil;
+        BSONSessionTableStore(&_strings, result, bsonString, length, hash);
+        ++_missCount;
+    }
+    maybe_retain_autorelease_and_return((__bridge NSString *) result);
+}
+
+- (NSNumber *) numberWithInt:(int32_t) value {
+    if (value < BSONSessionMinNumber || value > BSONSessionMaxNumber) return [NSNumber numberWithInt:value];
+    if (!_ints) _ints = calloc(BSONSessionNumberCount, sizeof(CFTypeRef));
+    CFTypeRef *slot = &_ints[value - BSONSessionMinNumber];
+    if (*slot)
+        ++_hitCount;
+    else {
+        *slot = CFNumberCreate(NULL, kCFNumberSInt32Type, &value);
+        ++_missCount;
+    }
+    maybe_retain_autorelease_and_return((__bridge NSNumber *) *slot);
+}
+
+- (NSNumber *) numberWithLongLong:(int64_t) value {
+    if (value < BSONSessionMinNumber || value > BSONSessionMaxNumber) return [NSNumber numberWithLongLong:value];
+    if (!_longs) _longs = calloc(BSONSessionNumberCount, sizeof(CFTypeRef));
+    CFTypeRef *slot = &_longs[value - BSONSessionMinNumber];
+    if (*slot)
+        ++_hitCount;
+    else {
+        *slot = CFNumberCreate(NULL, kCFNumberSInt64Type, &value);
+        ++_missCount;
+    }
+    maybe_retain_autorelease_and_return((__bridge NSNumber *) *slot);
+}
+
+@end
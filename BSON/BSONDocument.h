@@ -19,8 +19,18 @@
 
 #import <Foundation/Foundation.h>
 #import "BSONIterator.h"
+#import "BSONExtendedJSONWriter.h"
 
 @class BSONEncoder;
+@class BSONCompiledKeyPath;
+
+FOUNDATION_EXPORT NSInteger const BSONDocumentErrorMalformed;
+
+typedef enum {
+    BSONValidationDefault = 0,
+    /** Also check that keys and string values are valid UTF-8 */
+    BSONValidationCheckUTF8 = 1 << 0
+} BSONValidationOptions;
 
 /**
  Encapsulates a finished, immutable BSON document, as a wrapper around a
@@ -49,6 +59,24 @@
  */
 + (BSONDocument *) documentWithData:(NSData *) data;
 
+/**
+ Like <code>+documentWithData:</code>, for data from an untrusted source such as a file or a
+ queue. The data's structure is checked in one pass before the document is created: every
+ length must lie within its enclosing document, every string must be terminated, element types
+ must be known, and embedded documents and arrays can be nested at most
+ <code>BSONIteratorMaximumDepth</code> deep. With <code>BSONValidationCheckUTF8</code>, keys and
+ strings must also be valid UTF-8.
+
+ Once validated, the document is used without copying, like any other.
+
+ @return The document, or <code>nil</code> if the data isn't a well-formed BSON document, in
+ which case <i>error</i> is set to a <code>BSONDocumentErrorMalformed</code> error in
+ <code>BSONErrorDomain</code> describing the problem and where it is.
+ */
++ (BSONDocument *) documentWithValidatedData:(NSData *) data
+                                     options:(BSONValidationOptions) options
+                                       error:(NSError * __autoreleasing *) error;
+
 /**
  Returns an immutable <code>NSData</code> object with the contents of the document's
  BSON data buffer.
@@ -77,6 +105,22 @@
  */
 - (NSDictionary *) dictionaryValue;
 
+/**
+ Returns a dictionary which decodes the document's values as they're accessed. Use it to read a
+ few fields from a large document.
+ @returns A <code>BSONLazyDictionary</code> for the document
+ */
+- (NSDictionary *) lazyDictionaryValue;
+
+/**
+ Returns the object representation of the value at the dotted key path <i>keyPath</i>, such as
+ <code>a.b.3.c</code>, or <code>nil</code> if there isn't one. Only the value itself is decoded:
+ the document's bytes are searched directly, without creating objects for the embedded documents
+ and arrays along the way.
+ */
+- (id) objectForKeyPath:(NSString *) keyPath;
+- (id) objectForCompiledKeyPath:(BSONCompiledKeyPath *) keyPath;
+
 /**
  Returns a Boolean value that indicates whether the receiver is equal to another BSON document.
  @param object The object with which to compare the receiver
@@ -85,9 +129,16 @@
  */
 - (BOOL) isEqual:(id)object;
 
+/**
+ Returns the document as MongoDB Extended JSON, by way of
+ <code>+[BSONExtendedJSONWriter stringWithDocument:mode:]</code>. Safe to call from any thread.
+ */
+- (NSString *) extendedJSONStringWithMode:(BSONExtendedJSONMode) mode;
+
 /**
  Returns a string representation of the BSON document for debugging purposes. This uses the driver's
- printing code and requires synchronization. Be aware it's somewhat expensive.
+ printing code and requires synchronization. Be aware it's somewhat expensive. For output which can
+ be parsed, or at high volume, use <code>-extendedJSONStringWithMode:</code>.
  @returns A string representation of the BSON document.
  */
 - (NSString *) description;
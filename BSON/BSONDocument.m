@@ -19,8 +19,12 @@
 
 #import "BSONDocument.h"
 #import "BSONDecoder.h"
+#import "BSONLazyCollections.h"
 #import "BSON_PrivateInterfaces.h"
 #import "BSON_Helper.h"
+#import "BSON_Validation.h"
+
+NSInteger const BSONDocumentErrorMalformed = 201;
 
 static NSMutableString * target_for_substitute_for_printf = nil;
 
@@ -76,16 +80,40 @@ int substitute_for_printf(const char *format, ...) {
         _bson = bson_alloc();
         if (BSON_ERROR == bson_init_finished_data(_bson, (char *) self.privateData.bytes, 0)) {
             bson_dealloc(_bson);
+            _bson = NULL;
             nullify_self_and_return;
         }
     }
     return self;
 }
 
+- (id) initWithValidatedData:(NSData *) data
+                     options:(BSONValidationOptions) options
+                       error:(NSError * __autoreleasing *) error {
+    // Validate the bytes the document will keep
+    if ([data isKindOfClass:[NSMutableData class]]) data = [NSData dataWithData:data];
+    const char *reason = NULL;
+    size_t offset = 0;
+    if (!BSONValidateData(data.bytes, data.length, options & BSONValidationCheckUTF8,
+                          BSONIteratorMaximumDepth, &reason, &offset)) {
+        if (error) {
+            NSString *message = [NSString stringWithFormat:@"Malformed BSON document: %s at byte %lu",
+                                 reason, (unsigned long) offset];
+            *error = [NSError errorWithDomain:BSONErrorDomain
+                                         code:BSONDocumentErrorMalformed
+                                     userInfo:@{ NSLocalizedDescriptionKey : message }];
+        }
+        nullify_self_and_return;
+    }
+    return [self initWithData:data];
+}
+
 - (void) dealloc {
-    bson_destroy(_bson);
-    bson_dealloc(_bson);
-    _bson = NULL;
+    if (_bson) {
+        bson_destroy(_bson);
+        bson_dealloc(_bson);
+        _bson = NULL;
+    }
     maybe_release(_dependentOn);
     maybe_release(_privateData);
     super_dealloc;
@@ -106,6 +134,13 @@ int substitute_for_printf(const char *format, ...) {
     maybe_autorelease_and_return(result);    
 }
 
++ (BSONDocument *) documentWithValidatedData:(NSData *) data
+                                     options:(BSONValidationOptions) options
+                                       error:(NSError * __autoreleasing *) error {
+    BSONDocument *result = [[self alloc] initWithValidatedData:data options:options error:error];
+    maybe_autorelease_and_return(result);
+}
+
 - (const bson *) bsonValue {
     return _bson;
 }
@@ -135,6 +170,18 @@ int substitute_for_printf(const char *format, ...) {
     return [BSONDecoder decodeDictionaryWithDocument:self];
 }
 
+- (id) objectForKeyPath:(NSString *) keyPath {
+    return [[self iterator] objectForKeyPath:keyPath];
+}
+
+- (id) objectForCompiledKeyPath:(BSONCompiledKeyPath *) keyPath {
+    return [[self iterator] objectForCompiledKeyPath:keyPath];
+}
+
+- (NSDictionary *) lazyDictionaryValue {
+    return [BSONLazyDictionary dictionaryWithDocument:self];
+}
+
 - (BOOL) isEqual:(id)object {
     NSData *objectData = nil;
     if ([object isKindOfClass:[NSData class]])
@@ -144,6 +191,10 @@ int substitute_for_printf(const char *format, ...) {
     return [objectData isEqualToData:[self dataValue]];
 }
 
+- (NSString *) extendedJSONStringWithMode:(BSONExtendedJSONMode) mode {
+    return [BSONExtendedJSONWriter stringWithDocument:self mode:mode];
+}
+
 - (NSString *) description {        
     NSMutableString *result =
     [[NSMutableString alloc] initWithFormat:
@@ -0,0 +1,96 @@
+//
+//  BSONDocumentWriter.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class BSONEncoder;
+@class BSONDocument;
+
+/**
+ Writes BSON documents one after another to a file descriptor or an output stream, in the format
+ of the <code>.bson</code> files written by <code>mongodump</code> and read by
+ <code>mongorestore</code>.
+ 
+ Documents are collected in a write buffer of fixed capacity, so that memory use stays constant
+ however many documents are written. A document larger than the buffer is written directly.
+ 
+ Objects are encoded with the writer's own encoder, which is reset for each document. Set its
+ delegate or other options to customize encoding.
+ 
+ A writer isn't thread-safe.
+ */
+@interface BSONDocumentWriter : NSObject
+
+/**
+ Initializes a writer for <i>fileDescriptor</i> with the default buffer capacity.
+ @param fileDescriptor A file descriptor open for writing
+ @param closeOnDealloc <code>YES</code> if the writer should close the file descriptor when it's
+   closed or deallocated
+ */
+- (id) initWithFileDescriptor:(int) fileDescriptor closeOnDealloc:(BOOL) closeOnDealloc;
+- (id) initWithFileDescriptor:(int) fileDescriptor
+               closeOnDealloc:(BOOL) closeOnDealloc
+               bufferCapacity:(NSUInteger) bufferCapacity;
+
+/**
+ Initializes a writer for <i>stream</i> with the default buffer capacity, opening the stream if
+ necessary. Writes block until the stream accepts the data.
+ */
+- (id) initWithOutputStream:(NSOutputStream *) stream;
+- (id) initWithOutputStream:(NSOutputStream *) stream bufferCapacity:(NSUInteger) bufferCapacity;
+
+/**
+ Encodes <i>object</i> as a root object and adds it to the output.
+ @return <code>YES</code> on success, or <code>NO</code> if writing buffered data failed
+ */
+- (BOOL) writeObject:(id) object error:(NSError * __autoreleasing *) error;
+
+/**
+ Adds a finished document to the output.
+ @return <code>YES</code> on success, or <code>NO</code> if writing buffered data failed
+ */
+- (BOOL) writeDocument:(BSONDocument *) document error:(NSError * __autoreleasing *) error;
+
+/**
+ Writes any buffered documents.
+ */
+- (BOOL) flush:(NSError * __autoreleasing *) error;
+
+/**
+ Writes any buffered documents, synchronizes the file if <code>documentsPerSync</code> is set,
+ and closes the file descriptor or stream. Afterward the writer can't be used.
+ */
+- (BOOL) close:(NSError * __autoreleasing *) error;
+
+/**
+ The encoder used by <code>-writeObject:error:</code>.
+ */
+@property (retain, readonly) BSONEncoder *encoder;
+
+/**
+ When nonzero, the writer flushes and calls <code>fsync()</code> after each time it has written this
+ many documents, and when it's closed. Has no effect when writing to a stream. Defaults to zero.
+ */
+@property (assign) NSUInteger documentsPerSync;
+
+@property (assign, readonly) NSUInteger bufferCapacity;
+@property (assign, readonly) unsigned long long documentCount;
+@property (assign, readonly) unsigned long long byteCount;
+
+@end
@@ -0,0 +1,148 @@
+//
+//  BSONDocumentWriter.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSONDocumentWriter.h"
+#import "BSONEncoder.h"
+#import "BSON_PrivateInterfaces.h"
+#import "BSON_Helper.h"
+#import "BSON_OutputSink.h"
+
+#define BSONDocumentWriterDefaultBufferCapacity (256 * 1024)
+
+@interface BSONDocumentWriter ()
+@property (retain) BSONEncoder *encoder;
+@property (assign) unsigned long long documentCount;
+@property (assign) unsigned long long byteCount;
+@end
+
+@implementation BSONDocumentWriter {
+    BSONOutputSink *_sink;
+    NSUInteger _documentsSinceSync;
+}
+
+#pragma mark - Initialization
+
+/**
+ <i>sink</i> is nil if it couldn't allocate its buffer.
+ */
+- (id) _initWithSink:(BSONOutputSink *) sink {
+    if (!sink) nullify_self_and_return;
+    if (self = [super init]) {
+        _sink = maybe_retain(sink);
+        BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+        self.encoder = encoder;
+        maybe_release(encoder);
+    }
+    return self;
+}
+
+- (id) initWithFileDescriptor:(int) fileDescriptor closeOnDealloc:(BOOL) closeOnDealloc {
+    return [self initWithFileDescriptor:fileDescriptor
+                         closeOnDealloc:closeOnDealloc
+                         bufferCapacity:BSONDocumentWriterDefaultBufferCapacity];
+}
+
+- (id) initWithFileDescriptor:(int) fileDescriptor
+               closeOnDealloc:(BOOL) closeOnDealloc
+               bufferCapacity:(NSUInteger) bufferCapacity {
+    BSONOutputSink *sink = [[BSONOutputSink alloc] initWithFileDescriptor:fileDescriptor
+                                                              closeOnClose:closeOnDealloc
+                                                            bufferCapacity:bufferCapacity];
+    self = [self _initWithSink:sink];
+    maybe_release(sink);
+    return self;
+}
+
+- (id) initWithOutputStream:(NSOutputStream *) stream {
+    return [self initWithOutputStream:stream bufferCapacity:BSONDocumentWriterDefaultBufferCapacity];
+}
+
+- (id) initWithOutputStream:(NSOutputStream *) stream bufferCapacity:(NSUInteger) bufferCapacity {
+    BSONOutputSink *sink = [[BSONOutputSink alloc] initWithOutputStream:stream bufferCapacity:bufferCapacity];
+    self = [self _initWithSink:sink];
+    maybe_release(sink);
+    return self;
+}
+
+- (void) dealloc {
+    [self close:NULL];
+    maybe_release(_sink);
+    maybe_release(_encoder);
+    super_dealloc;
+}
+
+- (NSUInteger) bufferCapacity {
+    return _sink.bufferCapacity;
+}
+
+#pragma mark - Writing
+
+- (BOOL) flush:(NSError * __autoreleasing *) error {
+    return [_sink flush:error];
+}
+
+- (BOOL) _synchronize:(NSError * __autoreleasing *) error {
+    _documentsSinceSync = 0;
+    return [_sink synchronize:error];
+}
+
+- (BOOL) _appendBytes:(const char *) bytes length:(NSUInteger) length error:(NSError * __autoreleasing *) error {
+    if (_sink.closed)
+        [NSException raise:NSInternalInconsistencyException format:@"Can't write to a closed BSONDocumentWriter"];
+    
+    if (![_sink appendBytes:bytes length:length error:error]) return NO;
+    self.documentCount += 1;
+    self.byteCount += length;
+    if (self.documentsPerSync && ++_documentsSinceSync >= self.documentsPerSync)
+        return [self _synchronize:error];
+    return YES;
+}
+
+- (BOOL) writeDocument:(BSONDocument *) document error:(NSError * __autoreleasing *) error {
+    NSParameterAssert(document);
+    const bson *b = [document bsonValue];
+    return [self _appendBytes:bson_data(b) length:bson_size(b) error:error];
+}
+
+- (BOOL) writeObject:(id) object error:(NSError * __autoreleasing *) error {
+    BOOL result;
+    NSError *localError = nil;
+    @autoreleasepool {
+        // Also clears out a document abandoned by an exception
+        [self.encoder reset];
+        [self.encoder encodeObject:object];
+        result = [self writeDocument:[self.encoder BSONDocument] error:&localError];
+        // Keep the error out of the pool
+        maybe_retain_void(localError);
+    }
+    maybe_autorelease_void(localError);
+    if (!result && error) *error = localError;
+    return result;
+}
+
+- (BOOL) close:(NSError * __autoreleasing *) error {
+    if (!_sink || _sink.closed) return YES;
+    if (self.documentsPerSync && ![self _synchronize:error]) {
+        [_sink close:NULL];
+        return NO;
+    }
+    return [_sink close:error];
+}
+
+@end
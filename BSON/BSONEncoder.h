@@ -31,6 +31,14 @@ typedef enum {
     BSONRaiseExceptionOnNil
 } BSONEncoderBehaviorOnNil;
 
+typedef enum {
+    BSONBatchEncodingDefault = 0,
+    /** Encode the objects one after another on the calling thread */
+    BSONBatchEncodingSerially = 1 << 0,
+    /** Allow key names which MongoDB won't store, such as those beginning with <code>$</code> */
+    BSONBatchEncodingUnrestrictedKeyNames = 1 << 1
+} BSONBatchEncodingOptions;
+
 @class BSONEncoder;
 @class BSONDocument;
 
@@ -197,9 +205,29 @@ typedef enum {
 + (BSONDocument *) documentForDictionary:(NSDictionary *) dictionary
            restrictingKeyNamesForMongoDB:(BOOL) restrictingKeyNamesForMongoDB;
 
+/**
+ Encodes each object in <i>objects</i> as with <code>+documentForObject:</code>, returning the
+ documents in the same order. Objects which are already instances of <code>BSONDocument</code> are
+ returned as they are.
+
+ Unless <i>options</i> includes <code>BSONBatchEncodingSerially</code>, the objects are encoded
+ concurrently, so encoding them must not depend on shared mutable state. If an object can't be
+ encoded, the batch stops and the exception is raised on the calling thread.
+ */
++ (NSArray *) documentsForObjects:(NSArray *) objects options:(BSONBatchEncodingOptions) options;
+
 - (BSONDocument *) BSONDocument;
 - (NSData *) data;
 
+/**
+ Prepares the receiver to encode another document, discarding the document in progress or the
+ result of the last one. The delegate and other settings are kept.
+ 
+ The new buffer starts out at the size the last document grew to, so documents of similar size
+ are encoded back to back without regrowing it.
+ */
+- (void) reset;
+
 - (void) encodeObject:(id) obj;
 - (void) encodeDictionary:(NSDictionary *) dictionary;
 
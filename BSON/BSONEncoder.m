@@ -22,16 +22,196 @@
 #import "BSONEncoder.h"
 #import "bson.h"
 #import "BSON_PrivateInterfaces.h"
+#import "BSON_KeyTable.h"
+#import "BSON_Append.h"
+#import "BSON_KeyPath.h"
+#import <objc/runtime.h>
+#import <pthread.h>
+
+#pragma mark - Resolving classes to encoding routines
+
+/**
+ The encoding routine for a class. Values other than the shared null and undefined objects are
+ dispatched on the kind of their class, which is resolved once per class and cached.
+ */
+typedef enum {
+    BSONEncodingKindCustomObject = 0,
+    BSONEncodingKindObjectID,
+    BSONEncodingKindRegularExpression,
+    BSONEncodingKindTimestamp,
+    BSONEncodingKindCode,
+    BSONEncodingKindCodeWithScope,
+    BSONEncodingKindSymbol,
+    BSONEncodingKindString,
+    BSONEncodingKindNumber,
+    BSONEncodingKindDate,
+    BSONEncodingKindImage,
+    BSONEncodingKindData,
+    BSONEncodingKindBSONDocument,
+    BSONEncodingKindOrderedSet,
+    BSONEncodingKindArray,
+    BSONEncodingKindDictionary
+} BSONEncodingKind;
+
+static inline BOOL BSONClassIsKindOfClass(Class cls, Class ancestor) {
+    for (; cls; cls = class_getSuperclass(cls))
+        if (cls == ancestor) return YES;
+    return NO;
+}
+
+/**
+ Tests a class in the same order as the -isKindOfClass: tests this replaced, so that a class
+ (such as a class cluster's private subclass) resolves to the first routine which matches.
+ */
+static BSONEncodingKind BSONResolveEncodingKind(Class cls) {
+    // Use late binding so the package will work at runtime under 10.6 (which lacks NSOrderedSet) as well as 10.7
+    Class orderedSetClass = NSClassFromString(@"NSOrderedSet");
+    
+    if (BSONClassIsKindOfClass(cls, [BSONObjectID class])) return BSONEncodingKindObjectID;
+    if (BSONClassIsKindOfClass(cls, [BSONRegularExpression class])) return BSONEncodingKindRegularExpression;
+    if (BSONClassIsKindOfClass(cls, [BSONTimestamp class])) return BSONEncodingKindTimestamp;
+    if (cls == [BSONCode class]) return BSONEncodingKindCode;
+    if (cls == [BSONCodeWithScope class]) return BSONEncodingKindCodeWithScope;
+    if (BSONClassIsKindOfClass(cls, [BSONSymbol class])) return BSONEncodingKindSymbol;
+    if (BSONClassIsKindOfClass(cls, [NSString class])) return BSONEncodingKindString;
+    if (BSONClassIsKindOfClass(cls, [NSNumber class])) return BSONEncodingKindNumber;
+    if (BSONClassIsKindOfClass(cls, [NSDate class])) return BSONEncodingKindDate;
+    if (BSONClassIsKindOfClass(cls, [BSONImageClassName class])) return BSONEncodingKindImage;
+    if (BSONClassIsKindOfClass(cls, [NSData class])) return BSONEncodingKindData;
+    if (BSONClassIsKindOfClass(cls, [BSONDocument class])) return BSONEncodingKindBSONDocument;
+    if (orderedSetClass && BSONClassIsKindOfClass(cls, orderedSetClass)) return BSONEncodingKindOrderedSet;
+    if (BSONClassIsKindOfClass(cls, [NSArray class])) return BSONEncodingKindArray;
+    if (BSONClassIsKindOfClass(cls, [NSDictionary class])) return BSONEncodingKindDictionary;
+    return BSONEncodingKindCustomObject;
+}
+
+/**
+ Whether instances of a class may stand in another object for themselves, by adopting
+ <code>BSONCoding</code>, implementing <code>-replacementObjectForBSONEncoder:</code>, or
+ overriding NSObject's <code>-replacementObjectForCoder:</code>, which otherwise returns self.
+ */
+static BOOL BSONResolveProvidesReplacement(Class cls) {
+    static IMP defaultReplacement;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        defaultReplacement = class_getMethodImplementation([NSObject class], @selector(replacementObjectForCoder:));
+    });
+    return [cls conformsToProtocol:@protocol(BSONCoding)]
+        || class_respondsToSelector(cls, @selector(replacementObjectForBSONEncoder:))
+        || class_getMethodImplementation(cls, @selector(replacementObjectForCoder:)) != defaultReplacement;
+}
+
+// The cache is an open-addressed table like the key table's: slots are only ever filled, so it's
+// read without a lock, and each entry is written completely before it's published. Once the table
+// is full, further classes are resolved every time.
+
+#define BSONEncodingKindCacheSlotCount 1024 // power of two
+
+typedef struct {
+    const void *cls;
+    BSONEncodingKind kind;
+    BOOL providesReplacement;
+} BSONEncodingKindCacheEntry;
+
+static BSONEncodingKindCacheEntry * volatile encodingKindCache[BSONEncodingKindCacheSlotCount];
+static NSUInteger encodingKindCacheCount = 0;
+static pthread_mutex_t encodingKindCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ Returns the kind of <i>cls</i>, and sets <i>providesReplacement</i>, if it isn't NULL, to whether
+ its instances may replace themselves.
+ */
+static BSONEncodingKind BSONEncodingKindForClass(Class cls, BOOL *providesReplacement) {
+    const void *key = (__bridge const void *) cls;
+    NSUInteger i = ((uintptr_t) key >> 4) & (BSONEncodingKindCacheSlotCount - 1);
+    BSONEncodingKindCacheEntry *entry;
+    while ((entry = encodingKindCache[i])) {
+        if (entry->cls == key) {
+            if (providesReplacement) *providesReplacement = entry->providesReplacement;
+            return entry->kind;
+        }
+        i = (i + 1) & (BSONEncodingKindCacheSlotCount - 1);
+    }
+    
+    BSONEncodingKind kind = BSONResolveEncodingKind(cls);
+    BOOL replaces = BSONResolveProvidesReplacement(cls);
+    if (providesReplacement) *providesReplacement = replaces;
+    pthread_mutex_lock(&encodingKindCacheMutex);
+    if (encodingKindCacheCount < BSONEncodingKindCacheSlotCount / 2) {
+        while ((entry = encodingKindCache[i]) && entry->cls != key)
+            i = (i + 1) & (BSONEncodingKindCacheSlotCount - 1);
+        if (!entry) {
+            entry = malloc(sizeof(BSONEncodingKindCacheEntry));
+            entry->cls = key;
+            entry->kind = kind;
+            entry->providesReplacement = replaces;
+            __sync_synchronize();
+            encodingKindCache[i] = entry;
+            ++encodingKindCacheCount;
+        }
+    }
+    pthread_mutex_unlock(&encodingKindCacheMutex);
+    return kind;
+}
+
+/**
+ Uses <code>-class</code> rather than the isa pointer, as <code>-isKindOfClass:</code> does, so
+ that objects whose class is disguised (such as observed objects) resolve the same way.
+ */
+static inline BSONEncodingKind BSONEncodingKindForObject(id object) {
+    return BSONEncodingKindForClass([object class], NULL);
+}
+
+/**
+ Returns the kind of <i>object</i> for the encoding fast path, which doesn't look for replacements:
+ <code>BSONEncodingKindCustomObject</code> when the object may replace itself, so that it's sent
+ down the usual path, which does.
+ */
+static inline BSONEncodingKind BSONFastEncodingKindForObject(id object) {
+    BOOL providesReplacement;
+    BSONEncodingKind kind = BSONEncodingKindForClass([object class], &providesReplacement);
+    return providesReplacement ? BSONEncodingKindCustomObject : kind;
+}
 
 @interface BSONEncoder ()
 @property (retain) NSMutableArray *encodingObjectStack;
-@property (retain) NSMutableArray *privateKeyPathComponents;
 @property (retain) BSONDocument *resultDocument;
 @end
 
 @implementation BSONEncoder {
     bson *_bson;
-}
+    /**
+     The objects in <code>encodingObjectStack</code>, compared by identity, for detecting loops.
+     */
+    CFMutableSetRef _encodingObjectSet;
+    /**
+     The most recently used key. Interned keys are never freed, so a key which is identical to this
+     entry's string can skip the table lookup.
+     */
+    const BSONInternedKey *_lastKey;
+    /**
+     The size of the buffer when it was handed to <code>resultDocument</code>, for <code>-reset</code>.
+     */
+    int _finishedCapacity;
+    /**
+     The keys of the objects being encoded, which is also the key path passed to the delegate.
+     Always read directly rather than through a property, so that it isn't retained in passing.
+     */
+    BSONKeyPathStack *_keyPath;
+}
+
+/**
+ Reset buffers start out no smaller than a new encoder's and no larger than this, so that an
+ unusually large document doesn't pin a large buffer.
+ */
+#define BSONEncoderMinimumCapacity 128
+#define BSONEncoderMaximumRetainedCapacity (1 << 20)
+
+/**
+ The most encoders kept in each thread's pool.
+ */
+#define BSONEncoderPoolSize 4
+static NSString * const BSONEncoderPoolKey = @"BSONEncoderPool";
 
 #pragma mark - Initialization
 
@@ -45,7 +225,10 @@
         bson_init(_bson);
         self.restrictsKeyNamesForMongoDB = YES;
         self.encodingObjectStack = [NSMutableArray array];
-        self.privateKeyPathComponents = [NSMutableArray array];
+        _keyPath = [[BSONKeyPathStack alloc] init];
+        // NULL callbacks: don't retain (the stack does), and compare and hash by pointer
+        CFSetCallBacks identityCallBacks = { 0, NULL, NULL, NULL, NULL, NULL };
+        _encodingObjectSet = CFSetCreateMutable(kCFAllocatorDefault, 0, &identityCallBacks);
     }
     return self;
 }
@@ -54,15 +237,67 @@
     // In case object is deallocated in the middle of encoding
     bson_destroy(_bson);
     bson_dealloc(_bson);
+    if (_encodingObjectSet) CFRelease(_encodingObjectSet);
     maybe_release(_delegate);
     maybe_release(_encodingObjectStack);
-    maybe_release(_privateKeyPathComponents);
+    maybe_release(_keyPath);
     maybe_release(_resultDocument);
     super_dealloc;
 }
 
 - (bson *) bsonValue { return _bson; }
 
+- (void) reset {
+    int capacity = _bson ? _bson->dataSize : _finishedCapacity;
+    capacity = MAX(BSONEncoderMinimumCapacity, MIN(capacity, BSONEncoderMaximumRetainedCapacity));
+    if (_bson)
+        bson_destroy(_bson);
+    else
+        _bson = bson_alloc();
+    bson_init_size(_bson, capacity);
+    
+    [self.encodingObjectStack removeAllObjects];
+    CFSetRemoveAllValues(_encodingObjectSet);
+    [self _prepareKeyPathForWriting];
+    [_keyPath removeAllKeys];
+    self.resultDocument = nil;
+}
+
+#pragma mark - Thread-local pool
+
+//
+// The convenience methods borrow encoders from a small per-thread pool, so that back-to-back
+// documents reuse an encoder and its buffer capacity. The pool is a stack, so an object which
+// uses a convenience method while it's being encoded gets an encoder of its own. An encoder which
+// raises an exception is simply not returned.
+//
+
++ (BSONEncoder *) _dequeuePooledEncoder {
+    NSMutableArray *pool = [[[NSThread currentThread] threadDictionary] objectForKey:BSONEncoderPoolKey];
+    BSONEncoder *result = [pool lastObject];
+    if (result) {
+        maybe_retain_void(result);
+        [pool removeLastObject];
+        maybe_autorelease_and_return(result);
+    }
+    result = [[BSONEncoder alloc] initForWriting];
+    maybe_autorelease_and_return(result);
+}
+
++ (void) _enqueuePooledEncoder:(BSONEncoder *) encoder {
+    NSMutableDictionary *threadDictionary = [[NSThread currentThread] threadDictionary];
+    NSMutableArray *pool = [threadDictionary objectForKey:BSONEncoderPoolKey];
+    if (!pool) {
+        pool = [NSMutableArray arrayWithCapacity:BSONEncoderPoolSize];
+        [threadDictionary setObject:pool forKey:BSONEncoderPoolKey];
+    }
+    if (pool.count >= BSONEncoderPoolSize) return;
+    [encoder reset];
+    encoder.delegate = nil;
+    encoder.behaviorOnNil = BSONDoNothingOnNil;
+    [pool addObject:encoder];
+}
+
 #pragma mark - Convenience methods
 
 + (BSONDocument *) documentForObject:(id) obj {
@@ -70,11 +305,12 @@
 }
 
 + (BSONDocument *) documentForObject:(id) obj restrictingKeyNamesForMongoDB:(BOOL) restrictingKeyNamesForMongoDB {
-    BSONEncoder *encoder = maybe_autorelease([[BSONEncoder alloc] initForWriting]);
+    BSONEncoder *encoder = [self _dequeuePooledEncoder];
     encoder.restrictsKeyNamesForMongoDB = restrictingKeyNamesForMongoDB;
     [encoder encodeObject:obj];
-    BSONDocument *result = [encoder BSONDocument];
-    maybe_retain_autorelease_and_return(result);
+    BSONDocument *result = maybe_retain([encoder BSONDocument]);
+    [self _enqueuePooledEncoder:encoder];
+    maybe_autorelease_and_return(result);
 }
 
 + (BSONDocument *) documentForDictionary:(NSDictionary *) dictionary {
@@ -83,12 +319,87 @@
 
 + (BSONDocument *) documentForDictionary:(NSDictionary *) dictionary
            restrictingKeyNamesForMongoDB:(BOOL) restrictingKeyNamesForMongoDB {
-    BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+    BSONEncoder *encoder = [self _dequeuePooledEncoder];
     encoder.restrictsKeyNamesForMongoDB = restrictingKeyNamesForMongoDB;
     [encoder encodeDictionary:dictionary];
-    BSONDocument *result = [encoder BSONDocument];
-    maybe_release(encoder);
-    maybe_retain_autorelease_and_return(result);
+    BSONDocument *result = maybe_retain([encoder BSONDocument]);
+    [self _enqueuePooledEncoder:encoder];
+    maybe_autorelease_and_return(result);
+}
+
+#pragma mark - Batch encoding
+
+//
+// Concurrent batches are split into more chunks than there are processors, so that a chunk of
+// large objects doesn't leave the other workers idle at the end. Each worker encodes with the
+// encoders in its own thread's pool. The results are written to a C array at their own indexes,
+// which needs no lock.
+//
+
+#define BSONBatchEncodingChunksPerProcessor 4
+#define BSONBatchEncodingMinimumChunkSize 8
+
++ (NSArray *) documentsForObjects:(NSArray *) objects options:(BSONBatchEncodingOptions) options {
+    NSParameterAssert(objects);
+    NSUInteger count = objects.count;
+    BOOL restrictingKeyNames = !(options & BSONBatchEncodingUnrestrictedKeyNames);
+    
+    CFTypeRef *results = calloc(count ? count : 1, sizeof(CFTypeRef));
+    if (!results)
+        [NSException raise:NSMallocException format:@"Can't allocate results for %lu documents", (unsigned long) count];
+    __block NSException *failure = nil;
+    __block NSUInteger failureIndex = NSNotFound;
+    __block volatile BOOL failed = NO;
+    NSObject *failureLock = [[NSObject alloc] init];
+    
+    void (^encodeRange)(NSUInteger, NSUInteger) = ^(NSUInteger start, NSUInteger end) {
+        for (NSUInteger i = start; i < end && !failed; ++i) @autoreleasepool {
+            id object = [objects objectAtIndex:i];
+            @try {
+                BSONDocument *document = [object isKindOfClass:[BSONDocument class]]
+                    ? object
+                    : [self documentForObject:object restrictingKeyNamesForMongoDB:restrictingKeyNames];
+                results[i] = CFRetain((__bridge CFTypeRef) document);
+            } @catch (NSException *exception) {
+                @synchronized(failureLock) {
+                    if (i < failureIndex) {
+                        maybe_release(failure);
+                        failure = maybe_retain(exception);
+                        failureIndex = i;
+                    }
+                    failed = YES;
+                }
+            }
+        }
+    };
+    
+    NSUInteger processorCount = [[NSProcessInfo processInfo] activeProcessorCount];
+    if ((options & BSONBatchEncodingSerially)
+        || processorCount < 2
+        || count < 2 * BSONBatchEncodingMinimumChunkSize) {
+        encodeRange(0, count);
+    } else {
+        NSUInteger chunkSize = MAX(BSONBatchEncodingMinimumChunkSize,
+                                   count / (processorCount * BSONBatchEncodingChunksPerProcessor));
+        size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+        dispatch_apply(chunkCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t chunk) {
+            encodeRange(chunk * chunkSize, MIN(count, (chunk + 1) * chunkSize));
+        });
+    }
+    maybe_release(failureLock);
+    
+    NSArray *result = nil;
+    if (!failed)
+        result = (__bridge_transfer NSArray *) CFArrayCreate(NULL, results, count, &kCFTypeArrayCallBacks);
+    for (NSUInteger i = 0; i < count; ++i)
+        if (results[i]) CFRelease(results[i]);
+    free(results);
+    
+    if (failed) {
+        maybe_autorelease_void(failure);
+        @throw failure;
+    }
+    maybe_autorelease_and_return(result);
 }
 
 #pragma mark - Finishing
@@ -99,6 +410,7 @@
 
     if (BSON_ERROR == bson_finish(_bson)) [self _raiseBSONException];
     
+    _finishedCapacity = _bson->dataSize;
     self.resultDocument = [BSONDocument documentWithNativeDocument:_bson
                                                        dependentOn:nil];
     _bson = NULL;
@@ -128,65 +440,70 @@
 }
 
 - (void) _encodeObject:(id) objv forKey:(NSString *) key withSubstitutions:(BOOL) substitutions withObjectIDSubstitution:(BOOL) substituteObjectID {
-    static Class orderedSetClass;
-    if (!orderedSetClass) orderedSetClass = NSClassFromString(@"NSOrderedSet");
-    
     if ([self _encodingHelper:objv key:key withSubstitutions:substitutions withObjectIDSubstitution:substituteObjectID]) return;
     
-    if ([NSNull null] == objv)
+    if ([NSNull null] == objv) {
         [self encodeNullForKey:key];
-    
-    else if ([BSONIterator objectForUndefined] == objv)
+        return;
+    } else if ([BSONIterator objectForUndefined] == objv) {
         [self encodeUndefinedForKey:key];
+        return;
+    }
     
-    else if ([objv isKindOfClass:[BSONObjectID class]])
-        [self _encodeObjectID:objv forKey:key withSubstitutions:NO];
-
-    else if ([objv isKindOfClass:[BSONRegularExpression class]])
-        [self _encodeRegularExpression:objv forKey:key withSubstitutions:NO];
-    
-    else if ([objv isKindOfClass:[BSONTimestamp class]])
-        [self _encodeTimestamp:objv forKey:key withSubstitutions:NO];
-    
-    else if ([objv isMemberOfClass:[BSONCode class]])
-        [self _encodeCode:objv forKey:key withSubstitutions:NO];
-    
-    else if ([objv isMemberOfClass:[BSONCodeWithScope class]])
-        [self _encodeCodeWithScope:objv forKey:key withSubstitutions:NO];
-    
-    else if ([objv isKindOfClass:[BSONSymbol class]])
-        [self _encodeSymbol:objv forKey:key withSubstitutions:NO];
-        
-    else if ([objv isKindOfClass:[NSString class]])
-        [self _encodeString:objv forKey:key withSubstitutions:NO];
-    
-    else if ([objv isKindOfClass:[NSNumber class]])
-        [self _encodeNumber:objv forKey:key withSubstitutions:NO];
-    
-    else if ([objv isKindOfClass:[NSDate class]])
-        [self _encodeDate:objv forKey:key withSubstitutions:NO];
-
-    else if ([objv isKindOfClass:[BSONImageClassName class]])
-        [self _encodeImage:objv forKey:key withSubstitutions:NO];
+    [self _encodeObject:objv ofKind:BSONEncodingKindForObject(objv) forKey:key];
+}
 
-    else if ([objv isKindOfClass:[NSData class]])
-        [self _encodeData:objv forKey:key withSubstitutions:NO];
-    
-    else if ([objv isKindOfClass:[BSONDocument class]])
-        [self _encodeBSONDocument:objv forKey:key withSubstitutions:NO];
-    
-    // Use late binding so the package will work at runtime under 10.6 (which lacks NSOrderedSet) as well as 10.7
-    else if (orderedSetClass && [objv isKindOfClass:orderedSetClass])
-        [self _encodeArray:[(id)objv array] forKey:key withSubstitutions:NO];
-    
-    else if ([objv isKindOfClass:[NSArray class]])
-        [self _encodeArray:objv forKey:key withSubstitutions:NO];
-    
-    else if ([objv isKindOfClass:[NSDictionary class]])
-        [self _encodeDictionary:objv forKey:key withSubstitutions:NO];
-    
-    else
-        [self _encodeCustomObject:objv forKey:key];
+- (void) _encodeObject:(id) objv ofKind:(BSONEncodingKind) kind forKey:(NSString *) key {
+    switch (kind) {
+        case BSONEncodingKindObjectID:
+            [self _encodeObjectID:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindRegularExpression:
+            [self _encodeRegularExpression:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindTimestamp:
+            [self _encodeTimestamp:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindCode:
+            [self _encodeCode:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindCodeWithScope:
+            [self _encodeCodeWithScope:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindSymbol:
+            [self _encodeSymbol:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindString:
+            [self _encodeString:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindNumber:
+            [self _encodeNumber:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindDate:
+            [self _encodeDate:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindImage:
+            [self _encodeImage:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindData:
+            [self _encodeData:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindBSONDocument:
+            [self _encodeBSONDocument:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindOrderedSet:
+            [self _encodeArray:[(id)objv array] forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindArray:
+            [self _encodeArray:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindDictionary:
+            [self _encodeDictionary:objv forKey:key withSubstitutions:NO];
+            break;
+        case BSONEncodingKindCustomObject:
+            [self _encodeCustomObject:objv forKey:key];
+            break;
+    }
 }
 
 #pragma mark - Encoding the root object
@@ -199,28 +516,23 @@
 - (void) _encodeObject:(id) objv withSubstitutions:(BOOL) substitutions topLevel:(BOOL)topLevel {
     [self _encodingHelper];
     if (!objv) return;
-    if ([NSNull null] == objv
-        || [BSONIterator objectForUndefined] == objv
-        || [objv isKindOfClass:[BSONObjectID class]]
-        || [objv isKindOfClass:[BSONRegularExpression class]]
-        || [objv isKindOfClass:[BSONTimestamp class]]
-        || [objv isMemberOfClass:[BSONCode class]]
-        || [objv isMemberOfClass:[BSONCodeWithScope class]]
-        || [objv isKindOfClass:[BSONSymbol class]]
-        || [objv isKindOfClass:[NSString class]]
-        || [objv isKindOfClass:[NSNumber class]]
-        || [objv isKindOfClass:[NSDate class]]
-        || [objv isKindOfClass:[BSONImageClassName class]]
-        || [objv isKindOfClass:[NSData class]]
-        || [objv isKindOfClass:[NSArray class]]) {
+    if ([NSNull null] == objv || [BSONIterator objectForUndefined] == objv)
         [NSException raise:NSInvalidArchiveOperationException
                     format:@"Encode %@ using encodeObject:forKey: instead", [objv class]];
-    }
     
-    if ([objv isKindOfClass:[NSDictionary class]])
-        [self _encodeExposedDictionary:objv];
-    else
-        [self _encodeExposedCustomObject:objv];
+    switch (BSONEncodingKindForObject(objv)) {
+        case BSONEncodingKindDictionary:
+            [self _encodeExposedDictionary:objv];
+            break;
+        case BSONEncodingKindCustomObject:
+        case BSONEncodingKindBSONDocument:
+        case BSONEncodingKindOrderedSet:
+            [self _encodeExposedCustomObject:objv];
+            break;
+        default:
+            [NSException raise:NSInvalidArchiveOperationException
+                        format:@"Encode %@ using encodeObject:forKey: instead", [objv class]];
+    }
     
     [self _postEncodingHelper:objv keyOrNil:nil topLevel:topLevel];
 }
@@ -234,30 +546,40 @@
 #pragma mark - Exposing internal objects
 
 - (void) _exposeKey:(NSString *) key asArray:(BOOL)asArray forObject:(id) object {
-    NSParameterAssert(key != nil);
-    if (self.restrictsKeyNamesForMongoDB)
-        NSParameterAssert([key isValidKeyNameForMongoDB:nil]);
+    const char *bsonKey = [self _bsonKeyForKey:key validate:self.restrictsKeyNamesForMongoDB];
     
-    if ([self.encodingObjectStack containsObject:object]) {
+    if (CFSetContainsValue(_encodingObjectSet, (__bridge const void *) object)) {
         [NSException raise:NSInvalidArchiveOperationException
                     format:@"Attempting to encode objects in a loop"];
     }
-    [self.encodingObjectStack addObject:object];
+    [self _pushEncodingObject:object];
     
-    [self.privateKeyPathComponents addObject:key];
+    [self _prepareKeyPathForWriting];
+    [_keyPath pushKey:key];
     if (asArray)
-        bson_append_start_array(_bson, key.bsonString);
+        bson_append_start_array(_bson, bsonKey);
     else
-        bson_append_start_object(_bson, key.bsonString);    
+        bson_append_start_object(_bson, bsonKey);
 }
 
 - (void) _closeKey {
-    if (![self.privateKeyPathComponents count]) {
+    if (![_keyPath depth]) {
         [NSException raise:NSInvalidArchiveOperationException
                     format:@"-closeKey called too many times (without matching call to -_exposeKey:asArray:forObject:)"];
     }
     bson_append_finish_object(_bson);
-    [self.privateKeyPathComponents removeLastObject];
+    [self _prepareKeyPathForWriting];
+    [_keyPath popKey];
+    [self _popEncodingObject];
+}
+
+- (void) _pushEncodingObject:(id) object {
+    [self.encodingObjectStack addObject:object];
+    CFSetAddValue(_encodingObjectSet, (__bridge const void *) object);
+}
+
+- (void) _popEncodingObject {
+    CFSetRemoveValue(_encodingObjectSet, (__bridge const void *) [self.encodingObjectStack lastObject]);
     [self.encodingObjectStack removeLastObject];
 }
 
@@ -306,14 +628,33 @@
 }
 
 - (void) _encodeExposedArray:(NSArray *) array {
+    if (!self.delegate) {
+        [self _fastEncodeExposedArray:array];
+        return;
+    }
     for (NSUInteger i = 0; i < array.count; ++i)
         [self _encodeObject:[array objectAtIndex:i]
-                     forKey:[[NSNumber numberWithInteger:i] stringValue]
+                     forKey:[self _keyForArrayIndex:i]
           withSubstitutions:YES
    withObjectIDSubstitution:NO];
 }
 
+/**
+ Returns the key for an array element. Small indexes use precomputed keys, which are primed as the
+ last key used so that they're appended without another lookup or validation.
+ */
+- (NSString *) _keyForArrayIndex:(NSUInteger) index {
+    const BSONInternedKey *indexKey = BSONArrayIndexKey(index);
+    if (!indexKey) return [NSString stringWithFormat:@"%lu", (unsigned long) index];
+    _lastKey = indexKey;
+    return (__bridge NSString *) indexKey->string;
+}
+
 - (void) _encodeExposedDictionary:(NSDictionary *) dictionary {
+    if (!self.delegate) {
+        [self _fastEncodeExposedDictionary:dictionary];
+        return;
+    }
     for (id key in [dictionary allKeys])
         [self _encodeObject:[dictionary objectForKey:key]
                      forKey:key
@@ -321,6 +662,120 @@
    withObjectIDSubstitution:NO];
 }
 
+#pragma mark - Encoding exposed objects without a delegate
+
+//
+// Without a delegate, nothing observes or replaces the values of a dictionary or array as they're
+// encoded, so property-list values are appended straight to the buffer in a single pass. Foundation's
+// value classes inherit NSObject's -replacementObjectForCoder:, which returns self. Everything else
+// (BSON types, custom objects, ordered sets, images), and any class which may replace its instances,
+// is handed to -_encodeObject:forKey:... as usual.
+//
+
+- (void) _fastEncodeExposedDictionary:(NSDictionary *) dictionary {
+    BOOL restrictsKeyNames = self.restrictsKeyNamesForMongoDB;
+    id undefined = [BSONIterator objectForUndefined];
+    [dictionary enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+        if (![key isKindOfClass:[NSString class]]) {
+            [self _encodeObject:obj forKey:key withSubstitutions:YES withObjectIDSubstitution:NO];
+            return;
+        }
+        const char *bsonKey = [self _bsonKeyForKey:key validate:restrictsKeyNames];
+        if (obj == undefined) {
+            [self encodeUndefinedForKey:key];
+            return;
+        }
+        BSONEncodingKind kind = BSONFastEncodingKindForObject(obj);
+        if ([self _fastEncodeValue:obj ofKind:kind forKey:bsonKey]) return;
+        [self _fastEncodeObject:obj ofKind:kind forKey:key];
+    }];
+}
+
+- (void) _fastEncodeExposedArray:(NSArray *) array {
+    id undefined = [BSONIterator objectForUndefined];
+    // Past the precomputed keys, count up in place
+    char indexKey[24];
+    size_t indexKeyLength = snprintf(indexKey, sizeof(indexKey), "%lu", (unsigned long) BSONArrayIndexKeyCount);
+    NSUInteger i = 0;
+    for (id obj in array) {
+        const BSONInternedKey *precomputedKey = BSONArrayIndexKey(i);
+        const char *key = precomputedKey ? precomputedKey->bsonString : indexKey;
+        if (obj == undefined)
+            [self encodeUndefinedForKey:[self _keyForArrayIndex:i]];
+        else {
+            BSONEncodingKind kind = BSONFastEncodingKindForObject(obj);
+            if (![self _fastEncodeValue:obj ofKind:kind forKey:key])
+                [self _fastEncodeObject:obj ofKind:kind forKey:[self _keyForArrayIndex:i]];
+        }
+        if (!precomputedKey) indexKeyLength = BSONIncrementIndexKey(indexKey, indexKeyLength);
+        ++i;
+    }
+}
+
+- (void) _fastEncodeObject:(id) obj ofKind:(BSONEncodingKind) kind forKey:(NSString *) key {
+    if (BSONEncodingKindDictionary != kind && BSONEncodingKindArray != kind) {
+        [self _encodeObject:obj forKey:key withSubstitutions:YES withObjectIDSubstitution:NO];
+        return;
+    }
+    
+    BOOL isDictionary = BSONEncodingKindDictionary == kind;
+    [self _exposeKey:key asArray:!isDictionary forObject:obj];
+    if (isDictionary)
+        [self _fastEncodeExposedDictionary:obj];
+    else
+        [self _fastEncodeExposedArray:obj];
+    [self _closeKey];
+}
+
+/**
+ Appends a string, number, date, data, or null value. Returns NO without appending anything when
+ <i>obj</i> is some other kind of object.
+ */
+- (BOOL) _fastEncodeValue:(id) obj ofKind:(BSONEncodingKind) kind forKey:(const char *) key {
+    int result;
+    if ([NSNull null] == obj)
+        result = BSONAppendNull(_bson, key);
+    
+    else if (BSONEncodingKindString == kind)
+        result = BSONAppendString(_bson, BSON_STRING, key, obj);
+    
+    else if (BSONEncodingKindNumber == kind)
+        switch (*([obj objCType])) {
+            case 'd':
+            case 'f':
+                result = BSONAppendDouble(_bson, key, [obj doubleValue]);
+                break;
+            case 'l':
+            case 'L':
+            case 'q':
+            case 'Q':
+                result = BSONAppendLong(_bson, key, [obj longLongValue]);
+                break;
+            case 'B':
+            case 'c':
+                result = BSONAppendBool(_bson, key, [obj boolValue]);
+                break;
+            default:
+                result = BSONAppendInt(_bson, key, [obj intValue]);
+                break;
+        }
+    
+    else if (BSONEncodingKindDate == kind)
+        result = BSONAppendDate(_bson, key, 1000.0 * [obj timeIntervalSince1970]);
+    
+    else if (BSONEncodingKindData == kind) {
+        if ([obj length] > INT_MAX)
+            [NSException raise:NSInvalidArgumentException format:@"Data length is out of range"];
+        result = BSONAppendBinary(_bson, key, 0, [obj bytes], (int) [obj length]);
+    }
+    
+    else
+        return NO;
+    
+    if (BSON_ERROR == result) [self _raiseBSONException];
+    return YES;
+}
+
 #pragma mark - Encoding supported types - trampoline methods
 
 - (void) encodeObjectID:(BSONObjectID *) objv forKey:(NSString *) key {
@@ -372,44 +827,44 @@
 
 - (void) _encodeObjectID:(BSONObjectID *) objv forKey:(NSString *) key withSubstitutions:(BOOL) substitutions {
     if ([self _encodingHelper:objv key:key withSubstitutions:substitutions withObjectIDSubstitution:NO]) return;
-    if (BSON_ERROR == bson_append_oid(_bson, key.bsonString, [objv objectIDPointer]))
+    if (BSON_ERROR == bson_append_oid(_bson, [self _bsonKeyForKey:key validate:NO], [objv objectIDPointer]))
         [self _raiseBSONException];
     [self _postEncodingHelper:objv keyOrNil:key topLevel:NO];
 }
 
 - (void) encodeInt:(int) intv forKey:(NSString *) key {
-    [self _encodingHelperForKey:key];
-    if (BSON_ERROR == bson_append_int(_bson, key.bsonString, intv))
+    const char *bsonKey = [self _encodingHelperForKey:key];
+    if (BSON_ERROR == BSONAppendInt(_bson, bsonKey, intv))
         [self _raiseBSONException];
 }
 
 - (void) encodeInt64:(int64_t) intv forKey:(NSString *) key {
-    [self _encodingHelperForKey:key];
-    if (BSON_ERROR == bson_append_long(_bson, key.bsonString, intv))
+    const char *bsonKey = [self _encodingHelperForKey:key];
+    if (BSON_ERROR == BSONAppendLong(_bson, bsonKey, intv))
         [self _raiseBSONException];
 }
 
 - (void) encodeBool:(BOOL) boolv forKey:(NSString *) key {
-    [self _encodingHelperForKey:key];
-    if (BSON_ERROR == bson_append_bool(_bson, key.bsonString, boolv))
+    const char *bsonKey = [self _encodingHelperForKey:key];
+    if (BSON_ERROR == BSONAppendBool(_bson, bsonKey, boolv))
         [self _raiseBSONException];
 }
 
 - (void) encodeDouble:(double) realv forKey:(NSString *) key {
-    [self _encodingHelperForKey:key];
-    if (BSON_ERROR == bson_append_double(_bson, key.bsonString, realv))
+    const char *bsonKey = [self _encodingHelperForKey:key];
+    if (BSON_ERROR == BSONAppendDouble(_bson, bsonKey, realv))
         [self _raiseBSONException];
 }
 
 - (void) encodeNullForKey:(NSString *) key {
-    [self _encodingHelperForKey:key];
-    if (BSON_ERROR == bson_append_null(_bson, key.bsonString))
+    const char *bsonKey = [self _encodingHelperForKey:key];
+    if (BSON_ERROR == BSONAppendNull(_bson, bsonKey))
         [self _raiseBSONException];
 }
 
 - (void) encodeUndefinedForKey:(NSString *) key {
-    [self _encodingHelperForKey:key];
-    if (BSON_ERROR == bson_append_undefined(_bson, key.bsonString))
+    const char *bsonKey = [self _encodingHelperForKey:key];
+    if (BSON_ERROR == bson_append_undefined(_bson, bsonKey))
         [self _raiseBSONException];
 }
 
@@ -447,16 +902,16 @@
 
 - (void) _encodeDate:(NSDate *) objv forKey:(NSString *) key withSubstitutions:(BOOL) substitutions {
     if ([self _encodingHelper:objv key:key withSubstitutions:substitutions withObjectIDSubstitution:NO]) return;
-    if (BSON_ERROR == bson_append_date (_bson,
-                                        key.bsonString,
-                                        1000.0 * [objv timeIntervalSince1970]))
+    if (BSON_ERROR == BSONAppendDate(_bson,
+                                     [self _bsonKeyForKey:key validate:NO],
+                                     1000.0 * [objv timeIntervalSince1970]))
         [self _raiseBSONException];
     [self _postEncodingHelper:objv keyOrNil:key topLevel:NO];
 }
 
 - (void) _encodeTimestamp:(BSONTimestamp *) objv forKey:(NSString *) key withSubstitutions:(BOOL) substitutions {
     if ([self _encodingHelper:objv key:key withSubstitutions:substitutions withObjectIDSubstitution:NO]) return;
-    if (BSON_ERROR == bson_append_timestamp(_bson, key.bsonString, [objv timestampPointer]))
+    if (BSON_ERROR == bson_append_timestamp(_bson, [self _bsonKeyForKey:key validate:NO], [objv timestampPointer]))
         [self _raiseBSONException];
     [self _postEncodingHelper:objv keyOrNil:key topLevel:NO];
 }
@@ -475,18 +930,20 @@
 
 - (void) _encodeString:(NSString *) objv forKey:(NSString *) key withSubstitutions:(BOOL) substitutions {
     if ([self _encodingHelper:objv key:key withSubstitutions:substitutions withObjectIDSubstitution:NO]) return;
-    if (BSON_ERROR == bson_append_string(_bson,
-                                         key.bsonString,
-                                         objv.bsonString))
+    if (BSON_ERROR == BSONAppendString(_bson,
+                                       BSON_STRING,
+                                       [self _bsonKeyForKey:key validate:NO],
+                                       objv))
         [self _raiseBSONException];
     [self _postEncodingHelper:objv keyOrNil:key topLevel:NO];
 }
 
 - (void) _encodeSymbol:(BSONSymbol *)objv forKey:(NSString *) key withSubstitutions:(BOOL) substitutions {
     if ([self _encodingHelper:objv key:key withSubstitutions:substitutions withObjectIDSubstitution:NO]) return;
-    if (BSON_ERROR == bson_append_symbol(_bson,
-                                         key.bsonString,
-                                         objv.symbol.bsonString))
+    if (BSON_ERROR == BSONAppendString(_bson,
+                                       BSON_SYMBOL,
+                                       [self _bsonKeyForKey:key validate:NO],
+                                       objv.symbol))
         [self _raiseBSONException];
     [self _postEncodingHelper:objv keyOrNil:key topLevel:NO];
 }
@@ -497,10 +954,10 @@
         return;
     } else {
         NSParameterAssert(pattern != nil);
-        [self _encodingHelperForKey:key];
     }
+    const char *bsonKey = [self _encodingHelperForKey:key];
     if (BSON_ERROR == bson_append_regex(_bson,
-                                        key.bsonString,
+                                        bsonKey,
                                         pattern.bsonString,
                                         options ? options.bsonString : ""))
         [self _raiseBSONException];
@@ -515,7 +972,7 @@
 - (void) _encodeBSONDocument:(BSONDocument *) objv forKey:(NSString *) key withSubstitutions:(BOOL) substitutions {
     if ([self _encodingHelper:objv key:key withSubstitutions:substitutions withObjectIDSubstitution:NO]) return;
     if (BSON_ERROR == bson_append_bson(_bson,
-                                       key.bsonString,
+                                       [self _bsonKeyForKey:key validate:NO],
                                        [objv bsonValue]))
         [self _raiseBSONException];
     [self _postEncodingHelper:objv keyOrNil:key topLevel:NO];
@@ -525,20 +982,21 @@
     if ([self _encodingHelper:objv key:key withSubstitutions:substitutions withObjectIDSubstitution:NO]) return;
     if (objv.length > INT_MAX)
         [NSException raise:NSInvalidArgumentException format:@"Data length is out of range"];
-    if (BSON_ERROR == bson_append_binary(_bson,
-                                         key.bsonString,
-                                         0,
-                                         objv.bytes,
-                                         (int) objv.length))
+    if (BSON_ERROR == BSONAppendBinary(_bson,
+                                       [self _bsonKeyForKey:key validate:NO],
+                                       0,
+                                       objv.bytes,
+                                       (int) objv.length))
         [self _raiseBSONException];
     [self _postEncodingHelper:objv keyOrNil:key topLevel:NO];
 }
 
 - (void) _encodeCodeString:(NSString *) objv forKey:(NSString *) key withSubstitutions:(BOOL) substitutions {
     if ([self _encodingHelper:objv key:key withSubstitutions:substitutions withObjectIDSubstitution:NO]) return;
-    if (BSON_ERROR == bson_append_code(_bson,
-                                       key.bsonString,
-                                       objv.bsonString))
+    if (BSON_ERROR == BSONAppendString(_bson,
+                                       BSON_CODE,
+                                       [self _bsonKeyForKey:key validate:NO],
+                                       objv))
         [self _raiseBSONException];
     [self _postEncodingHelper:objv keyOrNil:key topLevel:NO];
 }
@@ -556,9 +1014,9 @@
     }
     NSParameterAssert(code != nil);
     NSParameterAssert(scope != nil);
-    [self _encodingHelperForKey:key];
+    const char *bsonKey = [self _encodingHelperForKey:key];
     if (BSON_ERROR == bson_append_code_w_scope(_bson,
-                                               key.bsonString,
+                                               bsonKey,
                                                code.bsonString,
                                                [scope bsonValue]))
         [self _raiseBSONException];
@@ -578,13 +1036,34 @@
                     format:@"Can't continue to encode after finishEncoding called"];
 }
 
-- (void) _encodingHelperForKey:(NSString *) key {
+- (const char *) _encodingHelperForKey:(NSString *) key {
     [self _encodingHelper];
+    return [self _bsonKeyForKey:key validate:self.restrictsKeyNamesForMongoDB];
+}
+
+/**
+ Returns the UTF-8 representation of <i>key</i>, asserting first that it's a valid key name when
+ <i>validate</i> is YES. Both come from the shared key table, which computes them once per key.
+ */
+- (const char *) _bsonKeyForKey:(NSString *) key validate:(BOOL) validate {
     NSParameterAssert(key != nil);
-    if (self.restrictsKeyNamesForMongoDB)
-        NSParameterAssert([key isValidKeyNameForMongoDB:nil]);
+    const BSONInternedKey *interned = _lastKey;
+    if (!interned || key != (__bridge NSString *) interned->string) {
+        const char *bsonString = NULL;
+        interned = BSONInternKeyConvertingKey(key, &bsonString);
+        if (!interned) {
+            if (validate)
+                NSParameterAssert([key isValidKeyNameForMongoDB:nil]);
+            return bsonString;
+        }
+        _lastKey = interned;
+    }
+    if (validate)
+        NSParameterAssert(interned->validForMongoDB);
+    return interned->bsonString;
 }
 
+
 - (BOOL) _encodingHelper:(id) object withSubstitutions:(BOOL) substitutions withObjectIDSubstitution:(BOOL) substituteObjectID topLevel:(BOOL) topLevel {
     [self _encodingHelper];
     
@@ -596,13 +1075,13 @@
     if (substitutions && object) {
         id substituteObject = [self _substituteForObject:object substituteObjectID:substituteObjectID keyOrNil:nil topLevel:topLevel];
         if (substituteObject != object) {
-            if (topLevel) [self.encodingObjectStack addObject:substituteObject];
+            if (topLevel) [self _pushEncodingObject:substituteObject];
             [self _encodeObject:substituteObject withSubstitutions:NO topLevel:topLevel];
             return YES;
         }
     }
     
-    if (topLevel) [self.encodingObjectStack addObject:object];
+    if (topLevel) [self _pushEncodingObject:object];
     return NO;
 }
 
@@ -634,8 +1113,8 @@
 
 - (void) _postEncodingHelper:(id) object keyOrNil:(NSString *) key topLevel:(BOOL) topLevel {
     if ([self.delegate respondsToSelector:@selector(encoder:didEncodeObject:forKeyPath:)])
-        [self.delegate encoder:self didEncodeObject:object forKeyPath:[self _keyPathComponentsAddingKeyOrNil:key]];
-    if (topLevel) [self.encodingObjectStack removeLastObject];
+        [self.delegate encoder:self didEncodeObject:object forKeyPath:BSONDelegateKeyPath(key)];
+    if (topLevel) [self _popEncodingObject];
 }
 
 #pragma mark - Other helper methods
@@ -643,13 +1122,28 @@
 - (BOOL) allowsKeyedCoding { return YES; }
 
 - (NSArray *) keyPathComponents {
-    maybe_autorelease_and_return([self.privateKeyPathComponents copy]);
+    return [_keyPath pushedKeys];
+}
+
+/**
+ Replaces the key path stack with a copy if a delegate kept a reference to it.
+ */
+- (void) _prepareKeyPathForWriting {
+    if ([_keyPath hasEscaped]) {
+        BSONKeyPathStack *copy = [_keyPath copyForWriting];
+        maybe_release(_keyPath);
+        _keyPath = copy;
+    }
 }
 
-- (NSArray *) _keyPathComponentsAddingKeyOrNil:(NSString *) key {
-    NSArray *result = [self keyPathComponents];
-    if (key) result = [result arrayByAddingObject:key];
-    return result.count ? result : nil;
+/**
+ Sets <i>key</i> as the last component of the key path, returning <code>NO</code> if the key path
+ is empty.
+ */
+- (BOOL) _prepareKeyPathForDelegateAddingKeyOrNil:(NSString *) key {
+    [self _prepareKeyPathForWriting];
+    [_keyPath setPendingKey:key];
+    return [_keyPath count] > 0;
 }
 
 - (id) _substituteForObject:(id) object substituteObjectID:(BOOL) substituteObjectID keyOrNil:(NSString *) key topLevel:(BOOL) topLevel {
@@ -658,7 +1152,7 @@
     if (!substituteObjectID
         && !topLevel
         && [self.delegate respondsToSelector:@selector(encoder:shouldSubstituteObjectIDForObject:forKeyPath:)])
-        substituteObjectID = [self.delegate encoder:self shouldSubstituteObjectIDForObject:object forKeyPath:[self _keyPathComponentsAddingKeyOrNil:key]];
+        substituteObjectID = [self.delegate encoder:self shouldSubstituteObjectIDForObject:object forKeyPath:BSONDelegateKeyPath(key)];
 
     // Substitute the object ID, if we were asked to
     if (substituteObjectID && object) {
@@ -684,12 +1178,12 @@
     
     // Then, allow the delegate to present a substitute object
     if (object && [self.delegate respondsToSelector:@selector(encoder:willEncodeObject:forKeyPath:)])
-        object = [self.delegate encoder:self willEncodeObject:object forKeyPath:[self _keyPathComponentsAddingKeyOrNil:key]];
+        object = [self.delegate encoder:self willEncodeObject:object forKeyPath:BSONDelegateKeyPath(key)];
     
     // Finally, notify the delegate if a substitution was made
     if (object != originalObject
         && [self.delegate respondsToSelector:@selector(encoder:willReplaceObject:withObject:forKeyPath:)])
-        [self.delegate encoder:self willReplaceObject:originalObject withObject:object forKeyPath:[self _keyPathComponentsAddingKeyOrNil:key]];
+        [self.delegate encoder:self willReplaceObject:originalObject withObject:object forKeyPath:BSONDelegateKeyPath(key)];
     
     return object;
 }
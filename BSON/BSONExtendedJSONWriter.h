@@ -0,0 +1,109 @@
+//
+//  BSONExtendedJSONWriter.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class BSONDocument;
+
+typedef enum {
+    /**
+     Writes 32- and 64-bit integers and finite doubles as JSON numbers, and dates from 1970
+     through 9999 as ISO-8601 strings. Easier to read and to consume with ordinary JSON tools,
+     but a reader can't always tell which BSON type a number had.
+     */
+    BSONExtendedJSONModeRelaxed = 0,
+    /**
+     Wraps every number and date to preserve its BSON type exactly, like
+     <code>{"$numberInt":"1"}</code>.
+     */
+    BSONExtendedJSONModeCanonical = 1
+} BSONExtendedJSONMode;
+
+/**
+ Writes BSON documents as MongoDB Extended JSON, one document per line, to a file descriptor or
+ an output stream, in the format written by <code>mongoexport</code>.
+
+ The JSON is produced directly from each document's bytes, without decoding its values. Output
+ is collected in a write buffer of fixed capacity, as in <code>BSONDocumentWriter</code>, so
+ memory use stays constant apart from the largest single document.
+
+ To convert a single document, use <code>+stringWithDocument:mode:</code> or
+ <code>+appendDocument:mode:toData:</code>. These don't use any shared state, so they can be
+ called from any number of threads at once. A writer itself isn't thread-safe.
+ */
+@interface BSONExtendedJSONWriter : NSObject
+
+/**
+ Returns <i>document</i> as Extended JSON, or <code>nil</code> if its keys or strings aren't
+ valid UTF-8. Like the other methods which take a document, raises
+ <code>NSInvalidArgumentException</code> if the document has an element of an unknown type.
+ */
++ (NSString *) stringWithDocument:(BSONDocument *) document mode:(BSONExtendedJSONMode) mode;
+
+/**
+ Appends <i>document</i> as UTF-8 Extended JSON to <i>data</i>. Reusing the same data object,
+ after setting its length to zero, avoids allocating for each document.
+ */
++ (void) appendDocument:(BSONDocument *) document mode:(BSONExtendedJSONMode) mode toData:(NSMutableData *) data;
+
+/**
+ Initializes a writer for <i>fileDescriptor</i> with the default buffer capacity.
+ @param fileDescriptor A file descriptor open for writing
+ @param closeOnDealloc <code>YES</code> if the writer should close the file descriptor when it's
+   closed or deallocated
+ */
+- (id) initWithFileDescriptor:(int) fileDescriptor closeOnDealloc:(BOOL) closeOnDealloc;
+- (id) initWithFileDescriptor:(int) fileDescriptor
+               closeOnDealloc:(BOOL) closeOnDealloc
+               bufferCapacity:(NSUInteger) bufferCapacity;
+
+/**
+ Initializes a writer for <i>stream</i> with the default buffer capacity, opening the stream if
+ necessary. Writes block until the stream accepts the data.
+ */
+- (id) initWithOutputStream:(NSOutputStream *) stream;
+- (id) initWithOutputStream:(NSOutputStream *) stream bufferCapacity:(NSUInteger) bufferCapacity;
+
+/**
+ Adds <i>document</i> to the output, followed by a newline.
+ @return <code>YES</code> on success, or <code>NO</code> if writing buffered data failed
+ */
+- (BOOL) writeDocument:(BSONDocument *) document error:(NSError * __autoreleasing *) error;
+
+/**
+ Writes any buffered output.
+ */
+- (BOOL) flush:(NSError * __autoreleasing *) error;
+
+/**
+ Writes any buffered output and closes the file descriptor or stream. Afterward the writer
+ can't be used.
+ */
+- (BOOL) close:(NSError * __autoreleasing *) error;
+
+/**
+ Defaults to <code>BSONExtendedJSONModeRelaxed</code>.
+ */
+@property (assign) BSONExtendedJSONMode mode;
+
+@property (assign, readonly) NSUInteger bufferCapacity;
+@property (assign, readonly) unsigned long long documentCount;
+@property (assign, readonly) unsigned long long byteCount;
+
+@end
@@ -0,0 +1,161 @@
+//
+//  BSONExtendedJSONWriter.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSONExtendedJSONWriter.h"
+#import "BSONDocument.h"
+#import "BSON_PrivateInterfaces.h"
+#import "BSON_Helper.h"
+#import "BSON_ExtendedJSON.h"
+#import "BSON_OutputSink.h"
+
+#define BSONExtendedJSONWriterDefaultBufferCapacity (256 * 1024)
+// Enough for most documents to be converted without touching the heap
+#define BSONExtendedJSONStackBufferLength 1024
+
+/**
+ Appends <i>document</i> to <i>buffer</i>, raising <code>NSInvalidArgumentException</code>,
+ with the buffer as it was, if the document has an element the writer doesn't know.
+ */
+static void BSONExtendedJSONAppendDocument(BSONJSONBuffer *buffer, BSONDocument *document, BSONExtendedJSONMode mode) {
+    NSCParameterAssert(document);
+    size_t length = buffer->length;
+    if (!BSONJSONAppendDocument(buffer, bson_data([document bsonValue]), NO, BSONExtendedJSONModeCanonical == mode)) {
+        buffer->length = length;
+        [NSException raise:NSInvalidArgumentException format:@"Document has an element of an unknown type"];
+    }
+}
+
+@interface BSONExtendedJSONWriter ()
+@property (assign) unsigned long long documentCount;
+@property (assign) unsigned long long byteCount;
+@end
+
+@implementation BSONExtendedJSONWriter {
+    BSONOutputSink *_sink;
+    // Each document is converted here and then added to the sink's buffer
+    BSONJSONBuffer _document;
+}
+
+#pragma mark - Converting single documents
+
++ (NSString *) stringWithDocument:(BSONDocument *) document mode:(BSONExtendedJSONMode) mode {
+    char storage[BSONExtendedJSONStackBufferLength];
+    BSONJSONBuffer buffer;
+    BSONJSONBufferInit(&buffer, storage, sizeof(storage));
+    NSString *result = nil;
+    @try {
+        BSONExtendedJSONAppendDocument(&buffer, document, mode);
+        result = [[NSString alloc] initWithBytes:buffer.bytes length:buffer.length encoding:NSUTF8StringEncoding];
+    } @finally {
+        BSONJSONBufferDestroy(&buffer);
+    }
+    maybe_autorelease_and_return(result);
+}
+
++ (void) appendDocument:(BSONDocument *) document mode:(BSONExtendedJSONMode) mode toData:(NSMutableData *) data {
+    NSParameterAssert(data);
+    char storage[BSONExtendedJSONStackBufferLength];
+    BSONJSONBuffer buffer;
+    BSONJSONBufferInit(&buffer, storage, sizeof(storage));
+    @try {
+        BSONExtendedJSONAppendDocument(&buffer, document, mode);
+        [data appendBytes:buffer.bytes length:buffer.length];
+    } @finally {
+        BSONJSONBufferDestroy(&buffer);
+    }
+}
+
+#pragma mark - Initialization
+
+/**
+ <i>sink</i> is nil if it couldn't allocate its buffer.
+ */
+- (id) _initWithSink:(BSONOutputSink *) sink {
+    if (!sink) nullify_self_and_return;
+    if (self = [super init]) {
+        _sink = maybe_retain(sink);
+        BSONJSONBufferInit(&_document, NULL, 0);
+    }
+    return self;
+}
+
+- (id) initWithFileDescriptor:(int) fileDescriptor closeOnDealloc:(BOOL) closeOnDealloc {
+    return [self initWithFileDescriptor:fileDescriptor
+                         closeOnDealloc:closeOnDealloc
+                         bufferCapacity:BSONExtendedJSONWriterDefaultBufferCapacity];
+}
+
+- (id) initWithFileDescriptor:(int) fileDescriptor
+               closeOnDealloc:(BOOL) closeOnDealloc
+               bufferCapacity:(NSUInteger) bufferCapacity {
+    BSONOutputSink *sink = [[BSONOutputSink alloc] initWithFileDescriptor:fileDescriptor
+                                                              closeOnClose:closeOnDealloc
+                                                            bufferCapacity:bufferCapacity];
+    self = [self _initWithSink:sink];
+    maybe_release(sink);
+    return self;
+}
+
+- (id) initWithOutputStream:(NSOutputStream *) stream {
+    return [self initWithOutputStream:stream bufferCapacity:BSONExtendedJSONWriterDefaultBufferCapacity];
+}
+
+- (id) initWithOutputStream:(NSOutputStream *) stream bufferCapacity:(NSUInteger) bufferCapacity {
+    BSONOutputSink *sink = [[BSONOutputSink alloc] initWithOutputStream:stream bufferCapacity:bufferCapacity];
+    self = [self _initWithSink:sink];
+    maybe_release(sink);
+    return self;
+}
+
+- (void) dealloc {
+    [self close:NULL];
+    BSONJSONBufferDestroy(&_document);
+    maybe_release(_sink);
+    super_dealloc;
+}
+
+- (NSUInteger) bufferCapacity {
+    return _sink.bufferCapacity;
+}
+
+#pragma mark - Writing
+
+- (BOOL) flush:(NSError * __autoreleasing *) error {
+    return [_sink flush:error];
+}
+
+- (BOOL) writeDocument:(BSONDocument *) document error:(NSError * __autoreleasing *) error {
+    NSParameterAssert(document);
+    if (_sink.closed)
+        [NSException raise:NSInternalInconsistencyException format:@"Can't write to a closed BSONExtendedJSONWriter"];
+    
+    _document.length = 0;
+    BSONExtendedJSONAppendDocument(&_document, document, self.mode);
+    BSONJSONBufferAppend(&_document, "\n", 1);
+    if (![_sink appendBytes:_document.bytes length:_document.length error:error]) return NO;
+    self.documentCount += 1;
+    self.byteCount += _document.length;
+    return YES;
+}
+
+- (BOOL) close:(NSError * __autoreleasing *) error {
+    return !_sink || [_sink close:error];
+}
+
+@end
@@ -24,6 +24,14 @@ FOUNDATION_EXPORT NSString * const BSONException;
 
 @class BSONDocument;
 @class BSONObjectID;
+@class BSONDecodingSession;
+@class BSONCompiledKeyPath;
+
+/**
+ The deepest nesting of embedded documents and arrays which <code>-enterEmbeddedObject</code>
+ supports. This is also the server's limit.
+ */
+#define BSONIteratorMaximumDepth 100
 
 /**
  Encapsulates a BSON iterator, an interface for accessing the content in a BSON document.
@@ -46,6 +54,10 @@ FOUNDATION_EXPORT NSString * const BSONException;
  
  Each instance of <code>BSONIterator</code> creates a <code>bson_iterator</code> structure during
  initialization and destoys it on deallocation. Each instance retains its associated document.
+ 
+ To walk nested documents without creating an iterator for each one, call
+ <code>-enterEmbeddedObject</code> and <code>-leaveEmbeddedObject</code>, which move the iterator
+ itself in and out of embedded documents and arrays.
  */
 @interface BSONIterator : NSObject
 
@@ -69,6 +81,22 @@ FOUNDATION_EXPORT NSString * const BSONException;
  */
 - (BSONType) valueTypeForKey:(NSString *)key;
 
+/**
+ Searches for the dotted key path <i>keyPath</i>, such as <code>a.b.3.c</code>, in the iterator's
+ BSON document, descending through embedded documents and arrays without creating an object for
+ any of them. At each level, other elements are skipped using their lengths.
+ 
+ Like <code>-valueTypeForKey:</code>, leaves the iterator at the item found, so that
+ <code>-objectValue</code> and the other accessors return its value. Afterwards, use keyed
+ searching rather than <code>-next</code>.
+ 
+ To look up the same key path many times, compile it once with <code>BSONCompiledKeyPath</code>
+ and use <code>-valueTypeForCompiledKeyPath:</code>.
+ @return The native BSON type of the item at <i>keyPath</i> (<code>bson_eoo</code> if there isn't one)
+ */
+- (BSONType) valueTypeForKeyPath:(NSString *) keyPath;
+- (BSONType) valueTypeForCompiledKeyPath:(BSONCompiledKeyPath *) keyPath;
+
 /**
  Attempts to advance the iterator to the next item in the document.
  @return The native BSON type of the next item in the document (<code>bson_eoo</code> if there are no more)
@@ -89,6 +117,48 @@ FOUNDATION_EXPORT NSString * const BSONException;
 
 - (NSArray *) keyPathComponents;
 
+/**
+ Moves the iterator into the current item, which must be an embedded document or an array, so
+ that it iterates the item's contents, as a sub-iterator would. Keyed searching is supported
+ within the item.
+ 
+ This doesn't create any objects. The iterator keeps a stack of native iterators, allocated
+ once with room for <code>BSONIteratorMaximumDepth</code> levels. Raises
+ <code>NSInvalidUnarchiveOperationException</code> if the item isn't an embedded document or
+ array, or it's nested too deeply.
+ */
+- (void) enterEmbeddedObject;
+
+/**
+ Moves the iterator back out to the item entered by the matching call to
+ <code>-enterEmbeddedObject</code>, so that <code>-next</code> continues with the item after it.
+ */
+- (void) leaveEmbeddedObject;
+
+/**
+ The number of embedded documents and arrays which have been entered and not left.
+ */
+@property (assign, readonly) NSUInteger depth;
+
+/**
+ A session which caches keys, small numbers and short strings across documents. Iterators for
+ embedded documents and arrays are created with their parent's session.
+ */
+@property (retain) BSONDecodingSession *session;
+
+/**
+ If <code>YES</code>, <code>-stringValue</code> and <code>-dataValue</code> return objects which
+ point into the document's bytes instead of copying them, for values of 64 bytes or more. Strings
+ are only referenced when they're entirely ASCII, since Core Foundation copies other text anyway.
+ Each
+ such object keeps the document alive until it's released, so reading a few small values out of
+ a large document this way can hold on to more memory than it saves. Use
+ <code>+[BSONDecoder detachedObject:]</code> to copy them when the results need to outlive the
+ document. Iterators for embedded documents and arrays are created with their parent's setting.
+ The default is <code>NO</code>.
+ */
+@property (assign) BOOL referencesDocumentBytes;
+
 /**
  Returns the BSON value type of the current item.
  @return The native BSON value type of the current item.
@@ -143,6 +213,13 @@ FOUNDATION_EXPORT NSString * const BSONException;
  */
 - (id) objectForKey:(NSString *)key;
 
+/**
+ Searches for the dotted key path <i>keyPath</i> as <code>-valueTypeForKeyPath:</code> does, and
+ returns that item's object representation, or <code>nil</code> if there isn't one.
+ */
+- (id) objectForKeyPath:(NSString *) keyPath;
+- (id) objectForCompiledKeyPath:(BSONCompiledKeyPath *) keyPath;
+
 /**
  Returns a sub-iterator for the current item, supporting sequential access (not keyed access). The current
  item's native type must be <code>bson_array</code> or <code>bson_object</code>.
@@ -251,8 +328,9 @@ FOUNDATION_EXPORT NSString * const BSONException;
 - (char) dataBinType;
 
 /**
- Returns a data representation containing a copy of the current item's binary data. The item's
- native type must be supported by <code>bson_iterator_bin_len</code> and <code>bson_iterator_bin_data</code>.
+ Returns a data representation containing a copy of the current item's binary data, or referring
+ to it if <code>referencesDocumentBytes</code> is set. The item's native type must be supported by
+ <code>bson_iterator_bin_len</code> and <code>bson_iterator_bin_data</code>.
  @return The data representation for the current item
  */
 - (NSData *) dataValue;
@@ -20,18 +20,56 @@
 #import "BSONIterator.h"
 #import "BSON_PrivateInterfaces.h"
 #import "BSON_Helper.h"
+#import "BSON_KeyTable.h"
+#import "BSON_KeyIndex.h"
+#import "BSON_ReferencedValues.h"
 
 NSString * const BSONException = @"BSONException";
 
+// Shorter strings and data are copied even when referencesDocumentBytes is set, since a copy
+// costs about as much as a reference, and doesn't keep the document alive
+#define BSONIteratorMinimumReferencedLength 64
+
 @interface BSONIterator ()
 @property (retain) id dependentOn; // An object which retains the bson we're using
 @property (retain) NSArray *privateKeyPathComponents;
 @property (assign) BSONType type;
 @end
 
+/**
+ An embedded document or array entered with -enterEmbeddedObject.
+ */
+typedef struct {
+    bson_iterator iterator;
+    /** The start of the embedded object's bytes, for keyed searching */
+    const char *data;
+    BSONKeyIndex *keyIndex;
+    BOOL keyIndexBuilt;
+} BSONIteratorLevel;
+
 @implementation BSONIterator {
+    /**
+     The native iterator for the current level, which is either _baseIter or the iterator of the
+     innermost entered level.
+     */
     bson_iterator *_iter;
+    bson_iterator *_baseIter;
+    /**
+     Room for BSONIteratorMaximumDepth levels, allocated the first time an embedded object is
+     entered.
+     */
+    BSONIteratorLevel *_levels;
     const bson *_b;
+    /**
+     Built on the first keyed search, if the document is large enough to need it.
+     */
+    BSONKeyIndex *_keyIndex;
+    BOOL _keyIndexBuilt;
+    /**
+     Retains dependentOn for the strings and data which refer to its bytes. Created the first
+     time one is returned.
+     */
+    CFAllocatorRef _referencingAllocator;
 }
 
 #pragma mark - Initialization
@@ -42,7 +80,7 @@ NSString * const BSONException = @"BSONException";
         self.dependentOn = document;
         self.privateKeyPathComponents = keyPathComponents ? keyPathComponents : [NSArray array];
         _b = [document bsonValue];
-        _iter = bson_iterator_alloc();
+        _iter = _baseIter = bson_iterator_alloc();
         bson_iterator_init(_iter, _b);
         self.type = (BSONType)bson_iterator_type(_iter);
     }
@@ -59,7 +97,7 @@ NSString * const BSONException = @"BSONException";
     if (self = [super init]) {
         self.dependentOn = dependentOn;
         self.privateKeyPathComponents = keyPathComponents;
-        _iter = bsonIter;
+        _iter = _baseIter = bsonIter;
         self.type = (BSONType)bson_iterator_type(_iter);
         
     }
@@ -67,7 +105,12 @@ NSString * const BSONException = @"BSONException";
 }
 
 - (void) dealloc {
-    bson_iterator_dealloc(_iter);
+    BSONKeyIndexFree(_keyIndex);
+    while (_depth) BSONKeyIndexFree(_levels[--_depth].keyIndex);
+    free(_levels);
+    maybe_release(_session);
+    if (_referencingAllocator) CFRelease(_referencingAllocator);
+    bson_iterator_dealloc(_baseIter);
     maybe_release(_dependentOn);
     maybe_release(_privateKeyPathComponents);
     super_dealloc;
@@ -77,10 +120,77 @@ NSString * const BSONException = @"BSONException";
 
 #pragma mark - Searching
 
+// Like bson_find(), for the document which starts at data, which needn't have a bson of its own
+static bson_type BSONFindInData(bson_iterator *iterator, const char *data, const char *key) {
+    bson_iterator_from_buffer(iterator, data);
+    while (bson_iterator_next(iterator))
+        if (0 == strcmp(key, bson_iterator_key(iterator))) break;
+    return bson_iterator_type(iterator);
+}
+
+// Finds each component of a key path in turn, in the embedded object the last one found, which
+// bson_iterator_next() steps over element by element using their lengths. Only the first
+// component can use a key index.
+static bson_type BSONFindKeyPathInData(bson_iterator *iterator, const char *data, const BSONKeyIndex *keyIndex,
+                                       const char * const *components, const uint32_t *hashes, NSUInteger count) {
+    bson_type type = BSON_EOO;
+    for (NSUInteger i = 0; i < count; ++i) {
+        if (i) {
+            if (BSON_OBJECT != type && BSON_ARRAY != type) return BSON_EOO;
+            data = bson_iterator_value(iterator);
+            keyIndex = NULL;
+        }
+        if (keyIndex)
+            type = BSONKeyIndexFind(keyIndex, iterator, components[i], hashes[i]);
+        else
+            type = BSONFindInData(iterator, data, components[i]);
+        if (BSON_EOO == type) break;
+    }
+    return type;
+}
+
+/**
+ Returns the start of the current level's document, and sets <i>keyIndex</i> to its key index,
+ which is built on first use, or to <code>NULL</code> if the document is too small to need one.
+ */
+- (const char *) _currentLevelDataWithKeyIndex:(BSONKeyIndex **) keyIndex {
+    if (_depth) {
+        BSONIteratorLevel *level = &_levels[_depth - 1];
+        if (!level->keyIndexBuilt) {
+            level->keyIndex = BSONKeyIndexCreateWithData(level->data);
+            level->keyIndexBuilt = YES;
+        }
+        *keyIndex = level->keyIndex;
+        return level->data;
+    }
+    if (!_keyIndexBuilt) {
+        _keyIndex = BSONKeyIndexCreate(_b);
+        _keyIndexBuilt = YES;
+    }
+    *keyIndex = _keyIndex;
+    return bson_data(_b);
+}
+
 - (BSONType) valueTypeForKey:(NSString *) key {
     [self _assertSupportsKeyedSearching];
     NSParameterAssert(key != nil);
-    return self.type = (BSONType)bson_find(_iter, _b, key.bsonString);
+    BSONKeyIndex *keyIndex;
+    const char *data = [self _currentLevelDataWithKeyIndex:&keyIndex];
+    if (!keyIndex)
+        return self.type = (BSONType)BSONFindInData(_iter, data, BSONKeyString(key));
+    
+    const BSONInternedKey *interned = BSONFindInternedKey(key);
+    const char *bsonKey;
+    uint32_t hash;
+    if (interned) {
+        bsonKey = interned->bsonString;
+        hash = interned->bytesHash;
+    } else {
+        size_t length;
+        bsonKey = [key bsonString];
+        hash = BSONHashKeyBytes(bsonKey, &length);
+    }
+    return self.type = (BSONType)BSONKeyIndexFind(keyIndex, _iter, bsonKey, hash);
 }
 
 - (BOOL) containsValueForKey:(NSString *) key {
@@ -98,6 +208,30 @@ NSString * const BSONException = @"BSONException";
     return [self objectForKey:key];
 }
 
+- (BSONType) valueTypeForCompiledKeyPath:(BSONCompiledKeyPath *) keyPath {
+    [self _assertSupportsKeyedSearching];
+    NSParameterAssert(keyPath != nil);
+    BSONKeyIndex *keyIndex;
+    const char *data = [self _currentLevelDataWithKeyIndex:&keyIndex];
+    return self.type = (BSONType)BSONFindKeyPathInData(_iter, data, keyIndex, [keyPath components],
+                                                       [keyPath hashes], [keyPath componentCount]);
+}
+
+- (BSONType) valueTypeForKeyPath:(NSString *) keyPath {
+    NSParameterAssert(keyPath != nil);
+    return [self valueTypeForCompiledKeyPath:[BSONCompiledKeyPath keyPathWithString:keyPath]];
+}
+
+- (id) objectForKeyPath:(NSString *) keyPath {
+    [self valueTypeForKeyPath:keyPath];
+    return [self objectValue];
+}
+
+- (id) objectForCompiledKeyPath:(BSONCompiledKeyPath *) keyPath {
+    [self valueTypeForCompiledKeyPath:keyPath];
+    return [self objectValue];
+}
+
 #pragma mark - High level iteration
 
 - (id) nextObject {
@@ -113,6 +247,36 @@ NSString * const BSONException = @"BSONException";
     return self.type = (BSONType)bson_iterator_next(_iter);
 }
 
+#pragma mark - Entering embedded objects in place
+
+- (void) enterEmbeddedObject {
+    if (BSONTypeEmbeddedDocument != self.type && BSONTypeArray != self.type)
+        [NSException raise:NSInvalidUnarchiveOperationException
+                    format:@"Can't enter an item of type %@", NSStringFromBSONType(self.type)];
+    if (BSONIteratorMaximumDepth == _depth)
+        [NSException raise:NSInvalidUnarchiveOperationException
+                    format:@"Can't enter embedded objects nested more than %d deep", BSONIteratorMaximumDepth];
+    
+    if (!_levels) _levels = malloc(BSONIteratorMaximumDepth * sizeof(BSONIteratorLevel));
+    BSONIteratorLevel *level = &_levels[_depth++];
+    level->data = bson_iterator_value(_iter);
+    level->keyIndex = NULL;
+    level->keyIndexBuilt = NO;
+    bson_iterator_from_buffer(&level->iterator, level->data);
+    _iter = &level->iterator;
+    self.type = (BSONType)bson_iterator_type(_iter);
+}
+
+- (void) leaveEmbeddedObject {
+    if (!_depth)
+        [NSException raise:NSInvalidUnarchiveOperationException
+                    format:@"-leaveEmbeddedObject called without a matching call to -enterEmbeddedObject"];
+    
+    BSONKeyIndexFree(_levels[--_depth].keyIndex);
+    _iter = _depth ? &_levels[_depth - 1].iterator : _baseIter;
+    self.type = (BSONType)bson_iterator_type(_iter);
+}
+
 #pragma mark - Information about the current key
 
 - (BSONType) valueType { return self.type; }
@@ -124,9 +288,28 @@ NSString * const BSONException = @"BSONException";
     return NO;
 }
 
-- (NSString *) key { return [NSString stringWithBSONString:bson_iterator_key(_iter)]; }
+// These read the session ivar directly, since they're called for every item
+
+static inline NSString * BSONIteratorKey(BSONDecodingSession *session, const bson_iterator *iterator) {
+    return session
+        ? [session keyForBSONString:bson_iterator_key(iterator)]
+        : BSONInternedKeyForBSONString(bson_iterator_key(iterator));
+}
+
+- (NSString *) key {
+    return BSONIteratorKey(_session, _iter);
+}
 - (NSArray *) keyPathComponents {
-    NSArray *result = [self.privateKeyPathComponents arrayByAddingObject:self.key];
+    NSArray *result;
+    if (!_depth)
+        result = [self.privateKeyPathComponents arrayByAddingObject:self.key];
+    else {
+        NSMutableArray *components = [NSMutableArray arrayWithArray:self.privateKeyPathComponents];
+        [components addObject:BSONIteratorKey(_session, _baseIter)];
+        for (NSUInteger i = 0; i < _depth; ++i)
+            [components addObject:BSONIteratorKey(_session, &_levels[i].iterator)];
+        result = components;
+    }
     maybe_retain_autorelease_and_return(result);
 }
 
@@ -138,6 +321,8 @@ NSString * const BSONException = @"BSONException";
     BSONIterator *iterator = [[BSONIterator alloc] initWithNativeIterator:subIter
                                                               dependentOn:self.dependentOn
                                                         keyPathComponents:self.keyPathComponents];
+    iterator.session = _session;
+    iterator.referencesDocumentBytes = _referencesDocumentBytes;
     maybe_autorelease_and_return(iterator);
 }
 
@@ -150,6 +335,8 @@ NSString * const BSONException = @"BSONException";
 - (BSONIterator *) embeddedDocumentIteratorValue {
     BSONIterator *iterator = [[BSONIterator alloc] initWithDocument:self.embeddedDocumentValue
                                              keyPathComponentsOrNil:self.keyPathComponents];
+    iterator.session = _session;
+    iterator.referencesDocumentBytes = _referencesDocumentBytes;
     maybe_autorelease_and_return(iterator);
 }
 
@@ -193,10 +380,12 @@ NSString * const BSONException = @"BSONException";
         case BSONTypeCodeWithScope:
             return [self codeWithScopeValue];
         case BSONTypeInteger:
+            if (_session) return [_session numberWithInt:[self intValue]];
             return [NSNumber numberWithInt:[self intValue]];
         case BSONTypeTimestamp:
             return [self timestampValue];
         case BSONTypeLong:
+            if (_session) return [_session numberWithLongLong:[self int64Value]];
             return [NSNumber numberWithLongLong:[self int64Value]];
         default:
             [NSException raise:NSInvalidUnarchiveOperationException
@@ -216,7 +405,37 @@ NSString * const BSONException = @"BSONException";
     return [BSONObjectID objectIDWithNativeOID:bson_iterator_oid(_iter)];
 }
 
+- (CFAllocatorRef) _allocatorForReferencedValues {
+    if (!_referencingAllocator) _referencingAllocator = BSONReferencingAllocatorCreate(self.dependentOn);
+    return _referencingAllocator;
+}
+
+/**
+ Returns <code>YES</code> if the <i>length</i> bytes at <i>bytes</i> lie within the document, so
+ that a value can refer to them. Guards against a corrupt length in data which wasn't validated.
+ The bounds are only known when the iterator depends on a <code>BSONDocument</code>.
+ */
+- (BOOL) _documentContainsBytes:(const char *) bytes length:(size_t) length {
+    if (![self.dependentOn isKindOfClass:[BSONDocument class]]) return NO;
+    const bson *b = [self.dependentOn bsonValue];
+    const char *start = bson_data(b);
+    const char *end = start + bson_size(b);
+    return bytes >= start && bytes <= end && length <= (size_t) (end - bytes);
+}
+
 - (NSString *) stringValue {
+    if (_referencesDocumentBytes) {
+        // Includes the terminator
+        int storedLength = bson_iterator_string_len(_iter);
+        const char *bytes = bson_iterator_string(_iter);
+        if (storedLength > BSONIteratorMinimumReferencedLength
+            && [self _documentContainsBytes:bytes length:storedLength]
+            && BSONCanReferenceString(bytes, storedLength - 1))
+            return BSONReferencingString([self _allocatorForReferencedValues], bytes, storedLength - 1);
+    }
+    if (_session)
+        return [_session stringForBSONString:bson_iterator_string(_iter)
+                                      length:bson_iterator_string_len(_iter) - 1];
     return [NSString stringWithBSONString:bson_iterator_string(_iter)];
 }
 - (int) stringLength {
@@ -244,8 +463,12 @@ NSString * const BSONException = @"BSONException";
 - (NSUInteger) dataLength { return (NSUInteger)bson_iterator_bin_len(_iter); }
 - (char) dataBinType { return bson_iterator_bin_type(_iter); }
 - (NSData *) dataValue {
+    NSUInteger length = [self dataLength];
+    if (_referencesDocumentBytes && length >= BSONIteratorMinimumReferencedLength
+        && [self _documentContainsBytes:bson_iterator_bin_data(_iter) length:length])
+        return BSONReferencingData([self _allocatorForReferencedValues], bson_iterator_bin_data(_iter), length);
     id value = [NSData dataWithBytes:bson_iterator_bin_data(_iter)
-                              length:[self dataLength]];
+                              length:length];
     return value;
 }
 
@@ -273,7 +496,7 @@ NSString * const BSONException = @"BSONException";
 }
 
 - (void) _assertSupportsKeyedSearching {
-    if (!_b)
+    if (!_b && !_depth)
         [NSException raise:NSInvalidUnarchiveOperationException
                     format:@"Can't perform keyed searching on a sequential iterator; use -embeddedDocumentIterator instead"];
 }
@@ -0,0 +1,47 @@
+//
+//  BSONLazyCollections.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class BSONDocument;
+
+/**
+ An immutable dictionary which reads its keys and values from a BSON document as they're
+ accessed, rather than decoding the whole document up front. Each value is decoded the first time
+ it's requested and then cached. Embedded documents and arrays are themselves lazy.
+ 
+ Keys enumerate in document order. Values are the same as those returned by
+ <code>+[BSONDecoder decodeDictionaryWithDocument:]</code> with the default options. As there, if
+ a key appears more than once, it enumerates in its first position with its last value.
+ 
+ The dictionary retains the document. It may be used from several threads at once.
+ */
+@interface BSONLazyDictionary : NSDictionary
+
+- (id) initWithDocument:(BSONDocument *) document;
++ (BSONLazyDictionary *) dictionaryWithDocument:(BSONDocument *) document;
+
+@end
+
+/**
+ An immutable array which decodes the elements of a BSON array as they're accessed, like
+ <code>BSONLazyDictionary</code>.
+ */
+@interface BSONLazyArray : NSArray
+@end
@@ -0,0 +1,376 @@
+//
+//  BSONLazyCollections.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSONLazyCollections.h"
+#import "BSON_PrivateInterfaces.h"
+#import "BSON_Helper.h"
+#import "BSON_KeyTable.h"
+
+//
+// Each collection scans its document's elements once, when it's created, recording their offsets.
+// Nothing is decoded then. Values and keys are cached in C arrays of retained objects. A slot is
+// filled with a compare-and-swap, so that two threads decoding the same value at once agree on one
+// object, and the other is released. Everything else is immutable after initialization.
+//
+
+#define BSONLazyDictionaryIndexThreshold 8
+
+typedef struct {
+    /** The document or array, starting with its length */
+    const char *data;
+    NSUInteger count;
+    /** The offset of each element's type byte from data */
+    uint32_t *offsets;
+    /** The decoded values, or NULL where not yet decoded */
+    CFTypeRef *values;
+} BSONLazyElements;
+
+@interface BSONLazyDictionary ()
+- (id) _initWithDocument:(BSONDocument *) document data:(const char *) data;
+@end
+
+@interface BSONLazyArray ()
+- (id) _initWithDocument:(BSONDocument *) document data:(const char *) data;
+@end
+
+#pragma mark - Elements
+
+static BOOL BSONLazyScanElements(BSONLazyElements *elements, const char *data) {
+    NSUInteger capacity = 16;
+    elements->data = data;
+    elements->count = 0;
+    elements->offsets = malloc(capacity * sizeof(uint32_t));
+    if (!elements->offsets) return NO;
+    
+    bson_iterator it;
+    bson_iterator_from_buffer(&it, data);
+    while (bson_iterator_next(&it)) {
+        if (elements->count == capacity) {
+            capacity *= 2;
+            uint32_t *offsets = realloc(elements->offsets, capacity * sizeof(uint32_t));
+            if (!offsets) return NO;
+            elements->offsets = offsets;
+        }
+        elements->offsets[elements->count++] = (uint32_t) (it.cur - data);
+    }
+    elements->values = calloc(elements->count ? elements->count : 1, sizeof(CFTypeRef));
+    return elements->values != NULL;
+}
+
+static void BSONLazyFreeElements(BSONLazyElements *elements) {
+    if (elements->values)
+        for (NSUInteger i = 0; i < elements->count; ++i)
+            if (elements->values[i]) CFRelease(elements->values[i]);
+    free(elements->values);
+    free(elements->offsets);
+}
+
+static inline const char * BSONLazyKeyAtIndex(const BSONLazyElements *elements, NSUInteger index) {
+    return elements->data + elements->offsets[index] + 1;
+}
+
+/**
+ Decodes the element at <i>offset</i> as the decoder would with its default options.
+ */
+static id BSONLazyValue(BSONDocument *document, const char *data, uint32_t offset) {
+    bson_iterator it;
+    it.cur = data + offset;
+    it.first = 0;
+    id result;
+    switch (bson_iterator_type(&it)) {
+        case BSON_OBJECT:
+            result = [[BSONLazyDictionary alloc] _initWithDocument:document data:bson_iterator_value(&it)];
+            maybe_autorelease_and_return(result);
+        case BSON_ARRAY:
+            result = [[BSONLazyArray alloc] _initWithDocument:document data:bson_iterator_value(&it)];
+            maybe_autorelease_and_return(result);
+        case BSON_STRING:
+            return [NSString stringWithBSONString:bson_iterator_string(&it)];
+        case BSON_INT:
+            return [NSNumber numberWithInt:bson_iterator_int(&it)];
+        case BSON_LONG:
+            return [NSNumber numberWithLongLong:bson_iterator_long(&it)];
+        case BSON_DOUBLE:
+            return [NSNumber numberWithDouble:bson_iterator_double(&it)];
+        case BSON_BOOL:
+            return [NSNumber numberWithBool:bson_iterator_bool(&it)];
+        case BSON_NULL:
+            return [NSNull null];
+        case BSON_DATE:
+            return [NSDate dateWithTimeIntervalSince1970:0.001 * bson_iterator_date(&it)];
+        default: {
+            // The less common types go through an iterator
+            bson_iterator *copy = bson_iterator_alloc();
+            *copy = it;
+            BSONIterator *iterator = [[BSONIterator alloc] initWithNativeIterator:copy
+                                                                      dependentOn:document
+                                                                keyPathComponents:[NSArray array]];
+            result = [iterator objectValue];
+            maybe_release(iterator);
+            return result;
+        }
+    }
+}
+
+static id BSONLazyCachedValue(BSONLazyElements *elements, BSONDocument *document, NSUInteger index) {
+    CFTypeRef value = elements->values[index];
+    if (!value) {
+        CFTypeRef decoded = CFRetain((__bridge CFTypeRef) BSONLazyValue(document, elements->data, elements->offsets[index]));
+        if (__sync_bool_compare_and_swap(&elements->values[index], NULL, decoded))
+            value = decoded;
+        else {
+            CFRelease(decoded);
+            value = elements->values[index];
+        }
+    }
+    return (__bridge id) value;
+}
+
+static void BSONLazyRaiseRangeException(NSUInteger index, NSUInteger count) {
+    [NSException raise:NSRangeException
+                format:@"Index %lu beyond bounds [0 .. %ld]", (unsigned long) index, (long) count - 1];
+}
+
+#pragma mark - BSONLazyDictionary
+
+@implementation BSONLazyDictionary {
+    BSONDocument *_document;
+    BSONLazyElements _elements;
+    /** The keys as strings, or NULL where not yet created */
+    CFTypeRef *_keys;
+    /** For documents above the threshold, an open-addressed table of element indexes plus one */
+    uint32_t *_slots;
+    uint32_t _mask;
+    uint32_t *_hashes;
+}
+
++ (BSONLazyDictionary *) dictionaryWithDocument:(BSONDocument *) document {
+    BSONLazyDictionary *result = [[self alloc] initWithDocument:document];
+    maybe_autorelease_and_return(result);
+}
+
+- (id) initWithDocument:(BSONDocument *) document {
+    NSParameterAssert(document);
+    return [self _initWithDocument:document data:bson_data([document bsonValue])];
+}
+
+- (id) _initWithDocument:(BSONDocument *) document data:(const char *) data {
+    if (self = [super init]) {
+        _document = maybe_retain(document);
+        if (!BSONLazyScanElements(&_elements, data) || ![self _removeDuplicateKeys]) nullify_self_and_return;
+        _keys = calloc(_elements.count ? _elements.count : 1, sizeof(CFTypeRef));
+        if (!_keys) nullify_self_and_return;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    BSONLazyFreeElements(&_elements);
+    if (_keys)
+        for (NSUInteger i = 0; i < _elements.count; ++i)
+            if (_keys[i]) CFRelease(_keys[i]);
+    free(_keys);
+    free(_slots);
+    free(_hashes);
+    maybe_release(_document);
+    super_dealloc;
+}
+
+/**
+ Returns the index of the element with <i>key</i>, or <code>NSNotFound</code>.
+ */
+- (NSUInteger) _indexOfKey:(const char *) key hash:(uint32_t) hash {
+    if (!_slots) {
+        for (NSUInteger i = 0; i < _elements.count; ++i)
+            if (0 == strcmp(key, BSONLazyKeyAtIndex(&_elements, i))) return i;
+        return NSNotFound;
+    }
+    for (uint32_t i = hash & _mask; _slots[i]; i = (i + 1) & _mask) {
+        uint32_t index = _slots[i] - 1;
+        if (_hashes[index] == hash && 0 == strcmp(key, BSONLazyKeyAtIndex(&_elements, index)))
+            return index;
+    }
+    return NSNotFound;
+}
+
+/**
+ Keeps one element for each key, in the position of the first with that key but holding the value
+ of the last, as decoding into an <code>OrderedDictionary</code> does. Builds the key table for
+ large documents as it goes.
+ */
+- (BOOL) _removeDuplicateKeys {
+    NSUInteger count = _elements.count;
+    if (count <= BSONLazyDictionaryIndexThreshold) {
+        NSUInteger kept = 0;
+        for (NSUInteger i = 0; i < count; ++i) {
+            _elements.count = kept;
+            NSUInteger index = [self _indexOfKey:BSONLazyKeyAtIndex(&_elements, i) hash:0];
+            _elements.offsets[NSNotFound == index ? kept++ : index] = _elements.offsets[i];
+        }
+        _elements.count = kept;
+        return YES;
+    }
+    
+    uint32_t slotCount = 16;
+    while (slotCount < 2 * count) slotCount *= 2;
+    _slots = calloc(slotCount, sizeof(uint32_t));
+    _hashes = malloc(count * sizeof(uint32_t));
+    if (!_slots || !_hashes) return NO;
+    _mask = slotCount - 1;
+    
+    NSUInteger kept = 0;
+    for (NSUInteger i = 0; i < count; ++i) {
+        _elements.count = kept;
+        _elements.offsets[kept] = _elements.offsets[i];
+        size_t length;
+        const char *key = BSONLazyKeyAtIndex(&_elements, kept);
+        uint32_t hash = BSONHashKeyBytes(key, &length);
+        NSUInteger index = [self _indexOfKey:key hash:hash];
+        if (NSNotFound != index) {
+            // The keys are the same, so the hash and slot still hold
+            _elements.offsets[index] = _elements.offsets[i];
+            continue;
+        }
+        uint32_t slot = hash & _mask;
+        while (_slots[slot]) slot = (slot + 1) & _mask;
+        _slots[slot] = (uint32_t) kept + 1;
+        _hashes[kept++] = hash;
+    }
+    _elements.count = kept;
+    return YES;
+}
+
+- (NSString *) _keyAtIndex:(NSUInteger) index {
+    CFTypeRef key = _keys[index];
+    if (!key) {
+        CFTypeRef created = CFRetain((__bridge CFTypeRef) BSONInternedKeyForBSONString(BSONLazyKeyAtIndex(&_elements, index)));
+        if (__sync_bool_compare_and_swap(&_keys[index], NULL, created))
+            key = created;
+        else {
+            CFRelease(created);
+            key = _keys[index];
+        }
+    }
+    return (__bridge NSString *) key;
+}
+
+#pragma mark - NSDictionary primitives
+
+- (NSUInteger) count {
+    return _elements.count;
+}
+
+- (id) objectForKey:(id) key {
+    if (![key isKindOfClass:[NSString class]]) return nil;
+    const char *bsonKey;
+    uint32_t hash = 0;
+    // Only look the key up, so that arbitrary lookups don't fill the table
+    const BSONInternedKey *interned = BSONFindInternedKey(key);
+    if (interned) {
+        bsonKey = interned->bsonString;
+        hash = interned->bytesHash;
+    } else {
+        size_t length;
+        bsonKey = [key bsonString];
+        if (!bsonKey) return nil;
+        hash = BSONHashKeyBytes(bsonKey, &length);
+    }
+    NSUInteger index = [self _indexOfKey:bsonKey hash:hash];
+    return NSNotFound == index ? nil : BSONLazyCachedValue(&_elements, _document, index);
+}
+
+- (NSEnumerator *) keyEnumerator {
+    return [[self allKeys] objectEnumerator];
+}
+
+- (NSArray *) allKeys {
+    for (NSUInteger i = 0; i < _elements.count; ++i) [self _keyAtIndex:i];
+    NSArray *result = (__bridge_transfer NSArray *) CFArrayCreate(NULL, _keys, _elements.count, &kCFTypeArrayCallBacks);
+    maybe_autorelease_and_return(result);
+}
+
+- (NSUInteger) countByEnumeratingWithState:(NSFastEnumerationState *) state
+                                   objects:(id __unsafe_unretained []) buffer
+                                     count:(NSUInteger) length {
+    NSUInteger start = state->state;
+    if (start >= _elements.count) return 0;
+    NSUInteger end = MIN(_elements.count, start + MAX(length, (NSUInteger) 16));
+    for (NSUInteger i = start; i < end; ++i) [self _keyAtIndex:i];
+    state->state = end;
+    state->itemsPtr = (__unsafe_unretained id *) (void *) (_keys + start);
+    // Immutable
+    state->mutationsPtr = &state->extra[0];
+    return end - start;
+}
+
+- (id) copyWithZone:(NSZone *) zone {
+    return maybe_retain(self);
+}
+
+@end
+
+#pragma mark - BSONLazyArray
+
+@implementation BSONLazyArray {
+    BSONDocument *_document;
+    BSONLazyElements _elements;
+}
+
+- (id) _initWithDocument:(BSONDocument *) document data:(const char *) data {
+    if (self = [super init]) {
+        _document = maybe_retain(document);
+        if (!BSONLazyScanElements(&_elements, data)) nullify_self_and_return;
+    }
+    return self;
+}
+
+- (void) dealloc {
+    BSONLazyFreeElements(&_elements);
+    maybe_release(_document);
+    super_dealloc;
+}
+
+- (NSUInteger) count {
+    return _elements.count;
+}
+
+- (id) objectAtIndex:(NSUInteger) index {
+    if (index >= _elements.count) BSONLazyRaiseRangeException(index, _elements.count);
+    return BSONLazyCachedValue(&_elements, _document, index);
+}
+
+- (NSUInteger) countByEnumeratingWithState:(NSFastEnumerationState *) state
+                                   objects:(id __unsafe_unretained []) buffer
+                                     count:(NSUInteger) length {
+    NSUInteger start = state->state;
+    if (start >= _elements.count) return 0;
+    NSUInteger end = MIN(_elements.count, start + MAX(length, (NSUInteger) 16));
+    for (NSUInteger i = start; i < end; ++i) BSONLazyCachedValue(&_elements, _document, i);
+    state->state = end;
+    state->itemsPtr = (__unsafe_unretained id *) (void *) (_elements.values + start);
+    // Immutable
+    state->mutationsPtr = &state->extra[0];
+    return end - start;
+}
+
+- (id) copyWithZone:(NSZone *) zone {
+    return maybe_retain(self);
+}
+
+@end
@@ -0,0 +1,102 @@
+//
+//  BSONObjectIDSet.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <Foundation/Foundation.h>
+
+@class BSONObjectID;
+
+/**
+ A set of object IDs stored as their 12 bytes, packed in sorted order, instead of as one object
+ each. It takes 12 bytes per object ID, plus batches of recent changes which hold about the square
+ root of the count. Suited to holding millions of object IDs, and to testing many of them at once.
+
+ Testing for an object ID takes logarithmic time, and a sorted run of them is tested in one pass.
+ Adding or removing one, in any order, takes amortized time proportional to the square root of the
+ count. The methods which take bytes read object IDs 12 bytes apart, as
+ <code>+[BSONObjectID generateObjectIDBytes:count:]</code> writes them, and many added at once
+ are merged in together.
+
+ The set isn't thread-safe. Besides the methods which change it, <code>-objectIDBytes</code>,
+ <code>-allObjectIDs</code>, <code>-copy</code> and <code>-isEqual:</code> merge the batches of
+ recent changes, so even these read methods mustn't be called while another thread uses the set.
+ */
+@interface BSONObjectIDSet : NSObject <NSCopying>
+
++ (BSONObjectIDSet *) set;
+- (id) initWithCapacity:(NSUInteger) capacity;
+/**
+ Initializes a set with each <code>BSONObjectID</code> in <i>objectIDs</i>, which may be an array,
+ a set or any other collection.
+ */
+- (id) initWithObjectIDs:(id <NSFastEnumeration>) objectIDs;
+
+- (void) addObjectID:(BSONObjectID *) objectID;
+- (void) addObjectIDBytes:(const void *) bytes count:(NSUInteger) count;
+- (void) removeObjectID:(BSONObjectID *) objectID;
+- (void) removeAllObjectIDs;
+
+- (BOOL) containsObjectID:(BSONObjectID *) objectID;
+- (BOOL) containsObjectIDBytes:(const void *) bytes;
+/**
+ Sets <code>results[i]</code> to whether the set contains the <i>i</i>th of the <i>count</i>
+ object IDs at <i>bytes</i>, and returns the number it contains.
+ */
+- (NSUInteger) containsObjectIDBytes:(const void *) bytes count:(NSUInteger) count results:(BOOL *) results;
+
+@property (assign, readonly) NSUInteger count;
+
+/**
+ Returns the object IDs in increasing order.
+ */
+- (NSArray *) allObjectIDs;
+
+/**
+ Returns the object IDs' bytes, packed in increasing order, which stay valid until the set is
+ changed.
+ */
+- (const void *) objectIDBytes NS_RETURNS_INNER_POINTER;
+
+@end
+
+/**
+ A map from object IDs to objects, with the object IDs stored as in <code>BSONObjectIDSet</code>
+ and the objects in a parallel array, taking 20 bytes per entry on 64-bit platforms. Like the set,
+ it isn't thread-safe, and <code>-allObjectIDs</code> merges the batches of recent changes.
+ */
+@interface BSONObjectIDMap : NSObject
+
++ (BSONObjectIDMap *) map;
+- (id) initWithCapacity:(NSUInteger) capacity;
+
+- (void) setObject:(id) object forObjectID:(BSONObjectID *) objectID;
+- (void) setObject:(id) object forObjectIDBytes:(const void *) bytes;
+- (void) removeObjectForObjectID:(BSONObjectID *) objectID;
+- (void) removeAllObjects;
+
+- (id) objectForObjectID:(BSONObjectID *) objectID;
+- (id) objectForObjectIDBytes:(const void *) bytes;
+
+@property (assign, readonly) NSUInteger count;
+
+/**
+ Returns the object IDs in increasing order.
+ */
+- (NSArray *) allObjectIDs;
+
+@end
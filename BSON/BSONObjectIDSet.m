@@ -0,0 +1,211 @@
+//
+//  BSONObjectIDSet.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSONObjectIDSet.h"
+#import "BSON_PrivateInterfaces.h"
+#import "BSON_Helper.h"
+#import "BSON_ObjectID.h"
+
+static NSArray * BSONObjectIDsInTable(BSONObjectIDTable *table) {
+    const char *keys = BSONObjectIDTableSortedKeys(table);
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:table->count];
+    for (NSUInteger i = 0; i < table->count; ++i)
+        [result addObject:[BSONObjectID objectIDWithNativeOID:(const bson_oid_t *) (keys + i * BSONObjectIDSize)]];
+    return [NSArray arrayWithArray:result];
+}
+
+#pragma mark - BSONObjectIDSet
+
+@implementation BSONObjectIDSet {
+    BSONObjectIDTable _table;
+}
+
++ (BSONObjectIDSet *) set {
+    BSONObjectIDSet *result = [[self alloc] init];
+    maybe_autorelease_and_return(result);
+}
+
+- (id) init {
+    return [self initWithCapacity:0];
+}
+
+- (id) initWithCapacity:(NSUInteger) capacity {
+    if (self = [super init]) {
+        BSONObjectIDTableInit(&_table, NO, capacity);
+    }
+    return self;
+}
+
+- (id) initWithObjectIDs:(id <NSFastEnumeration>) objectIDs {
+    if (self = [self initWithCapacity:0]) {
+        for (BSONObjectID *objectID in objectIDs)
+            [self addObjectID:objectID];
+    }
+    return self;
+}
+
+- (void) dealloc {
+    BSONObjectIDTableDestroy(&_table);
+    super_dealloc;
+}
+
+- (id) copyWithZone:(NSZone *) zone {
+    BSONObjectIDSet *copy = [[[self class] allocWithZone:zone] initWithCapacity:self.count];
+    [copy addObjectIDBytes:[self objectIDBytes] count:self.count];
+    return copy;
+}
+
+- (void) addObjectID:(BSONObjectID *) objectID {
+    NSParameterAssert(objectID != nil);
+    BSONObjectIDTableAdd(&_table, [objectID objectIDPointer], NULL, 1);
+}
+
+- (void) addObjectIDBytes:(const void *) bytes count:(NSUInteger) count {
+    NSParameterAssert(bytes != NULL || !count);
+    BSONObjectIDTableAdd(&_table, bytes, NULL, count);
+}
+
+- (void) removeObjectID:(BSONObjectID *) objectID {
+    NSParameterAssert(objectID != nil);
+    BSONObjectIDTableRemove(&_table, [objectID objectIDPointer]);
+}
+
+- (void) removeAllObjectIDs {
+    BSONObjectIDTableRemoveAll(&_table);
+}
+
+- (BOOL) containsObjectID:(BSONObjectID *) objectID {
+    NSParameterAssert(objectID != nil);
+    return BSONObjectIDTableContainsKey(&_table, [objectID objectIDPointer]);
+}
+
+- (BOOL) containsObjectIDBytes:(const void *) bytes {
+    NSParameterAssert(bytes != NULL);
+    return BSONObjectIDTableContainsKey(&_table, bytes);
+}
+
+- (NSUInteger) containsObjectIDBytes:(const void *) bytes count:(NSUInteger) count results:(BOOL *) results {
+    NSParameterAssert((bytes != NULL && results != NULL) || !count);
+    return BSONObjectIDTableContainsKeys(&_table, bytes, count, results);
+}
+
+- (NSUInteger) count {
+    return _table.count;
+}
+
+- (NSArray *) allObjectIDs {
+    return BSONObjectIDsInTable(&_table);
+}
+
+- (const void *) objectIDBytes {
+    return BSONObjectIDTableSortedKeys(&_table);
+}
+
+- (BOOL) isEqual:(id) object {
+    if (self == object) return YES;
+    if (![object isKindOfClass:[BSONObjectIDSet class]]) return NO;
+    NSUInteger count = self.count;
+    return count == [object count] && (!count || 0 == memcmp([self objectIDBytes], [object objectIDBytes], count * BSONObjectIDSize));
+}
+
+- (NSUInteger) hash {
+    return self.count;
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"<%@: %p> %lu object IDs",
+            [[self class] description], self, (unsigned long) self.count];
+}
+
+@end
+
+#pragma mark - BSONObjectIDMap
+
+@implementation BSONObjectIDMap {
+    BSONObjectIDTable _table;
+}
+
++ (BSONObjectIDMap *) map {
+    BSONObjectIDMap *result = [[self alloc] init];
+    maybe_autorelease_and_return(result);
+}
+
+- (id) init {
+    return [self initWithCapacity:0];
+}
+
+- (id) initWithCapacity:(NSUInteger) capacity {
+    if (self = [super init]) {
+        BSONObjectIDTableInit(&_table, YES, capacity);
+    }
+    return self;
+}
+
+- (void) dealloc {
+    BSONObjectIDTableDestroy(&_table);
+    super_dealloc;
+}
+
+- (void) setObject:(id) object forObjectID:(BSONObjectID *) objectID {
+    NSParameterAssert(objectID != nil);
+    [self setObject:object forObjectIDBytes:[objectID objectIDPointer]];
+}
+
+- (void) setObject:(id) object forObjectIDBytes:(const void *) bytes {
+    NSParameterAssert(object != nil);
+    NSParameterAssert(bytes != NULL);
+    CFTypeRef value = (__bridge CFTypeRef) object;
+    BSONObjectIDTableAdd(&_table, bytes, &value, 1);
+}
+
+- (void) removeObjectForObjectID:(BSONObjectID *) objectID {
+    NSParameterAssert(objectID != nil);
+    BSONObjectIDTableRemove(&_table, [objectID objectIDPointer]);
+}
+
+- (void) removeAllObjects {
+    BSONObjectIDTableRemoveAll(&_table);
+}
+
+- (id) objectForObjectID:(BSONObjectID *) objectID {
+    NSParameterAssert(objectID != nil);
+    return [self objectForObjectIDBytes:[objectID objectIDPointer]];
+}
+
+- (id) objectForObjectIDBytes:(const void *) bytes {
+    NSParameterAssert(bytes != NULL);
+    CFTypeRef value = BSONObjectIDTableValueForKey(&_table, bytes);
+    if (!value) return nil;
+    maybe_retain_autorelease_and_return((__bridge id) value);
+}
+
+- (NSUInteger) count {
+    return _table.count;
+}
+
+- (NSArray *) allObjectIDs {
+    return BSONObjectIDsInTable(&_table);
+}
+
+- (NSString *) description {
+    return [NSString stringWithFormat:@"<%@: %p> %lu object IDs",
+            [[self class] description], self, (unsigned long) self.count];
+}
+
+@end
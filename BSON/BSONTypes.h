@@ -62,11 +62,29 @@ NSString * NSStringFromBSONType (BSONType t);
 
 /**
  Creates a new, unique object ID.
+ 
+ Object IDs are generated without locks: each thread takes a block of increments from a counter
+ shared by the process, so the object IDs created on a thread increase, and those created on
+ different threads never collide. While a block is set with <code>+generateFuzzUsingBlock:</code>
+ or <code>+generateIncrementUsingBlock:</code>, the driver's <code>bson_oid_gen()</code> is used
+ instead.
  */
 + (BSONObjectID *) objectID;
 
+/**
+ Returns an array of <i>count</i> new object IDs, whose increments are consecutive.
+ */
++ (NSArray *) objectIDsWithCount:(NSUInteger) count;
+
+/**
+ Writes <i>count</i> new object IDs to <i>buffer</i>, 12 bytes each, in the same order as
+ <code>+objectIDsWithCount:</code>, without creating objects for them.
+ */
++ (void) generateObjectIDBytes:(void *) buffer count:(NSUInteger) count;
+
 /*
- Creates an object ID from a hexadecimal string.
+ Creates an object ID from a hexadecimal string, or returns nil if the string isn't 24
+ hexadecimal digits.
  @param A 24-character hexadecimal string for the object ID
  @seealso http://www.mongodb.org/display/DOCS/Object+IDs
  */
@@ -21,6 +21,8 @@
 #import "BSON_Helper.h"
 #import "bson.h"
 #import "BSON_PrivateInterfaces.h"
+#import "BSON_ObjectID.h"
+#import <pthread.h>
 
 #define bson_type_case(type) case type: name = NSStringize(type); break
 
@@ -59,6 +61,89 @@ int block_based_fuzz_func(void) { return fuzzGenerator(); }
 int block_based_inc_func(void);
 int block_based_inc_func(void) { return incrementGenerator(); }
 
+#pragma mark - Generating object IDs
+
+// Object IDs have the same layout as bson_oid_gen() gives them: the time in seconds, four bytes
+// which identify the process, and an increment, each big-endian. Unlike bson_oid_gen(), which
+// increments an unsynchronized global, each thread takes a block of increments from a shared
+// counter with one atomic add, and hands them out without further synchronization. So each
+// thread's object IDs increase, and all of them are unique, but two threads' IDs may interleave.
+//
+// The generator isn't used while a fuzz or increment block is set, so that those keep working.
+
+#define BSONObjectIDIncrementBlockSize 256
+
+typedef struct {
+    uint32_t next;
+    uint32_t remaining;
+} BSONObjectIDThreadState;
+
+static BOOL customObjectIDGenerators;
+static pthread_key_t objectIDThreadStateKey;
+static uint32_t objectIDIncrement;
+static uint32_t objectIDFuzz;
+
+static void BSONObjectIDGeneratorInit(void) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        pthread_key_create(&objectIDThreadStateKey, free);
+        objectIDFuzz = arc4random();
+        // Small enough that billions of object IDs can be created before the increment wraps
+        objectIDIncrement = arc4random() & 0xffffff;
+    });
+}
+
+/**
+ Reserves <i>count</i> consecutive increments and returns the first.
+ */
+static inline uint32_t BSONObjectIDReserveIncrements(uint32_t count) {
+    BSONObjectIDThreadState *state = pthread_getspecific(objectIDThreadStateKey);
+    if (!state) {
+        state = calloc(1, sizeof(BSONObjectIDThreadState));
+        pthread_setspecific(objectIDThreadStateKey, state);
+    }
+    if (count > BSONObjectIDIncrementBlockSize) {
+        // The rest of the thread's block is behind these now, so it's dropped
+        state->remaining = 0;
+        return __sync_fetch_and_add(&objectIDIncrement, count);
+    }
+    if (state->remaining < count) {
+        state->next = __sync_fetch_and_add(&objectIDIncrement, BSONObjectIDIncrementBlockSize);
+        state->remaining = BSONObjectIDIncrementBlockSize;
+    }
+    uint32_t result = state->next;
+    state->next += count;
+    state->remaining -= count;
+    return result;
+}
+
+/**
+ Writes <i>count</i> object IDs of 12 bytes each to <i>buffer</i>, which needn't be aligned.
+ */
+static void BSONObjectIDGenerate(void *buffer, NSUInteger count) {
+    char *bytes = buffer;
+    if (customObjectIDGenerators) {
+        for (NSUInteger i = 0; i < count; ++i, bytes += 12) {
+            bson_oid_t oid;
+            bson_oid_gen(&oid);
+            memcpy(bytes, oid.bytes, 12);
+        }
+        return;
+    }
+    BSONObjectIDGeneratorInit();
+    int32_t seconds = (int32_t) time(NULL);
+    while (count) {
+        uint32_t chunk = (uint32_t) MIN(count, (NSUInteger) UINT32_MAX);
+        uint32_t increment = BSONObjectIDReserveIncrements(chunk);
+        for (uint32_t i = 0; i < chunk; ++i, ++increment, bytes += 12) {
+            bson_big_endian32(bytes, &seconds);
+            memcpy(bytes + 4, &objectIDFuzz, 4);
+            bson_big_endian32(bytes + 8, &increment);
+        }
+        count -= chunk;
+    }
+}
+
 @interface BSONObjectID ()
 @property (retain) NSString *privateStringValue;
 @end
@@ -72,39 +157,55 @@ int block_based_inc_func(void) { return incrementGenerator(); }
 + (void) generateFuzzUsingBlock:(int (^)(void)) block {
     maybe_release(fuzzGenerator);
     if (block == nil) {
+        fuzzGenerator = nil;
         bson_set_oid_fuzz(NULL);
     } else {
         fuzzGenerator = [block copy];
         bson_set_oid_fuzz(block_based_fuzz_func);
     }
+    customObjectIDGenerators = fuzzGenerator || incrementGenerator;
 }
 
 + (void) generateIncrementUsingBlock:(int (^)(void)) block {
     maybe_release(incrementGenerator);
     if (block == nil) {
+        incrementGenerator = nil;
         bson_set_oid_inc(NULL);
     } else {
         incrementGenerator = [block copy];
         bson_set_oid_inc(block_based_inc_func);
     }
+    customObjectIDGenerators = fuzzGenerator || incrementGenerator;
 }
 
 #pragma mark - Initialization
 
 - (id) init {
     if (self = [super init]) {
-        bson_oid_gen(&_oid);
+        BSONObjectIDGenerate(_oid.bytes, 1);
     }
     return self;
 }
 
+static BOOL BSONObjectIDFromString(NSString *s, bson_oid_t *oid) {
+    if (s.length != 24) return NO;
+    char hex[24];
+    NSUInteger length = 0;
+    [s getBytes:hex maxLength:sizeof(hex) usedLength:&length encoding:NSASCIIStringEncoding
+        options:0 range:NSMakeRange(0, 24) remainingRange:NULL];
+    return 24 == length && BSONObjectIDFromHex(hex, oid->bytes);
+}
+
 - (id) initWithString:(NSString *) s {
     if (s.length != 24) {
         maybe_release(self);
         [NSException raise:NSInvalidArgumentException format:@"String should be 24 characters long"];
     }
     if (self = [super init]) {
-        bson_oid_from_string(&_oid, s.bsonString);
+        if (!BSONObjectIDFromString(s, &_oid)) {
+            maybe_release(self);
+            [NSException raise:NSInvalidArgumentException format:@"String should be 24 hexadecimal digits"];
+        }
     }
     return self;
 }
@@ -128,9 +229,28 @@ int block_based_inc_func(void) { return incrementGenerator(); }
     maybe_autorelease_and_return([[self alloc] init]);
 }
 
++ (NSArray *) objectIDsWithCount:(NSUInteger) count {
+    bson_oid_t *oids = malloc((count ? count : 1) * sizeof(bson_oid_t));
+    BSONObjectIDGenerate(oids, count);
+    CFTypeRef *objectIDs = malloc((count ? count : 1) * sizeof(CFTypeRef));
+    for (NSUInteger i = 0; i < count; ++i)
+        objectIDs[i] = (__bridge_retained CFTypeRef) [[self alloc] initWithNativeOID:&oids[i]];
+    NSArray *result = (__bridge_transfer NSArray *) CFArrayCreate(NULL, objectIDs, count, &kCFTypeArrayCallBacks);
+    for (NSUInteger i = 0; i < count; ++i) CFRelease(objectIDs[i]);
+    free(objectIDs);
+    free(oids);
+    maybe_autorelease_and_return(result);
+}
+
++ (void) generateObjectIDBytes:(void *) buffer count:(NSUInteger) count {
+    NSParameterAssert(buffer != NULL || !count);
+    BSONObjectIDGenerate(buffer, count);
+}
+
 + (BSONObjectID *) objectIDWithString:(NSString *) s {
-    if (s.length != 24) return nil;
-    maybe_autorelease_and_return([[self alloc] initWithString:s]);
+    bson_oid_t oid;
+    if (!BSONObjectIDFromString(s, &oid)) return nil;
+    maybe_autorelease_and_return([[self alloc] initWithNativeOID:&oid]);
 }
 
 + (BSONObjectID *) objectIDWithData:(NSData *) data {
@@ -158,7 +278,7 @@ int block_based_inc_func(void) { return incrementGenerator(); }
 }
 
 - (NSUInteger) hash {
-	return _oid.ints[0] + _oid.ints[1] + _oid.ints[2];
+	return BSONObjectIDHashBytes(_oid.bytes);
 }
 
 - (NSString *) description {
@@ -167,27 +287,25 @@ int block_based_inc_func(void) { return incrementGenerator(); }
 
 - (NSString *) stringValue {
     if (self.privateStringValue) return self.privateStringValue;
-    // str must be at least 24 hex chars + null byte
-    char buffer[25];
-    bson_oid_to_string(&_oid, buffer);
-    return self.privateStringValue = [NSString stringWithBSONString:buffer];
+    char buffer[24];
+    BSONObjectIDToHex(_oid.bytes, buffer);
+    NSString *result = [[NSString alloc] initWithBytes:buffer length:sizeof(buffer) encoding:NSASCIIStringEncoding];
+    self.privateStringValue = result;
+    maybe_release(result);
+    return self.privateStringValue;
 }
 
+// Byte by byte, which orders object IDs by time first
 - (NSComparisonResult)compare:(BSONObjectID *) other {
     if (!other) [NSException raise:NSInvalidArgumentException format:@"Nil argument"];
-    for (int i = 0; i < 3; i++) {
-        int diff = _oid.ints[i] - other->_oid.ints[i];
-        if (diff < 0)
-            return NSOrderedAscending;
-        else if (diff > 0)
-            return NSOrderedDescending;
-    }
-    return NSOrderedSame;
+    int order = memcmp(_oid.bytes, other->_oid.bytes, 12);
+    return order < 0 ? NSOrderedAscending : order > 0 ? NSOrderedDescending : NSOrderedSame;
 }
 
 - (BOOL)isEqual:(id)other {
+    if (self == other) return YES;
     if (![other isKindOfClass:[BSONObjectID class]]) return NO;
-    return [self compare:other] == NSOrderedSame;
+    return 0 == memcmp(_oid.bytes, ((BSONObjectID *) other)->_oid.bytes, 12);
 }
 
 @end
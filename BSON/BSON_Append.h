@@ -0,0 +1,58 @@
+//
+//  BSON_Append.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+//
+// Appends elements to a driver buffer, writing keys and strings in a single pass. The driver's
+// own append functions scan each key for UTF-8 validity, a leading '$' and embedded '.' on every
+// call, after the caller has already converted it with strlen() and -cStringUsingEncoding:. Here
+// each key and string is copied into the buffer by a vectorized loop which stops at an embedded
+// NUL and notes a '.' as it goes. Keys and strings which come from NSString are always valid
+// UTF-8, so they aren't checked again.
+//
+// These functions return BSON_OK or BSON_ERROR and set the same error flags on the buffer that
+// the driver's functions do, including BSON_FIELD_INIT_DOLLAR and BSON_FIELD_HAS_DOT for key names
+// which MongoDB won't store.
+//
+
+#import <Foundation/Foundation.h>
+#import "bson.h"
+
+/**
+ Copies up to <i>length</i> bytes from <i>source</i> to <i>destination</i>, stopping at the first
+ NUL byte, and returns the number of bytes copied. If <i>destination</i> is <code>NULL</code>,
+ only scans. If <i>hasDot</i> is not <code>NULL</code>, sets it to <code>YES</code> when the
+ bytes before the first NUL include a <code>.</code>, and leaves it alone otherwise.
+
+ Uses AVX2, SSE2 or NEON when the target supports them.
+ */
+size_t BSONScanCopy(char *destination, const char *source, size_t length, BOOL *hasDot);
+
+/**
+ Appends a string, symbol or code element (according to <i>type</i>) with the UTF-8 bytes of
+ <i>value</i>. Like <code>-bsonString</code>, stops at an embedded NUL character.
+ */
+int BSONAppendString(bson *b, int type, const char *key, NSString *value);
+
+int BSONAppendDouble(bson *b, const char *key, double value);
+int BSONAppendInt(bson *b, const char *key, int32_t value);
+int BSONAppendLong(bson *b, const char *key, int64_t value);
+int BSONAppendBool(bson *b, const char *key, BOOL value);
+int BSONAppendNull(bson *b, const char *key);
+int BSONAppendDate(bson *b, const char *key, int64_t millis);
+int BSONAppendBinary(bson *b, const char *key, char subtype, const void *bytes, int length);
@@ -0,0 +1,221 @@
+//
+//  BSON_Append.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSON_Append.h"
+#import <libkern/OSByteOrder.h>
+
+#if defined(__AVX2__)
+#import <immintrin.h>
+#elif defined(__SSE2__)
+#import <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#import <arm_neon.h>
+#endif
+
+#pragma mark - Scanning
+
+static inline size_t BSONScanCopyScalar(char *destination, const char *source, size_t length, BOOL *hasDot) {
+    size_t i = 0;
+    for (; i < length && source[i]; ++i) {
+        if (hasDot && '.' == source[i]) *hasDot = YES;
+        if (destination) destination[i] = source[i];
+    }
+    return i;
+}
+
+// Each vector loop handles whole blocks: on a block with a NUL, the block's bytes before the NUL
+// are finished by the scalar loop.
+
+size_t BSONScanCopy(char *destination, const char *source, size_t length, BOOL *hasDot) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i zeros = _mm256_setzero_si256();
+    const __m256i dots = _mm256_set1_epi8('.');
+    for (; i + 32 <= length; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *) (source + i));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zeros))) break;
+        if (hasDot && _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, dots))) *hasDot = YES;
+        if (destination) _mm256_storeu_si256((__m256i *) (destination + i), block);
+    }
+#elif defined(__SSE2__)
+    const __m128i zeros = _mm_setzero_si128();
+    const __m128i dots = _mm_set1_epi8('.');
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (source + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(block, zeros))) break;
+        if (hasDot && _mm_movemask_epi8(_mm_cmpeq_epi8(block, dots))) *hasDot = YES;
+        if (destination) _mm_storeu_si128((__m128i *) (destination + i), block);
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    const uint8x16_t dots = vdupq_n_u8('.');
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t block = vld1q_u8((const uint8_t *) (source + i));
+        // The minimum byte is zero only if the block has a NUL
+        uint8x8_t minimum = vmin_u8(vget_low_u8(block), vget_high_u8(block));
+        minimum = vpmin_u8(minimum, minimum);
+        minimum = vpmin_u8(minimum, minimum);
+        minimum = vpmin_u8(minimum, minimum);
+        if (!vget_lane_u8(minimum, 0)) break;
+        if (hasDot) {
+            uint8x16_t matches = vceqq_u8(block, dots);
+            uint8x8_t maximum = vmax_u8(vget_low_u8(matches), vget_high_u8(matches));
+            maximum = vpmax_u8(maximum, maximum);
+            maximum = vpmax_u8(maximum, maximum);
+            maximum = vpmax_u8(maximum, maximum);
+            if (vget_lane_u8(maximum, 0)) *hasDot = YES;
+        }
+        if (destination) vst1q_u8((uint8_t *) (destination + i), block);
+    }
+#endif
+
+    return i + BSONScanCopyScalar(destination ? destination + i : NULL, source + i, length - i, hasDot);
+}
+
+#pragma mark - Appending elements
+
+/**
+ Writes the type and key of a new element, making room for the element's <i>dataSize</i> bytes of
+ data, and returns a pointer to where the data goes, or <code>NULL</code> on error.
+ */
+static inline char * BSONAppendElementStart(bson *b, int type, const char *key, size_t dataSize) {
+    if (b->finished) {
+        b->err |= BSON_ALREADY_FINISHED;
+        return NULL;
+    }
+    size_t keyLength = strlen(key);
+    if (1 + keyLength + 1 + dataSize > INT_MAX) {
+        b->err |= BSON_SIZE_OVERFLOW;
+        return NULL;
+    }
+    if (BSON_ERROR == bson_ensure_space(b, (int) (1 + keyLength + 1 + dataSize))) return NULL;
+
+    char *p = b->cur;
+    *p++ = (char) type;
+    BOOL hasDot = NO;
+    BSONScanCopy(p, key, keyLength, &hasDot);
+    p[keyLength] = '\0';
+    if ('$' == key[0]) b->err |= BSON_FIELD_INIT_DOLLAR;
+    if (hasDot) b->err |= BSON_FIELD_HAS_DOT;
+    return p + keyLength + 1;
+}
+
+static inline void BSONWriteInt32(char *p, int32_t value) {
+    OSWriteLittleInt32(p, 0, value);
+}
+
+int BSONAppendString(bson *b, int type, const char *key, NSString *value) {
+    NSUInteger characterCount = [value length];
+    const char *ascii = CFStringGetCStringPtr((__bridge CFStringRef) value, kCFStringEncodingASCII);
+    // Reserving three bytes per character is enough for any string, but for a long one, it's
+    // better to measure first
+    NSUInteger capacity = ascii ? characterCount
+        : characterCount > 4096 ? [value lengthOfBytesUsingEncoding:NSUTF8StringEncoding]
+        : [value maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    if (capacity >= INT_MAX - 5) {
+        b->err |= BSON_SIZE_OVERFLOW;
+        return BSON_ERROR;
+    }
+
+    char *p = BSONAppendElementStart(b, type, key, 4 + capacity + 1);
+    if (!p) return BSON_ERROR;
+
+    size_t length;
+    if (ascii)
+        length = BSONScanCopy(p + 4, ascii, characterCount, NULL);
+    else {
+        NSUInteger usedLength = 0;
+        NSRange remainingRange;
+        if (![value getBytes:p + 4
+                   maxLength:capacity
+                  usedLength:&usedLength
+                    encoding:NSUTF8StringEncoding
+                     options:0
+                       range:NSMakeRange(0, characterCount)
+              remainingRange:&remainingRange]
+            || remainingRange.length) {
+            // Unpaired surrogates can't be converted
+            b->err |= BSON_NOT_UTF8;
+            return BSON_ERROR;
+        }
+        length = BSONScanCopy(NULL, p + 4, usedLength, NULL);
+    }
+    p[4 + length] = '\0';
+    BSONWriteInt32(p, (int32_t) length + 1);
+    b->cur = p + 4 + length + 1;
+    return BSON_OK;
+}
+
+int BSONAppendDouble(bson *b, const char *key, double value) {
+    char *p = BSONAppendElementStart(b, BSON_DOUBLE, key, 8);
+    if (!p) return BSON_ERROR;
+    union { double d; uint64_t i; } bits = { value };
+    OSWriteLittleInt64(p, 0, bits.i);
+    b->cur = p + 8;
+    return BSON_OK;
+}
+
+int BSONAppendInt(bson *b, const char *key, int32_t value) {
+    char *p = BSONAppendElementStart(b, BSON_INT, key, 4);
+    if (!p) return BSON_ERROR;
+    BSONWriteInt32(p, value);
+    b->cur = p + 4;
+    return BSON_OK;
+}
+
+int BSONAppendLong(bson *b, const char *key, int64_t value) {
+    char *p = BSONAppendElementStart(b, BSON_LONG, key, 8);
+    if (!p) return BSON_ERROR;
+    OSWriteLittleInt64(p, 0, value);
+    b->cur = p + 8;
+    return BSON_OK;
+}
+
+int BSONAppendBool(bson *b, const char *key, BOOL value) {
+    char *p = BSONAppendElementStart(b, BSON_BOOL, key, 1);
+    if (!p) return BSON_ERROR;
+    *p = value ? 1 : 0;
+    b->cur = p + 1;
+    return BSON_OK;
+}
+
+int BSONAppendNull(bson *b, const char *key) {
+    char *p = BSONAppendElementStart(b, BSON_NULL, key, 0);
+    if (!p) return BSON_ERROR;
+    b->cur = p;
+    return BSON_OK;
+}
+
+int BSONAppendDate(bson *b, const char *key, int64_t millis) {
+    char *p = BSONAppendElementStart(b, BSON_DATE, key, 8);
+    if (!p) return BSON_ERROR;
+    OSWriteLittleInt64(p, 0, millis);
+    b->cur = p + 8;
+    return BSON_OK;
+}
+
+int BSONAppendBinary(bson *b, const char *key, char subtype, const void *bytes, int length) {
+    char *p = BSONAppendElementStart(b, BSON_BINDATA, key, 4 + 1 + (size_t) length);
+    if (!p) return BSON_ERROR;
+    BSONWriteInt32(p, length);
+    p[4] = subtype;
+    memcpy(p + 5, bytes, length);
+    b->cur = p + 5 + length;
+    return BSON_OK;
+}
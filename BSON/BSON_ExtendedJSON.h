@@ -0,0 +1,71 @@
+//
+//  BSON_ExtendedJSON.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//
+// Writes MongoDB Extended JSON, version 2, straight from a document's bytes, without decoding
+// values into objects.
+//
+// Output goes to a BSONJSONBuffer owned by the caller, which can start out in caller-provided
+// storage, such as an array on the stack, and moves to the heap only when that fills up. There's
+// no shared state, so any number of threads can write at once, each to its own buffer.
+//
+// The document is trusted, like it is by the driver's iterator. Check data from an untrusted
+// source with BSONValidateData() first.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef struct {
+    char *bytes;
+    size_t length;
+    size_t capacity;
+    /** Whether <code>bytes</code> belongs to the caller, and is copied instead of reallocated */
+    BOOL borrowed;
+} BSONJSONBuffer;
+
+/**
+ Initializes <i>buffer</i> to write into <i>storage</i>, which may be <code>NULL</code>.
+ */
+void BSONJSONBufferInit(BSONJSONBuffer *buffer, char *storage, size_t capacity);
+void BSONJSONBufferDestroy(BSONJSONBuffer *buffer);
+
+/**
+ Makes room for <i>length</i> more bytes. Raises <code>NSMallocException</code> if it can't.
+ */
+void BSONJSONBufferGrow(BSONJSONBuffer *buffer, size_t length);
+
+static inline void BSONJSONBufferReserve(BSONJSONBuffer *buffer, size_t length) {
+    if (length > buffer->capacity - buffer->length) BSONJSONBufferGrow(buffer, length);
+}
+
+static inline void BSONJSONBufferAppend(BSONJSONBuffer *buffer, const char *bytes, size_t length) {
+    BSONJSONBufferReserve(buffer, length);
+    memcpy(buffer->bytes + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+/**
+ Appends the document at <i>data</i> as a JSON object, or as an array if <i>isArray</i> is
+ <code>YES</code>. In canonical form, every number is wrapped to keep its BSON type; otherwise
+ the relaxed form writes 32- and 64-bit integers, finite doubles and dates between 1970 and
+ 9999 as plain JSON numbers and ISO-8601 strings.
+
+ Returns <code>NO</code> if the document contains an element type it can't skip, in which case
+ the output is incomplete.
+ */
+BOOL BSONJSONAppendDocument(BSONJSONBuffer *buffer, const char *data, BOOL isArray, BOOL canonical);
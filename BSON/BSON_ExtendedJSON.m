@@ -0,0 +1,486 @@
+//
+//  BSON_ExtendedJSON.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSON_ExtendedJSON.h"
+#import "BSONTypes.h"
+#import <xlocale.h>
+#import <math.h>
+
+#if defined(__SSE2__)
+#import <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#import <arm_neon.h>
+#endif
+
+// Element types the driver doesn't name
+#define BSONJSONTypeMinKey 0xFF
+#define BSONJSONTypeMaxKey 0x7F
+
+// Milliseconds from 1970 to 10000, beyond which relaxed dates are written as numbers
+#define BSONJSONMaximumISODate 253402300800000LL
+
+#pragma mark - Buffer
+
+void BSONJSONBufferInit(BSONJSONBuffer *buffer, char *storage, size_t capacity) {
+    buffer->bytes = storage;
+    buffer->length = 0;
+    buffer->capacity = storage ? capacity : 0;
+    buffer->borrowed = YES;
+}
+
+void BSONJSONBufferDestroy(BSONJSONBuffer *buffer) {
+    if (!buffer->borrowed) free(buffer->bytes);
+    buffer->bytes = NULL;
+    buffer->length = buffer->capacity = 0;
+    buffer->borrowed = YES;
+}
+
+void BSONJSONBufferGrow(BSONJSONBuffer *buffer, size_t length) {
+    size_t capacity = buffer->capacity ? buffer->capacity : 256;
+    while (capacity - buffer->length < length) {
+        if (capacity > SIZE_MAX / 2)
+            [NSException raise:NSMallocException format:@"JSON output too large"];
+        capacity *= 2;
+    }
+    char *bytes;
+    if (buffer->borrowed) {
+        bytes = malloc(capacity);
+        if (bytes && buffer->length) memcpy(bytes, buffer->bytes, buffer->length);
+    } else
+        bytes = realloc(buffer->bytes, capacity);
+    if (!bytes)
+        [NSException raise:NSMallocException format:@"Couldn't allocate %lu bytes for JSON output", (unsigned long) capacity];
+    buffer->bytes = bytes;
+    buffer->capacity = capacity;
+    buffer->borrowed = NO;
+}
+
+#define BSONJSONAppendLiteral(buffer, literal) BSONJSONBufferAppend(buffer, literal, sizeof(literal) - 1)
+
+static inline void BSONJSONAppendCharacter(BSONJSONBuffer *buffer, char character) {
+    BSONJSONBufferReserve(buffer, 1);
+    buffer->bytes[buffer->length++] = character;
+}
+
+#pragma mark - Values
+
+static inline int32_t BSONJSONReadInt32(const char *position) {
+    int32_t result;
+    memcpy(&result, position, sizeof(result));
+    return NSSwapLittleIntToHost(result);
+}
+
+static inline int64_t BSONJSONReadInt64(const char *position) {
+    int64_t result;
+    memcpy(&result, position, sizeof(result));
+    return NSSwapLittleLongLongToHost(result);
+}
+
+/**
+ Returns the length of the prefix of <i>bytes</i> which can be copied into a JSON string as is:
+ everything but control characters, quotes and backslashes.
+ */
+static inline size_t BSONJSONPlainPrefixLength(const uint8_t *bytes, size_t length) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i controlMaximum = _mm_set1_epi8(0x1F);
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *) (bytes + i));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(block, controlMaximum), controlMaximum),
+                                       _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)));
+        if (_mm_movemask_epi8(special)) break;
+    }
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    const uint8x16_t controlLimit = vdupq_n_u8(0x20);
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t block = vld1q_u8(bytes + i);
+        uint8x16_t special = vorrq_u8(vcltq_u8(block, controlLimit),
+                                      vorrq_u8(vceqq_u8(block, quote), vceqq_u8(block, backslash)));
+        uint8x8_t maximum = vmax_u8(vget_low_u8(special), vget_high_u8(special));
+        maximum = vpmax_u8(maximum, maximum);
+        maximum = vpmax_u8(maximum, maximum);
+        maximum = vpmax_u8(maximum, maximum);
+        if (vget_lane_u8(maximum, 0)) break;
+    }
+#endif
+    while (i < length && bytes[i] >= 0x20 && bytes[i] != '"' && bytes[i] != '\\') ++i;
+    return i;
+}
+
+static void BSONJSONAppendString(BSONJSONBuffer *buffer, const char *string, size_t length) {
+    static const char hexDigits[] = "0123456789abcdef";
+    const uint8_t *bytes = (const uint8_t *) string;
+    // Most strings need no escapes, so reserve for the common case up front
+    BSONJSONBufferReserve(buffer, length + 2);
+    buffer->bytes[buffer->length++] = '"';
+    size_t i = 0;
+    while (i < length) {
+        size_t plainLength = BSONJSONPlainPrefixLength(bytes + i, length - i);
+        BSONJSONBufferAppend(buffer, string + i, plainLength);
+        i += plainLength;
+        if (i == length) break;
+
+        uint8_t character = bytes[i++];
+        switch (character) {
+            case '"': BSONJSONAppendLiteral(buffer, "\\\""); break;
+            case '\\': BSONJSONAppendLiteral(buffer, "\\\\"); break;
+            case '\b': BSONJSONAppendLiteral(buffer, "\\b"); break;
+            case '\f': BSONJSONAppendLiteral(buffer, "\\f"); break;
+            case '\n': BSONJSONAppendLiteral(buffer, "\\n"); break;
+            case '\r': BSONJSONAppendLiteral(buffer, "\\r"); break;
+            case '\t': BSONJSONAppendLiteral(buffer, "\\t"); break;
+            default: {
+                char escape[6] = { '\\', 'u', '0', '0', hexDigits[character >> 4], hexDigits[character & 0xF] };
+                BSONJSONBufferAppend(buffer, escape, sizeof(escape));
+            }
+        }
+    }
+    BSONJSONAppendCharacter(buffer, '"');
+}
+
+static inline void BSONJSONAppendCString(BSONJSONBuffer *buffer, const char *string) {
+    BSONJSONAppendString(buffer, string, strlen(string));
+}
+
+static void BSONJSONAppendUnsigned(BSONJSONBuffer *buffer, uint64_t value) {
+    char digits[20];
+    char *end = digits + sizeof(digits);
+    char *start = end;
+    do {
+        *--start = '0' + (char) (value % 10);
+        value /= 10;
+    } while (value);
+    BSONJSONBufferAppend(buffer, start, end - start);
+}
+
+static inline void BSONJSONAppendInteger(BSONJSONBuffer *buffer, int64_t value) {
+    if (value < 0) {
+        BSONJSONAppendCharacter(buffer, '-');
+        // Negating as unsigned also handles INT64_MIN
+        BSONJSONAppendUnsigned(buffer, 0 - (uint64_t) value);
+    } else
+        BSONJSONAppendUnsigned(buffer, (uint64_t) value);
+}
+
+/**
+ Appends the shortest decimal which reads back as <i>value</i>, always with a decimal point or
+ exponent so that it reads back as a double. Formats in the C locale, whatever the process's is.
+ */
+static void BSONJSONAppendFiniteDouble(BSONJSONBuffer *buffer, double value) {
+    // Whole numbers are common, and much cheaper to write
+    if (value == trunc(value) && fabs(value) < 1e15) {
+        if (signbit(value)) BSONJSONAppendCharacter(buffer, '-');
+        BSONJSONAppendUnsigned(buffer, (uint64_t) fabs(value));
+        BSONJSONAppendLiteral(buffer, ".0");
+        return;
+    }
+    char digits[32];
+    int length = 0;
+    for (int precision = 15; precision <= 17; ++precision) {
+        length = snprintf_l(digits, sizeof(digits), NULL, "%.*g", precision, value);
+        if (strtod_l(digits, NULL, NULL) == value) break;
+    }
+    BOOL hasPoint = NO;
+    for (int i = 0; i < length; ++i) {
+        if ('e' == digits[i]) digits[i] = 'E';
+        if ('.' == digits[i] || 'E' == digits[i]) hasPoint = YES;
+    }
+    BSONJSONBufferAppend(buffer, digits, length);
+    if (!hasPoint) BSONJSONAppendLiteral(buffer, ".0");
+}
+
+static void BSONJSONAppendDouble(BSONJSONBuffer *buffer, double value, BOOL canonical) {
+    if (!canonical && isfinite(value)) {
+        BSONJSONAppendFiniteDouble(buffer, value);
+        return;
+    }
+    BSONJSONAppendLiteral(buffer, "{\"$numberDouble\":\"");
+    if (isnan(value)) BSONJSONAppendLiteral(buffer, "NaN");
+    else if (isinf(value)) {
+        if (value < 0) BSONJSONAppendCharacter(buffer, '-');
+        BSONJSONAppendLiteral(buffer, "Infinity");
+    } else
+        BSONJSONAppendFiniteDouble(buffer, value);
+    BSONJSONAppendLiteral(buffer, "\"}");
+}
+
+static inline void BSONJSONAppendTwoDigits(char *destination, int value) {
+    destination[0] = '0' + value / 10;
+    destination[1] = '0' + value % 10;
+}
+
+/**
+ Appends a date from 1970 to 9999 as a quoted ISO-8601 string in UTC, with milliseconds only if
+ there are any.
+ */
+static void BSONJSONAppendISODate(BSONJSONBuffer *buffer, int64_t milliseconds) {
+    int64_t days = milliseconds / 86400000;
+    int millisecondOfDay = (int) (milliseconds % 86400000);
+
+    // Converts days since 1970 to a civil date, in eras of 400 years which start in March
+    int64_t shifted = days + 719468;
+    int64_t era = shifted / 146097;
+    int dayOfEra = (int) (shifted - era * 146097);
+    int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    int shiftedMonth = (5 * dayOfYear + 2) / 153;
+    int day = dayOfYear - (153 * shiftedMonth + 2) / 5 + 1;
+    int month = shiftedMonth < 10 ? shiftedMonth + 3 : shiftedMonth - 9;
+    int year = (int) (era * 400) + yearOfEra + (month <= 2);
+
+    int seconds = millisecondOfDay / 1000;
+    int millisecond = millisecondOfDay % 1000;
+    char string[] = "\"YYYY-MM-DDTHH:MM:SS.mmmZ\"";
+    BSONJSONAppendTwoDigits(string + 1, year / 100);
+    BSONJSONAppendTwoDigits(string + 3, year % 100);
+    BSONJSONAppendTwoDigits(string + 6, month);
+    BSONJSONAppendTwoDigits(string + 9, day);
+    BSONJSONAppendTwoDigits(string + 12, seconds / 3600);
+    BSONJSONAppendTwoDigits(string + 15, seconds / 60 % 60);
+    BSONJSONAppendTwoDigits(string + 18, seconds % 60);
+    if (millisecond) {
+        string[21] = '0' + millisecond / 100;
+        BSONJSONAppendTwoDigits(string + 22, millisecond % 100);
+        BSONJSONBufferAppend(buffer, string, sizeof(string) - 1);
+    } else {
+        string[20] = 'Z';
+        string[21] = '"';
+        BSONJSONBufferAppend(buffer, string, 22);
+    }
+}
+
+static void BSONJSONAppendDate(BSONJSONBuffer *buffer, int64_t milliseconds, BOOL canonical) {
+    BSONJSONAppendLiteral(buffer, "{\"$date\":");
+    if (!canonical && milliseconds >= 0 && milliseconds < BSONJSONMaximumISODate)
+        BSONJSONAppendISODate(buffer, milliseconds);
+    else {
+        BSONJSONAppendLiteral(buffer, "{\"$numberLong\":\"");
+        BSONJSONAppendInteger(buffer, milliseconds);
+        BSONJSONAppendLiteral(buffer, "\"}");
+    }
+    BSONJSONAppendCharacter(buffer, '}');
+}
+
+static void BSONJSONAppendObjectID(BSONJSONBuffer *buffer, const char *bytes) {
+    static const char hexDigits[] = "0123456789abcdef";
+    char string[] = "{\"$oid\":\"000000000000000000000000\"}";
+    char *digits = string + 9;
+    for (int i = 0; i < 12; ++i) {
+        uint8_t byte = (uint8_t) bytes[i];
+        digits[2 * i] = hexDigits[byte >> 4];
+        digits[2 * i + 1] = hexDigits[byte & 0xF];
+    }
+    BSONJSONBufferAppend(buffer, string, sizeof(string) - 1);
+}
+
+static void BSONJSONAppendBase64(BSONJSONBuffer *buffer, const uint8_t *bytes, size_t length) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    BSONJSONBufferReserve(buffer, (length + 2) / 3 * 4);
+    char *output = buffer->bytes + buffer->length;
+    size_t i = 0;
+    for (; i + 3 <= length; i += 3) {
+        uint32_t triple = (uint32_t) bytes[i] << 16 | (uint32_t) bytes[i + 1] << 8 | bytes[i + 2];
+        *output++ = alphabet[triple >> 18];
+        *output++ = alphabet[(triple >> 12) & 0x3F];
+        *output++ = alphabet[(triple >> 6) & 0x3F];
+        *output++ = alphabet[triple & 0x3F];
+    }
+    if (i < length) {
+        uint32_t triple = (uint32_t) bytes[i] << 16;
+        if (i + 1 < length) triple |= (uint32_t) bytes[i + 1] << 8;
+        *output++ = alphabet[triple >> 18];
+        *output++ = alphabet[(triple >> 12) & 0x3F];
+        *output++ = i + 1 < length ? alphabet[(triple >> 6) & 0x3F] : '=';
+        *output++ = '=';
+    }
+    buffer->length = output - buffer->bytes;
+}
+
+static void BSONJSONAppendBinary(BSONJSONBuffer *buffer, const char *position) {
+    static const char hexDigits[] = "0123456789abcdef";
+    int32_t length = BSONJSONReadInt32(position);
+    uint8_t subtype = (uint8_t) position[4];
+    const char *bytes = position + 5;
+    // The old binary subtype repeats the length inside the data
+    if (0x02 == subtype && length >= 4) {
+        bytes += 4;
+        length -= 4;
+    }
+    BSONJSONAppendLiteral(buffer, "{\"$binary\":{\"base64\":\"");
+    BSONJSONAppendBase64(buffer, (const uint8_t *) bytes, length);
+    char suffix[] = "\",\"subType\":\"00\"}}";
+    suffix[13] = hexDigits[subtype >> 4];
+    suffix[14] = hexDigits[subtype & 0xF];
+    BSONJSONBufferAppend(buffer, suffix, sizeof(suffix) - 1);
+}
+
+static void BSONJSONAppendRegularExpression(BSONJSONBuffer *buffer, const char *pattern, const char *options) {
+    BSONJSONAppendLiteral(buffer, "{\"$regularExpression\":{\"pattern\":");
+    BSONJSONAppendCString(buffer, pattern);
+    BSONJSONAppendLiteral(buffer, ",\"options\":");
+    // Options are written in alphabetical order
+    size_t length = strlen(options);
+    char sorted[16];
+    if (length <= sizeof(sorted)) {
+        memcpy(sorted, options, length);
+        for (size_t i = 1; i < length; ++i)
+            for (size_t j = i; j > 0 && sorted[j - 1] > sorted[j]; --j) {
+                char swap = sorted[j];
+                sorted[j] = sorted[j - 1];
+                sorted[j - 1] = swap;
+            }
+        BSONJSONAppendString(buffer, sorted, length);
+    } else
+        BSONJSONAppendString(buffer, options, length);
+    BSONJSONAppendLiteral(buffer, "}}");
+}
+
+#pragma mark - Documents
+
+BOOL BSONJSONAppendDocument(BSONJSONBuffer *buffer, const char *data, BOOL isArray, BOOL canonical) {
+    const char *position = data + 4;
+    BSONJSONAppendCharacter(buffer, isArray ? '[' : '{');
+    BOOL first = YES;
+    while (*position) {
+        uint8_t type = (uint8_t) *position;
+        const char *key = position + 1;
+        size_t keyLength = strlen(key);
+        position = key + keyLength + 1;
+
+        if (!first) BSONJSONAppendCharacter(buffer, ',');
+        first = NO;
+        if (!isArray) {
+            BSONJSONAppendString(buffer, key, keyLength);
+            BSONJSONAppendCharacter(buffer, ':');
+        }
+
+        switch (type) {
+            case BSONTypeDouble: {
+                int64_t bits = BSONJSONReadInt64(position);
+                double value;
+                memcpy(&value, &bits, sizeof(value));
+                BSONJSONAppendDouble(buffer, value, canonical);
+                position += 8;
+                break;
+            }
+            case BSONTypeString:
+            case BSONTypeCode:
+            case BSONTypeSymbol: {
+                int32_t length = BSONJSONReadInt32(position);
+                if (BSONTypeCode == type) BSONJSONAppendLiteral(buffer, "{\"$code\":");
+                else if (BSONTypeSymbol == type) BSONJSONAppendLiteral(buffer, "{\"$symbol\":");
+                BSONJSONAppendString(buffer, position + 4, length - 1);
+                if (BSONTypeString != type) BSONJSONAppendCharacter(buffer, '}');
+                position += 4 + length;
+                break;
+            }
+            case BSONTypeEmbeddedDocument:
+            case BSONTypeArray:
+                if (!BSONJSONAppendDocument(buffer, position, BSONTypeArray == type, canonical)) return NO;
+                position += BSONJSONReadInt32(position);
+                break;
+            case BSONTypeBinaryData:
+                BSONJSONAppendBinary(buffer, position);
+                position += 5 + BSONJSONReadInt32(position);
+                break;
+            case BSONTypeUndefined:
+                BSONJSONAppendLiteral(buffer, "{\"$undefined\":true}");
+                break;
+            case BSONTypeObjectID:
+                BSONJSONAppendObjectID(buffer, position);
+                position += 12;
+                break;
+            case BSONTypeBoolean:
+                if (*position) BSONJSONAppendLiteral(buffer, "true");
+                else BSONJSONAppendLiteral(buffer, "false");
+                position += 1;
+                break;
+            case BSONTypeDate:
+                BSONJSONAppendDate(buffer, BSONJSONReadInt64(position), canonical);
+                position += 8;
+                break;
+            case BSONTypeNull:
+                BSONJSONAppendLiteral(buffer, "null");
+                break;
+            case BSONTypeRegularExpression: {
+                const char *options = position + strlen(position) + 1;
+                BSONJSONAppendRegularExpression(buffer, position, options);
+                position = options + strlen(options) + 1;
+                break;
+            }
+            case BSONTypeDBRef: {
+                int32_t length = BSONJSONReadInt32(position);
+                BSONJSONAppendLiteral(buffer, "{\"$dbPointer\":{\"$ref\":");
+                BSONJSONAppendString(buffer, position + 4, length - 1);
+                BSONJSONAppendLiteral(buffer, ",\"$id\":");
+                position += 4 + length;
+                BSONJSONAppendObjectID(buffer, position);
+                BSONJSONAppendLiteral(buffer, "}}");
+                position += 12;
+                break;
+            }
+            case BSONTypeCodeWithScope: {
+                const char *code = position + 4;
+                int32_t length = BSONJSONReadInt32(code);
+                BSONJSONAppendLiteral(buffer, "{\"$code\":");
+                BSONJSONAppendString(buffer, code + 4, length - 1);
+                BSONJSONAppendLiteral(buffer, ",\"$scope\":");
+                if (!BSONJSONAppendDocument(buffer, code + 4 + length, NO, canonical)) return NO;
+                BSONJSONAppendCharacter(buffer, '}');
+                position += BSONJSONReadInt32(position);
+                break;
+            }
+            case BSONTypeInteger:
+                if (canonical) BSONJSONAppendLiteral(buffer, "{\"$numberInt\":\"");
+                BSONJSONAppendInteger(buffer, BSONJSONReadInt32(position));
+                if (canonical) BSONJSONAppendLiteral(buffer, "\"}");
+                position += 4;
+                break;
+            case BSONTypeTimestamp:
+                // The increment comes first, in the low four bytes
+                BSONJSONAppendLiteral(buffer, "{\"$timestamp\":{\"t\":");
+                BSONJSONAppendUnsigned(buffer, (uint32_t) BSONJSONReadInt32(position + 4));
+                BSONJSONAppendLiteral(buffer, ",\"i\":");
+                BSONJSONAppendUnsigned(buffer, (uint32_t) BSONJSONReadInt32(position));
+                BSONJSONAppendLiteral(buffer, "}}");
+                position += 8;
+                break;
+            case BSONTypeLong:
+                if (canonical) BSONJSONAppendLiteral(buffer, "{\"$numberLong\":\"");
+                BSONJSONAppendInteger(buffer, BSONJSONReadInt64(position));
+                if (canonical) BSONJSONAppendLiteral(buffer, "\"}");
+                position += 8;
+                break;
+            case BSONJSONTypeMinKey:
+                BSONJSONAppendLiteral(buffer, "{\"$minKey\":1}");
+                break;
+            case BSONJSONTypeMaxKey:
+                BSONJSONAppendLiteral(buffer, "{\"$maxKey\":1}");
+                break;
+            default:
+                return NO;
+        }
+    }
+    BSONJSONAppendCharacter(buffer, isArray ? ']' : '}');
+    return YES;
+}
@@ -26,6 +26,7 @@ NSString * NSStringFromBSONError(int err) {
     if (err & BSON_FIELD_HAS_DOT) [errors addObject:@"BSON_FIELD_HAS_DOT"];
     if (err & BSON_FIELD_INIT_DOLLAR) [errors addObject:@"BSON_FIELD_INIT_DOLLAR"];
     if (err & BSON_ALREADY_FINISHED) [errors addObject:@"BSON_ALREADY_FINISHED"];
+    if (err & BSON_SIZE_OVERFLOW) [errors addObject:@"BSON_SIZE_OVERFLOW"];
     
     if (errors.count)
         return [errors componentsJoinedByString:@" | "];
@@ -0,0 +1,60 @@
+//
+//  BSON_KeyIndex.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+//
+// An index from key names to element offsets within one document, so that keyed lookups don't
+// scan the document from the start with bson_find(). A keyed decoder reads most of an object's
+// fields by name, and on a wide document those scans add up to quadratic time.
+//
+// The index is an open-addressed table of element offsets and key hashes, built in one pass over
+// the document. It doesn't copy the keys; lookups compare against the bytes in the document, which
+// must outlive the index. Freed indexes go to a small per-thread free list, so that the indexes of
+// successive nested documents reuse the same tables.
+//
+
+#import <Foundation/Foundation.h>
+#import "bson.h"
+
+typedef struct BSONKeyIndex BSONKeyIndex;
+
+/**
+ Documents with this many elements or fewer aren't indexed, since a scan is as fast.
+ */
+#define BSONKeyIndexMinimumElementCount 8
+
+/**
+ Builds an index of the keys in <i>b</i>, or returns <code>NULL</code> if the document is too
+ small to be worth indexing.
+ */
+BSONKeyIndex * BSONKeyIndexCreate(const bson *b);
+/**
+ Like <code>BSONKeyIndexCreate()</code>, for the document whose bytes start at <i>data</i>, such
+ as an embedded document.
+ */
+BSONKeyIndex * BSONKeyIndexCreateWithData(const char *data);
+
+void BSONKeyIndexFree(BSONKeyIndex *index);
+
+/**
+ Positions <i>iterator</i> at the first element of the indexed document with the NUL-terminated
+ key <i>key</i>, whose hash from <code>BSONHashKeyBytes()</code> is <i>hash</i>, and returns its
+ type. If there is no such element, positions it at the end and returns <code>BSON_EOO</code>,
+ just as <code>bson_find()</code> does.
+ */
+bson_type BSONKeyIndexFind(const BSONKeyIndex *index, bson_iterator *iterator, const char *key, uint32_t hash);
@@ -0,0 +1,158 @@
+//
+//  BSON_KeyIndex.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSON_KeyIndex.h"
+#import "BSON_KeyTable.h"
+#import <pthread.h>
+
+#define BSONKeyIndexFreeListSize 8
+
+typedef struct {
+    /** The offset of the element's type byte from the start of the document, or 0 for an empty slot */
+    uint32_t offset;
+    uint32_t hash;
+} BSONKeyIndexSlot;
+
+struct BSONKeyIndex {
+    const char *data;
+    /** The offset of the document's terminating byte */
+    uint32_t endOffset;
+    /** The number of slots less one; the number of slots is a power of two */
+    uint32_t mask;
+    uint32_t slotCapacity;
+    BSONKeyIndexSlot *slots;
+    BSONKeyIndex *nextFree;
+};
+
+#pragma mark - Free list
+
+static pthread_key_t freeListKey;
+
+static void BSONKeyIndexFreeList(void *head) {
+    BSONKeyIndex *index = head;
+    while (index) {
+        BSONKeyIndex *next = index->nextFree;
+        free(index->slots);
+        free(index);
+        index = next;
+    }
+}
+
+static pthread_key_t BSONKeyIndexFreeListKey(void) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{ pthread_key_create(&freeListKey, BSONKeyIndexFreeList); });
+    return freeListKey;
+}
+
+static BSONKeyIndex * BSONKeyIndexDequeue(void) {
+    pthread_key_t key = BSONKeyIndexFreeListKey();
+    BSONKeyIndex *head = pthread_getspecific(key);
+    if (!head) return calloc(1, sizeof(BSONKeyIndex));
+    pthread_setspecific(key, head->nextFree);
+    head->nextFree = NULL;
+    return head;
+}
+
+void BSONKeyIndexFree(BSONKeyIndex *index) {
+    if (!index) return;
+    pthread_key_t key = BSONKeyIndexFreeListKey();
+    BSONKeyIndex *head = pthread_getspecific(key);
+    NSUInteger length = 0;
+    for (BSONKeyIndex *cur = head; cur; cur = cur->nextFree) ++length;
+    if (length >= BSONKeyIndexFreeListSize) {
+        free(index->slots);
+        free(index);
+        return;
+    }
+    index->data = NULL;
+    index->nextFree = head;
+    pthread_setspecific(key, index);
+}
+
+#pragma mark - Building and searching
+
+BSONKeyIndex * BSONKeyIndexCreate(const bson *b) {
+    return BSONKeyIndexCreateWithData(bson_data(b));
+}
+
+BSONKeyIndex * BSONKeyIndexCreateWithData(const char *data) {
+    bson_iterator it;
+    bson_iterator_from_buffer(&it, data);
+    uint32_t count = 0;
+    while (bson_iterator_next(&it)) ++count;
+    if (count <= BSONKeyIndexMinimumElementCount) return NULL;
+    
+    BSONKeyIndex *index = BSONKeyIndexDequeue();
+    if (!index) return NULL;
+    // At most half full
+    uint32_t slotCount = 16;
+    while (slotCount < 2 * count) slotCount *= 2;
+    if (slotCount > index->slotCapacity) {
+        free(index->slots);
+        index->slots = malloc(slotCount * sizeof(BSONKeyIndexSlot));
+        if (!index->slots) {
+            free(index);
+            return NULL;
+        }
+        index->slotCapacity = slotCount;
+    }
+    memset(index->slots, 0, slotCount * sizeof(BSONKeyIndexSlot));
+    index->mask = slotCount - 1;
+    index->data = data;
+    int32_t size;
+    bson_little_endian32(&size, data);
+    index->endOffset = (uint32_t) size - 1;
+    
+    bson_iterator_from_buffer(&it, data);
+    while (bson_iterator_next(&it)) {
+        size_t length;
+        uint32_t hash = BSONHashKeyBytes(bson_iterator_key(&it), &length);
+        uint32_t offset = (uint32_t) (it.cur - index->data);
+        uint32_t i = hash & index->mask;
+        BOOL duplicate = NO;
+        while (index->slots[i].offset) {
+            // Like bson_find(), keep the first of any duplicate keys
+            if (index->slots[i].hash == hash
+                && 0 == strcmp(index->data + index->slots[i].offset + 1, bson_iterator_key(&it))) {
+                duplicate = YES;
+                break;
+            }
+            i = (i + 1) & index->mask;
+        }
+        if (duplicate) continue;
+        index->slots[i].offset = offset;
+        index->slots[i].hash = hash;
+    }
+    return index;
+}
+
+bson_type BSONKeyIndexFind(const BSONKeyIndex *index, bson_iterator *iterator, const char *key, uint32_t hash) {
+    uint32_t offset = index->endOffset;
+    uint32_t i = hash & index->mask;
+    for (; index->slots[i].offset; i = (i + 1) & index->mask) {
+        if (index->slots[i].hash == hash
+            && 0 == strcmp(index->data + index->slots[i].offset + 1, key)) {
+            offset = index->slots[i].offset;
+            break;
+        }
+    }
+    iterator->cur = index->data + offset;
+    iterator->first = 0;
+    return bson_iterator_type(iterator);
+}
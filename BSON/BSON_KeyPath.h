@@ -0,0 +1,79 @@
+//
+//  BSON_KeyPath.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+//
+// The key path stack of an encoder or decoder, which is also the array it passes to its delegate.
+// Pushing and popping keys doesn't allocate, and neither does passing the stack to the delegate
+// with the key of the current value appended as a pending key.
+//
+// Delegates may keep the arrays they're passed. The stack notes when anything retains it, which
+// the coder that allocated it never does. Before changing an escaped stack, the coder leaves it
+// alone and carries on with a copy, so the stack keeps the key path it had when it escaped. Copying
+// the stack returns an immutable array. This file overrides -retain, so it's built without ARC.
+//
+// Any retain counts, even one that's balanced before the delegate returns. A delegate built with
+// ARC and without optimization retains its arguments on entry, so with such a delegate, as in a
+// Debug build, the stack escapes on every call and the coder copies it for every value. The key
+// paths are still right, but only an optimized or non-ARC delegate gets them without allocating.
+//
+
+#import <Foundation/Foundation.h>
+
+@interface BSONKeyPathStack : NSArray
+
+/**
+ The number of pushed keys, not including a pending key.
+ */
+- (NSUInteger) depth;
+
+- (void) pushKey:(NSString *) key;
+- (void) popKey;
+- (void) removeAllKeys;
+
+/**
+ Sets the key which follows the pushed keys, or with <code>nil</code>, removes it.
+ */
+- (void) setPendingKey:(NSString *) key;
+
+/**
+ Returns a new array of the pushed keys, not including a pending key.
+ */
+- (NSArray *) pushedKeys;
+
+/**
+ Returns <code>YES</code> once anything has retained the stack, after which the owning coder
+ mustn't change it.
+ */
+- (BOOL) hasEscaped;
+
+/**
+ Returns a new stack with the same pushed keys and no pending key.
+ */
+- (BSONKeyPathStack *) copyForWriting;
+
+@end
+
+/**
+ The key path a coder passes to its delegate for the value with <i>key</i>, or <code>nil</code> at
+ the top level. Expects the coder to keep its stack in a <code>_keyPath</code> instance variable and
+ implement <code>-_prepareKeyPathForDelegateAddingKeyOrNil:</code>. It reads the instance variable
+ directly, as a method which returned the stack might retain and autorelease it, after which the
+ stack would appear to have escaped.
+ */
+#define BSONDelegateKeyPath(key) ([self _prepareKeyPathForDelegateAddingKeyOrNil:(key)] ? _keyPath : nil)
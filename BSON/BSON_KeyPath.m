@@ -0,0 +1,168 @@
+//
+//  BSON_KeyPath.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSON_KeyPath.h"
+#import "BSON_Helper.h"
+
+#if __has_feature(objc_arc)
+#error BSON_KeyPath.m overrides -retain, so it must be compiled with -fno-objc-arc
+#endif
+
+#define BSONKeyPathStackInitialCapacity 8
+
+@implementation BSONKeyPathStack {
+    /**
+     The pushed keys, followed by the pending key if there is one. Each is retained.
+     */
+    CFTypeRef *_keys;
+    NSUInteger _depth;
+    NSUInteger _capacity;
+    BOOL _hasPendingKey;
+    BOOL _escaped;
+    unsigned long _mutations;
+}
+
+- (id) init {
+    if (self = [super init]) {
+        _capacity = BSONKeyPathStackInitialCapacity;
+        _keys = malloc(_capacity * sizeof(CFTypeRef));
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [self removeAllKeys];
+    free(_keys);
+    super_dealloc;
+}
+
+/**
+ The coder owns the stack from its allocation and never retains it, so any retain comes from
+ something else keeping it, such as a delegate, a collection, or an autorelease.
+ */
+- (id) retain {
+    _escaped = YES;
+    return [super retain];
+}
+
+#pragma mark - NSArray primitives
+
+- (NSUInteger) count {
+    return _depth + (_hasPendingKey ? 1 : 0);
+}
+
+- (id) objectAtIndex:(NSUInteger) index {
+    if (index >= [self count])
+        [NSException raise:NSRangeException
+                    format:@"Index %lu beyond bounds of key path of length %lu",
+         (unsigned long) index, (unsigned long) [self count]];
+    return (__bridge id) _keys[index];
+}
+
+- (void) getObjects:(id __unsafe_unretained []) objects range:(NSRange) range {
+    if (NSMaxRange(range) > [self count])
+        [NSException raise:NSRangeException
+                    format:@"Range %@ beyond bounds of key path of length %lu",
+         NSStringFromRange(range), (unsigned long) [self count]];
+    for (NSUInteger i = 0; i < range.length; ++i)
+        objects[i] = (__bridge id) _keys[range.location + i];
+}
+
+- (NSUInteger) countByEnumeratingWithState:(NSFastEnumerationState *) state
+                                   objects:(id __unsafe_unretained []) buffer
+                                     count:(NSUInteger) length {
+    if (state->state) return 0;
+    state->state = 1;
+    state->itemsPtr = (__unsafe_unretained id *) (void *) _keys;
+    state->mutationsPtr = &_mutations;
+    return [self count];
+}
+
+- (id) copyWithZone:(NSZone *) zone {
+    return (__bridge_transfer NSArray *) CFArrayCreate(NULL, _keys, [self count], &kCFTypeArrayCallBacks);
+}
+
+#pragma mark - Stack
+
+- (NSUInteger) depth { return _depth; }
+
+- (void) _reserveCapacity:(NSUInteger) capacity {
+    if (capacity <= _capacity) return;
+    while (_capacity < capacity) _capacity *= 2;
+    _keys = reallocf(_keys, _capacity * sizeof(CFTypeRef));
+    if (!_keys)
+        [NSException raise:NSMallocException format:@"Can't grow key path to %lu keys", (unsigned long) _capacity];
+}
+
+- (void) pushKey:(NSString *) key {
+    NSParameterAssert(key);
+    [self setPendingKey:nil];
+    [self _reserveCapacity:_depth + 1];
+    _keys[_depth++] = CFRetain((__bridge CFTypeRef) key);
+    ++_mutations;
+}
+
+- (void) popKey {
+    NSParameterAssert(_depth);
+    [self setPendingKey:nil];
+    CFRelease(_keys[--_depth]);
+    ++_mutations;
+}
+
+- (void) removeAllKeys {
+    [self setPendingKey:nil];
+    if (!_depth) return;
+    while (_depth) CFRelease(_keys[--_depth]);
+    ++_mutations;
+}
+
+- (void) setPendingKey:(NSString *) key {
+    if (_hasPendingKey) {
+        if (_keys[_depth] == (__bridge CFTypeRef) key) return;
+        CFRelease(_keys[_depth]);
+        _hasPendingKey = NO;
+        ++_mutations;
+    }
+    if (key) {
+        [self _reserveCapacity:_depth + 1];
+        _keys[_depth] = CFRetain((__bridge CFTypeRef) key);
+        _hasPendingKey = YES;
+        ++_mutations;
+    }
+}
+
+- (NSArray *) pushedKeys {
+    NSArray *result = (__bridge_transfer NSArray *) CFArrayCreate(NULL, _keys, _depth, &kCFTypeArrayCallBacks);
+    maybe_autorelease_and_return(result);
+}
+
+- (BOOL) hasEscaped {
+    return _escaped;
+}
+
+- (BSONKeyPathStack *) copyForWriting {
+    BSONKeyPathStack *result = [[BSONKeyPathStack alloc] init];
+    [result _reserveCapacity:_depth + 1];
+    for (NSUInteger i = 0; i < _depth; ++i)
+        result->_keys[i] = CFRetain(_keys[i]);
+    result->_depth = _depth;
+    return result;
+}
+
+@end
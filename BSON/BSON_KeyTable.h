@@ -0,0 +1,123 @@
+//
+//  BSON_KeyTable.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+//
+// A process-wide table of interned key names, shared by the encoder and the decoder. Documents
+// tend to reuse a small set of key names many times, so each key's UTF-8 representation and its
+// validity as a MongoDB key name are computed once, and decoded keys share one immutable string.
+//
+// Lookups don't take a lock. Entries are never removed, so the pointers returned remain valid for
+// the life of the process. Once the table is full, or for very long keys, the functions return
+// NULL and callers convert the key themselves.
+//
+
+#import <Foundation/Foundation.h>
+#import "NSString+BSONAdditions.h"
+
+typedef struct {
+    /** The key, an immutable string owned by the table */
+    CFStringRef string;
+    /** The NUL-terminated UTF-8 representation of the key */
+    const char *bsonString;
+    /** The length of <code>bsonString</code> in bytes, not including the terminator */
+    size_t length;
+    /** <code>NO</code> if the key begins with <code>$</code> or contains <code>.</code> */
+    BOOL validForMongoDB;
+    NSUInteger stringHash;
+    uint32_t bytesHash;
+} BSONInternedKey;
+
+/**
+ Returns the hash of a NUL-terminated UTF-8 key, as in <code>bytesHash</code>, and sets
+ <i>length</i> to its length. The hash is FNV-1a, which measures the key as it goes so that it's
+ only read once.
+ */
+static inline uint32_t BSONHashKeyBytes(const char *bsonString, size_t *length) {
+    uint32_t hash = 2166136261u;
+    const unsigned char *p = (const unsigned char *) bsonString;
+    for (; *p; ++p) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    *length = p - (const unsigned char *) bsonString;
+    return hash;
+}
+
+/**
+ Returns the interned entry for <i>key</i>, adding it to the table if necessary.
+ @return The entry, or <code>NULL</code> if the key can't be interned
+ */
+const BSONInternedKey * BSONInternKey(NSString *key);
+
+/**
+ Like <code>BSONInternKey()</code>, but when the key can't be interned, sets <i>bsonString</i>
+ to its UTF-8 representation, so that the caller doesn't need to convert it again.
+ */
+const BSONInternedKey * BSONInternKeyConvertingKey(NSString *key, const char **bsonString);
+
+/**
+ Returns the interned entry for <i>key</i> if it's already in the table, without adding it. Use
+ this to look keys up, so that arbitrary lookups don't fill the table.
+ @return The entry, or <code>NULL</code> if the key isn't in the table
+ */
+const BSONInternedKey * BSONFindInternedKey(NSString *key);
+
+/**
+ Returns the shared string for a UTF-8 key read from a BSON document, adding it to the table
+ if necessary. If the key can't be interned, returns a new autoreleased string.
+ */
+NSString * BSONInternedKeyForBSONString(const char *bsonString);
+
+/**
+ The number of array indexes with precomputed keys.
+ */
+#define BSONArrayIndexKeyCount 1000
+
+/**
+ Returns the precomputed key for an array index, or <code>NULL</code> if <i>index</i> is
+ <code>BSONArrayIndexKeyCount</code> or more. These keys are always valid for MongoDB. Decimal
+ keys are otherwise left out of the table, so that long arrays don't fill it.
+ */
+const BSONInternedKey * BSONArrayIndexKey(NSUInteger index);
+
+/**
+ Advances a decimal key in place, e.g. from <code>"999"</code> to <code>"1000"</code>, returning
+ the new length. The buffer needs room for one more digit.
+ */
+static inline size_t BSONIncrementIndexKey(char *key, size_t length) {
+    for (size_t i = length; i > 0; --i) {
+        if (key[i - 1] != '9') {
+            ++key[i - 1];
+            return length;
+        }
+        key[i - 1] = '0';
+    }
+    memmove(key + 1, key, length + 1);
+    key[0] = '1';
+    return length + 1;
+}
+
+/**
+ Returns the UTF-8 representation of <i>key</i> for looking it up, using the interned
+ representation when the key is already in the table, without adding it.
+ */
+static inline const char * BSONKeyString(NSString *key) {
+    const BSONInternedKey *interned = BSONFindInternedKey(key);
+    return interned ? interned->bsonString : [key bsonString];
+}
@@ -0,0 +1,195 @@
+//
+//  BSON_KeyTable.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSON_KeyTable.h"
+#import "BSON_Append.h"
+#import <pthread.h>
+
+// The table is a pair of open-addressed hash tables over the same entries, one probed by
+// NSString hash and the other by a hash of the UTF-8 bytes. Slots are only ever filled, never
+// cleared or moved, so readers can probe without a lock: an entry is completely written before
+// a memory barrier and the store which publishes it. Writers serialize on insertMutex and probe
+// again before inserting.
+
+#define BSONKeyTableSlotCount 4096 // power of two
+#define BSONKeyTableMaxEntryCount (BSONKeyTableSlotCount / 2)
+#define BSONKeyTableMaxKeyLength 128
+
+static BSONInternedKey arrayIndexKeys[BSONArrayIndexKeyCount];
+static char arrayIndexKeyBytes[BSONArrayIndexKeyCount][4];
+
+static BSONInternedKey * volatile stringSlots[BSONKeyTableSlotCount];
+static BSONInternedKey * volatile bytesSlots[BSONKeyTableSlotCount];
+static NSUInteger entryCount = 0;
+static pthread_mutex_t insertMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void BSONInitArrayIndexKeys(void) {
+    for (NSUInteger i = 0; i < BSONArrayIndexKeyCount; ++i) {
+        BSONInternedKey *entry = &arrayIndexKeys[i];
+        snprintf(arrayIndexKeyBytes[i], sizeof(arrayIndexKeyBytes[i]), "%lu", (unsigned long) i);
+        entry->bsonString = arrayIndexKeyBytes[i];
+        entry->validForMongoDB = YES;
+        entry->string = CFStringCreateWithCString(NULL, entry->bsonString, kCFStringEncodingUTF8);
+        entry->stringHash = [(__bridge NSString *) entry->string hash];
+        entry->bytesHash = BSONHashKeyBytes(entry->bsonString, &entry->length);
+    }
+}
+
+const BSONInternedKey * BSONArrayIndexKey(NSUInteger index) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{ BSONInitArrayIndexKeys(); });
+    return index < BSONArrayIndexKeyCount ? &arrayIndexKeys[index] : NULL;
+}
+
+static inline BOOL BSONIsDecimalKey(const char *bsonString, size_t length) {
+    if (!length) return NO;
+    for (size_t i = 0; i < length; ++i)
+        if (bsonString[i] < '0' || bsonString[i] > '9') return NO;
+    return YES;
+}
+
+// Returns the precomputed entry if the key is a canonical array index within the table
+static inline const BSONInternedKey * BSONFindArrayIndexKey(const char *bsonString) {
+    if ('0' == bsonString[0]) return bsonString[1] ? NULL : BSONArrayIndexKey(0);
+    NSUInteger value = 0;
+    const char *p = bsonString;
+    for (; *p >= '0' && *p <= '9' && p - bsonString < 4; ++p)
+        value = value * 10 + (*p - '0');
+    if (*p || p == bsonString) return NULL;
+    return BSONArrayIndexKey(value);
+}
+
+static inline BSONInternedKey * BSONFindKey(NSString *key, NSUInteger hash) {
+    NSUInteger i = hash & (BSONKeyTableSlotCount - 1);
+    BSONInternedKey *entry;
+    while ((entry = stringSlots[i])) {
+        if (entry->stringHash == hash
+            && ((__bridge NSString *) entry->string == key || [key isEqualToString:(__bridge NSString *) entry->string]))
+            return entry;
+        i = (i + 1) & (BSONKeyTableSlotCount - 1);
+    }
+    return NULL;
+}
+
+static inline BSONInternedKey * BSONFindBSONString(const char *bsonString, size_t length, uint32_t hash) {
+    NSUInteger i = hash & (BSONKeyTableSlotCount - 1);
+    BSONInternedKey *entry;
+    while ((entry = bytesSlots[i])) {
+        if (entry->bytesHash == hash
+            && entry->length == length
+            && 0 == memcmp(entry->bsonString, bsonString, length))
+            return entry;
+        i = (i + 1) & (BSONKeyTableSlotCount - 1);
+    }
+    return NULL;
+}
+
+// Call with insertMutex held, after checking that the key isn't already present. Takes
+// ownership of string.
+static BSONInternedKey * BSONInsertKey(CFStringRef string, const char *bsonString, size_t length, uint32_t bytesHash) {
+    if (entryCount >= BSONKeyTableMaxEntryCount) {
+        CFRelease(string);
+        return NULL;
+    }
+
+    BSONInternedKey *entry = malloc(sizeof(BSONInternedKey));
+    char *bytes = malloc(length + 1);
+    BOOL hasDot = NO;
+    BSONScanCopy(bytes, bsonString, length, &hasDot);
+    bytes[length] = '\0';
+
+    entry->string = string;
+    entry->bsonString = bytes;
+    entry->length = length;
+    entry->validForMongoDB = !(length && '$' == bytes[0]) && !hasDot;
+    entry->stringHash = [(__bridge NSString *) string hash];
+    entry->bytesHash = bytesHash;
+
+    // Publish only after the entry is completely written
+    __sync_synchronize();
+
+    NSUInteger i = entry->stringHash & (BSONKeyTableSlotCount - 1);
+    while (stringSlots[i]) i = (i + 1) & (BSONKeyTableSlotCount - 1);
+    stringSlots[i] = entry;
+
+    i = bytesHash & (BSONKeyTableSlotCount - 1);
+    while (bytesSlots[i]) i = (i + 1) & (BSONKeyTableSlotCount - 1);
+    bytesSlots[i] = entry;
+
+    ++entryCount;
+    return entry;
+}
+
+const BSONInternedKey * BSONInternKeyConvertingKey(NSString *key, const char **bsonString) {
+    NSUInteger hash = [key hash];
+    BSONInternedKey *entry = BSONFindKey(key, hash);
+    if (entry) return entry;
+
+    const char *converted = NULL;
+    if (bsonString || [key length] <= BSONKeyTableMaxKeyLength) converted = [key bsonString];
+    if (bsonString) *bsonString = converted;
+    if (!converted || [key length] > BSONKeyTableMaxKeyLength) return NULL;
+    size_t length;
+    uint32_t bytesHash = BSONHashKeyBytes(converted, &length);
+    // A key with an embedded NUL converts only up to the NUL, which would file it under the bytes
+    // of a different key
+    if (length != [key lengthOfBytesUsingEncoding:NSUTF8StringEncoding]) return NULL;
+    const BSONInternedKey *indexKey = BSONFindArrayIndexKey(converted);
+    if (indexKey) return indexKey;
+    if (entryCount >= BSONKeyTableMaxEntryCount || BSONIsDecimalKey(converted, length)) return NULL;
+
+    pthread_mutex_lock(&insertMutex);
+    if (!(entry = BSONFindBSONString(converted, length, bytesHash)))
+        entry = BSONInsertKey(CFStringCreateCopy(NULL, (__bridge CFStringRef) key), converted, length, bytesHash);
+    pthread_mutex_unlock(&insertMutex);
+    return entry;
+}
+
+const BSONInternedKey * BSONInternKey(NSString *key) {
+    return BSONInternKeyConvertingKey(key, NULL);
+}
+
+const BSONInternedKey * BSONFindInternedKey(NSString *key) {
+    return BSONFindKey(key, [key hash]);
+}
+
+NSString * BSONInternedKeyForBSONString(const char *bsonString) {
+    const BSONInternedKey *indexKey = BSONFindArrayIndexKey(bsonString);
+    if (indexKey) return (__bridge NSString *) indexKey->string;
+    
+    size_t length;
+    uint32_t bytesHash = BSONHashKeyBytes(bsonString, &length);
+    BSONInternedKey *entry = BSONFindBSONString(bsonString, length, bytesHash);
+    if (entry) return (__bridge NSString *) entry->string;
+
+    if (entryCount < BSONKeyTableMaxEntryCount && length <= BSONKeyTableMaxKeyLength
+        && !BSONIsDecimalKey(bsonString, length)) {
+        CFStringRef string = CFStringCreateWithBytes(NULL, (const UInt8 *) bsonString, length, kCFStringEncodingUTF8, false);
+        if (string) {
+            pthread_mutex_lock(&insertMutex);
+            if (!(entry = BSONFindBSONString(bsonString, length, bytesHash)))
+                entry = BSONInsertKey(string, bsonString, length, bytesHash);
+            else
+                CFRelease(string);
+            pthread_mutex_unlock(&insertMutex);
+            if (entry) return (__bridge NSString *) entry->string;
+        }
+    }
+    return [NSString stringWithBSONString:bsonString];
+}
@@ -0,0 +1,109 @@
+//
+//  BSON_ObjectID.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//
+// Works with object IDs as 12 raw bytes: hashing them, converting them to and from hex, and
+// storing many of them packed into one sorted table.
+//
+// BSONObjectIDTable keeps its keys sorted and packed 12 bytes apart, with an optional parallel
+// array of values. Keys added or removed since the last merge are kept in two small batches, which
+// are merged into the keys when either fills up, or when the sorted keys are asked for.
+//
+
+#import <Foundation/Foundation.h>
+
+#define BSONObjectIDSize 12
+
+static inline NSUInteger BSONObjectIDHashBytes(const void *bytes) {
+    uint64_t low, high = 0;
+    memcpy(&low, bytes, 8);
+    memcpy(&high, (const char *) bytes + 8, 4);
+    // The finalizer of MurmurHash3, so that IDs from the same second which differ only in their
+    // increments spread across the whole range
+    uint64_t x = low ^ (high * 0xc2b2ae3d27d4eb4fULL);
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return (NSUInteger) x;
+}
+
+/**
+ Writes the 24 lowercase hex digits for the object ID at <i>bytes</i> to <i>hex</i>, without a
+ terminator.
+ */
+void BSONObjectIDToHex(const void *bytes, char *hex);
+
+/**
+ Reads 24 hex digits of either case, and returns <code>NO</code> if any isn't one.
+ */
+BOOL BSONObjectIDFromHex(const char *hex, void *bytes);
+
+typedef struct {
+    /** Sorted, including those removed since the last merge */
+    char *keys;
+    /** Retained, or NULL for a removed key, or for a set */
+    CFTypeRef *values;
+    NSUInteger keyCount;
+    NSUInteger keyCapacity;
+    /** Keys added since the last merge, sorted, and their values */
+    char *addedKeys;
+    CFTypeRef *addedValues;
+    NSUInteger addedCount;
+    /** The increasing indexes in keys of the keys removed since the last merge */
+    NSUInteger *removedIndexes;
+    NSUInteger removedCount;
+    /** The most entries either batch holds before they're merged */
+    NSUInteger batchCapacity;
+    NSUInteger count;
+    BOOL hasValues;
+} BSONObjectIDTable;
+
+// The functions which allocate raise NSMallocException if they can't
+
+void BSONObjectIDTableInit(BSONObjectIDTable *table, BOOL hasValues, NSUInteger capacity);
+void BSONObjectIDTableDestroy(BSONObjectIDTable *table);
+void BSONObjectIDTableRemoveAll(BSONObjectIDTable *table);
+
+/**
+ Adds <i>count</i> keys, 12 bytes apart, with <i>values</i> if the table has them. Where a key
+ appears more than once, the last value added is kept.
+ */
+void BSONObjectIDTableAdd(BSONObjectIDTable *table, const void *keys, const CFTypeRef *values, NSUInteger count);
+
+BOOL BSONObjectIDTableContainsKey(const BSONObjectIDTable *table, const void *key);
+
+/**
+ Returns the value for <i>key</i>, or NULL if it's absent.
+ */
+CFTypeRef BSONObjectIDTableValueForKey(const BSONObjectIDTable *table, const void *key);
+
+BOOL BSONObjectIDTableRemove(BSONObjectIDTable *table, const void *key);
+
+/**
+ Sets <code>results[i]</code> to whether the <i>i</i>th of <i>count</i> keys is in the table,
+ and returns how many are. Keys in increasing order are found in one pass.
+ */
+NSUInteger BSONObjectIDTableContainsKeys(const BSONObjectIDTable *table, const void *keys, NSUInteger count, BOOL *results);
+
+/**
+ Returns the keys packed in increasing order, or NULL when there are none. Merges any keys added
+ or removed since the last merge, and so changes the table.
+ */
+const char *BSONObjectIDTableSortedKeys(BSONObjectIDTable *table);
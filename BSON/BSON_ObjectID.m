@@ -0,0 +1,511 @@
+//
+//  BSON_ObjectID.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSON_ObjectID.h"
+#import <math.h>
+
+#if defined(__SSE2__)
+#import <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#import <arm_neon.h>
+#endif
+
+#pragma mark - Hex
+
+// Twelve bytes fit in one vector, which is loaded from a padded copy so as not to read past
+// them. Each byte is split into its two nibbles, which are interleaved and turned into digits.
+// Going the other way, every character is checked and turned into a nibble at once, and each
+// pair of nibbles is combined into a byte.
+
+#if !defined(__SSE2__) && !(defined(__ARM_NEON__) || defined(__ARM_NEON))
+static inline int BSONHexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+#endif
+
+void BSONObjectIDToHex(const void *bytes, char *hex) {
+    uint8_t input[16] = { 0 };
+    memcpy(input, bytes, BSONObjectIDSize);
+#if defined(__SSE2__)
+    __m128i value = _mm_loadu_si128((const __m128i *) input);
+    __m128i mask = _mm_set1_epi8(0x0f);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(value, 4), mask);
+    __m128i low = _mm_and_si128(value, mask);
+    __m128i nibbles[2] = { _mm_unpacklo_epi8(high, low), _mm_unpackhi_epi8(high, low) };
+    char output[32];
+    for (int i = 0; i < 2; ++i) {
+        __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles[i], _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+        __m128i digits = _mm_add_epi8(_mm_add_epi8(nibbles[i], _mm_set1_epi8('0')), letters);
+        _mm_storeu_si128((__m128i *) (output + 16 * i), digits);
+    }
+    memcpy(hex, output, 2 * BSONObjectIDSize);
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint8x16_t value = vld1q_u8(input);
+    uint8x16x2_t nibbles = vzipq_u8(vshrq_n_u8(value, 4), vandq_u8(value, vdupq_n_u8(0x0f)));
+    uint8_t output[32];
+    for (int i = 0; i < 2; ++i) {
+        uint8x16_t letters = vandq_u8(vcgtq_u8(nibbles.val[i], vdupq_n_u8(9)), vdupq_n_u8('a' - '0' - 10));
+        vst1q_u8(output + 16 * i, vaddq_u8(vaddq_u8(nibbles.val[i], vdupq_n_u8('0')), letters));
+    }
+    memcpy(hex, output, 2 * BSONObjectIDSize);
+#else
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < BSONObjectIDSize; ++i) {
+        hex[2 * i] = digits[input[i] >> 4];
+        hex[2 * i + 1] = digits[input[i] & 0x0f];
+    }
+#endif
+}
+
+BOOL BSONObjectIDFromHex(const char *hex, void *bytes) {
+    uint8_t input[32];
+    memcpy(input, hex, 2 * BSONObjectIDSize);
+    memset(input + 2 * BSONObjectIDSize, '0', sizeof(input) - 2 * BSONObjectIDSize);
+#if defined(__SSE2__)
+    __m128i packed[2];
+    for (int i = 0; i < 2; ++i) {
+        __m128i c = _mm_loadu_si128((const __m128i *) (input + 16 * i));
+        // Bytes above 0x7f compare as negative, so they fail both ranges
+        __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                        _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+        __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+        __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                         _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+        if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xffff) return NO;
+        __m128i nibbles = _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+                                       _mm_and_si128(isLetter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+        // Each 16-bit lane holds a high nibble in its low byte and a low nibble in its high byte
+        packed[i] = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00ff)), 4),
+                                 _mm_srli_epi16(nibbles, 8));
+    }
+    uint8_t output[16];
+    _mm_storeu_si128((__m128i *) output, _mm_packus_epi16(packed[0], packed[1]));
+    memcpy(bytes, output, BSONObjectIDSize);
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    uint8_t output[16];
+    for (int i = 0; i < 2; ++i) {
+        uint8x16_t c = vld1q_u8(input + 16 * i);
+        uint8x16_t isDigit = vcleq_u8(vsubq_u8(c, vdupq_n_u8('0')), vdupq_n_u8(9));
+        uint8x16_t lower = vorrq_u8(c, vdupq_n_u8(0x20));
+        uint8x16_t isLetter = vcleq_u8(vsubq_u8(lower, vdupq_n_u8('a')), vdupq_n_u8(5));
+        uint8x16_t valid = vorrq_u8(isDigit, isLetter);
+        uint8x8_t allValid = vand_u8(vget_low_u8(valid), vget_high_u8(valid));
+        if (vget_lane_u64(vreinterpret_u64_u8(allValid), 0) != UINT64_MAX) return NO;
+        uint8x16_t nibbles = vbslq_u8(isDigit, vsubq_u8(c, vdupq_n_u8('0')), vsubq_u8(lower, vdupq_n_u8('a' - 10)));
+        uint8x16x2_t pairs = vuzpq_u8(nibbles, nibbles);
+        vst1_u8(output + 8 * i, vorr_u8(vshl_n_u8(vget_low_u8(pairs.val[0]), 4), vget_low_u8(pairs.val[1])));
+    }
+    memcpy(bytes, output, BSONObjectIDSize);
+#else
+    uint8_t *output = bytes;
+    for (int i = 0; i < BSONObjectIDSize; ++i) {
+        int high = BSONHexValue(input[2 * i]), low = BSONHexValue(input[2 * i + 1]);
+        if (high < 0 || low < 0) return NO;
+        output[i] = (uint8_t) (high << 4 | low);
+    }
+#endif
+    return YES;
+}
+
+#pragma mark - Table
+
+// The merged keys are kept sorted and packed, and found by binary search. Keys added since the
+// last merge go in a small sorted batch of their own, and removed keys stay where they are with
+// their indexes noted in another batch. When either batch fills up, both are merged into the keys
+// in one pass. A batch holds about the square root of the number of keys, so adding or removing a
+// key takes amortized time proportional to that, and finding one takes logarithmic time.
+
+#define BSONObjectIDTableMinimumBatchCapacity 64
+
+static void *BSONObjectIDTableReallocate(void *pointer, NSUInteger count, size_t size) {
+    if (count > SIZE_MAX / size)
+        [NSException raise:NSMallocException format:@"Too many object IDs (%lu)", (unsigned long) count];
+    void *result = realloc(pointer, MAX(count, (NSUInteger) 1) * size);
+    if (!result)
+        [NSException raise:NSMallocException format:@"Couldn't allocate %lu bytes for object IDs", (unsigned long) (count * size)];
+    return result;
+}
+
+static NSUInteger BSONObjectIDTableBatchCapacity(NSUInteger keyCount) {
+    return MAX((NSUInteger) sqrt((double) keyCount), (NSUInteger) BSONObjectIDTableMinimumBatchCapacity);
+}
+
+// Orders keys as memcmp does, with two loads each
+static inline int BSONObjectIDCompare(const void *a, const void *b) {
+    unsigned long long a8, b8;
+    memcpy(&a8, a, 8);
+    memcpy(&b8, b, 8);
+    if (a8 != b8) return NSSwapBigLongLongToHost(a8) < NSSwapBigLongLongToHost(b8) ? -1 : 1;
+    unsigned int a4, b4;
+    memcpy(&a4, (const char *) a + 8, 4);
+    memcpy(&b4, (const char *) b + 8, 4);
+    if (a4 == b4) return 0;
+    return NSSwapBigIntToHost(a4) < NSSwapBigIntToHost(b4) ? -1 : 1;
+}
+
+static inline BOOL BSONObjectIDKeyEqual(const char *keys, NSUInteger index, const void *key) {
+    return !BSONObjectIDCompare(keys + index * BSONObjectIDSize, key);
+}
+
+// Returns the index of the first of count sorted keys which isn't less than key
+static NSUInteger BSONObjectIDLowerBound(const char *keys, NSUInteger count, const void *key) {
+    NSUInteger low = 0, high = count;
+    while (low < high) {
+        NSUInteger middle = low + (high - low) / 2;
+        if (BSONObjectIDCompare(keys + middle * BSONObjectIDSize, key) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+// Returns the index of the first of keys[start, count) which isn't less than key, searching
+// forward from start in growing steps, for keys which are usually found close together
+static NSUInteger BSONObjectIDLowerBoundAfter(const char *keys, NSUInteger start, NSUInteger count, const void *key) {
+    NSUInteger low = start, step = 1;
+    while (step <= count - low && BSONObjectIDCompare(keys + (low + step - 1) * BSONObjectIDSize, key) < 0) {
+        low += step;
+        step *= 2;
+    }
+    NSUInteger high = MIN(low + step - 1, count);
+    return low + BSONObjectIDLowerBound(keys + low * BSONObjectIDSize, high - low, key);
+}
+
+// Returns the index of the first of keys[0, end) which isn't less than key, searching back from
+// the end in growing steps
+static NSUInteger BSONObjectIDLowerBoundBefore(const char *keys, NSUInteger end, const void *key) {
+    NSUInteger high = end, step = 1;
+    while (step <= high && BSONObjectIDCompare(keys + (high - step) * BSONObjectIDSize, key) >= 0) {
+        high -= step;
+        step *= 2;
+    }
+    NSUInteger low = step <= high ? high - step + 1 : 0;
+    return low + BSONObjectIDLowerBound(keys + low * BSONObjectIDSize, high - low, key);
+}
+
+static BOOL BSONObjectIDKeysIncrease(const char *keys, NSUInteger count) {
+    for (NSUInteger i = 1; i < count; ++i)
+        if (BSONObjectIDCompare(keys + (i - 1) * BSONObjectIDSize, keys + i * BSONObjectIDSize) >= 0) return NO;
+    return YES;
+}
+
+static int BSONObjectIDCompareBytes(const void *a, const void *b) {
+    return BSONObjectIDCompare(a, b);
+}
+
+// Returns whether the merged key at index has been removed, and sets *position to where its index
+// is or belongs among the removed indexes
+static BOOL BSONObjectIDTableIsRemoved(const BSONObjectIDTable *table, NSUInteger index, NSUInteger *position) {
+    NSUInteger low = 0, high = table->removedCount;
+    while (low < high) {
+        NSUInteger middle = low + (high - low) / 2;
+        if (table->removedIndexes[middle] < index)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    *position = low;
+    return low < table->removedCount && table->removedIndexes[low] == index;
+}
+
+typedef enum {
+    BSONObjectIDAbsent,
+    BSONObjectIDMerged,
+    BSONObjectIDAdded
+} BSONObjectIDLocation;
+
+// Looks for key among the merged keys from *from on, then among those added since, and sets
+// *index to where it is. Sets *from to where key is or belongs among the merged keys.
+static BSONObjectIDLocation BSONObjectIDTableLocate(const BSONObjectIDTable *table, const void *key, NSUInteger *from, NSUInteger *index) {
+    NSUInteger i = *from ? BSONObjectIDLowerBoundAfter(table->keys, *from, table->keyCount, key)
+                         : BSONObjectIDLowerBound(table->keys, table->keyCount, key);
+    *from = i;
+    if (i < table->keyCount && BSONObjectIDKeyEqual(table->keys, i, key)) {
+        // A removed key which is added again is restored in place, so it can't be in the batch
+        NSUInteger position;
+        if (BSONObjectIDTableIsRemoved(table, i, &position)) return BSONObjectIDAbsent;
+        *index = i;
+        return BSONObjectIDMerged;
+    }
+    NSUInteger j = BSONObjectIDLowerBound(table->addedKeys, table->addedCount, key);
+    if (j < table->addedCount && BSONObjectIDKeyEqual(table->addedKeys, j, key)) {
+        *index = j;
+        return BSONObjectIDAdded;
+    }
+    return BSONObjectIDAbsent;
+}
+
+static void BSONObjectIDTableReserveKeys(BSONObjectIDTable *table, NSUInteger capacity) {
+    if (capacity <= table->keyCapacity) return;
+    table->keys = BSONObjectIDTableReallocate(table->keys, capacity, BSONObjectIDSize);
+    if (table->hasValues)
+        table->values = BSONObjectIDTableReallocate(table->values, capacity, sizeof(CFTypeRef));
+    table->keyCapacity = capacity;
+}
+
+static void BSONObjectIDTableReserveBatches(BSONObjectIDTable *table, NSUInteger capacity) {
+    table->addedKeys = BSONObjectIDTableReallocate(table->addedKeys, capacity, BSONObjectIDSize);
+    if (table->hasValues)
+        table->addedValues = BSONObjectIDTableReallocate(table->addedValues, capacity, sizeof(CFTypeRef));
+    table->removedIndexes = BSONObjectIDTableReallocate(table->removedIndexes, capacity, sizeof(NSUInteger));
+    table->batchCapacity = capacity;
+}
+
+// Merges count sorted keys, none of them repeated, into the merged keys, which mustn't have any
+// removed. Takes over values, which replace those of keys already present when the keys may
+// overlap. Returns the number of keys which weren't present.
+static NSUInteger BSONObjectIDTableMergeKeys(BSONObjectIDTable *table, const char *keys, const CFTypeRef *values, NSUInteger count, BOOL mayOverlap) {
+    NSUInteger newCount = count;
+    if (mayOverlap) {
+        for (NSUInteger i = 0, j = 0; i < table->keyCount && j < count; ) {
+            int order = BSONObjectIDCompare(table->keys + i * BSONObjectIDSize, keys + j * BSONObjectIDSize);
+            if (order <= 0) ++i;
+            if (order >= 0) ++j;
+            if (!order) --newCount;
+        }
+    }
+    if (!newCount && !table->hasValues) return 0;
+    BSONObjectIDTableReserveKeys(table, table->keyCount + newCount);
+    
+    // From the back, so that merged keys move at most once, and in runs between the keys merged in
+    NSUInteger i = table->keyCount, to = table->keyCount + newCount;
+    for (NSUInteger j = count; j--; ) {
+        const char *key = keys + j * BSONObjectIDSize;
+        NSUInteger start = BSONObjectIDLowerBoundBefore(table->keys, i, key);
+        BOOL present = start < i && BSONObjectIDKeyEqual(table->keys, start, key);
+        if (present && table->hasValues) CFRelease(table->values[start]);
+        NSUInteger after = present ? start + 1 : start, moved = i - after;
+        to -= moved;
+        memmove(table->keys + to * BSONObjectIDSize, table->keys + after * BSONObjectIDSize, moved * BSONObjectIDSize);
+        if (table->hasValues) memmove(table->values + to, table->values + after, moved * sizeof(CFTypeRef));
+        --to;
+        memcpy(table->keys + to * BSONObjectIDSize, key, BSONObjectIDSize);
+        if (table->hasValues) table->values[to] = values[j];
+        i = start;
+    }
+    table->keyCount += newCount;
+    return newCount;
+}
+
+static void BSONObjectIDTableMerge(BSONObjectIDTable *table) {
+    // Close up the gaps left by removed keys
+    if (table->removedCount) {
+        NSUInteger to = table->removedIndexes[0];
+        for (NSUInteger r = 0; r < table->removedCount; ++r) {
+            NSUInteger from = table->removedIndexes[r] + 1;
+            NSUInteger end = r + 1 < table->removedCount ? table->removedIndexes[r + 1] : table->keyCount;
+            memmove(table->keys + to * BSONObjectIDSize, table->keys + from * BSONObjectIDSize, (end - from) * BSONObjectIDSize);
+            if (table->hasValues) memmove(table->values + to, table->values + from, (end - from) * sizeof(CFTypeRef));
+            to += end - from;
+        }
+        table->keyCount = to;
+        table->removedCount = 0;
+    }
+    if (table->addedCount) {
+        BSONObjectIDTableMergeKeys(table, table->addedKeys, table->addedValues, table->addedCount, NO);
+        table->addedCount = 0;
+    }
+    NSUInteger batchCapacity = BSONObjectIDTableBatchCapacity(table->keyCount);
+    if (batchCapacity > table->batchCapacity) {
+        if (table->addedKeys)
+            BSONObjectIDTableReserveBatches(table, batchCapacity);
+        else
+            table->batchCapacity = batchCapacity;
+    }
+}
+
+static void BSONObjectIDTableAddKey(BSONObjectIDTable *table, const void *key, CFTypeRef value) {
+    NSUInteger i = 0, index, position;
+    switch (BSONObjectIDTableLocate(table, key, &i, &index)) {
+        case BSONObjectIDMerged:
+            if (table->hasValues) {
+                CFTypeRef old = table->values[index];
+                table->values[index] = CFRetain(value);
+                CFRelease(old);
+            }
+            return;
+        case BSONObjectIDAdded:
+            if (table->hasValues) {
+                CFTypeRef old = table->addedValues[index];
+                table->addedValues[index] = CFRetain(value);
+                CFRelease(old);
+            }
+            return;
+        case BSONObjectIDAbsent:
+            break;
+    }
+    
+    if (i < table->keyCount && BSONObjectIDKeyEqual(table->keys, i, key) && BSONObjectIDTableIsRemoved(table, i, &position)) {
+        memmove(table->removedIndexes + position, table->removedIndexes + position + 1,
+                (table->removedCount - position - 1) * sizeof(NSUInteger));
+        --table->removedCount;
+        if (table->hasValues) table->values[i] = CFRetain(value);
+        ++table->count;
+        return;
+    }
+    
+    if (!table->addedKeys)
+        BSONObjectIDTableReserveBatches(table, table->batchCapacity);
+    else if (table->addedCount == table->batchCapacity)
+        BSONObjectIDTableMerge(table);
+    NSUInteger j = BSONObjectIDLowerBound(table->addedKeys, table->addedCount, key);
+    memmove(table->addedKeys + (j + 1) * BSONObjectIDSize, table->addedKeys + j * BSONObjectIDSize,
+            (table->addedCount - j) * BSONObjectIDSize);
+    memcpy(table->addedKeys + j * BSONObjectIDSize, key, BSONObjectIDSize);
+    if (table->hasValues) {
+        memmove(table->addedValues + j + 1, table->addedValues + j, (table->addedCount - j) * sizeof(CFTypeRef));
+        table->addedValues[j] = CFRetain(value);
+    }
+    ++table->addedCount;
+    ++table->count;
+}
+
+void BSONObjectIDTableInit(BSONObjectIDTable *table, BOOL hasValues, NSUInteger capacity) {
+    memset(table, 0, sizeof(BSONObjectIDTable));
+    table->hasValues = hasValues;
+    table->batchCapacity = BSONObjectIDTableBatchCapacity(capacity);
+    if (capacity) BSONObjectIDTableReserveKeys(table, capacity);
+}
+
+void BSONObjectIDTableRemoveAll(BSONObjectIDTable *table) {
+    if (table->hasValues) {
+        // Removed keys' values are already released, and set to NULL
+        for (NSUInteger i = 0; i < table->keyCount; ++i)
+            if (table->values[i]) CFRelease(table->values[i]);
+        for (NSUInteger i = 0; i < table->addedCount; ++i)
+            CFRelease(table->addedValues[i]);
+    }
+    table->keyCount = 0;
+    table->addedCount = 0;
+    table->removedCount = 0;
+    table->count = 0;
+}
+
+void BSONObjectIDTableDestroy(BSONObjectIDTable *table) {
+    BSONObjectIDTableRemoveAll(table);
+    free(table->keys);
+    free(table->values);
+    free(table->addedKeys);
+    free(table->addedValues);
+    free(table->removedIndexes);
+    memset(table, 0, sizeof(BSONObjectIDTable));
+}
+
+void BSONObjectIDTableAdd(BSONObjectIDTable *table, const void *keys, const CFTypeRef *values, NSUInteger count) {
+    const char *key = keys;
+    if (table->hasValues || count < table->batchCapacity) {
+        for (NSUInteger i = 0; i < count; ++i, key += BSONObjectIDSize)
+            BSONObjectIDTableAddKey(table, key, values ? values[i] : NULL);
+        return;
+    }
+    
+    // Many keys at once are sorted, unless they already are, as generated ones are, and merged
+    BSONObjectIDTableMerge(table);
+    if (BSONObjectIDKeysIncrease(keys, count)) {
+        table->count += BSONObjectIDTableMergeKeys(table, keys, NULL, count, table->keyCount > 0);
+        return;
+    }
+    char *sorted = BSONObjectIDTableReallocate(NULL, count, BSONObjectIDSize);
+    @try {
+        memcpy(sorted, keys, count * BSONObjectIDSize);
+        qsort(sorted, count, BSONObjectIDSize, BSONObjectIDCompareBytes);
+        NSUInteger unique = 1;
+        for (NSUInteger i = 1; i < count; ++i) {
+            if (BSONObjectIDKeyEqual(sorted, unique - 1, sorted + i * BSONObjectIDSize)) continue;
+            memcpy(sorted + unique++ * BSONObjectIDSize, sorted + i * BSONObjectIDSize, BSONObjectIDSize);
+        }
+        table->count += BSONObjectIDTableMergeKeys(table, sorted, NULL, unique, table->keyCount > 0);
+    } @finally {
+        free(sorted);
+    }
+}
+
+BOOL BSONObjectIDTableContainsKey(const BSONObjectIDTable *table, const void *key) {
+    NSUInteger from = 0, index;
+    return BSONObjectIDAbsent != BSONObjectIDTableLocate(table, key, &from, &index);
+}
+
+CFTypeRef BSONObjectIDTableValueForKey(const BSONObjectIDTable *table, const void *key) {
+    NSUInteger from = 0, index;
+    switch (BSONObjectIDTableLocate(table, key, &from, &index)) {
+        case BSONObjectIDMerged:
+            return table->values[index];
+        case BSONObjectIDAdded:
+            return table->addedValues[index];
+        case BSONObjectIDAbsent:
+            break;
+    }
+    return NULL;
+}
+
+BOOL BSONObjectIDTableRemove(BSONObjectIDTable *table, const void *key) {
+    if (table->removedCount && table->removedCount == table->batchCapacity)
+        BSONObjectIDTableMerge(table);
+    NSUInteger from = 0, index, position;
+    switch (BSONObjectIDTableLocate(table, key, &from, &index)) {
+        case BSONObjectIDAbsent:
+            return NO;
+        case BSONObjectIDAdded:
+            if (table->hasValues) {
+                CFRelease(table->addedValues[index]);
+                memmove(table->addedValues + index, table->addedValues + index + 1,
+                        (table->addedCount - index - 1) * sizeof(CFTypeRef));
+            }
+            memmove(table->addedKeys + index * BSONObjectIDSize, table->addedKeys + (index + 1) * BSONObjectIDSize,
+                    (table->addedCount - index - 1) * BSONObjectIDSize);
+            --table->addedCount;
+            break;
+        case BSONObjectIDMerged:
+            if (!table->removedIndexes)
+                BSONObjectIDTableReserveBatches(table, table->batchCapacity);
+            BSONObjectIDTableIsRemoved(table, index, &position);
+            memmove(table->removedIndexes + position + 1, table->removedIndexes + position,
+                    (table->removedCount - position) * sizeof(NSUInteger));
+            table->removedIndexes[position] = index;
+            ++table->removedCount;
+            if (table->hasValues) {
+                CFRelease(table->values[index]);
+                table->values[index] = NULL;
+            }
+            break;
+    }
+    --table->count;
+    return YES;
+}
+
+NSUInteger BSONObjectIDTableContainsKeys(const BSONObjectIDTable *table, const void *keys, NSUInteger count, BOOL *results) {
+    // While the keys increase, each search starts where the last one stopped
+    const char *key = keys;
+    NSUInteger found = 0, from = 0, index;
+    for (NSUInteger i = 0; i < count; ++i, key += BSONObjectIDSize) {
+        if (i && BSONObjectIDCompare(key - BSONObjectIDSize, key) > 0) from = 0;
+        results[i] = BSONObjectIDAbsent != BSONObjectIDTableLocate(table, key, &from, &index);
+        found += results[i];
+    }
+    return found;
+}
+
+const char *BSONObjectIDTableSortedKeys(BSONObjectIDTable *table) {
+    if (table->addedCount || table->removedCount) BSONObjectIDTableMerge(table);
+    return table->count ? table->keys : NULL;
+}
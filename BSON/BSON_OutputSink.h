@@ -0,0 +1,63 @@
+//
+//  BSON_OutputSink.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//
+// The buffered destination shared by the document writers: a file descriptor or an output stream
+// behind a write buffer of fixed capacity. Writes retry after partial writes and interruptions,
+// and failures are reported as NSErrors in NSPOSIXErrorDomain, or as the stream's own error.
+//
+
+#import <Foundation/Foundation.h>
+
+@interface BSONOutputSink : NSObject
+
+/**
+ @param closeOnClose <code>YES</code> if closing the sink should close the file descriptor
+ */
+- (id) initWithFileDescriptor:(int) fileDescriptor
+                 closeOnClose:(BOOL) closeOnClose
+               bufferCapacity:(NSUInteger) bufferCapacity;
+
+/**
+ Opens <i>stream</i> if necessary.
+ */
+- (id) initWithOutputStream:(NSOutputStream *) stream bufferCapacity:(NSUInteger) bufferCapacity;
+
+/**
+ Adds <i>bytes</i> to the buffer, first writing out what's buffered if they don't fit. Bytes which
+ don't fit even in an empty buffer are written directly.
+ */
+- (BOOL) appendBytes:(const char *) bytes length:(NSUInteger) length error:(NSError * __autoreleasing *) error;
+
+- (BOOL) flush:(NSError * __autoreleasing *) error;
+
+/**
+ Flushes, and then calls <code>fsync()</code> on a file descriptor.
+ */
+- (BOOL) synchronize:(NSError * __autoreleasing *) error;
+
+/**
+ Flushes, and then closes the stream, or the file descriptor if the sink owns it. Closing a second
+ time does nothing.
+ */
+- (BOOL) close:(NSError * __autoreleasing *) error;
+
+@property (assign, readonly) NSUInteger bufferCapacity;
+@property (assign, readonly, getter = isClosed) BOOL closed;
+
+@end
@@ -0,0 +1,156 @@
+//
+//  BSON_OutputSink.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSON_OutputSink.h"
+#import "BSON_Helper.h"
+#import <unistd.h>
+#import <errno.h>
+
+@interface BSONOutputSink ()
+@property (retain) NSOutputStream *stream;
+@property (assign) NSUInteger bufferCapacity;
+@property (assign, getter = isClosed) BOOL closed;
+@end
+
+@implementation BSONOutputSink {
+    int _fileDescriptor;
+    BOOL _closesFileDescriptor;
+    char *_buffer;
+    NSUInteger _bufferLength;
+}
+
+#pragma mark - Initialization
+
+- (id) _initWithBufferCapacity:(NSUInteger) bufferCapacity {
+    NSParameterAssert(bufferCapacity > 0);
+    if (self = [super init]) {
+        _fileDescriptor = -1;
+        _buffer = malloc(bufferCapacity);
+        if (!_buffer) nullify_self_and_return;
+        self.bufferCapacity = bufferCapacity;
+    }
+    return self;
+}
+
+- (id) initWithFileDescriptor:(int) fileDescriptor
+                 closeOnClose:(BOOL) closeOnClose
+               bufferCapacity:(NSUInteger) bufferCapacity {
+    NSParameterAssert(fileDescriptor >= 0);
+    if (self = [self _initWithBufferCapacity:bufferCapacity]) {
+        _fileDescriptor = fileDescriptor;
+        _closesFileDescriptor = closeOnClose;
+    }
+    return self;
+}
+
+- (id) initWithOutputStream:(NSOutputStream *) stream bufferCapacity:(NSUInteger) bufferCapacity {
+    NSParameterAssert(stream);
+    if (self = [self _initWithBufferCapacity:bufferCapacity]) {
+        self.stream = stream;
+        if (NSStreamStatusNotOpen == stream.streamStatus) [stream open];
+    }
+    return self;
+}
+
+- (void) dealloc {
+    [self close:NULL];
+    free(_buffer);
+    maybe_release(_stream);
+    super_dealloc;
+}
+
+#pragma mark - Writing
+
+- (NSError *) _errorWithErrno:(int) errorNumber {
+    return [NSError errorWithDomain:NSPOSIXErrorDomain code:errorNumber userInfo:nil];
+}
+
+- (NSError *) _streamError {
+    NSError *result = self.stream.streamError;
+    if (!result)
+        result = [NSError errorWithDomain:NSPOSIXErrorDomain code:EIO userInfo:nil];
+    return result;
+}
+
+/**
+ Writes all of <i>bytes</i>, retrying after partial writes and interruptions.
+ */
+- (BOOL) _writeBytes:(const char *) bytes length:(NSUInteger) length error:(NSError * __autoreleasing *) error {
+    while (length) {
+        if (self.stream) {
+            NSInteger written = [self.stream write:(const uint8_t *) bytes maxLength:length];
+            if (written <= 0) {
+                if (error) *error = [self _streamError];
+                return NO;
+            }
+            bytes += written;
+            length -= written;
+        } else {
+            ssize_t written = write(_fileDescriptor, bytes, length);
+            if (written < 0) {
+                if (EINTR == errno) continue;
+                if (error) *error = [self _errorWithErrno:errno];
+                return NO;
+            }
+            bytes += written;
+            length -= written;
+        }
+    }
+    return YES;
+}
+
+- (BOOL) appendBytes:(const char *) bytes length:(NSUInteger) length error:(NSError * __autoreleasing *) error {
+    if (length > self.bufferCapacity - _bufferLength && ![self flush:error]) return NO;
+    if (length >= self.bufferCapacity) return [self _writeBytes:bytes length:length error:error];
+    memcpy(_buffer + _bufferLength, bytes, length);
+    _bufferLength += length;
+    return YES;
+}
+
+- (BOOL) flush:(NSError * __autoreleasing *) error {
+    if (!_bufferLength) return YES;
+    if (![self _writeBytes:_buffer length:_bufferLength error:error]) return NO;
+    _bufferLength = 0;
+    return YES;
+}
+
+- (BOOL) synchronize:(NSError * __autoreleasing *) error {
+    if (![self flush:error]) return NO;
+    if (self.stream) return YES;
+    if (fsync(_fileDescriptor)) {
+        if (error) *error = [self _errorWithErrno:errno];
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL) close:(NSError * __autoreleasing *) error {
+    if (self.closed) return YES;
+    BOOL result = [self flush:error];
+    self.closed = YES;
+    if (self.stream)
+        [self.stream close];
+    else if (_closesFileDescriptor && close(_fileDescriptor) && result) {
+        if (error) *error = [self _errorWithErrno:errno];
+        result = NO;
+    }
+    return result;
+}
+
+@end
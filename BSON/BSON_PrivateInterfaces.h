@@ -43,6 +43,8 @@
 #import "BSONEncoder.h"
 #import "BSONIterator.h"
 #import "BSONTypes.h"
+#import "BSONDecodingSession.h"
+#import "BSONCompiledKeyPath.h"
 
 @interface BSONDocument (Project)
 /**
@@ -59,9 +61,34 @@
 @interface BSONIterator (Project)
 - (BSONIterator *) initWithDocument:(BSONDocument *)document
              keyPathComponentsOrNil:(NSArray *) keyPathComponents;
+/**
+ Takes ownership of the given iterator and retains dependentOn.
+ */
+- (id) initWithNativeIterator:(bson_iterator *) bsonIter
+                  dependentOn:(id) dependentOn
+            keyPathComponents:(NSArray *) keyPathComponents;
 - (bson_iterator *) nativeIteratorValue NS_RETURNS_INNER_POINTER;
 @end
 
+@interface BSONCompiledKeyPath (Project)
+- (const char * const *) components NS_RETURNS_INNER_POINTER;
+- (const uint32_t *) hashes NS_RETURNS_INNER_POINTER;
+@end
+
+@interface BSONDecodingSession (Project)
+/**
+ Each returns an autoreleased object, from the cache when possible.
+ */
+- (NSString *) keyForBSONString:(const char *) bsonString;
+/**
+ <i>maximumLength</i> bounds the length of the NUL-terminated <i>bsonString</i>, not including
+ the terminator.
+ */
+- (NSString *) stringForBSONString:(const char *) bsonString length:(size_t) maximumLength;
+- (NSNumber *) numberWithInt:(int32_t) value;
+- (NSNumber *) numberWithLongLong:(int64_t) value;
+@end
+
 @interface BSONObjectID (Project)
 + (BSONObjectID *) objectIDWithNativeOID:(const bson_oid_t *) objectIDPointer;
 - (bson_oid_t) oid;
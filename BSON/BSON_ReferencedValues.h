@@ -0,0 +1,63 @@
+//
+//  BSON_ReferencedValues.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//
+// Creates strings and data which point into a document's bytes instead of copying them.
+//
+// Each value is a CFString or CFData whose allocator is a BSONReferencingAllocator. The allocator
+// retains the object which owns the bytes, and each value retains its allocator, so the bytes
+// live at least as long as the values. The allocator forwards to malloc() for the value itself,
+// and the bytes it points into are never freed, since the value is created with kCFAllocatorNull
+// as its contents deallocator. Checking a value's allocator tells whether it refers to a
+// document.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Returns a new allocator which retains <i>owner</i> until it's released.
+ */
+CFAllocatorRef BSONReferencingAllocatorCreate(id owner) CF_RETURNS_RETAINED;
+
+/**
+ Returns <code>YES</code> if the <i>length</i> bytes at <i>bytes</i> can be made into a string
+ which refers to them: they must be ASCII, with no NUL. CFString copies any other UTF-8 text into
+ storage of its own, so a referencing string would hold on to the document without saving
+ anything, and the copying path ends a string at its first NUL.
+ */
+BOOL BSONCanReferenceString(const char *bytes, size_t length);
+
+/**
+ Each returns an autoreleased value which points into <i>bytes</i>. The bytes of a string must
+ pass <code>BSONCanReferenceString()</code>.
+ */
+NSString * BSONReferencingString(CFAllocatorRef allocator, const char *bytes, size_t length);
+NSData * BSONReferencingData(CFAllocatorRef allocator, const char *bytes, size_t length);
+
+/**
+ Returns <code>YES</code> if <i>object</i> was created by <code>BSONReferencingString()</code> or
+ <code>BSONReferencingData()</code>.
+ */
+BOOL BSONObjectReferencesDocument(id object);
+
+/**
+ Returns <i>object</i>, or a copy of it in which each string, data and symbol which refers to a
+ document is replaced by a copy. Arrays and dictionaries are copied only when something inside
+ them is replaced, and an <code>OrderedDictionary</code> is copied to another.
+ */
+id BSONDetachedObject(id object);
@@ -0,0 +1,151 @@
+//
+//  BSON_ReferencedValues.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <objc/runtime.h>
+#import "BSON_ReferencedValues.h"
+#import "BSON_Helper.h"
+#import "BSON_Validation.h"
+#import "BSONTypes.h"
+#import "OrderedDictionary.h"
+
+#pragma mark - Allocator
+
+static const void * BSONReferencingAllocatorRetain(const void *info) {
+    return CFRetain(info);
+}
+
+static void BSONReferencingAllocatorRelease(const void *info) {
+    CFRelease(info);
+}
+
+static void * BSONReferencingAllocatorAllocate(CFIndex size, CFOptionFlags hint, void *info) {
+    return malloc(size);
+}
+
+static void * BSONReferencingAllocatorReallocate(void *ptr, CFIndex size, CFOptionFlags hint, void *info) {
+    return realloc(ptr, size);
+}
+
+static void BSONReferencingAllocatorDeallocate(void *ptr, void *info) {
+    free(ptr);
+}
+
+CFAllocatorRef BSONReferencingAllocatorCreate(id owner) {
+    NSCParameterAssert(owner != nil);
+    CFAllocatorContext context = {
+        0, (__bridge void *) owner,
+        BSONReferencingAllocatorRetain, BSONReferencingAllocatorRelease, NULL,
+        BSONReferencingAllocatorAllocate, BSONReferencingAllocatorReallocate,
+        BSONReferencingAllocatorDeallocate, NULL
+    };
+    return CFAllocatorCreate(kCFAllocatorDefault, &context);
+}
+
+// The classes of the values created by this file. CFGetAllocator() is only called on objects of
+// these classes, which are CF objects, since it isn't safe on others, like tagged pointer strings.
+static Class BSONReferencingStringClass;
+static Class BSONReferencingDataClass;
+
+static void BSONLoadReferencingClasses(void) {
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        static const UInt8 sample[] = "sample";
+        CFStringRef string = CFStringCreateWithBytesNoCopy(NULL, sample, sizeof(sample) - 1,
+                                                           kCFStringEncodingASCII, false, kCFAllocatorNull);
+        CFDataRef data = CFDataCreateWithBytesNoCopy(NULL, sample, sizeof(sample) - 1, kCFAllocatorNull);
+        BSONReferencingStringClass = object_getClass((__bridge id) string);
+        BSONReferencingDataClass = object_getClass((__bridge id) data);
+        CFRelease(string);
+        CFRelease(data);
+    });
+}
+
+BOOL BSONObjectReferencesDocument(id object) {
+    BSONLoadReferencingClasses();
+    Class class = object_getClass(object);
+    if (!class || (class != BSONReferencingStringClass && class != BSONReferencingDataClass)) return NO;
+    CFAllocatorRef allocator = CFGetAllocator((__bridge CFTypeRef) object);
+    CFAllocatorContext context;
+    context.version = 0;
+    CFAllocatorGetContext(allocator, &context);
+    return BSONReferencingAllocatorAllocate == context.allocate;
+}
+
+#pragma mark - Values
+
+BOOL BSONCanReferenceString(const char *bytes, size_t length) {
+    return !memchr(bytes, 0, length) && BSONIsASCII(bytes, length);
+}
+
+NSString * BSONReferencingString(CFAllocatorRef allocator, const char *bytes, size_t length) {
+    NSCParameterAssert(BSONCanReferenceString(bytes, length));
+    CFStringRef result = CFStringCreateWithBytesNoCopy(allocator, (const UInt8 *) bytes, length,
+                                                       kCFStringEncodingASCII, false, kCFAllocatorNull);
+    maybe_autorelease_and_return((__bridge_transfer NSString *) result);
+}
+
+NSData * BSONReferencingData(CFAllocatorRef allocator, const char *bytes, size_t length) {
+    CFDataRef result = CFDataCreateWithBytesNoCopy(allocator, (const UInt8 *) bytes, length, kCFAllocatorNull);
+    maybe_autorelease_and_return((__bridge_transfer NSData *) result);
+}
+
+#pragma mark - Detaching
+
+id BSONDetachedObject(id object) {
+    if ([object isKindOfClass:[NSString class]]) {
+        if (!BSONObjectReferencesDocument(object)) return object;
+        // A string is only returned as its own copy when the allocators match
+        CFStringRef copy = CFStringCreateCopy(kCFAllocatorDefault, (__bridge CFStringRef) object);
+        maybe_autorelease_and_return((__bridge_transfer NSString *) copy);
+        
+    } else if ([object isKindOfClass:[NSData class]]) {
+        if (!BSONObjectReferencesDocument(object)) return object;
+        return [NSData dataWithBytes:[object bytes] length:[object length]];
+        
+    } else if ([object isKindOfClass:[BSONSymbol class]]) {
+        NSString *symbol = [object symbol];
+        NSString *detached = BSONDetachedObject(symbol);
+        return detached == symbol ? object : [BSONSymbol symbol:detached];
+        
+    } else if ([object isKindOfClass:[NSArray class]]) {
+        NSMutableArray *copy = nil;
+        NSUInteger i = 0;
+        for (id item in object) {
+            id detached = BSONDetachedObject(item);
+            if (detached != item && !copy) copy = [NSMutableArray arrayWithArray:object];
+            if (copy) [copy replaceObjectAtIndex:i withObject:detached];
+            ++i;
+        }
+        return copy ? [NSArray arrayWithArray:copy] : object;
+        
+    } else if ([object isKindOfClass:[NSDictionary class]]) {
+        NSMutableDictionary *copy = nil;
+        for (id key in object) {
+            id value = [object objectForKey:key];
+            id detached = BSONDetachedObject(value);
+            if (detached != value && !copy)
+                copy = [object isKindOfClass:[OrderedDictionary class]]
+                    ? [OrderedDictionary dictionaryWithDictionary:object]
+                    : [NSMutableDictionary dictionaryWithDictionary:object];
+            if (copy) [copy setObject:detached forKey:key];
+        }
+        return copy ? copy : object;
+    }
+    return object;
+}
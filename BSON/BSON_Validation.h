@@ -0,0 +1,54 @@
+//
+//  BSON_Validation.h
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//
+// Checks the structure of a BSON document from an untrusted source in one pass, so that the
+// driver's iterator, which trusts the lengths it reads, can then walk it without reading out of
+// bounds. Every length is checked against the bytes which remain in its enclosing document, every
+// C string must end before its enclosing document does, and embedded documents may only be nested
+// so deep. Element types the iterator doesn't know are rejected.
+//
+// Optionally, keys and string values are also checked for valid UTF-8, so that converting them to
+// NSString won't fail. Runs of ASCII are checked a vector at a time.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ Returns <code>YES</code> if the <i>length</i> bytes at <i>data</i> are exactly one well-formed
+ BSON document, whose embedded documents and arrays are nested no more than <i>maximumDepth</i>
+ deep. If <i>checkUTF8</i> is <code>YES</code>, also requires keys and strings to be valid UTF-8.
+
+ Otherwise returns <code>NO</code>, and sets <i>reason</i> to a static description of the first
+ problem found and <i>offset</i> to its position in the data.
+ */
+BOOL BSONValidateData(const char *data, size_t length, BOOL checkUTF8, NSUInteger maximumDepth,
+                      const char **reason, size_t *offset);
+
+/**
+ Returns <code>YES</code> if the <i>length</i> bytes at <i>bytes</i> are valid UTF-8, rejecting
+ overlong forms, surrogates and code points above U+10FFFF. Uses AVX2, SSE2 or NEON to skip ASCII
+ when the target supports them.
+ */
+BOOL BSONValidateUTF8(const char *bytes, size_t length);
+
+/**
+ Returns <code>YES</code> if the <i>length</i> bytes at <i>bytes</i> are all ASCII, checking a
+ vector at a time like <code>BSONValidateUTF8()</code>.
+ */
+BOOL BSONIsASCII(const char *bytes, size_t length);
@@ -0,0 +1,274 @@
+//
+//  BSON_Validation.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import "BSON_Validation.h"
+#import "BSONTypes.h"
+
+#if defined(__AVX2__)
+#import <immintrin.h>
+#elif defined(__SSE2__)
+#import <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#import <arm_neon.h>
+#endif
+
+#pragma mark - UTF-8
+
+static inline size_t BSONASCIIPrefixLength(const uint8_t *bytes, size_t length) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= length; i += 32)
+        if (_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i *) (bytes + i)))) break;
+#elif defined(__SSE2__)
+    for (; i + 16 <= length; i += 16)
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i *) (bytes + i)))) break;
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    for (; i + 16 <= length; i += 16) {
+        uint8x16_t block = vld1q_u8(bytes + i);
+        uint8x8_t maximum = vmax_u8(vget_low_u8(block), vget_high_u8(block));
+        maximum = vpmax_u8(maximum, maximum);
+        maximum = vpmax_u8(maximum, maximum);
+        maximum = vpmax_u8(maximum, maximum);
+        if (vget_lane_u8(maximum, 0) & 0x80) break;
+    }
+#endif
+    while (i < length && bytes[i] < 0x80) ++i;
+    return i;
+}
+
+/**
+ Returns the length of the multi-byte sequence at <i>bytes</i>, or 0 if it isn't valid.
+ */
+static inline size_t BSONUTF8SequenceLength(const uint8_t *bytes, size_t length) {
+    uint8_t lead = bytes[0];
+    size_t sequenceLength;
+    // The range of the second byte, which excludes overlong forms, surrogates and code points
+    // above U+10FFFF
+    uint8_t low = 0x80, high = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF) sequenceLength = 2;
+    else if (lead >= 0xE0 && lead <= 0xEF) {
+        sequenceLength = 3;
+        if (0xE0 == lead) low = 0xA0;
+        else if (0xED == lead) high = 0x9F;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        sequenceLength = 4;
+        if (0xF0 == lead) low = 0x90;
+        else if (0xF4 == lead) high = 0x8F;
+    } else return 0;
+    
+    if (sequenceLength > length) return 0;
+    if (bytes[1] < low || bytes[1] > high) return 0;
+    for (size_t i = 2; i < sequenceLength; ++i)
+        if ((bytes[i] & 0xC0) != 0x80) return 0;
+    return sequenceLength;
+}
+
+BOOL BSONValidateUTF8(const char *bytes, size_t length) {
+    const uint8_t *cur = (const uint8_t *) bytes;
+    size_t i = 0;
+    while (i < length) {
+        i += BSONASCIIPrefixLength(cur + i, length - i);
+        if (i == length) break;
+        size_t sequenceLength = BSONUTF8SequenceLength(cur + i, length - i);
+        if (!sequenceLength) return NO;
+        i += sequenceLength;
+    }
+    return YES;
+}
+
+BOOL BSONIsASCII(const char *bytes, size_t length) {
+    return BSONASCIIPrefixLength((const uint8_t *) bytes, length) == length;
+}
+
+#pragma mark - Documents
+
+typedef struct {
+    const char *data;
+    BOOL checkUTF8;
+    NSUInteger maximumDepth;
+    const char *reason;
+    size_t offset;
+} BSONValidation;
+
+static inline BOOL BSONValidationFail(BSONValidation *validation, const char *position, const char *reason) {
+    validation->reason = reason;
+    validation->offset = position - validation->data;
+    return NO;
+}
+
+static inline int32_t BSONValidationReadInt32(const char *position) {
+    int32_t result;
+    memcpy(&result, position, sizeof(result));
+    return NSSwapLittleIntToHost(result);
+}
+
+/**
+ Checks the C string at <i>position</i>, which must end before <i>end</i>, and sets
+ <i>next</i> to the byte after its terminator.
+ */
+static BOOL BSONValidateCString(BSONValidation *validation, const char *position, const char *end, const char **next) {
+    const char *terminator = memchr(position, 0, end - position);
+    if (!terminator) return BSONValidationFail(validation, position, "unterminated string");
+    if (validation->checkUTF8 && !BSONValidateUTF8(position, terminator - position))
+        return BSONValidationFail(validation, position, "invalid UTF-8");
+    *next = terminator + 1;
+    return YES;
+}
+
+/**
+ Checks a string value with a length prefix at <i>position</i>, which must end by <i>end</i>,
+ and sets <i>next</i> to the byte after it.
+ */
+static BOOL BSONValidateString(BSONValidation *validation, const char *position, const char *end, const char **next) {
+    if (end - position < 4) return BSONValidationFail(validation, position, "truncated string length");
+    int32_t length = BSONValidationReadInt32(position);
+    if (length < 1 || length > end - position - 4)
+        return BSONValidationFail(validation, position, "string length out of bounds");
+    const char *bytes = position + 4;
+    if (bytes[length - 1]) return BSONValidationFail(validation, bytes + length - 1, "unterminated string");
+    if (validation->checkUTF8 && !BSONValidateUTF8(bytes, length - 1))
+        return BSONValidationFail(validation, bytes, "invalid UTF-8");
+    *next = bytes + length;
+    return YES;
+}
+
+static BOOL BSONValidateDocument(BSONValidation *validation, const char *position, const char *end,
+                                 NSUInteger depth, const char **next);
+
+static BOOL BSONValidateElements(BSONValidation *validation, const char *position, const char *documentEnd, NSUInteger depth) {
+    // The last byte of the document is its terminator
+    const char *end = documentEnd - 1;
+    while (position < end) {
+        const char *element = position;
+        BSONType type = (BSONType) *position;
+        if (!BSONValidateCString(validation, position + 1, end, &position)) return NO;
+        
+        size_t fixedLength = 0;
+        switch (type) {
+            case BSONTypeUndefined:
+            case BSONTypeNull:
+                break;
+            case BSONTypeBoolean:
+                if (position >= end) return BSONValidationFail(validation, position, "truncated value");
+                if (*position != 0 && *position != 1) return BSONValidationFail(validation, position, "invalid Boolean");
+                fixedLength = 1;
+                break;
+            case BSONTypeInteger:
+                fixedLength = 4;
+                break;
+            case BSONTypeDouble:
+            case BSONTypeDate:
+            case BSONTypeTimestamp:
+            case BSONTypeLong:
+                fixedLength = 8;
+                break;
+            case BSONTypeObjectID:
+                fixedLength = 12;
+                break;
+            case BSONTypeString:
+            case BSONTypeCode:
+            case BSONTypeSymbol:
+                if (!BSONValidateString(validation, position, end, &position)) return NO;
+                break;
+            case BSONTypeDBRef:
+                if (!BSONValidateString(validation, position, end, &position)) return NO;
+                fixedLength = 12;
+                break;
+            case BSONTypeRegularExpression:
+                if (!BSONValidateCString(validation, position, end, &position)) return NO;
+                if (!BSONValidateCString(validation, position, end, &position)) return NO;
+                break;
+            case BSONTypeEmbeddedDocument:
+            case BSONTypeArray:
+                if (!BSONValidateDocument(validation, position, end, depth + 1, &position)) return NO;
+                break;
+            case BSONTypeBinaryData: {
+                if (end - position < 5) return BSONValidationFail(validation, position, "truncated binary length");
+                int32_t length = BSONValidationReadInt32(position);
+                if (length < 0 || length > end - position - 5)
+                    return BSONValidationFail(validation, position, "binary length out of bounds");
+                // The old binary subtype repeats the length inside the data
+                if (0x02 == position[4]
+                    && (length < 4 || BSONValidationReadInt32(position + 5) != length - 4))
+                    return BSONValidationFail(validation, position, "invalid binary length");
+                position += 5 + length;
+                break;
+            }
+            case BSONTypeCodeWithScope: {
+                if (end - position < 4) return BSONValidationFail(validation, position, "truncated code length");
+                int32_t length = BSONValidationReadInt32(position);
+                // The length, a string of at least one byte and an empty document
+                if (length < 14 || length > end - position)
+                    return BSONValidationFail(validation, position, "code length out of bounds");
+                const char *codeEnd = position + length;
+                const char *scope;
+                if (!BSONValidateString(validation, position + 4, codeEnd, &scope)) return NO;
+                if (!BSONValidateDocument(validation, scope, codeEnd, depth + 1, &position)) return NO;
+                if (position != codeEnd) return BSONValidationFail(validation, position, "code length mismatch");
+                break;
+            }
+            case BSONTypeEndOfObject:
+                return BSONValidationFail(validation, element, "unexpected end of document");
+            default:
+                return BSONValidationFail(validation, element, "unsupported element type");
+        }
+        if (fixedLength > (size_t) (end - position)) return BSONValidationFail(validation, position, "truncated value");
+        position += fixedLength;
+    }
+    if (position != end) return BSONValidationFail(validation, position, "element overruns document");
+    return YES;
+}
+
+/**
+ Checks the document at <i>position</i>, which must end by <i>end</i>, and sets <i>next</i> to
+ the byte after it.
+ */
+static BOOL BSONValidateDocument(BSONValidation *validation, const char *position, const char *end,
+                                 NSUInteger depth, const char **next) {
+    if (depth > validation->maximumDepth) return BSONValidationFail(validation, position, "nested too deeply");
+    if (end - position < 5) return BSONValidationFail(validation, position, "truncated document");
+    int32_t size = BSONValidationReadInt32(position);
+    if (size < 5 || size > end - position) return BSONValidationFail(validation, position, "document size out of bounds");
+    const char *documentEnd = position + size;
+    if (documentEnd[-1]) return BSONValidationFail(validation, documentEnd - 1, "unterminated document");
+    if (!BSONValidateElements(validation, position + 4, documentEnd, depth)) return NO;
+    *next = documentEnd;
+    return YES;
+}
+
+BOOL BSONValidateData(const char *data, size_t length, BOOL checkUTF8, NSUInteger maximumDepth,
+                      const char **reason, size_t *offset) {
+    BSONValidation validation = { data, checkUTF8, maximumDepth, NULL, 0 };
+    const char *end = data + length;
+    const char *next = data;
+    BOOL valid = NO;
+    if (length > INT32_MAX)
+        BSONValidationFail(&validation, data, "document too large");
+    else if (BSONValidateDocument(&validation, data, end, 0, &next)) {
+        if (next == end)
+            valid = YES;
+        else
+            BSONValidationFail(&validation, next, "data after end of document");
+    }
+    if (!valid) {
+        if (reason) *reason = validation.reason;
+        if (offset) *offset = validation.offset;
+    }
+    return valid;
+}
@@ -25,8 +25,15 @@
 
 #import "BSONTypes.h"
 #import "BSONDocument.h"
+#import "BSONDocumentWriter.h"
+#import "BSONExtendedJSONWriter.h"
+#import "BSONLazyCollections.h"
 #import "BSONEncoder.h"
 #import "BSONDecoder.h"
+#import "BSONDecodingSession.h"
+#import "BSONColumnarDecoder.h"
+#import "BSONCompiledKeyPath.h"
+#import "BSONObjectIDSet.h"
 #import "BSONCoding.h"
 #import "NSDictionary+BSONAdditions.h"
 #import "NSManagedObject+BSONCoding.h"
@@ -20,6 +20,8 @@
 #import <Foundation/Foundation.h>
 #import "mongo.h"
 #import "BSONDocument.h"
+#import "BSONDecodingSession.h"
+#import "BSONColumnarDecoder.h"
 
 @interface MongoCursor : NSEnumerator
 
@@ -31,4 +33,24 @@
 - (BSONDocument *) nextObjectNoCopy;
 - (NSArray *) allObjects;
 
+/**
+ Returns the next document decoded as a dictionary using <code>decodingSession</code>, or
+ <code>nil</code> if there are no more documents.
+ */
+- (NSDictionary *) nextDictionary;
+
+/**
+ Appends up to <i>maximumCount</i> of the cursor's documents to <i>decoder</i>'s columns, and
+ returns the number appended. Since the columns hold copies of the values, the documents aren't
+ copied out of the cursor's buffer.
+ */
+- (NSUInteger) appendNextDocuments:(NSUInteger) maximumCount toColumnarDecoder:(BSONColumnarDecoder *) decoder;
+
+/**
+ A session created with the cursor, so that decoding its documents shares repeated keys, small
+ numbers and short strings. To use it with your own decoding, pass it to
+ <code>-[BSONDecoder initWithDocument:session:]</code>.
+ */
+@property (retain) BSONDecodingSession *decodingSession;
+
 @end
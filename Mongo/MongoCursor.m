@@ -21,6 +21,7 @@
 #import "BSON_Helper.h"
 #import "Mongo_Helper.h"
 #import "BSON_PrivateInterfaces.h"
+#import "BSONDecoder.h"
 
 @implementation MongoCursor {
     mongo_cursor *_cursor;
@@ -31,6 +32,7 @@
 - (id) initWithNativeCursor:(mongo_cursor *) cursor {
     if (self = [super init]) {
         _cursor = cursor;
+        self.decodingSession = [BSONDecodingSession session];
     }
     return self;
 }
@@ -43,6 +45,7 @@
 - (void) dealloc {
     mongo_cursor_destroy(_cursor);
     _cursor = NULL;
+    maybe_release(_decodingSession);
     super_dealloc;
 }
 
@@ -63,6 +66,26 @@
     return [BSONDocument documentWithNativeDocument:newBson dependentOn:nil];
 }
 
+- (NSDictionary *) nextDictionary {
+    BSONDocument *document = [self nextObject];
+    if (!document) return nil;
+    BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document session:self.decodingSession];
+    NSDictionary *result = [decoder decodeDictionary];
+    maybe_release(decoder);
+    maybe_retain_autorelease_and_return(result);
+}
+
+- (NSUInteger) appendNextDocuments:(NSUInteger) maximumCount toColumnarDecoder:(BSONColumnarDecoder *) decoder {
+    NSUInteger count = 0;
+    while (count < maximumCount) @autoreleasepool {
+        BSONDocument *document = [self nextObjectNoCopy];
+        if (!document) break;
+        [decoder appendDocument:document];
+        ++count;
+    }
+    return count;
+}
+
 - (NSArray *) allObjects {
     NSMutableArray *result = [NSMutableArray array];
     BSONDocument *document;
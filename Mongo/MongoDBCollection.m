@@ -106,14 +106,11 @@
          INT_MAX];
 
     int documentsToInsert = (int) documentArray.count;
+    NSArray *documents = [BSONEncoder documentsForObjects:documentArray options:BSONBatchEncodingDefault];
     const bson *bsonArray[documentsToInsert];
     const bson **current = bsonArray;
-    for (__strong BSONDocument *document in documentArray) {
-        if(![document isKindOfClass:[BSONDocument class]]) {
-            document = [BSONEncoder documentForObject:document];
-        }
+    for (BSONDocument *document in documents)
         *current++ = document.bsonValue;
-    }
     int flags = continueOnError ? MONGO_CONTINUE_ON_ERROR : 0;
     if (MONGO_OK == mongo_insert_batch(self.connection.connValue,
                                        self.fullyQualifiedName.bsonString,
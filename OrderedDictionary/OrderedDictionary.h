@@ -8,6 +8,8 @@
 //  MODIFIED #import directive
 //  by Paul Melnikow on February 8, 2013
 //
+//  MODIFIED to move the instance variables to the implementation
+//
 //  This software is provided 'as-is', without any express or implied
 //  warranty. In no event will the authors be held liable for any damages
 //  arising from the use of this software. Permission is granted to anyone to
@@ -27,10 +29,6 @@
 #import <Foundation/Foundation.h>
 
 @interface OrderedDictionary : NSMutableDictionary
-{
-	NSMutableDictionary *dictionary;
-	NSMutableArray *array;
-}
 
 - (void)insertObject:(id)anObject forKey:(id)aKey atIndex:(NSUInteger)anIndex;
 - (id)keyAtIndex:(NSUInteger)anIndex;
@@ -8,6 +8,9 @@
 //  MODIFIED -descriptionWithLocale:indent:
 //  by Paul Melnikow on March 11, 2012
 //
+//  MODIFIED to store entries in a single hash table over an insertion-ordered
+//  array, instead of in an NSMutableDictionary and an NSMutableArray
+//
 //  This software is provided 'as-is', without any express or implied
 //  warranty. In no event will the authors be held liable for any damages
 //  arising from the use of this software. Permission is granted to anyone to
@@ -26,6 +29,30 @@
 
 #import "OrderedDictionary.h"
 
+//
+//  The keys, values and key hashes are kept in parallel arrays in insertion
+//  order, and an open-addressed table of indexes into them finds a key. A
+//  removed entry leaves a hole in the arrays and a tombstone in the table,
+//  so removal doesn't have to shift the entries after it. Both are swept away
+//  once holes make up a quarter of the arrays, or when the arrays fill up.
+//  Only methods which change the dictionary compact it; the ones which read
+//  it step over the holes, so that, like other dictionaries, it can be read
+//  from several threads at once.
+//
+//  The table has at least twice as many slots as the arrays have room for
+//  entries, and is rebuilt whenever they're compacted or grow, so it is never
+//  more than half full.
+//
+
+#define OrderedDictionaryEmptySlot 0
+#define OrderedDictionaryDeletedSlot NSUIntegerMax
+#define OrderedDictionaryMinimumCapacity 4
+
+static inline BOOL OrderedDictionaryKeysEqual(CFTypeRef a, CFTypeRef b)
+{
+	return a == b || [(__bridge id)a isEqual:(__bridge id)b];
+}
+
 NSString *DescriptionForObject(NSObject *object, id locale, NSUInteger indent);
 NSString *DescriptionForObject(NSObject *object, id locale, NSUInteger indent)
 {
@@ -54,28 +81,43 @@ NSString *DescriptionForObject(NSObject *object, id locale, NSUInteger indent)
 }
 
 @implementation OrderedDictionary
+{
+	// keys, values and hashes have room for capacity entries, of which the
+	// first used have been filled and entryCount are still present. slots has
+	// slotCount entries, each 0 for an empty slot, NSUIntegerMax for a
+	// removed one, or one more than the index of an entry. All of them share
+	// one allocation.
+	CFTypeRef *keys;
+	CFTypeRef *values;
+	NSUInteger *hashes;
+	NSUInteger *slots;
+	NSUInteger capacity;
+	NSUInteger slotCount;
+	NSUInteger used;
+	NSUInteger entryCount;
+	unsigned long mutations;
+}
 
 - (id)init
 {
 	return [self initWithCapacity:0];
 }
 
-- (id)initWithCapacity:(NSUInteger)capacity
+- (id)initWithCapacity:(NSUInteger)aCapacity
 {
 	self = [super init];
 	if (self != nil)
 	{
-		dictionary = [[NSMutableDictionary alloc] initWithCapacity:capacity];
-		array = [[NSMutableArray alloc] initWithCapacity:capacity];
+		[self resizeToCapacity:MAX(aCapacity, OrderedDictionaryMinimumCapacity)];
 	}
 	return self;
 }
 
 - (void)dealloc
 {
+	[self releaseEntries];
+	free(keys);
 #if !__has_feature(objc_arc)
-	[dictionary release];
-	[array release];
 	[super dealloc];
 #endif
 }
@@ -85,54 +127,321 @@ NSString *DescriptionForObject(NSObject *object, id locale, NSUInteger indent)
 	return [self mutableCopy];
 }
 
+#pragma mark - Storage
+
+- (void)releaseEntries
+{
+	for (NSUInteger i = 0; i < used; i++)
+	{
+		if (keys[i])
+		{
+			CFRelease(keys[i]);
+			CFRelease(values[i]);
+		}
+	}
+}
+
+- (void)rebuildSlots
+{
+	memset(slots, 0, slotCount * sizeof(NSUInteger));
+	NSUInteger mask = slotCount - 1;
+	for (NSUInteger i = 0; i < used; i++)
+	{
+		NSUInteger slot = hashes[i] & mask;
+		while (slots[slot] != OrderedDictionaryEmptySlot)
+		{
+			slot = (slot + 1) & mask;
+		}
+		slots[slot] = i + 1;
+	}
+}
+
+// Moves the remaining entries together, dropping the holes left by removals,
+// into storage with room for newCapacity entries, and rebuilds the table.
+- (void)resizeToCapacity:(NSUInteger)newCapacity
+{
+	NSUInteger newSlotCount = 8;
+	while (newSlotCount < 2 * newCapacity)
+	{
+		newSlotCount *= 2;
+	}
+	char *storage = malloc(newCapacity * (2 * sizeof(CFTypeRef) + sizeof(NSUInteger))
+		+ newSlotCount * sizeof(NSUInteger));
+	CFTypeRef *newKeys = (CFTypeRef *)storage;
+	CFTypeRef *newValues = newKeys + newCapacity;
+	NSUInteger *newHashes = (NSUInteger *)(newValues + newCapacity);
+
+	NSUInteger j = 0;
+	for (NSUInteger i = 0; i < used; i++)
+	{
+		if (keys[i])
+		{
+			newKeys[j] = keys[i];
+			newValues[j] = values[i];
+			newHashes[j] = hashes[i];
+			j++;
+		}
+	}
+	free(keys);
+
+	keys = newKeys;
+	values = newValues;
+	hashes = newHashes;
+	slots = newHashes + newCapacity;
+	capacity = newCapacity;
+	slotCount = newSlotCount;
+	used = j;
+	[self rebuildSlots];
+}
+
+- (void)compact
+{
+	if (used != entryCount)
+	{
+		[self resizeToCapacity:capacity];
+	}
+}
+
+// Returns the slot holding aKey, or NSNotFound
+- (NSUInteger)slotForKey:(CFTypeRef)aKey hash:(NSUInteger)hash
+{
+	NSUInteger mask = slotCount - 1;
+	NSUInteger slot = hash & mask;
+	NSUInteger entry;
+	while ((entry = slots[slot]) != OrderedDictionaryEmptySlot)
+	{
+		if (entry != OrderedDictionaryDeletedSlot
+			&& hashes[entry - 1] == hash
+			&& OrderedDictionaryKeysEqual(keys[entry - 1], aKey))
+		{
+			return slot;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return NSNotFound;
+}
+
+- (void)appendKey:(CFTypeRef)aKey value:(CFTypeRef)anObject hash:(NSUInteger)hash
+{
+	if (used == capacity)
+	{
+		// Reclaim the holes if there are enough of them, or else grow
+		[self resizeToCapacity:entryCount < capacity * 3 / 4 ? capacity : capacity * 2];
+	}
+	keys[used] = aKey;
+	values[used] = anObject;
+	hashes[used] = hash;
+	NSUInteger mask = slotCount - 1;
+	NSUInteger slot = hash & mask;
+	while (slots[slot] != OrderedDictionaryEmptySlot && slots[slot] != OrderedDictionaryDeletedSlot)
+	{
+		slot = (slot + 1) & mask;
+	}
+	slots[slot] = ++used;
+	entryCount++;
+}
+
+// Dictionaries copy their keys
+- (CFTypeRef)retainedCopyOfKey:(id)aKey
+{
+	id keyCopy = [aKey copy];
+	CFTypeRef result = CFRetain((__bridge CFTypeRef)keyCopy);
+#if !__has_feature(objc_arc)
+	[keyCopy release];
+#endif
+	return result;
+}
+
+#pragma mark - Primitive methods
+
 - (void)setObject:(id)anObject forKey:(id)aKey
 {
-	if (![dictionary objectForKey:aKey])
+	if (!anObject || !aKey)
+	{
+		[NSException raise:NSInvalidArgumentException
+			format:@"*** -[%@ setObject:forKey:]: %@ cannot be nil",
+			[self class], anObject ? @"key" : @"object"];
+	}
+	NSUInteger hash = [aKey hash];
+	NSUInteger slot = [self slotForKey:(__bridge CFTypeRef)aKey hash:hash];
+	CFTypeRef value = CFRetain((__bridge CFTypeRef)anObject);
+	if (slot != NSNotFound)
 	{
-		[array addObject:aKey];
+		NSUInteger entry = slots[slot] - 1;
+		CFRelease(values[entry]);
+		values[entry] = value;
+		return;
 	}
-	[dictionary setObject:anObject forKey:aKey];
+	[self appendKey:[self retainedCopyOfKey:aKey] value:value hash:hash];
+	mutations++;
 }
 
 - (void)removeObjectForKey:(id)aKey
 {
-	[dictionary removeObjectForKey:aKey];
-	[array removeObject:aKey];
+	if (!aKey)
+	{
+		return;
+	}
+	NSUInteger slot = [self slotForKey:(__bridge CFTypeRef)aKey hash:[aKey hash]];
+	if (slot == NSNotFound)
+	{
+		return;
+	}
+	NSUInteger entry = slots[slot] - 1;
+	CFTypeRef key = keys[entry];
+	CFTypeRef value = values[entry];
+	keys[entry] = NULL;
+	values[entry] = NULL;
+	slots[slot] = OrderedDictionaryDeletedSlot;
+	entryCount--;
+	mutations++;
+	if (used - entryCount > used / 4)
+	{
+		[self compact];
+	}
+	// Release last, since the key may be an object the caller doesn't own
+	CFRelease(key);
+	CFRelease(value);
+}
+
+- (void)removeAllObjects
+{
+	[self releaseEntries];
+	used = 0;
+	entryCount = 0;
+	mutations++;
+	memset(slots, 0, slotCount * sizeof(NSUInteger));
 }
 
 - (NSUInteger)count
 {
-	return [dictionary count];
+	return entryCount;
 }
 
 - (id)objectForKey:(id)aKey
 {
-	return [dictionary objectForKey:aKey];
+	if (!aKey)
+	{
+		return nil;
+	}
+	NSUInteger slot = [self slotForKey:(__bridge CFTypeRef)aKey hash:[aKey hash]];
+	return slot == NSNotFound ? nil : (__bridge id)values[slots[slot] - 1];
+}
+
+- (NSArray *)orderedKeys
+{
+	CFArrayRef result;
+	if (used == entryCount)
+	{
+		result = CFArrayCreate(NULL, keys, entryCount, &kCFTypeArrayCallBacks);
+	}
+	else
+	{
+		CFTypeRef *presentKeys = malloc(entryCount * sizeof(CFTypeRef));
+		NSUInteger j = 0;
+		for (NSUInteger i = 0; i < used; i++)
+		{
+			if (keys[i])
+			{
+				presentKeys[j++] = keys[i];
+			}
+		}
+		result = CFArrayCreate(NULL, presentKeys, entryCount, &kCFTypeArrayCallBacks);
+		free(presentKeys);
+	}
+#if __has_feature(objc_arc)
+	return (__bridge_transfer NSArray *)result;
+#else
+	return [(NSArray *)result autorelease];
+#endif
 }
 
 - (NSEnumerator *)keyEnumerator
 {
-	return [array objectEnumerator];
+	return [[self orderedKeys] objectEnumerator];
 }
 
 - (NSEnumerator *)reverseKeyEnumerator
 {
-	return [array reverseObjectEnumerator];
+	return [[self orderedKeys] reverseObjectEnumerator];
+}
+
+- (NSUInteger)countByEnumeratingWithState:(NSFastEnumerationState *)state
+	objects:(__unsafe_unretained id [])buffer
+	count:(NSUInteger)length
+{
+	// state->state is the index of the next entry to look at
+	NSUInteger i = state->state;
+	state->mutationsPtr = &mutations;
+	if (used == entryCount)
+	{
+		// Without holes, the keys can be returned in place, all at once
+		state->itemsPtr = (__unsafe_unretained id *)(void *)(keys + i);
+		state->state = used;
+		return used - i;
+	}
+	NSUInteger n = 0;
+	for (; i < used && n < length; i++)
+	{
+		if (keys[i])
+		{
+			buffer[n++] = (__bridge id)keys[i];
+		}
+	}
+	state->itemsPtr = buffer;
+	state->state = i;
+	return n;
 }
 
 - (void)insertObject:(id)anObject forKey:(id)aKey atIndex:(NSUInteger)anIndex
 {
-	if ([dictionary objectForKey:aKey])
+	if ([self objectForKey:aKey])
 	{
 		[self removeObjectForKey:aKey];
 	}
-	[array insertObject:aKey atIndex:anIndex];
-	[dictionary setObject:anObject forKey:aKey];
+	if (anIndex > entryCount)
+	{
+		[NSException raise:NSRangeException
+			format:@"*** -[%@ insertObject:forKey:atIndex:]: index %lu beyond bounds [0 .. %lu]",
+			[self class], (unsigned long)anIndex, (unsigned long)entryCount];
+	}
+	[self setObject:anObject forKey:aKey];
+	// The new entry is last; rotate it into place
+	[self compact];
+	NSUInteger last = used - 1;
+	CFTypeRef key = keys[last];
+	CFTypeRef value = values[last];
+	NSUInteger hash = hashes[last];
+	memmove(keys + anIndex + 1, keys + anIndex, (last - anIndex) * sizeof(CFTypeRef));
+	memmove(values + anIndex + 1, values + anIndex, (last - anIndex) * sizeof(CFTypeRef));
+	memmove(hashes + anIndex + 1, hashes + anIndex, (last - anIndex) * sizeof(NSUInteger));
+	keys[anIndex] = key;
+	values[anIndex] = value;
+	hashes[anIndex] = hash;
+	[self rebuildSlots];
 }
 
 - (id)keyAtIndex:(NSUInteger)anIndex
 {
-	return [array objectAtIndex:anIndex];
+	if (anIndex >= entryCount)
+	{
+		[NSException raise:NSRangeException
+			format:@"*** -[%@ keyAtIndex:]: index %lu beyond bounds [0 .. %lu]",
+			[self class], (unsigned long)anIndex, (unsigned long)entryCount - 1];
+	}
+	if (used == entryCount)
+	{
+		return (__bridge id)keys[anIndex];
+	}
+	NSUInteger i = 0;
+	for (;; i++)
+	{
+		if (keys[i] && anIndex-- == 0)
+		{
+			break;
+		}
+	}
+	return (__bridge id)keys[i];
 }
 
 //
@@ -0,0 +1,113 @@
+//
+//  BSONAppendTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_Append.h"
+#import "NSString+BSONAdditions.h"
+
+@interface BSONAppendTest : XCTestCase
+
+@end
+
+@implementation BSONAppendTest
+
+- (void) testScanCopy {
+    const char *source = "a fairly long string with a . somewhere past the first vector block";
+    size_t length = strlen(source);
+    char destination[128];
+    BOOL hasDot = NO;
+    XCTAssertEqual(length, BSONScanCopy(destination, source, length, &hasDot));
+    XCTAssertTrue(hasDot);
+    XCTAssertEqual(0, memcmp(source, destination, length));
+    
+    hasDot = NO;
+    XCTAssertEqual((size_t) 27, BSONScanCopy(NULL, source, 27, &hasDot));
+    XCTAssertFalse(hasDot, @"Only bytes within the length should be scanned");
+    
+    const char withNul[] = "0123456789abcdefghijklmnopqrstuvwxyz\0.after";
+    hasDot = NO;
+    XCTAssertEqual((size_t) 36, BSONScanCopy(destination, withNul, sizeof(withNul) - 1, &hasDot));
+    XCTAssertFalse(hasDot, @"Scanning should stop at a NUL byte");
+}
+
+/**
+ Builds a document with the driver's functions and with the single-pass ones, which should match.
+ */
+- (void) testAppendMatchesDriver {
+    NSString *ascii = @"plain ASCII value which runs past a couple of vector blocks";
+    NSString *unicode = @"ünïcødé välüé ✓";
+    NSData *data = [@"binary" dataUsingEncoding:NSUTF8StringEncoding];
+    
+    bson expected;
+    bson_init(&expected);
+    bson_append_string(&expected, "ascii", [ascii bsonString]);
+    bson_append_string(&expected, "ünïcødé", [unicode bsonString]);
+    bson_append_symbol(&expected, "symbol", "sym");
+    bson_append_code(&expected, "code", "x = 1");
+    bson_append_double(&expected, "double", 1.5);
+    bson_append_int(&expected, "int", -7);
+    bson_append_long(&expected, "long", 3000000000LL);
+    bson_append_bool(&expected, "bool", 1);
+    bson_append_null(&expected, "null");
+    bson_append_date(&expected, "date", 1234567890123LL);
+    bson_append_binary(&expected, "binary", 0, data.bytes, (int) data.length);
+    bson_append_string(&expected, "$dollar.dot", "flags");
+    bson_finish(&expected);
+    
+    bson actual;
+    bson_init(&actual);
+    XCTAssertEqual(BSON_OK, BSONAppendString(&actual, BSON_STRING, "ascii", ascii));
+    XCTAssertEqual(BSON_OK, BSONAppendString(&actual, BSON_STRING, "ünïcødé", unicode));
+    XCTAssertEqual(BSON_OK, BSONAppendString(&actual, BSON_SYMBOL, "symbol", @"sym"));
+    XCTAssertEqual(BSON_OK, BSONAppendString(&actual, BSON_CODE, "code", @"x = 1"));
+    XCTAssertEqual(BSON_OK, BSONAppendDouble(&actual, "double", 1.5));
+    XCTAssertEqual(BSON_OK, BSONAppendInt(&actual, "int", -7));
+    XCTAssertEqual(BSON_OK, BSONAppendLong(&actual, "long", 3000000000LL));
+    XCTAssertEqual(BSON_OK, BSONAppendBool(&actual, "bool", YES));
+    XCTAssertEqual(BSON_OK, BSONAppendNull(&actual, "null"));
+    XCTAssertEqual(BSON_OK, BSONAppendDate(&actual, "date", 1234567890123LL));
+    XCTAssertEqual(BSON_OK, BSONAppendBinary(&actual, "binary", 0, data.bytes, (int) data.length));
+    XCTAssertEqual(BSON_OK, BSONAppendString(&actual, BSON_STRING, "$dollar.dot", @"flags"));
+    bson_finish(&actual);
+    
+    XCTAssertEqual(bson_size(&expected), bson_size(&actual));
+    XCTAssertEqual(0, memcmp(bson_data(&expected), bson_data(&actual), bson_size(&expected)));
+    XCTAssertEqual(expected.err, actual.err);
+    XCTAssertTrue(actual.err & BSON_FIELD_HAS_DOT);
+    XCTAssertTrue(actual.err & BSON_FIELD_INIT_DOLLAR);
+    
+    bson_destroy(&expected);
+    bson_destroy(&actual);
+}
+
+- (void) testAppendStringStopsAtNul {
+    bson b;
+    bson_init(&b);
+    unichar characters[] = { 'b', 'e', 'f', 'o', 'r', 'e', 0, 'a', 'f', 't', 'e', 'r' };
+    BSONAppendString(&b, BSON_STRING, "key", [NSString stringWithCharacters:characters length:12]);
+    bson_finish(&b);
+    bson_iterator it;
+    bson_iterator_init(&it, &b);
+    XCTAssertEqual(BSON_STRING, bson_iterator_next(&it));
+    XCTAssertEqual(0, strcmp("before", bson_iterator_string(&it)));
+    XCTAssertEqual(7, bson_iterator_string_len(&it));
+    bson_destroy(&b);
+}
+
+@end
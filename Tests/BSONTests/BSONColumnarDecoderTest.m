@@ -0,0 +1,129 @@
+//
+//  BSONColumnarDecoderTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_Helper.h"
+#import "BSONColumnarDecoder.h"
+#import "BSONEncoder.h"
+#import "BSONDocument.h"
+#import "BSONTypes.h"
+
+@interface BSONColumnarDecoderTest : XCTestCase
+
+@end
+
+@implementation BSONColumnarDecoderTest
+
++ (NSArray *) sampleDocuments {
+    NSMutableArray *result = [NSMutableArray array];
+    for (int i = 0; i < 300; ++i) {
+        NSMutableDictionary *row = [NSMutableDictionary dictionary];
+        [row setObject:[NSNumber numberWithDouble:i * 0.5] forKey:@"price"];
+        [row setObject:[NSNumber numberWithInt:i] forKey:@"quantity"];
+        [row setObject:[NSNumber numberWithLongLong:1LL << 40 | i] forKey:@"serial"];
+        [row setObject:[NSNumber numberWithBool:i % 2] forKey:@"shipped"];
+        [row setObject:[NSDate dateWithTimeIntervalSince1970:i] forKey:@"when"];
+        [row setObject:@{ @"zip" : [NSString stringWithFormat:@"%05d", i], @"floor" : @(i % 7) } forKey:@"address"];
+        [row setObject:@[ @"first", [NSString stringWithFormat:@"second %d", i] ] forKey:@"lines"];
+        // Every third document lacks a name, and every fifth has a number instead
+        if (i % 3)
+            [row setObject:(i % 5 ? (id) [NSString stringWithFormat:@"Name %d", i] : (id) @5) forKey:@"name"];
+        [result addObject:[BSONEncoder documentForDictionary:row]];
+    }
+    return result;
+}
+
+- (void) testDecodesColumns {
+    BSONColumnarDecoder *decoder = [[BSONColumnarDecoder alloc] init];
+    BSONColumn *price = [decoder addColumnWithKeyPath:@"price" type:BSONTypeDouble];
+    BSONColumn *quantity = [decoder addColumnWithKeyPath:@"quantity" type:BSONTypeInteger];
+    BSONColumn *quantityAsDouble = [decoder addColumnWithKeyPath:@"quantity" type:BSONTypeDouble];
+    BSONColumn *serial = [decoder addColumnWithKeyPath:@"serial" type:BSONTypeLong];
+    BSONColumn *shipped = [decoder addColumnWithKeyPath:@"shipped" type:BSONTypeBoolean];
+    BSONColumn *when = [decoder addColumnWithKeyPath:@"when" type:BSONTypeDate];
+    BSONColumn *zip = [decoder addColumnWithKeyPath:@"address.zip" type:BSONTypeString];
+    BSONColumn *floor = [decoder addColumnWithKeyPath:@"address.floor" type:BSONTypeInteger];
+    BSONColumn *line = [decoder addColumnWithKeyPath:@"lines.1" type:BSONTypeString];
+    BSONColumn *name = [decoder addColumnWithKeyPath:@"name" type:BSONTypeString];
+    BSONColumn *missing = [decoder addColumnWithKeyPath:@"address.zip.plus4" type:BSONTypeInteger];
+
+    XCTAssertEqual((NSUInteger) 300, [decoder appendDocuments:[[self class] sampleDocuments]]);
+    XCTAssertEqual((NSUInteger) 300, decoder.count);
+    XCTAssertEqual((NSUInteger) 300, name.count);
+    XCTAssertEqual(name, [decoder columnForKeyPath:@"name"]);
+
+    XCTAssertTrue(NULL == [price int64Values]);
+    XCTAssertTrue(NULL == [name doubleValues]);
+    for (NSUInteger i = 0; i < 300; ++i) {
+        XCTAssertEqual(i * 0.5, [price doubleValues][i]);
+        XCTAssertEqual((int32_t) i, [quantity int32Values][i]);
+        XCTAssertEqual((double) i, [quantityAsDouble doubleValues][i]);
+        XCTAssertEqual((int64_t) (1LL << 40 | i), [serial int64Values][i]);
+        XCTAssertEqual((BOOL) (i % 2), [shipped boolValues][i]);
+        XCTAssertEqual((int64_t) i * 1000, [when int64Values][i]);
+        XCTAssertEqualObjects(([NSString stringWithFormat:@"%05lu", (unsigned long) i]), [zip stringAtIndex:i]);
+        XCTAssertEqual((int32_t) (i % 7), [floor int32Values][i]);
+        XCTAssertEqualObjects(([NSString stringWithFormat:@"second %lu", (unsigned long) i]), [line stringAtIndex:i]);
+        XCTAssertFalse([price isNullAtIndex:i]);
+        XCTAssertTrue([missing isNullAtIndex:i]);
+        XCTAssertEqual(0, [missing int32Values][i]);
+        if (i % 3 && i % 5)
+            XCTAssertEqualObjects(([NSString stringWithFormat:@"Name %lu", (unsigned long) i]), [name stringAtIndex:i]);
+        else {
+            XCTAssertTrue([name isNullAtIndex:i]);
+            XCTAssertNil([name stringAtIndex:i]);
+            XCTAssertEqual([name stringOffsets][i], [name stringOffsets][i + 1]);
+        }
+    }
+    maybe_release(decoder);
+}
+
+- (void) testKeyPathsSplitLikeCompiledKeyPaths {
+    BSONColumnarDecoder *decoder = [[BSONColumnarDecoder alloc] init];
+    // UTF-8 conversion stops at the NUL, as it does for a compiled key path
+    NSString *withNUL = [NSString stringWithFormat:@"address.zip%C.plus4", (unichar) 0];
+    BSONColumn *truncated = [decoder addColumnWithKeyPath:withNUL type:BSONTypeString];
+    BSONColumn *zip = [decoder addColumnWithKeyPath:@"address.zip" type:BSONTypeString];
+    XCTAssertThrows([decoder addColumnWithKeyPath:[NSString stringWithFormat:@"%C", (unichar) 0xd800] type:BSONTypeString]);
+    
+    XCTAssertEqual((NSUInteger) 300, [decoder appendDocuments:[[self class] sampleDocuments]]);
+    for (NSUInteger i = 0; i < 300; ++i)
+        XCTAssertEqualObjects([zip stringAtIndex:i], [truncated stringAtIndex:i]);
+    maybe_release(decoder);
+}
+
+- (void) testBatches {
+    BSONColumnarDecoder *decoder = [[BSONColumnarDecoder alloc] init];
+    BSONColumn *quantity = [decoder addColumnWithKeyPath:@"quantity" type:BSONTypeInteger];
+    NSEnumerator *enumerator = [[[self class] sampleDocuments] objectEnumerator];
+    NSUInteger total = 0;
+    NSUInteger count;
+    while ((count = [decoder appendDocumentsFromEnumerator:enumerator maximumCount:128])) {
+        XCTAssertEqual(count, quantity.count);
+        XCTAssertEqual((int32_t) total, [quantity int32Values][0]);
+        total += count;
+        [decoder removeAllRows];
+        XCTAssertEqual((NSUInteger) 0, quantity.count);
+    }
+    XCTAssertEqual((NSUInteger) 300, total);
+    XCTAssertThrows([decoder addColumnWithKeyPath:@"price" type:BSONTypeObjectID]);
+    maybe_release(decoder);
+}
+
+@end
@@ -0,0 +1,96 @@
+//
+//  BSONCompiledKeyPathTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_Helper.h"
+#import "BSONCompiledKeyPath.h"
+#import "BSONEncoder.h"
+#import "BSONDocument.h"
+#import "BSONIterator.h"
+
+@interface BSONCompiledKeyPathTest : XCTestCase
+
+@end
+
+@implementation BSONCompiledKeyPathTest
+
++ (BSONDocument *) sampleDocument {
+    NSMutableDictionary *wide = [NSMutableDictionary dictionary];
+    for (int i = 0; i < 20; ++i)
+        [wide setObject:[NSNumber numberWithInt:i] forKey:[NSString stringWithFormat:@"field%d", i]];
+    [wide setObject:@{ @"b" : @[ @"zero", @"one", @"two", @{ @"c" : @"found" } ] } forKey:@"a"];
+    [wide setObject:@"flat" forKey:@"x"];
+    [wide setObject:@{ @"y" : [NSNull null] } forKey:@"w"];
+    return [BSONEncoder documentForDictionary:wide];
+}
+
+- (void) testKeyPathLookup {
+    BSONDocument *document = [[self class] sampleDocument];
+    XCTAssertEqualObjects(@"found", [document objectForKeyPath:@"a.b.3.c"]);
+    XCTAssertEqualObjects(@"two", [document objectForKeyPath:@"a.b.2"]);
+    XCTAssertEqualObjects(@"flat", [document objectForKeyPath:@"x"]);
+    XCTAssertEqualObjects([NSNumber numberWithInt:7], [document objectForKeyPath:@"field7"]);
+    XCTAssertEqualObjects([NSNull null], [document objectForKeyPath:@"w.y"]);
+    
+    XCTAssertNil([document objectForKeyPath:@"a.b.4"]);
+    XCTAssertNil([document objectForKeyPath:@"a.c"]);
+    XCTAssertNil([document objectForKeyPath:@"x.y"]);
+    XCTAssertNil([document objectForKeyPath:@"a.b.3.c.d"]);
+    XCTAssertNil([document objectForKeyPath:@"missing"]);
+    XCTAssertNil([document objectForKeyPath:@""]);
+    
+    BSONIterator *iterator = [document iterator];
+    XCTAssertEqual(BSONTypeArray, [iterator valueTypeForKeyPath:@"a.b"]);
+    XCTAssertEqual(BSONTypeEmbeddedDocument, [iterator valueTypeForKeyPath:@"a.b.3"]);
+    XCTAssertEqual(BSONTypeString, [iterator valueTypeForKeyPath:@"a.b.3.c"]);
+    XCTAssertEqualObjects(@"found", [iterator stringValue]);
+    XCTAssertEqual(BSONTypeEndOfObject, [iterator valueTypeForKeyPath:@"a.b.9"]);
+    // Keyed searching still works afterwards
+    XCTAssertEqualObjects(@"flat", [iterator objectForKey:@"x"]);
+}
+
+- (void) testKeyPathLookupWithinEmbeddedObject {
+    BSONIterator *iterator = [[[self class] sampleDocument] iterator];
+    [iterator valueTypeForKey:@"a"];
+    [iterator enterEmbeddedObject];
+    XCTAssertEqualObjects(@"found", [iterator objectForKeyPath:@"b.3.c"]);
+    XCTAssertNil([iterator objectForKeyPath:@"a.b"]);
+}
+
+- (void) testCompiledKeyPath {
+    BSONCompiledKeyPath *keyPath = [BSONCompiledKeyPath keyPathWithString:@"a.b.3.c"];
+    XCTAssertEqual((NSUInteger) 4, keyPath.componentCount);
+    XCTAssertEqualObjects(@"a.b.3.c", keyPath.string);
+    XCTAssertEqualObjects(keyPath, [BSONCompiledKeyPath keyPathWithString:@"a.b.3.c"]);
+    BSONCompiledKeyPath *copy = [keyPath copy];
+    XCTAssertEqual(keyPath, copy);
+    maybe_release(copy);
+    
+    BSONDocument *document = [[self class] sampleDocument];
+    XCTAssertEqualObjects(@"found", [document objectForCompiledKeyPath:keyPath]);
+    XCTAssertEqualObjects([NSNumber numberWithInt:19],
+                          [document objectForCompiledKeyPath:[BSONCompiledKeyPath keyPathWithString:@"field19"]]);
+    XCTAssertNil([document objectForCompiledKeyPath:[BSONCompiledKeyPath keyPathWithString:@"field20"]]);
+    
+    BSONIterator *iterator = [document iterator];
+    for (int i = 0; i < 3; ++i)
+        XCTAssertEqual(BSONTypeString, [iterator valueTypeForCompiledKeyPath:keyPath]);
+}
+
+@end
@@ -0,0 +1,102 @@
+//
+//  BSONDecodingSessionTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_Helper.h"
+#import "BSONDecodingSession.h"
+#import "BSONEncoder.h"
+#import "BSONDecoder.h"
+#import "BSONDocument.h"
+#import "BSONIterator.h"
+
+@interface BSONDecodingSessionTest : XCTestCase
+
+@end
+
+@implementation BSONDecodingSessionTest
+
++ (NSDictionary *) sampleWithIndex:(int) i {
+    return @{
+             @"status" : i % 2 ? @"awaiting review" : @"approved",
+             @"name" : [NSString stringWithFormat:@"A name which is too long to be cached, number %d", i],
+             @"priority" : [NSNumber numberWithInt:i % 3],
+             @"total" : [NSNumber numberWithLongLong:i % 3],
+             @"large" : [NSNumber numberWithInt:100000 + i],
+             @"tags" : @[ @"awaiting review", @{ @"status" : @"approved" } ],
+             };
+}
+
+- (NSDictionary *) decodeSampleWithIndex:(int) i session:(BSONDecodingSession *) session {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] sampleWithIndex:i]];
+    BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document session:session];
+    NSDictionary *result = [decoder decodeDictionary];
+    maybe_release(decoder);
+    return result;
+}
+
+- (void) testMatchesDecodingWithoutSession {
+    BSONDecodingSession *session = [BSONDecodingSession session];
+    for (int i = 0; i < 4; ++i) {
+        NSDictionary *sample = [[self class] sampleWithIndex:i];
+        XCTAssertEqualObjects(sample, [self decodeSampleWithIndex:i session:session]);
+        XCTAssertEqualObjects(sample, [self decodeSampleWithIndex:i session:nil]);
+    }
+}
+
+- (void) testSharesObjectsAcrossDocuments {
+    BSONDecodingSession *session = [BSONDecodingSession session];
+    NSDictionary *first = [self decodeSampleWithIndex:1 session:session];
+    NSDictionary *second = [self decodeSampleWithIndex:3 session:session];
+    XCTAssertEqual([first objectForKey:@"status"], [second objectForKey:@"status"]);
+    XCTAssertEqual([first objectForKey:@"priority"], [second objectForKey:@"priority"]);
+    XCTAssertEqual([first objectForKey:@"total"], [second objectForKey:@"total"]);
+    XCTAssertEqual([[first objectForKey:@"tags"] objectAtIndex:0], [second objectForKey:@"status"],
+                   @"Embedded arrays should use the session");
+    XCTAssertNotEqual([first objectForKey:@"name"], [second objectForKey:@"name"]);
+    XCTAssertTrue(session.hitCount > 0);
+}
+
+- (void) testPreservesNumberTypes {
+    BSONDecodingSession *session = [BSONDecodingSession session];
+    NSDictionary *result = [self decodeSampleWithIndex:2 session:session];
+    XCTAssertEqual(*[[result objectForKey:@"priority"] objCType], *@encode(int));
+    XCTAssertEqual(*[[result objectForKey:@"total"] objCType], *@encode(long long));
+    XCTAssertEqualObjects([result objectForKey:@"large"], @100002);
+}
+
+- (void) testCounts {
+    BSONDecodingSession *session = [BSONDecodingSession session];
+    BSONIterator *iterator = [[BSONEncoder documentForDictionary:@{ @"a" : @"short", @"b" : @"short" }] iterator];
+    iterator.session = session;
+    [iterator next];
+    XCTAssertEqualObjects(@"short", [iterator objectValue]);
+    XCTAssertEqual((NSUInteger) 0, session.hitCount);
+    XCTAssertEqual((NSUInteger) 1, session.missCount);
+    [iterator next];
+    XCTAssertNotNil([iterator key]);
+    XCTAssertEqualObjects(@"short", [iterator objectValue]);
+    XCTAssertEqual((NSUInteger) 1, session.hitCount);
+    XCTAssertEqual((NSUInteger) 2, session.missCount);
+
+    [session removeAllObjects];
+    XCTAssertEqualObjects(@"short", [iterator objectValue]);
+    XCTAssertEqual((NSUInteger) 3, session.missCount);
+}
+
+@end
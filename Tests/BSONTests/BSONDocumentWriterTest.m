@@ -0,0 +1,132 @@
+//
+//  BSONDocumentWriterTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import <fcntl.h>
+#import "BSON_Helper.h"
+#import "BSONDocumentWriter.h"
+#import "BSONEncoder.h"
+#import "BSONDocument.h"
+
+@interface BSONDocumentWriterTest : XCTestCase
+
+@end
+
+@implementation BSONDocumentWriterTest
+
++ (NSArray *) sampleObjects {
+    NSMutableArray *result = [NSMutableArray array];
+    for (int i = 0; i < 100; ++i)
+        [result addObject:@{ @"index" : [NSNumber numberWithInt:i],
+                             @"name" : [NSString stringWithFormat:@"document %d", i] }];
+    // Larger than the buffer in the tests below
+    [result addObject:@{ @"padding" : [@"" stringByPaddingToLength:5000 withString:@"p" startingAtIndex:0] }];
+    return result;
+}
+
+/**
+ Splits concatenated BSON, as in a mongodump file, into documents.
+ */
++ (NSArray *) documentsWithConcatenatedData:(NSData *) data {
+    NSMutableArray *result = [NSMutableArray array];
+    NSUInteger offset = 0;
+    while (offset + 4 <= data.length) {
+        int32_t length;
+        [data getBytes:&length range:NSMakeRange(offset, 4)];
+        length = OSSwapLittleToHostInt32(length);
+        NSData *documentData = [data subdataWithRange:NSMakeRange(offset, length)];
+        [result addObject:[BSONDocument documentWithData:documentData]];
+        offset += length;
+    }
+    return offset == data.length ? result : nil;
+}
+
+- (void) testWriteToOutputStream {
+    NSOutputStream *stream = [NSOutputStream outputStreamToMemory];
+    BSONDocumentWriter *writer = [[BSONDocumentWriter alloc] initWithOutputStream:stream bufferCapacity:1024];
+    NSArray *objects = [[self class] sampleObjects];
+    NSError *error = nil;
+    for (id object in objects)
+        XCTAssertTrue([writer writeObject:object error:&error], @"%@", error);
+    XCTAssertEqual((unsigned long long) objects.count, writer.documentCount);
+    XCTAssertTrue([writer close:&error], @"%@", error);
+    
+    NSData *data = [stream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+    XCTAssertEqual((unsigned long long) data.length, writer.byteCount);
+    NSArray *documents = [[self class] documentsWithConcatenatedData:data];
+    XCTAssertEqual(objects.count, documents.count);
+    for (NSUInteger i = 0; i < objects.count; ++i)
+        XCTAssertEqualObjects([objects objectAtIndex:i], [[documents objectAtIndex:i] dictionaryValue]);
+    maybe_release(writer);
+}
+
+- (void) testWriteToFileDescriptor {
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                      [NSString stringWithFormat:@"BSONDocumentWriterTest-%d.bson", getpid()]];
+    int fd = open([path fileSystemRepresentation], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    XCTAssertTrue(fd >= 0);
+    
+    BSONDocumentWriter *writer = [[BSONDocumentWriter alloc] initWithFileDescriptor:fd
+                                                                     closeOnDealloc:YES
+                                                                     bufferCapacity:1024];
+    writer.documentsPerSync = 16;
+    NSArray *objects = [[self class] sampleObjects];
+    NSError *error = nil;
+    for (id object in objects) {
+        BSONDocument *document = [BSONEncoder documentForObject:object];
+        XCTAssertTrue([writer writeDocument:document error:&error], @"%@", error);
+    }
+    XCTAssertTrue([writer close:&error], @"%@", error);
+    XCTAssertThrows([writer writeObject:[objects lastObject] error:NULL]);
+    maybe_release(writer);
+    
+    NSArray *documents = [[self class] documentsWithConcatenatedData:[NSData dataWithContentsOfFile:path]];
+    XCTAssertEqual(objects.count, documents.count);
+    XCTAssertEqualObjects([objects objectAtIndex:42], [[documents objectAtIndex:42] dictionaryValue]);
+    [[NSFileManager defaultManager] removeItemAtPath:path error:NULL];
+}
+
+- (void) testWriteErrorIsReported {
+    int pipeEnds[2];
+    XCTAssertEqual(0, pipe(pipeEnds));
+    close(pipeEnds[0]);
+    signal(SIGPIPE, SIG_IGN);
+    
+    BSONDocumentWriter *writer = [[BSONDocumentWriter alloc] initWithFileDescriptor:pipeEnds[1] closeOnDealloc:YES];
+    NSError *error = nil;
+    XCTAssertTrue([writer writeObject:@{ @"buffered" : @YES } error:&error]);
+    XCTAssertFalse([writer flush:&error]);
+    XCTAssertEqualObjects(NSPOSIXErrorDomain, error.domain);
+    XCTAssertEqual((NSInteger) EPIPE, error.code);
+    maybe_release(writer);
+}
+
+- (void) testEncodingExceptionLeavesWriterUsable {
+    NSOutputStream *stream = [NSOutputStream outputStreamToMemory];
+    BSONDocumentWriter *writer = [[BSONDocumentWriter alloc] initWithOutputStream:stream];
+    XCTAssertThrows([writer writeObject:@{ @"$bad" : @1 } error:NULL]);
+    XCTAssertTrue([writer writeObject:@{ @"good" : @1 } error:NULL]);
+    XCTAssertTrue([writer close:NULL]);
+    NSData *data = [stream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+    NSArray *documents = [[self class] documentsWithConcatenatedData:data];
+    XCTAssertEqualObjects((@[ @{ @"good" : @1 } ]), [documents valueForKey:@"dictionaryValue"]);
+    maybe_release(writer);
+}
+
+@end
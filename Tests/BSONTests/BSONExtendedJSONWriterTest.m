@@ -0,0 +1,169 @@
+//
+//  BSONExtendedJSONWriterTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_Helper.h"
+#import "BSONExtendedJSONWriter.h"
+#import "BSONEncoder.h"
+#import "BSONDocument.h"
+#import "BSONTypes.h"
+
+@interface BSONExtendedJSONWriterTest : XCTestCase
+
+@end
+
+@implementation BSONExtendedJSONWriterTest
+
+/**
+ A document with one element of each type, in a fixed order.
+ */
++ (BSONDocument *) sampleDocument {
+    BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+    [encoder encodeObjectID:[BSONObjectID objectIDWithString:@"56e1fc72e0c917e9c4714161"] forKey:@"_id"];
+    [encoder encodeString:@"say \"hi\"\n\u00e9" forKey:@"string"];
+    [encoder encodeInt:-42 forKey:@"int"];
+    [encoder encodeInt64:3000000000LL forKey:@"long"];
+    [encoder encodeDouble:1.5 forKey:@"double"];
+    [encoder encodeDouble:2 forKey:@"wholeDouble"];
+    [encoder encodeBool:YES forKey:@"bool"];
+    [encoder encodeNullForKey:@"null"];
+    [encoder encodeDate:[NSDate dateWithTimeIntervalSince1970:1356351330.5] forKey:@"date"];
+    [encoder encodeData:[@"abcd" dataUsingEncoding:NSUTF8StringEncoding] forKey:@"data"];
+    [encoder encodeArray:@[ @1, @"two" ] forKey:@"array"];
+    [encoder encodeDictionary:@{ @"key" : @"value" } forKey:@"embedded"];
+    [encoder encodeRegularExpressionPattern:@"^a" options:@"xi" forKey:@"pattern"];
+    [encoder encodeTimestamp:[BSONTimestamp timestampWithIncrement:2 timeInSeconds:1000] forKey:@"timestamp"];
+    [encoder encodeSymbol:[BSONSymbol symbol:@"symbol"] forKey:@"symbol"];
+    [encoder encodeCodeString:@"f()" forKey:@"code"];
+    BSONDocument *result = [encoder BSONDocument];
+    maybe_release(encoder);
+    return result;
+}
+
+- (void) testRelaxed {
+    NSString *expected =
+    @"{\"_id\":{\"$oid\":\"56e1fc72e0c917e9c4714161\"},\"string\":\"say \\\"hi\\\"\\n\u00e9\","
+    @"\"int\":-42,\"long\":3000000000,\"double\":1.5,\"wholeDouble\":2.0,\"bool\":true,\"null\":null,"
+    @"\"date\":{\"$date\":\"2012-12-24T12:15:30.500Z\"},"
+    @"\"data\":{\"$binary\":{\"base64\":\"YWJjZA==\",\"subType\":\"00\"}},"
+    @"\"array\":[1,\"two\"],\"embedded\":{\"key\":\"value\"},"
+    @"\"pattern\":{\"$regularExpression\":{\"pattern\":\"^a\",\"options\":\"ix\"}},"
+    @"\"timestamp\":{\"$timestamp\":{\"t\":1000,\"i\":2}},"
+    @"\"symbol\":{\"$symbol\":\"symbol\"},\"code\":{\"$code\":\"f()\"}}";
+    BSONDocument *document = [[self class] sampleDocument];
+    XCTAssertEqualObjects([document extendedJSONStringWithMode:BSONExtendedJSONModeRelaxed], expected);
+    
+    NSData *data = [expected dataUsingEncoding:NSUTF8StringEncoding];
+    NSDictionary *parsed = [NSJSONSerialization JSONObjectWithData:data options:0 error:NULL];
+    XCTAssertEqualObjects([parsed objectForKey:@"string"], @"say \"hi\"\n\u00e9");
+    XCTAssertEqualObjects([parsed objectForKey:@"long"], @3000000000LL);
+}
+
+- (void) testCanonical {
+    NSString *expected =
+    @"{\"_id\":{\"$oid\":\"56e1fc72e0c917e9c4714161\"},\"string\":\"say \\\"hi\\\"\\n\u00e9\","
+    @"\"int\":{\"$numberInt\":\"-42\"},\"long\":{\"$numberLong\":\"3000000000\"},"
+    @"\"double\":{\"$numberDouble\":\"1.5\"},\"wholeDouble\":{\"$numberDouble\":\"2.0\"},\"bool\":true,\"null\":null,"
+    @"\"date\":{\"$date\":{\"$numberLong\":\"1356351330500\"}},"
+    @"\"data\":{\"$binary\":{\"base64\":\"YWJjZA==\",\"subType\":\"00\"}},"
+    @"\"array\":[{\"$numberInt\":\"1\"},\"two\"],\"embedded\":{\"key\":\"value\"},"
+    @"\"pattern\":{\"$regularExpression\":{\"pattern\":\"^a\",\"options\":\"ix\"}},"
+    @"\"timestamp\":{\"$timestamp\":{\"t\":1000,\"i\":2}},"
+    @"\"symbol\":{\"$symbol\":\"symbol\"},\"code\":{\"$code\":\"f()\"}}";
+    XCTAssertEqualObjects([BSONExtendedJSONWriter stringWithDocument:[[self class] sampleDocument]
+                                                                mode:BSONExtendedJSONModeCanonical], expected);
+}
+
+- (void) testSpecialValues {
+    BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+    [encoder encodeDouble:INFINITY forKey:@"infinity"];
+    [encoder encodeDouble:-0.0 forKey:@"negativeZero"];
+    [encoder encodeDouble:0.1 forKey:@"tenth"];
+    [encoder encodeDate:[NSDate dateWithTimeIntervalSince1970:-1] forKey:@"before1970"];
+    [encoder encodeUndefinedForKey:@"undefined"];
+    [encoder encodeString:@"\t\x01" forKey:@"control"];
+    NSString *expected =
+    @"{\"infinity\":{\"$numberDouble\":\"Infinity\"},\"negativeZero\":-0.0,\"tenth\":0.1,"
+    @"\"before1970\":{\"$date\":{\"$numberLong\":\"-1000\"}},\"undefined\":{\"$undefined\":true},"
+    @"\"control\":\"\\t\\u0001\"}";
+    XCTAssertEqualObjects([[encoder BSONDocument] extendedJSONStringWithMode:BSONExtendedJSONModeRelaxed], expected);
+    maybe_release(encoder);
+}
+
+- (void) testAppendToReusedData {
+    BSONDocument *document = [BSONEncoder documentForDictionary:@{ @"a" : @1 }];
+    NSMutableData *data = [NSMutableData data];
+    [BSONExtendedJSONWriter appendDocument:document mode:BSONExtendedJSONModeRelaxed toData:data];
+    [BSONExtendedJSONWriter appendDocument:document mode:BSONExtendedJSONModeCanonical toData:data];
+    NSString *string = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+    XCTAssertEqualObjects(string, @"{\"a\":1}{\"a\":{\"$numberInt\":\"1\"}}");
+    maybe_release(string);
+    
+    // Larger than the stack buffer
+    NSString *padding = [@"" stringByPaddingToLength:5000 withString:@"p" startingAtIndex:0];
+    [data setLength:0];
+    [BSONExtendedJSONWriter appendDocument:[BSONEncoder documentForDictionary:@{ @"padding" : padding }]
+                                      mode:BSONExtendedJSONModeRelaxed
+                                    toData:data];
+    XCTAssertEqual(data.length, padding.length + 14);
+}
+
+- (void) testConcurrentConversion {
+    BSONDocument *document = [[self class] sampleDocument];
+    NSString *expected = [document extendedJSONStringWithMode:BSONExtendedJSONModeCanonical];
+    __block NSUInteger mismatches = 0;
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+        for (int i = 0; i < 1000; ++i) @autoreleasepool {
+            if (![[document extendedJSONStringWithMode:BSONExtendedJSONModeCanonical] isEqualToString:expected])
+                __sync_fetch_and_add(&mismatches, 1);
+        }
+    });
+    XCTAssertEqual(mismatches, (NSUInteger) 0);
+}
+
+- (void) testWriteToOutputStream {
+    NSOutputStream *stream = [NSOutputStream outputStreamToMemory];
+    BSONExtendedJSONWriter *writer = [[BSONExtendedJSONWriter alloc] initWithOutputStream:stream bufferCapacity:1024];
+    NSMutableArray *objects = [NSMutableArray array];
+    for (int i = 0; i < 100; ++i)
+        [objects addObject:@{ @"index" : [NSNumber numberWithInt:i] }];
+    // Larger than the buffer
+    [objects addObject:@{ @"padding" : [@"" stringByPaddingToLength:5000 withString:@"p" startingAtIndex:0] }];
+    NSError *error = nil;
+    for (NSDictionary *object in objects)
+        XCTAssertTrue([writer writeDocument:[BSONEncoder documentForDictionary:object] error:&error], @"%@", error);
+    XCTAssertEqual((unsigned long long) objects.count, writer.documentCount);
+    XCTAssertTrue([writer close:&error], @"%@", error);
+    XCTAssertThrows([writer writeDocument:[BSONDocument document] error:NULL]);
+    
+    NSData *data = [stream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+    XCTAssertEqual((unsigned long long) data.length, writer.byteCount);
+    NSString *output = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+    NSArray *lines = [output componentsSeparatedByString:@"\n"];
+    XCTAssertEqual(lines.count, objects.count + 1);
+    XCTAssertEqualObjects([lines lastObject], @"");
+    for (NSUInteger i = 0; i < objects.count; ++i) {
+        NSData *line = [[lines objectAtIndex:i] dataUsingEncoding:NSUTF8StringEncoding];
+        XCTAssertEqualObjects([NSJSONSerialization JSONObjectWithData:line options:0 error:NULL], [objects objectAtIndex:i]);
+    }
+    maybe_release(output);
+    maybe_release(writer);
+}
+
+@end
@@ -0,0 +1,184 @@
+//
+//  BSONKeyPathStackTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_Helper.h"
+#import "BSON_KeyPath.h"
+#import "BSONEncoder.h"
+#import "BSONDecoder.h"
+
+@interface BSONKeyPathStackTestDelegate : NSObject <BSONEncoderDelegate, BSONDecoderDelegate>
+@property (retain) NSMutableArray *keptKeyPaths;
+@property (retain) NSMutableArray *readKeyPaths;
+@end
+
+@implementation BSONKeyPathStackTestDelegate
+
+- (id) init {
+    if (self = [super init]) {
+        self.keptKeyPaths = [NSMutableArray array];
+        self.readKeyPaths = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (void) dealloc {
+    maybe_release(_keptKeyPaths);
+    maybe_release(_readKeyPaths);
+    super_dealloc;
+}
+
+// Keeps some key paths and only reads the others, so that the encoder's stack escapes now and then
+- (id) encoder:(BSONEncoder *) encoder willEncodeObject:(id) obj forKeyPath:(NSArray *) keyPathComponents {
+    if ([[keyPathComponents lastObject] hasPrefix:@"kept"])
+        [self.keptKeyPaths addObject:keyPathComponents];
+    else if (keyPathComponents)
+        [self.readKeyPaths addObject:[keyPathComponents componentsJoinedByString:@"."]];
+    return obj;
+}
+
+- (id) decoder:(BSONDecoder *) decoder didDecodeObject:(id) object forKeyPath:(NSArray *) keyPathComponents {
+    if ([[keyPathComponents lastObject] hasPrefix:@"kept"])
+        [self.keptKeyPaths addObject:keyPathComponents];
+    else if (keyPathComponents)
+        [self.readKeyPaths addObject:[keyPathComponents componentsJoinedByString:@"."]];
+    return object;
+}
+
+@end
+
+@interface BSONKeyPathStackTest : XCTestCase
+
+@end
+
+@implementation BSONKeyPathStackTest
+
+- (void) testPushPopAndPendingKey {
+    BSONKeyPathStack *stack = [[BSONKeyPathStack alloc] init];
+    XCTAssertEqual((NSUInteger) 0, stack.count);
+    
+    for (int i = 0; i < 20; ++i)
+        [stack pushKey:[NSString stringWithFormat:@"key%d", i]];
+    XCTAssertEqual((NSUInteger) 20, stack.depth);
+    XCTAssertEqualObjects(@"key19", stack.lastObject);
+    
+    [stack setPendingKey:@"pending"];
+    XCTAssertEqual((NSUInteger) 20, stack.depth);
+    XCTAssertEqual((NSUInteger) 21, stack.count);
+    XCTAssertEqualObjects(@"pending", stack.lastObject);
+    XCTAssertEqual((NSUInteger) 20, stack.pushedKeys.count);
+    XCTAssertEqualObjects(@"key19", stack.pushedKeys.lastObject);
+    
+    NSUInteger enumerated = 0;
+    for (NSString *key in stack) {
+        XCTAssertTrue([key hasPrefix:@"key"] || [key isEqualToString:@"pending"]);
+        ++enumerated;
+    }
+    XCTAssertEqual((NSUInteger) 21, enumerated);
+    
+    [stack popKey];
+    XCTAssertEqual((NSUInteger) 19, stack.count, @"Popping should remove the pending key");
+    XCTAssertEqualObjects(@"key18", stack.lastObject);
+    XCTAssertThrows([stack objectAtIndex:19]);
+    
+    [stack removeAllKeys];
+    XCTAssertEqual((NSUInteger) 0, stack.count);
+    maybe_release(stack);
+}
+
+- (void) testCopyIsSnapshot {
+    BSONKeyPathStack *stack = [[BSONKeyPathStack alloc] init];
+    [stack pushKey:@"a"];
+    [stack setPendingKey:@"b"];
+    NSArray *copy = [stack copy];
+    [stack popKey];
+    [stack pushKey:@"c"];
+    XCTAssertEqualObjects((@[ @"a", @"b" ]), copy);
+    XCTAssertEqualObjects((@[ @"c" ]), stack);
+    XCTAssertFalse([copy isKindOfClass:[BSONKeyPathStack class]]);
+    
+    BSONKeyPathStack *writable = [stack copyForWriting];
+    XCTAssertEqualObjects((@[ @"c" ]), writable);
+    [writable pushKey:@"d"];
+    XCTAssertEqualObjects((@[ @"c" ]), stack);
+    maybe_release(writable);
+    maybe_release(copy);
+    maybe_release(stack);
+}
+
+- (void) testRetainingMarksEscaped {
+    BSONKeyPathStack *stack = [[BSONKeyPathStack alloc] init];
+    [stack pushKey:@"a"];
+    XCTAssertFalse([stack hasEscaped]);
+    @autoreleasepool {
+        NSArray *holder = [[NSArray alloc] initWithObjects:stack, nil];
+        XCTAssertTrue([stack hasEscaped]);
+        maybe_release(holder);
+    }
+    // The holder may have handed the stack on, so it stays escaped
+    XCTAssertTrue([stack hasEscaped]);
+    
+    BSONKeyPathStack *writable = [stack copyForWriting];
+    XCTAssertFalse([writable hasEscaped]);
+    maybe_release(writable);
+    maybe_release(stack);
+}
+
+- (void) testMutatingWhileEnumeratingThrows {
+    BSONKeyPathStack *stack = [[BSONKeyPathStack alloc] init];
+    [stack pushKey:@"a"];
+    [stack pushKey:@"b"];
+    XCTAssertThrows({
+        for (NSString *key in stack) {
+            (void) key;
+            [stack popKey];
+        }
+    });
+    maybe_release(stack);
+}
+
+- (void) testKeptKeyPathsDontChange {
+    BSONKeyPathStackTestDelegate *delegate = [[BSONKeyPathStackTestDelegate alloc] init];
+    NSDictionary *object = @{ @"outer" : @{ @"kept1" : @1,
+                                            @"read" : @2,
+                                            @"inner" : @{ @"kept2" : @3, @"read" : @4 } } };
+    
+    BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+    encoder.delegate = delegate;
+    [encoder encodeDictionary:object];
+    BSONDocument *document = [encoder BSONDocument];
+    maybe_release(encoder);
+    
+    NSSet *expectedKept = [NSSet setWithObjects:@[ @"outer", @"kept1" ], @[ @"outer", @"inner", @"kept2" ], nil];
+    NSSet *expectedRead = [NSSet setWithObjects:@"outer", @"outer.read", @"outer.inner", @"outer.inner.read", nil];
+    XCTAssertEqualObjects(expectedKept, [NSSet setWithArray:delegate.keptKeyPaths]);
+    XCTAssertEqualObjects(expectedRead, [NSSet setWithArray:delegate.readKeyPaths]);
+    
+    maybe_release(delegate);
+    delegate = [[BSONKeyPathStackTestDelegate alloc] init];
+    BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document];
+    decoder.delegate = delegate;
+    [decoder decodeDictionary];
+    XCTAssertEqualObjects(expectedKept, [NSSet setWithArray:delegate.keptKeyPaths]);
+    XCTAssertEqualObjects(expectedRead, [NSSet setWithArray:delegate.readKeyPaths]);
+    maybe_release(decoder);
+    maybe_release(delegate);
+}
+
+@end
@@ -0,0 +1,115 @@
+//
+//  BSONKeyTableTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_KeyTable.h"
+#import "BSONEncoder.h"
+#import "BSONDecoder.h"
+
+@interface BSONKeyTableTest : XCTestCase
+
+@end
+
+@implementation BSONKeyTableTest
+
+- (void) testInternKey {
+    NSString *key = [NSString stringWithFormat:@"interned%@", @"Key"];
+    const BSONInternedKey *interned = BSONInternKey(key);
+    XCTAssertTrue(interned != NULL);
+    XCTAssertEqual(interned, BSONInternKey(@"internedKey"),
+                   @"Equal keys should share an entry");
+    XCTAssertEqual(0, strcmp("internedKey", interned->bsonString));
+    XCTAssertEqual((size_t) 11, interned->length);
+    XCTAssertEqualObjects(key, (__bridge NSString *) interned->string);
+    XCTAssertTrue(interned->validForMongoDB);
+    
+    XCTAssertFalse(BSONInternKey(@"$set")->validForMongoDB);
+    XCTAssertFalse(BSONInternKey(@"a.b")->validForMongoDB);
+    XCTAssertTrue(BSONInternKey(@"a$")->validForMongoDB);
+    
+    const BSONInternedKey *unicode = BSONInternKey(@"clé");
+    XCTAssertEqual((size_t) 4, unicode->length);
+    XCTAssertEqual(0, strcmp("cl\xc3\xa9", unicode->bsonString));
+}
+
+- (void) testInternedKeyForBSONString {
+    NSString *key = BSONInternedKeyForBSONString("decodedKey");
+    XCTAssertEqualObjects(@"decodedKey", key);
+    XCTAssertEqual(key, BSONInternedKeyForBSONString("decodedKey"),
+                   @"Decoded keys should share one string");
+    XCTAssertEqual(key, (__bridge NSString *) BSONInternKey(@"decodedKey")->string);
+    XCTAssertEqualObjects(@"", BSONInternedKeyForBSONString(""));
+    
+    NSString *longKey = [@"" stringByPaddingToLength:1000 withString:@"k" startingAtIndex:0];
+    XCTAssertEqualObjects(longKey, BSONInternedKeyForBSONString([longKey UTF8String]));
+    XCTAssertEqual(0, strcmp([longKey UTF8String], BSONKeyString(longKey)));
+}
+
+- (void) testKeyWithEmbeddedNULIsNotInterned {
+    NSString *key = [NSString stringWithFormat:@"nul%Cafter", (unichar) 0];
+    XCTAssertTrue(BSONInternKey(key) == NULL);
+    [BSONEncoder documentForDictionary:@{ key : @1 }];
+    
+    NSString *truncated = BSONInternedKeyForBSONString("nul");
+    XCTAssertEqualObjects(@"nul", truncated);
+    XCTAssertTrue(BSONInternKey(@"nul")->validForMongoDB);
+    NSDictionary *decoded = [BSONDecoder decodeDictionaryWithDocument:[BSONEncoder documentForDictionary:@{ @"nul" : @1 }]];
+    XCTAssertEqualObjects(@[ @"nul" ], [decoded allKeys]);
+    
+    NSString *dotted = [NSString stringWithFormat:@"nul%C.after", (unichar) 0];
+    XCTAssertTrue(BSONInternKey(dotted) == NULL);
+    XCTAssertEqual(0, strcmp("nul", BSONKeyString(dotted)));
+}
+
+- (void) testArrayIndexKey {
+    XCTAssertEqual(0, strcmp("0", BSONArrayIndexKey(0)->bsonString));
+    XCTAssertEqual(0, strcmp("999", BSONArrayIndexKey(999)->bsonString));
+    XCTAssertEqual((size_t) 3, BSONArrayIndexKey(999)->length);
+    XCTAssertTrue(BSONArrayIndexKey(BSONArrayIndexKeyCount) == NULL);
+    XCTAssertEqualObjects(@"42", (__bridge NSString *) BSONArrayIndexKey(42)->string);
+    XCTAssertEqual(BSONArrayIndexKey(42), BSONInternKey(@"42"));
+    XCTAssertEqual((__bridge NSString *) BSONArrayIndexKey(42)->string, BSONInternedKeyForBSONString("42"));
+    XCTAssertTrue(BSONInternKey(@"1234") == NULL, @"Long decimal keys shouldn't fill the table");
+    XCTAssertEqualObjects(@"042", BSONInternedKeyForBSONString("042"));
+    
+    char key[24] = "998";
+    size_t length = 3;
+    length = BSONIncrementIndexKey(key, length);
+    XCTAssertEqual(0, strcmp("999", key));
+    length = BSONIncrementIndexKey(key, length);
+    XCTAssertEqual(0, strcmp("1000", key));
+    XCTAssertEqual((size_t) 4, length);
+}
+
+- (void) testConcurrentInterning {
+    NSMutableArray *keys = [NSMutableArray array];
+    for (int i = 0; i < 200; ++i)
+        [keys addObject:[NSString stringWithFormat:@"concurrent%d", i]];
+    
+    __block BOOL mismatch = NO;
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t iteration) {
+        for (NSString *key in keys) {
+            NSString *decoded = BSONInternedKeyForBSONString([key UTF8String]);
+            if (decoded != (__bridge NSString *) BSONInternKey(key)->string) mismatch = YES;
+        }
+    });
+    XCTAssertFalse(mismatch);
+}
+
+@end
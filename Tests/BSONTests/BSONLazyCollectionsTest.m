@@ -0,0 +1,153 @@
+//
+//  BSONLazyCollectionsTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_Helper.h"
+#import "BSONLazyCollections.h"
+#import "BSONEncoder.h"
+#import "BSONDecoder.h"
+#import "BSONDocument.h"
+#import "BSONTypes.h"
+#import "BSON_KeyTable.h"
+
+@interface BSONLazyCollectionsTest : XCTestCase
+
+@end
+
+@implementation BSONLazyCollectionsTest
+
++ (NSDictionary *) sample {
+    NSMutableDictionary *wide = [NSMutableDictionary dictionary];
+    for (int i = 0; i < 40; ++i)
+        [wide setObject:[NSNumber numberWithInt:i] forKey:[NSString stringWithFormat:@"field%d", i]];
+    return @{
+             @"string" : @"Lucy Ricardo",
+             @"int" : @75,
+             @"long" : [NSNumber numberWithLongLong:1LL << 40],
+             @"double" : @1234.5,
+             @"bool" : @YES,
+             @"null" : [NSNull null],
+             @"date" : [NSDate dateWithTimeIntervalSince1970:1000000],
+             @"objectID" : [BSONObjectID objectIDWithString:@"4f9aa5ef8a0c58d1f9000001"],
+             @"data" : [@"bytes" dataUsingEncoding:NSUTF8StringEncoding],
+             @"array" : @[ @1, @"two", @{ @"three" : @3 }, @[ @4 ] ],
+             @"nested" : @{ @"street" : @"623 East 68th Street", @"zip" : @10065 },
+             @"wide" : wide,
+             };
+}
+
+- (void) testMatchesDecoder {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] sample]];
+    NSDictionary *lazy = [document lazyDictionaryValue];
+    XCTAssertTrue([lazy isKindOfClass:[BSONLazyDictionary class]]);
+    NSDictionary *eager = [document dictionaryValue];
+    XCTAssertEqual(eager.count, lazy.count);
+    XCTAssertEqualObjects(eager, lazy);
+    XCTAssertEqualObjects([eager allKeys], [lazy allKeys], @"Keys should be in document order");
+    XCTAssertTrue([[lazy objectForKey:@"nested"] isKindOfClass:[BSONLazyDictionary class]]);
+    XCTAssertTrue([[lazy objectForKey:@"array"] isKindOfClass:[BSONLazyArray class]]);
+    XCTAssertNil([lazy objectForKey:@"missing"]);
+    XCTAssertNil([lazy objectForKey:@1]);
+    XCTAssertEqualObjects(@39, [[lazy objectForKey:@"wide"] objectForKey:@"field39"]);
+    XCTAssertNil([[lazy objectForKey:@"wide"] objectForKey:@"field40"]);
+    
+    NSDictionary *rare = @{ @"regex" : [BSONRegularExpression regularExpressionWithPattern:@"^a" options:@"i"],
+                            @"symbol" : [BSONSymbol symbol:@"sym"] };
+    NSDictionary *lazyRare = [[BSONEncoder documentForDictionary:rare] lazyDictionaryValue];
+    XCTAssertEqualObjects(@"^a", [[lazyRare objectForKey:@"regex"] pattern]);
+    XCTAssertEqualObjects(@"i", [[lazyRare objectForKey:@"regex"] options]);
+    XCTAssertEqualObjects(@"sym", [[lazyRare objectForKey:@"symbol"] symbol]);
+}
+
+- (void) testValuesAreCached {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] sample]];
+    NSDictionary *lazy = [document lazyDictionaryValue];
+    XCTAssertEqual([lazy objectForKey:@"string"], [lazy objectForKey:@"string"]);
+    NSArray *array = [lazy objectForKey:@"array"];
+    XCTAssertEqual([array objectAtIndex:2], [array objectAtIndex:2]);
+    XCTAssertThrowsSpecificNamed([array objectAtIndex:4], NSException, NSRangeException);
+    NSDictionary *copy = [lazy copy];
+    XCTAssertEqual(lazy, copy);
+    maybe_release(copy);
+}
+
+- (void) testFastEnumeration {
+    NSMutableDictionary *sample = [NSMutableDictionary dictionary];
+    NSMutableArray *list = [NSMutableArray array];
+    for (int i = 0; i < 100; ++i) {
+        [sample setObject:[NSNumber numberWithInt:i] forKey:[NSString stringWithFormat:@"key%d", i]];
+        [list addObject:[NSNumber numberWithInt:i]];
+    }
+    [sample setObject:list forKey:@"list"];
+    BSONDocument *document = [BSONEncoder documentForDictionary:sample];
+    NSDictionary *lazy = [document lazyDictionaryValue];
+    
+    NSMutableArray *keys = [NSMutableArray array];
+    for (NSString *key in lazy) [keys addObject:key];
+    XCTAssertEqualObjects([[document dictionaryValue] allKeys], keys);
+    
+    NSMutableArray *elements = [NSMutableArray array];
+    for (NSNumber *element in [lazy objectForKey:@"list"]) [elements addObject:element];
+    XCTAssertEqualObjects(list, elements);
+}
+
+- (void) testDuplicateKeysUseLastValueInFirstPosition {
+    for (int width = 2; width < 40; width += 30) {
+        BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+        encoder.restrictsKeyNamesForMongoDB = NO;
+        for (int i = 0; i < width; ++i)
+            [encoder encodeInt:i forKey:[NSString stringWithFormat:@"key%d", i]];
+        [encoder encodeInt:-1 forKey:@"key0"];
+        [encoder encodeInt:-2 forKey:@"key1"];
+        BSONDocument *document = [encoder BSONDocument];
+        NSDictionary *lazy = [document lazyDictionaryValue];
+        XCTAssertEqual((NSUInteger) width, lazy.count);
+        XCTAssertEqualObjects(@(-1), [lazy objectForKey:@"key0"]);
+        XCTAssertEqualObjects(@(-2), [lazy objectForKey:@"key1"]);
+        XCTAssertEqual((NSUInteger) width, [[lazy allKeys] count]);
+        XCTAssertEqualObjects(@"key0", [[lazy allKeys] objectAtIndex:0]);
+        XCTAssertEqualObjects(@"key1", [[lazy allKeys] objectAtIndex:1]);
+        XCTAssertEqualObjects([document dictionaryValue], lazy, @"Should match the eager dictionary");
+        maybe_release(encoder);
+    }
+}
+
+- (void) testLookupsDontInternKeys {
+    NSDictionary *lazy = [[BSONEncoder documentForDictionary:@{ @"present" : @1 }] lazyDictionaryValue];
+    NSString *key = [NSString stringWithFormat:@"absent%@", [[NSProcessInfo processInfo] globallyUniqueString]];
+    XCTAssertNil([lazy objectForKey:key]);
+    XCTAssertTrue(BSONFindInternedKey(key) == NULL, @"Looking up a key shouldn't add it to the table");
+    XCTAssertEqualObjects(@1, [lazy objectForKey:[NSMutableString stringWithString:@"present"]]);
+}
+
+- (void) testConcurrentAccess {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] sample]];
+    NSDictionary *lazy = [document lazyDictionaryValue];
+    NSDictionary *eager = [document dictionaryValue];
+    NSArray *keys = [eager allKeys];
+    __block NSUInteger mismatches = 0;
+    dispatch_apply(64, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+        NSString *key = [keys objectAtIndex:i % keys.count];
+        if (![[eager objectForKey:key] isEqual:[lazy objectForKey:key]])
+            __sync_fetch_and_add(&mismatches, 1);
+    });
+    XCTAssertEqual((NSUInteger) 0, mismatches);
+}
+
+@end
@@ -0,0 +1,183 @@
+//
+//  BSONObjectIDSetTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_Helper.h"
+#import "BSONObjectIDSet.h"
+#import "BSONTypes.h"
+
+@interface BSONObjectIDSetTest : XCTestCase
+
+@end
+
+@implementation BSONObjectIDSetTest
+
++ (BSONObjectID *) objectIDWithByte:(unsigned char) byte {
+    unsigned char bytes[12] = { 0 };
+    bytes[0] = byte;
+    bytes[11] = (unsigned char) ~byte;
+    return [BSONObjectID objectIDWithData:[NSData dataWithBytes:bytes length:12]];
+}
+
+- (void) testAddContainsRemove {
+    BSONObjectIDSet *set = [BSONObjectIDSet set];
+    XCTAssertEqual(set.count, (NSUInteger) 0);
+
+    BSONObjectID *first = [BSONObjectID objectID];
+    BSONObjectID *second = [BSONObjectID objectID];
+    BSONObjectID *absent = [BSONObjectID objectID];
+    [set addObjectID:second];
+    [set addObjectID:first];
+    [set addObjectID:[BSONObjectID objectIDWithString:first.stringValue]];
+
+    XCTAssertEqual(set.count, (NSUInteger) 2, @"Duplicates should be added once");
+    XCTAssertTrue([set containsObjectID:first]);
+    XCTAssertTrue([set containsObjectID:second]);
+    XCTAssertFalse([set containsObjectID:absent]);
+    NSArray *expected = @[ first, second ];
+    XCTAssertEqualObjects([set allObjectIDs], expected, @"Object IDs should be in increasing order");
+
+    [set removeObjectID:first];
+    [set removeObjectID:absent];
+    XCTAssertEqual(set.count, (NSUInteger) 1);
+    XCTAssertFalse([set containsObjectID:first]);
+    XCTAssertTrue([set containsObjectID:second]);
+
+    [set removeAllObjectIDs];
+    XCTAssertEqual(set.count, (NSUInteger) 0);
+    XCTAssertFalse([set containsObjectID:second]);
+}
+
+- (void) testOrderingUsesUnsignedBytes {
+    BSONObjectID *low = [[self class] objectIDWithByte:0x7f];
+    BSONObjectID *high = [[self class] objectIDWithByte:0x80];
+    BSONObjectIDSet *set = [[BSONObjectIDSet alloc] initWithObjectIDs:@[ high, low ]];
+    NSArray *expected = @[ low, high ];
+    XCTAssertEqualObjects([set allObjectIDs], expected);
+    XCTAssertEqual([low compare:high], NSOrderedAscending);
+    maybe_release(set);
+}
+
+- (void) testBulkContains {
+    NSUInteger count = 1000;
+    char *bytes = malloc(count * 12);
+    [BSONObjectID generateObjectIDBytes:bytes count:count];
+
+    BSONObjectIDSet *set = [[BSONObjectIDSet alloc] initWithCapacity:count];
+    // Every other object ID, added out of order
+    for (NSUInteger i = count; i >= 2; i -= 2)
+        [set addObjectIDBytes:bytes + (i - 2) * 12 count:1];
+    XCTAssertEqual(set.count, count / 2);
+
+    BOOL *results = malloc(count * sizeof(BOOL));
+    XCTAssertEqual([set containsObjectIDBytes:bytes count:count results:results], count / 2);
+    for (NSUInteger i = 0; i < count; ++i)
+        XCTAssertEqual(results[i], (BOOL) (i % 2 == 0), @"Sorted query %lu", (unsigned long) i);
+
+    // Reversed
+    char *reversed = malloc(count * 12);
+    for (NSUInteger i = 0; i < count; ++i)
+        memcpy(reversed + i * 12, bytes + (count - 1 - i) * 12, 12);
+    XCTAssertEqual([set containsObjectIDBytes:reversed count:count results:results], count / 2);
+    for (NSUInteger i = 0; i < count; ++i)
+        XCTAssertEqual(results[i], (BOOL) ((count - 1 - i) % 2 == 0), @"Unsorted query %lu", (unsigned long) i);
+
+    XCTAssertEqual(0, memcmp([set objectIDBytes], bytes, 12), @"Bytes should start with the least object ID");
+
+    BSONObjectIDSet *copy = [set copy];
+    XCTAssertEqualObjects(copy, set);
+    [copy addObjectIDBytes:bytes + 12 count:1];
+    XCTAssertFalse([copy isEqual:set]);
+    XCTAssertFalse([set containsObjectIDBytes:bytes + 12]);
+
+    maybe_release(copy);
+    maybe_release(set);
+    free(reversed);
+    free(results);
+    free(bytes);
+}
+
+- (void) testRemoveInRandomOrder {
+    NSUInteger count = 5000;
+    char *bytes = malloc(count * 12);
+    [BSONObjectID generateObjectIDBytes:bytes count:count];
+    BSONObjectIDSet *set = [BSONObjectIDSet set];
+    [set addObjectIDBytes:bytes count:count];
+
+    // Enough removals to fill the batch of removed keys several times over
+    NSUInteger *order = malloc(count * sizeof(NSUInteger));
+    for (NSUInteger i = 0; i < count; ++i) order[i] = i;
+    for (NSUInteger i = count - 1; i > 0; --i) {
+        NSUInteger j = arc4random_uniform((uint32_t) i + 1), swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    for (NSUInteger i = 0; i < count / 2; ++i)
+        [set removeObjectID:[BSONObjectID objectIDWithData:[NSData dataWithBytes:bytes + order[i] * 12 length:12]]];
+    XCTAssertEqual(set.count, count - count / 2);
+    for (NSUInteger i = 0; i < count; ++i)
+        XCTAssertEqual([set containsObjectIDBytes:bytes + order[i] * 12], (BOOL) (i >= count / 2),
+                       @"Object ID %lu", (unsigned long) order[i]);
+
+    // Adding removed object IDs back one at a time, some of them twice
+    for (NSUInteger i = 0; i < count / 2; ++i)
+        [set addObjectIDBytes:bytes + order[i / 3 * 3] * 12 count:1];
+    XCTAssertEqual(set.count, count - count / 2 + (count / 2 + 2) / 3);
+    for (NSUInteger i = 0; i < count; ++i)
+        XCTAssertEqual([set containsObjectIDBytes:bytes + order[i] * 12], (BOOL) (i >= count / 2 || i % 3 == 0),
+                       @"Object ID %lu", (unsigned long) order[i]);
+    const char *sorted = [set objectIDBytes];
+    for (NSUInteger i = 1; i < set.count; ++i)
+        XCTAssertTrue(memcmp(sorted + (i - 1) * 12, sorted + i * 12, 12) < 0, @"Bytes should increase at %lu", (unsigned long) i);
+
+    free(order);
+    free(bytes);
+}
+
+- (void) testMap {
+    BSONObjectIDMap *map = [BSONObjectIDMap map];
+    BSONObjectID *first = [BSONObjectID objectID];
+    BSONObjectID *second = [BSONObjectID objectID];
+
+    [map setObject:@"second" forObjectID:second];
+    [map setObject:@"first" forObjectID:first];
+    XCTAssertEqual(map.count, (NSUInteger) 2);
+    XCTAssertEqualObjects([map objectForObjectID:first], @"first");
+    XCTAssertEqualObjects([map objectForObjectIDBytes:[first.dataValue bytes]], @"first");
+    XCTAssertEqualObjects([map objectForObjectID:second], @"second");
+    XCTAssertNil([map objectForObjectID:[BSONObjectID objectID]]);
+
+    NSMutableString *replacement = [NSMutableString stringWithString:@"replaced"];
+    [map setObject:replacement forObjectID:[BSONObjectID objectIDWithString:first.stringValue]];
+    XCTAssertEqual(map.count, (NSUInteger) 2);
+    XCTAssertEqual([map objectForObjectID:first], replacement, @"The last object set should win");
+    NSArray *expected = @[ first, second ];
+    XCTAssertEqualObjects([map allObjectIDs], expected);
+
+    [map removeObjectForObjectID:first];
+    XCTAssertEqual(map.count, (NSUInteger) 1);
+    XCTAssertNil([map objectForObjectID:first]);
+    XCTAssertEqualObjects([map objectForObjectID:second], @"second");
+
+    [map removeAllObjects];
+    XCTAssertEqual(map.count, (NSUInteger) 0);
+    XCTAssertNil([map objectForObjectID:second]);
+}
+
+@end
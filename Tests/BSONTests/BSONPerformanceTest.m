@@ -0,0 +1,1163 @@
+//
+//  BSONPerformanceTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import <fcntl.h>
+#import <malloc/malloc.h>
+#import "BSON_Helper.h"
+#import "BSON_Append.h"
+#import "BSONEncoder.h"
+#import "BSONDecoder.h"
+#import "BSONDocument.h"
+#import "BSONIterator.h"
+#import "BSONDocumentWriter.h"
+#import "BSONDecodingSession.h"
+#import "BSONColumnarDecoder.h"
+#import "BSONCompiledKeyPath.h"
+#import "BSONObjectIDSet.h"
+#import "BSONExtendedJSONWriter.h"
+#import "BSONTypes.h"
+#import "BSONCoding.h"
+#import "OrderedDictionary.h"
+
+/**
+ An empty delegate. Installing it forces the encoder onto its general,
+ delegate-aware path, which gives the benchmarks a baseline.
+ */
+@interface BSONPerformanceTestEncoderDelegate : NSObject <BSONEncoderDelegate>
+@end
+@implementation BSONPerformanceTestEncoderDelegate
+@end
+
+/**
+ A decoder delegate which returns each object unchanged. Installing it forces the decoder onto its
+ general, hook-aware path, which gives the benchmarks a baseline.
+ */
+@interface BSONPerformanceTestDecoderDelegate : NSObject <BSONDecoderDelegate>
+@end
+@implementation BSONPerformanceTestDecoderDelegate
+- (id) decoder:(BSONDecoder *) decoder didDecodeObject:(id) object forKeyPath:(NSArray *) keyPathComponents {
+    return object;
+}
+@end
+
+/**
+ A delegate which looks at the key path of every value without keeping it, like one which decides
+ by key path whether to substitute an object ID.
+ */
+@interface BSONPerformanceTestKeyPathDelegate : NSObject <BSONEncoderDelegate, BSONDecoderDelegate>
+@property (assign) NSUInteger depthTotal;
+@end
+@implementation BSONPerformanceTestKeyPathDelegate
+- (BOOL) encoder:(BSONEncoder *) encoder shouldSubstituteObjectIDForObject:(id) obj forKeyPath:(NSArray *) keyPathComponents {
+    self.depthTotal += keyPathComponents.count;
+    return NO;
+}
+- (id) encoder:(BSONEncoder *) encoder willEncodeObject:(id) obj forKeyPath:(NSArray *) keyPathComponents {
+    if ([[keyPathComponents lastObject] isEqualToString:@"_id"]) self.depthTotal += 1;
+    return obj;
+}
+- (id) decoder:(BSONDecoder *) decoder didDecodeObject:(id) object forKeyPath:(NSArray *) keyPathComponents {
+    if ([[keyPathComponents lastObject] isEqualToString:@"_id"]) self.depthTotal += 1;
+    return object;
+}
+@end
+
+/**
+ A model object with sixty fields, which it decodes by key.
+ */
+@interface BSONPerformanceTestWideObject : NSObject <BSONCoding>
+@property (retain) NSMutableArray *values;
+@end
+@implementation BSONPerformanceTestWideObject
++ (NSArray *) fieldNames {
+    static NSArray *names;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableArray *result = [NSMutableArray array];
+        for (int i = 0; i < 60; ++i)
+            [result addObject:[NSString stringWithFormat:@"field%d", i]];
+        names = [result copy];
+    });
+    return names;
+}
+- (id) initWithBSONDecoder:(BSONDecoder *) decoder {
+    if (self = [super init]) {
+        self.values = [NSMutableArray array];
+        for (NSString *name in [[self class] fieldNames])
+            [self.values addObject:[decoder decodeObjectForKey:name]];
+    }
+    return self;
+}
+- (void) dealloc {
+    maybe_release(_values);
+    super_dealloc;
+}
+@end
+
+/**
+ The previous implementation of <code>OrderedDictionary</code>, which keeps its keys in an array
+ next to a dictionary, for comparison.
+ */
+@interface BSONPerformanceTestLegacyOrderedDictionary : NSMutableDictionary
+@end
+@implementation BSONPerformanceTestLegacyOrderedDictionary {
+    NSMutableDictionary *_dictionary;
+    NSMutableArray *_array;
+}
+- (id) initWithCapacity:(NSUInteger) capacity {
+    if (self = [super init]) {
+        _dictionary = [[NSMutableDictionary alloc] initWithCapacity:capacity];
+        _array = [[NSMutableArray alloc] initWithCapacity:capacity];
+    }
+    return self;
+}
+- (id) init { return [self initWithCapacity:0]; }
+- (void) dealloc {
+    maybe_release(_dictionary);
+    maybe_release(_array);
+    super_dealloc;
+}
+- (void) setObject:(id) object forKey:(id) key {
+    if (![_dictionary objectForKey:key]) [_array addObject:key];
+    [_dictionary setObject:object forKey:key];
+}
+- (void) removeObjectForKey:(id) key {
+    [_dictionary removeObjectForKey:key];
+    [_array removeObject:key];
+}
+- (NSUInteger) count { return [_dictionary count]; }
+- (id) objectForKey:(id) key { return [_dictionary objectForKey:key]; }
+- (NSEnumerator *) keyEnumerator { return [_array objectEnumerator]; }
+@end
+
+@interface BSONPerformanceTest : XCTestCase
+@end
+
+@implementation BSONPerformanceTest
+
+#pragma mark - Sample documents
+
++ (NSDictionary *) samplePayload {
+    static NSDictionary *payload;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableArray *tags = [NSMutableArray array];
+        for (int i = 0; i < 20; ++i)
+            [tags addObject:[NSString stringWithFormat:@"tag-%d", i]];
+        NSMutableArray *readings = [NSMutableArray array];
+        for (int i = 0; i < 100; ++i)
+            [readings addObject:[NSNumber numberWithDouble:i * 0.5]];
+        payload = @{
+                    @"name" : @"Lucy Ricardo",
+                    @"visits" : @75,
+                    @"active" : @YES,
+                    @"balance" : @1234.5,
+                    @"since" : [NSDate dateWithTimeIntervalSince1970:1000000],
+                    @"tags" : tags,
+                    @"readings" : readings,
+                    @"address" : @{
+                            @"street" : @"623 East 68th Street",
+                            @"city" : @"New York",
+                            @"zip" : @10065
+                            }
+                    };
+        maybe_retain_void(payload);
+    });
+    return payload;
+}
+
+/**
+ Builds a document nested <i>depth</i> levels deep where every level has the same keys, so that
+ structural comparison of a level with its ancestors has to descend before it finds a difference.
+ */
++ (NSDictionary *) nestedPayloadWithDepth:(NSUInteger) depth width:(NSUInteger) width {
+    NSDictionary *result = @{ @"leaf" : @YES };
+    for (NSUInteger level = 0; level < depth; ++level) {
+        NSMutableDictionary *dictionary = [NSMutableDictionary dictionary];
+        for (NSUInteger i = 0; i < width; ++i)
+            [dictionary setObject:[NSNumber numberWithUnsignedInteger:i]
+                           forKey:[NSString stringWithFormat:@"field%lu", (unsigned long) i]];
+        [dictionary setObject:result forKey:@"next"];
+        [dictionary setObject:@[ @{ @"leaf" : @YES }, @{ @"leaf" : @YES } ] forKey:@"siblings"];
+        result = dictionary;
+    }
+    return result;
+}
+
+/**
+ An array of documents whose values cycle through most of the types the encoder supports.
+ */
++ (NSDictionary *) mixedTypePayload {
+    NSMutableArray *rows = [NSMutableArray array];
+    for (int i = 0; i < 200; ++i)
+        [rows addObject:@{
+                          @"_id" : [BSONObjectID objectID],
+                          @"name" : [NSString stringWithFormat:@"row %d", i],
+                          @"mutableName" : [NSMutableString stringWithFormat:@"row %d", i],
+                          @"count" : [NSNumber numberWithInt:i],
+                          @"ratio" : [NSNumber numberWithDouble:i / 3.0],
+                          @"flag" : [NSNumber numberWithBool:i % 2],
+                          @"when" : [NSDate dateWithTimeIntervalSince1970:i],
+                          @"blob" : [NSData dataWithBytes:&i length:sizeof(i)],
+                          @"missing" : [NSNull null],
+                          @"pattern" : [BSONRegularExpression regularExpressionWithPattern:@"^row" options:@"i"],
+                          @"symbol" : [BSONSymbol symbol:@"sym"],
+                          @"list" : [NSMutableArray arrayWithObjects:@1, @"two", nil],
+                          }];
+    return @{ @"rows" : rows };
+}
+
+/**
+ A batch of 2,000 of the documents from <code>+mixedTypePayload</code>, like one bulk insert.
+ */
++ (NSArray *) batchPayload {
+    static NSArray *payload;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableArray *batch = [NSMutableArray array];
+        for (int i = 0; i < 10; ++i)
+            [batch addObjectsFromArray:[[self mixedTypePayload] objectForKey:@"rows"]];
+        payload = [batch copy];
+    });
+    return payload;
+}
+
+/**
+ A result set of 2,000 documents like a query would return, whose fields repeat a few short
+ strings and small numbers.
+ */
++ (NSArray *) resultSetDocuments {
+    static NSArray *documents;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSArray *statuses = @[ @"awaiting review", @"approved by editor", @"rejected by editor" ];
+        NSMutableArray *result = [NSMutableArray array];
+        for (int i = 0; i < 2000; ++i)
+            [result addObject:[BSONEncoder documentForDictionary:@{
+                                @"_id" : [BSONObjectID objectID],
+                                @"title" : [NSString stringWithFormat:@"Article number %d of the result set", i],
+                                @"status" : [statuses objectAtIndex:i % 3],
+                                @"section" : i % 2 ? @"international news" : @"metropolitan news",
+                                @"revision" : [NSNumber numberWithInt:i % 10],
+                                @"wordCount" : [NSNumber numberWithLongLong:i % 1000],
+                                @"rating" : [NSNumber numberWithDouble:i % 5],
+                                @"labels" : @[ @"featured on front page", [NSNumber numberWithInt:i % 4] ],
+                                }]];
+        documents = [result copy];
+    });
+    return documents;
+}
+
+/**
+ 100 documents, each with 64 KB of binary data and 4 KB of text.
+ */
++ (NSArray *) blobDocuments {
+    static NSArray *documents;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableData *blob = [NSMutableData dataWithLength:64 * 1024];
+        for (NSUInteger i = 0; i < blob.length; ++i) ((char *) blob.mutableBytes)[i] = (char) i;
+        NSMutableString *text = [NSMutableString string];
+        while (text.length < 4096) [text appendString:@"The quick brown fox jumps over the lazy dog. "];
+        NSMutableArray *result = [NSMutableArray array];
+        for (int i = 0; i < 100; ++i)
+            [result addObject:[BSONEncoder documentForDictionary:@{
+                                @"_id" : [BSONObjectID objectID],
+                                @"name" : [NSString stringWithFormat:@"attachment-%d.bin", i],
+                                @"description" : text,
+                                @"contents" : blob,
+                                }]];
+        documents = [result copy];
+    });
+    return documents;
+}
+
+/**
+ Decodes the blob documents, holding on to the results, and returns the number of bytes they
+ occupy on the heap.
+ */
++ (size_t) bytesInUseDecodingBlobDocumentsReferencingBytes:(BOOL) referencesDocumentBytes {
+    NSArray *documents = [self blobDocuments];
+    NSMutableArray *results = [[NSMutableArray alloc] initWithCapacity:documents.count];
+    malloc_statistics_t before, after;
+    @autoreleasepool {
+        malloc_zone_statistics(NULL, &before);
+        for (BSONDocument *document in documents) {
+            BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document];
+            decoder.referencesDocumentBytes = referencesDocumentBytes;
+            [results addObject:[decoder decodeDictionary]];
+            maybe_release(decoder);
+        }
+    }
+    malloc_zone_statistics(NULL, &after);
+    maybe_release(results);
+    return after.size_in_use - before.size_in_use;
+}
+
+/**
+ Decodes the result set, holding on to the results, and returns the number of heap blocks they
+ occupy.
+ */
++ (size_t) allocationCountDecodingResultSetWithSession:(BSONDecodingSession *) session {
+    NSArray *documents = [self resultSetDocuments];
+    NSMutableArray *results = [[NSMutableArray alloc] initWithCapacity:documents.count];
+    malloc_statistics_t before, after;
+    @autoreleasepool {
+        malloc_zone_statistics(NULL, &before);
+        for (BSONDocument *document in documents) {
+            BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document session:session];
+            [results addObject:[decoder decodeDictionary]];
+            maybe_release(decoder);
+        }
+    }
+    malloc_zone_statistics(NULL, &after);
+    maybe_release(results);
+    return after.blocks_in_use - before.blocks_in_use;
+}
+
+#pragma mark - Encoding
+
+- (void) testEncodeDictionaryWithoutDelegatePerformance {
+    NSDictionary *payload = [[self class] samplePayload];
+    [self measureBlock:^{
+        for (int i = 0; i < 2000; ++i) @autoreleasepool {
+            [BSONEncoder documentForDictionary:payload];
+        }
+    }];
+}
+
+- (void) testEncodeDictionaryWithDelegatePerformance {
+    NSDictionary *payload = [[self class] samplePayload];
+    BSONPerformanceTestEncoderDelegate *delegate = [[BSONPerformanceTestEncoderDelegate alloc] init];
+    [self measureBlock:^{
+        for (int i = 0; i < 2000; ++i) @autoreleasepool {
+            BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+            encoder.delegate = delegate;
+            [encoder encodeDictionary:payload];
+            [encoder BSONDocument];
+            maybe_release(encoder);
+        }
+    }];
+    maybe_release(delegate);
+}
+
+- (void) testEncodeWithNewEncoderPerformance {
+    NSDictionary *payload = [[self class] samplePayload];
+    [self measureBlock:^{
+        for (int i = 0; i < 2000; ++i) @autoreleasepool {
+            BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+            [encoder encodeDictionary:payload];
+            [encoder BSONDocument];
+            maybe_release(encoder);
+        }
+    }];
+}
+
+- (void) testEncodeWithResetEncoderPerformance {
+    NSDictionary *payload = [[self class] samplePayload];
+    BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+    [self measureBlock:^{
+        for (int i = 0; i < 2000; ++i) @autoreleasepool {
+            [encoder reset];
+            [encoder encodeDictionary:payload];
+            [encoder BSONDocument];
+        }
+    }];
+    maybe_release(encoder);
+}
+
+- (void) testEncodeDeeplyNestedDictionaryPerformance {
+    NSDictionary *payload = [[self class] nestedPayloadWithDepth:24 width:16];
+    [self measureBlock:^{
+        for (int i = 0; i < 20; ++i) @autoreleasepool {
+            [BSONEncoder documentForDictionary:payload];
+        }
+    }];
+}
+
+- (void) testEncodeLongNumericArrayPerformance {
+    NSMutableArray *series = [NSMutableArray array];
+    for (int i = 0; i < 100000; ++i)
+        [series addObject:[NSNumber numberWithDouble:i * 0.25]];
+    NSDictionary *payload = @{ @"series" : series };
+    [self measureBlock:^{
+        for (int i = 0; i < 10; ++i) @autoreleasepool {
+            [BSONEncoder documentForDictionary:payload];
+        }
+    }];
+}
+
+- (void) testEncodeMixedTypesPerformance {
+    NSDictionary *payload = [[self class] mixedTypePayload];
+    [self measureBlock:^{
+        for (int i = 0; i < 100; ++i) @autoreleasepool {
+            [BSONEncoder documentForDictionary:payload];
+        }
+    }];
+}
+
+- (void) testEncodeMixedTypesWithDelegatePerformance {
+    NSDictionary *payload = [[self class] mixedTypePayload];
+    BSONPerformanceTestEncoderDelegate *delegate = [[BSONPerformanceTestEncoderDelegate alloc] init];
+    [self measureBlock:^{
+        for (int i = 0; i < 100; ++i) @autoreleasepool {
+            BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+            encoder.delegate = delegate;
+            [encoder encodeDictionary:payload];
+            [encoder BSONDocument];
+            maybe_release(encoder);
+        }
+    }];
+    maybe_release(delegate);
+}
+
+- (void) testEncodeWithKeyPathDelegatePerformance {
+    NSDictionary *payload = [[self class] mixedTypePayload];
+    BSONPerformanceTestKeyPathDelegate *delegate = [[BSONPerformanceTestKeyPathDelegate alloc] init];
+    [self measureBlock:^{
+        for (int i = 0; i < 100; ++i) @autoreleasepool {
+            BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+            encoder.delegate = delegate;
+            [encoder encodeDictionary:payload];
+            [encoder BSONDocument];
+            maybe_release(encoder);
+        }
+    }];
+    maybe_release(delegate);
+}
+
+- (void) testEncodeASCIIKeysAndValuesPerformance {
+    NSMutableDictionary *payload = [NSMutableDictionary dictionary];
+    for (int i = 0; i < 200; ++i)
+        [payload setObject:[NSString stringWithFormat:@"a value of moderate length, number %d, in plain ASCII", i]
+                    forKey:[NSString stringWithFormat:@"asciiKeyNumber%d", i]];
+    [self measureBlock:^{
+        for (int i = 0; i < 1000; ++i) @autoreleasepool {
+            [BSONEncoder documentForDictionary:payload];
+        }
+    }];
+}
+
+- (void) testEncodeNonASCIIKeysAndValuesPerformance {
+    NSMutableDictionary *payload = [NSMutableDictionary dictionary];
+    for (int i = 0; i < 200; ++i)
+        [payload setObject:[NSString stringWithFormat:@"une valeur de longueur modérée, numéro %d, en français ✓", i]
+                    forKey:[NSString stringWithFormat:@"clé numéro %d", i]];
+    [self measureBlock:^{
+        for (int i = 0; i < 1000; ++i) @autoreleasepool {
+            [BSONEncoder documentForDictionary:payload];
+        }
+    }];
+}
+
+- (void) testScanCopyPerformance {
+    NSMutableData *source = [NSMutableData dataWithLength:1 << 16];
+    memset(source.mutableBytes, 'k', source.length);
+    NSMutableData *destination = [NSMutableData dataWithLength:source.length];
+    [self measureBlock:^{
+        for (int i = 0; i < 2000; ++i) {
+            BOOL hasDot = NO;
+            BSONScanCopy(destination.mutableBytes, source.bytes, source.length, &hasDot);
+        }
+    }];
+}
+
+- (void) testEncodeBatchSeriallyPerformance {
+    NSArray *batch = [[self class] batchPayload];
+    [self measureBlock:^{
+        for (int i = 0; i < 5; ++i) @autoreleasepool {
+            [BSONEncoder documentsForObjects:batch options:BSONBatchEncodingSerially];
+        }
+    }];
+}
+
+- (void) testEncodeBatchConcurrentlyPerformance {
+    NSArray *batch = [[self class] batchPayload];
+    [self measureBlock:^{
+        for (int i = 0; i < 5; ++i) @autoreleasepool {
+            [BSONEncoder documentsForObjects:batch options:BSONBatchEncodingDefault];
+        }
+    }];
+}
+
+/**
+ Encodes the batch in <i>threadCount</i> slices at once, each slice serially on its own thread.
+ Comparing the thread counts shows how encoding throughput scales with the number of cores: on a
+ machine with enough of them, each doubling should come close to halving the time.
+ */
+- (void) measureBatchEncodingWithThreadCount:(size_t) threadCount {
+    NSArray *batch = [[self class] batchPayload];
+    NSUInteger sliceLength = (batch.count + threadCount - 1) / threadCount;
+    [self measureBlock:^{
+        dispatch_apply(threadCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+            NSUInteger start = MIN(batch.count, thread * sliceLength);
+            NSArray *slice = [batch subarrayWithRange:NSMakeRange(start, MIN(sliceLength, batch.count - start))];
+            for (int i = 0; i < 5; ++i) @autoreleasepool {
+                [BSONEncoder documentsForObjects:slice options:BSONBatchEncodingSerially];
+            }
+        });
+    }];
+}
+
+- (void) testEncodeBatchOn1ThreadPerformance { [self measureBatchEncodingWithThreadCount:1]; }
+- (void) testEncodeBatchOn2ThreadsPerformance { [self measureBatchEncodingWithThreadCount:2]; }
+- (void) testEncodeBatchOn4ThreadsPerformance { [self measureBatchEncodingWithThreadCount:4]; }
+- (void) testEncodeBatchOn8ThreadsPerformance { [self measureBatchEncodingWithThreadCount:8]; }
+- (void) testEncodeBatchOn16ThreadsPerformance { [self measureBatchEncodingWithThreadCount:16]; }
+
+- (void) testWriteDocumentsToFileDescriptorPerformance {
+    NSArray *batch = [[self class] batchPayload];
+    [self measureBlock:^{
+        int fd = open("/dev/null", O_WRONLY);
+        BSONDocumentWriter *writer = [[BSONDocumentWriter alloc] initWithFileDescriptor:fd closeOnDealloc:YES];
+        for (int i = 0; i < 5; ++i)
+            for (id object in batch)
+                [writer writeObject:object error:NULL];
+        [writer close:NULL];
+        maybe_release(writer);
+    }];
+}
+
+#pragma mark - Ordered dictionaries
+
++ (NSArray *) orderedDictionaryKeys {
+    static NSArray *keys;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableArray *result = [NSMutableArray array];
+        for (int i = 0; i < 2000; ++i)
+            [result addObject:[NSString stringWithFormat:@"key%d", i]];
+        keys = [result copy];
+    });
+    return keys;
+}
+
+/**
+ Builds many small dictionaries, as decoding documents does, and reads each key back.
+ */
+- (void) measureBuildingSmallDictionariesOfClass:(Class) class {
+    NSArray *keys = [[[self class] orderedDictionaryKeys] subarrayWithRange:NSMakeRange(0, 16)];
+    [self measureBlock:^{
+        for (int i = 0; i < 5000; ++i) @autoreleasepool {
+            NSMutableDictionary *dictionary = [[class alloc] init];
+            for (NSString *key in keys) [dictionary setObject:key forKey:key];
+            for (NSString *key in keys) [dictionary objectForKey:key];
+            for (NSString *key in dictionary) (void) key;
+            maybe_release(dictionary);
+        }
+    }];
+}
+
+/**
+ Fills one large dictionary and removes every key in order.
+ */
+- (void) measureRemovingKeysOfClass:(Class) class {
+    NSArray *keys = [[self class] orderedDictionaryKeys];
+    [self measureBlock:^{
+        NSMutableDictionary *dictionary = [[class alloc] init];
+        for (NSString *key in keys) [dictionary setObject:key forKey:key];
+        for (NSString *key in keys) [dictionary removeObjectForKey:key];
+        maybe_release(dictionary);
+    }];
+}
+
+- (void) testOrderedDictionarySmallDictionariesPerformance {
+    [self measureBuildingSmallDictionariesOfClass:[OrderedDictionary class]];
+}
+
+- (void) testLegacyOrderedDictionarySmallDictionariesPerformance {
+    [self measureBuildingSmallDictionariesOfClass:[BSONPerformanceTestLegacyOrderedDictionary class]];
+}
+
+- (void) testOrderedDictionaryRemoveKeysPerformance {
+    [self measureRemovingKeysOfClass:[OrderedDictionary class]];
+}
+
+- (void) testLegacyOrderedDictionaryRemoveKeysPerformance {
+    [self measureRemovingKeysOfClass:[BSONPerformanceTestLegacyOrderedDictionary class]];
+}
+
+#pragma mark - Decoding
+
+- (void) testDecodeDictionaryPerformance {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] samplePayload]];
+    [self measureBlock:^{
+        for (int i = 0; i < 2000; ++i) @autoreleasepool {
+            [BSONDecoder decodeDictionaryWithDocument:document];
+        }
+    }];
+}
+
+- (void) testReadFewFieldsEagerlyPerformance {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] mixedTypePayload]];
+    [self measureBlock:^{
+        for (int i = 0; i < 100; ++i) @autoreleasepool {
+            NSArray *rows = [[document dictionaryValue] objectForKey:@"rows"];
+            [[rows objectAtIndex:100] objectForKey:@"name"];
+        }
+    }];
+}
+
+- (void) testReadFewFieldsLazilyPerformance {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] mixedTypePayload]];
+    [self measureBlock:^{
+        for (int i = 0; i < 100; ++i) @autoreleasepool {
+            NSArray *rows = [[document lazyDictionaryValue] objectForKey:@"rows"];
+            [[rows objectAtIndex:100] objectForKey:@"name"];
+        }
+    }];
+}
+
+- (void) testDecodeWideObjectByKeyPerformance {
+    NSMutableDictionary *fields = [NSMutableDictionary dictionary];
+    for (NSString *name in [BSONPerformanceTestWideObject fieldNames])
+        [fields setObject:[NSString stringWithFormat:@"value of %@", name] forKey:name];
+    BSONDocument *document = [BSONEncoder documentForDictionary:fields];
+    [self measureBlock:^{
+        for (int i = 0; i < 2000; ++i) @autoreleasepool {
+            [BSONDecoder decodeObjectWithClass:[BSONPerformanceTestWideObject class] document:document];
+        }
+    }];
+}
+
++ (NSUInteger) countItemsUsingSubIterators:(BSONIterator *) iterator {
+    NSUInteger count = 0;
+    BSONType type;
+    while ((type = [iterator next])) {
+        ++count;
+        if (BSONTypeEmbeddedDocument == type || BSONTypeArray == type)
+            count += [self countItemsUsingSubIterators:[iterator sequentialSubIteratorValue]];
+    }
+    return count;
+}
+
++ (NSUInteger) countItemsInPlace:(BSONIterator *) iterator {
+    NSUInteger count = 0;
+    BSONType type;
+    while ((type = [iterator next])) {
+        ++count;
+        if (BSONTypeEmbeddedDocument == type || BSONTypeArray == type) {
+            [iterator enterEmbeddedObject];
+            count += [self countItemsInPlace:iterator];
+            [iterator leaveEmbeddedObject];
+        }
+    }
+    return count;
+}
+
+- (void) testIterateNestedDocumentUsingSubIteratorsPerformance {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] nestedPayloadWithDepth:50 width:4]];
+    [self measureBlock:^{
+        for (int i = 0; i < 2000; ++i) @autoreleasepool {
+            [[self class] countItemsUsingSubIterators:[document iterator]];
+        }
+    }];
+}
+
+- (void) testIterateNestedDocumentInPlacePerformance {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] nestedPayloadWithDepth:50 width:4]];
+    [self measureBlock:^{
+        for (int i = 0; i < 2000; ++i) @autoreleasepool {
+            [[self class] countItemsInPlace:[document iterator]];
+        }
+    }];
+}
+
+// Compare the two validated runs with the unvalidated one to see what the checks cost
+
+- (void) measureCreatingResultSetDocumentsValidating:(BOOL) validating options:(BSONValidationOptions) options {
+    NSMutableArray *datas = [NSMutableArray array];
+    for (BSONDocument *document in [[self class] resultSetDocuments])
+        [datas addObject:[document dataValue]];
+    [self measureBlock:^{
+        for (int i = 0; i < 10; ++i) @autoreleasepool {
+            for (NSData *data in datas) {
+                if (validating)
+                    [BSONDocument documentWithValidatedData:data options:options error:NULL];
+                else
+                    [BSONDocument documentWithData:data];
+            }
+        }
+    }];
+}
+
+- (void) testCreateDocumentsWithoutValidationPerformance {
+    [self measureCreatingResultSetDocumentsValidating:NO options:BSONValidationDefault];
+}
+
+- (void) testCreateDocumentsWithValidationPerformance {
+    [self measureCreatingResultSetDocumentsValidating:YES options:BSONValidationDefault];
+}
+
+- (void) testCreateDocumentsWithUTF8ValidationPerformance {
+    [self measureCreatingResultSetDocumentsValidating:YES options:BSONValidationCheckUTF8];
+}
+
+- (void) testDecodeResultSetAllocations {
+    // Warm up the key table and the class caches so that neither run pays for them
+    [[self class] allocationCountDecodingResultSetWithSession:nil];
+    size_t withoutSession = [[self class] allocationCountDecodingResultSetWithSession:nil];
+    size_t withSession = [[self class] allocationCountDecodingResultSetWithSession:[BSONDecodingSession session]];
+    NSLog(@"Decoding %lu documents: %lu live allocations without a session, %lu with one",
+          (unsigned long) [[[self class] resultSetDocuments] count],
+          (unsigned long) withoutSession, (unsigned long) withSession);
+    XCTAssertTrue(withSession < withoutSession);
+}
+
+- (void) testDecodeResultSetWithoutSessionPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    [self measureBlock:^{
+        @autoreleasepool {
+            for (BSONDocument *document in documents)
+                [BSONDecoder decodeDictionaryWithDocument:document];
+        }
+    }];
+}
+
+- (void) testDecodeResultSetWithSessionPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    [self measureBlock:^{
+        @autoreleasepool {
+            BSONDecodingSession *session = [BSONDecodingSession session];
+            for (BSONDocument *document in documents) {
+                BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document session:session];
+                [decoder decodeDictionary];
+                maybe_release(decoder);
+            }
+        }
+    }];
+}
+
+// Compare with -testDecodeResultSetWithoutSessionPerformance, which has no hooks
+- (void) testDecodeResultSetWithDelegatePerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    BSONPerformanceTestDecoderDelegate *delegate = [[BSONPerformanceTestDecoderDelegate alloc] init];
+    [self measureBlock:^{
+        @autoreleasepool {
+            for (BSONDocument *document in documents) {
+                BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document];
+                decoder.delegate = delegate;
+                [decoder decodeDictionary];
+                maybe_release(decoder);
+            }
+        }
+    }];
+    maybe_release(delegate);
+}
+
+/**
+ Decodes the result set five times with up to <i>maximumConcurrency</i> threads. On a machine with
+ enough cores, each doubling should come close to halving the time.
+ */
+- (void) measureBatchDecodingWithMaximumConcurrency:(NSUInteger) maximumConcurrency {
+    NSArray *documents = [[self class] resultSetDocuments];
+    [self measureBlock:^{
+        for (int i = 0; i < 5; ++i) @autoreleasepool {
+            [BSONDecoder decodeObjectsWithClass:nil documents:documents maximumConcurrency:maximumConcurrency];
+        }
+    }];
+}
+
+- (void) testDecodeBatchOn1ThreadPerformance { [self measureBatchDecodingWithMaximumConcurrency:1]; }
+- (void) testDecodeBatchOn2ThreadsPerformance { [self measureBatchDecodingWithMaximumConcurrency:2]; }
+- (void) testDecodeBatchOn4ThreadsPerformance { [self measureBatchDecodingWithMaximumConcurrency:4]; }
+- (void) testDecodeBatchOn8ThreadsPerformance { [self measureBatchDecodingWithMaximumConcurrency:8]; }
+- (void) testDecodeBatchOnAllProcessorsPerformance { [self measureBatchDecodingWithMaximumConcurrency:0]; }
+
+- (void) testDecodeBlobsMemory {
+    [[self class] bytesInUseDecodingBlobDocumentsReferencingBytes:NO];
+    size_t copying = [[self class] bytesInUseDecodingBlobDocumentsReferencingBytes:NO];
+    size_t referencing = [[self class] bytesInUseDecodingBlobDocumentsReferencingBytes:YES];
+    NSLog(@"Decoding %lu blob documents: %lu bytes in use copying values, %lu referencing them",
+          (unsigned long) [[[self class] blobDocuments] count],
+          (unsigned long) copying, (unsigned long) referencing);
+    XCTAssertTrue(referencing < copying / 10);
+}
+
+- (void) measureDecodingBlobsReferencingBytes:(BOOL) referencesDocumentBytes {
+    NSArray *documents = [[self class] blobDocuments];
+    [self measureBlock:^{
+        for (int i = 0; i < 10; ++i) @autoreleasepool {
+            for (BSONDocument *document in documents) {
+                BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document];
+                decoder.referencesDocumentBytes = referencesDocumentBytes;
+                [decoder decodeDictionary];
+                maybe_release(decoder);
+            }
+        }
+    }];
+}
+
+- (void) testDecodeBlobsCopyingPerformance { [self measureDecodingBlobsReferencingBytes:NO]; }
+- (void) testDecodeBlobsReferencingDocumentPerformance { [self measureDecodingBlobsReferencingBytes:YES]; }
+
+- (void) testDetachDecodedBlobsPerformance {
+    NSMutableArray *decoded = [NSMutableArray array];
+    for (BSONDocument *document in [[self class] blobDocuments]) {
+        BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document];
+        decoder.referencesDocumentBytes = YES;
+        [decoded addObject:[decoder decodeDictionary]];
+        maybe_release(decoder);
+    }
+    [self measureBlock:^{
+        @autoreleasepool {
+            XCTAssertTrue(decoded != [BSONDecoder detachedObject:decoded]);
+        }
+    }];
+}
+
+#pragma mark - Object IDs
+
+// bson_oid_gen() increments a global without synchronization, so this baseline can produce
+// duplicates
+- (void) testGenerateObjectIDsWithDriverOn8ThreadsPerformance {
+    [self measureBlock:^{
+        dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+            bson_oid_t oid;
+            for (int i = 0; i < 100000; ++i) bson_oid_gen(&oid);
+        });
+    }];
+}
+
+- (void) testCreateObjectIDsOn8ThreadsPerformance {
+    [self measureBlock:^{
+        dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+            for (int i = 0; i < 100000; ++i) @autoreleasepool {
+                [BSONObjectID objectID];
+            }
+        });
+    }];
+}
+
+- (void) testGenerateObjectIDBytesOn8ThreadsPerformance {
+    [self measureBlock:^{
+        dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+            char buffer[12 * 100];
+            for (int i = 0; i < 1000; ++i) [BSONObjectID generateObjectIDBytes:buffer count:100];
+        });
+    }];
+}
+
+#define BSONPerformanceObjectIDCount 1000000
+
+/**
+ Returns the bytes of a million object IDs, the odd-numbered ones of which stand in for object
+ IDs that are looked up but not present.
+ */
++ (NSData *) objectIDBytes {
+    static NSData *result;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableData *bytes = [[NSMutableData alloc] initWithLength:12 * BSONPerformanceObjectIDCount];
+        [BSONObjectID generateObjectIDBytes:[bytes mutableBytes] count:BSONPerformanceObjectIDCount];
+        result = bytes;
+    });
+    return result;
+}
+
++ (NSArray *) objectIDsFromBytes:(NSData *) data {
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity:data.length / 12];
+    for (NSUInteger i = 0; i < data.length; i += 12)
+        [result addObject:[BSONObjectID objectIDWithData:[data subdataWithRange:NSMakeRange(i, 12)]]];
+    return result;
+}
+
+- (void) testObjectIDSetMemory {
+    NSData *bytes = [[self class] objectIDBytes];
+    malloc_statistics_t before, after;
+    size_t objects, packed;
+    @autoreleasepool {
+        NSArray *objectIDs = [[self class] objectIDsFromBytes:bytes];
+        malloc_zone_statistics(NULL, &before);
+        NSSet *set = [[NSSet alloc] initWithArray:objectIDs];
+        malloc_zone_statistics(NULL, &after);
+        // Each object ID in an NSSet is also a heap object, which the array above already holds
+        objects = after.size_in_use - before.size_in_use + objectIDs.count * malloc_size((__bridge void *) [objectIDs lastObject]);
+        maybe_release(set);
+    }
+    malloc_zone_statistics(NULL, &before);
+    BSONObjectIDSet *set = [[BSONObjectIDSet alloc] initWithCapacity:BSONPerformanceObjectIDCount];
+    [set addObjectIDBytes:[bytes bytes] count:BSONPerformanceObjectIDCount];
+    malloc_zone_statistics(NULL, &after);
+    packed = after.size_in_use - before.size_in_use;
+    maybe_release(set);
+    NSLog(@"Holding %d object IDs: %lu bytes as objects in an NSSet, %lu in a BSONObjectIDSet",
+          BSONPerformanceObjectIDCount, (unsigned long) objects, (unsigned long) packed);
+    XCTAssertTrue(packed < objects / 4);
+}
+
+- (void) testObjectIDMembershipUsingNSSetPerformance {
+    NSArray *objectIDs = [[self class] objectIDsFromBytes:[[self class] objectIDBytes]];
+    NSMutableSet *set = [NSMutableSet setWithCapacity:objectIDs.count / 2];
+    for (NSUInteger i = 0; i < objectIDs.count; i += 2) [set addObject:[objectIDs objectAtIndex:i]];
+    [self measureBlock:^{
+        NSUInteger found = 0;
+        for (BSONObjectID *objectID in objectIDs)
+            if ([set containsObject:objectID]) ++found;
+        XCTAssertEqual(found, objectIDs.count / 2);
+    }];
+}
+
+- (void) testObjectIDMembershipUsingObjectIDSetPerformance {
+    NSArray *objectIDs = [[self class] objectIDsFromBytes:[[self class] objectIDBytes]];
+    BSONObjectIDSet *set = [[BSONObjectIDSet alloc] initWithCapacity:objectIDs.count / 2];
+    for (NSUInteger i = 0; i < objectIDs.count; i += 2) [set addObjectID:[objectIDs objectAtIndex:i]];
+    [self measureBlock:^{
+        NSUInteger found = 0;
+        for (BSONObjectID *objectID in objectIDs)
+            if ([set containsObjectID:objectID]) ++found;
+        XCTAssertEqual(found, objectIDs.count / 2);
+    }];
+    maybe_release(set);
+}
+
+- (void) testObjectIDBulkMembershipUsingObjectIDSetPerformance {
+    NSData *bytes = [[self class] objectIDBytes];
+    BSONObjectIDSet *set = [[BSONObjectIDSet alloc] initWithCapacity:BSONPerformanceObjectIDCount / 2];
+    for (NSUInteger i = 0; i < BSONPerformanceObjectIDCount; i += 2)
+        [set addObjectIDBytes:(const char *) [bytes bytes] + i * 12 count:1];
+    BOOL *results = malloc(BSONPerformanceObjectIDCount * sizeof(BOOL));
+    [self measureBlock:^{
+        XCTAssertEqual([set containsObjectIDBytes:[bytes bytes] count:BSONPerformanceObjectIDCount results:results],
+                       (NSUInteger) BSONPerformanceObjectIDCount / 2);
+    }];
+    free(results);
+    maybe_release(set);
+}
+
+// Checks before adding each object ID, in random order, as deduplicating a stream would
+- (void) testObjectIDAlternateAddAndContainsPerformance {
+    NSData *bytes = [[self class] objectIDBytes];
+    NSUInteger *order = malloc(BSONPerformanceObjectIDCount * sizeof(NSUInteger));
+    for (NSUInteger i = 0; i < BSONPerformanceObjectIDCount; ++i) order[i] = i;
+    for (NSUInteger i = BSONPerformanceObjectIDCount - 1; i > 0; --i) {
+        NSUInteger j = arc4random_uniform((uint32_t) i + 1), swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+    [self measureBlock:^{
+        BSONObjectIDSet *set = [[BSONObjectIDSet alloc] init];
+        NSUInteger found = 0;
+        for (NSUInteger i = 0; i < BSONPerformanceObjectIDCount; ++i) {
+            const char *objectID = (const char *) [bytes bytes] + order[i] / 2 * 2 * 12;
+            if ([set containsObjectIDBytes:objectID])
+                ++found;
+            else
+                [set addObjectIDBytes:objectID count:1];
+        }
+        XCTAssertEqual(found, (NSUInteger) BSONPerformanceObjectIDCount / 2);
+        maybe_release(set);
+    }];
+    free(order);
+}
+
+- (void) testObjectIDStringRoundTripPerformance {
+    NSArray *objectIDs = [[[self class] objectIDsFromBytes:[[self class] objectIDBytes]]
+                          subarrayWithRange:NSMakeRange(0, 100000)];
+    NSArray *strings = [objectIDs valueForKey:@"stringValue"];
+    // Each parsed object ID is new, so its string value isn't cached
+    [self measureBlock:^{
+        @autoreleasepool {
+            for (NSString *string in strings)
+                XCTAssertTrue(24 == [[[BSONObjectID objectIDWithString:string] stringValue] length]);
+        }
+    }];
+}
+
+// Compare with -testDecodeResultSetWithoutSessionPerformance, which decodes every field
+- (void) testDecodeResultSetWithKeyPathsPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    NSArray *keyPaths = @[ [BSONCompiledKeyPath keyPathWithString:@"status"],
+                           [BSONCompiledKeyPath keyPathWithString:@"rating"],
+                           [BSONCompiledKeyPath keyPathWithString:@"labels.1"] ];
+    [self measureBlock:^{
+        @autoreleasepool {
+            for (BSONDocument *document in documents)
+                XCTAssertEqual((NSUInteger) 3, [[BSONDecoder decodeDictionaryWithKeyPaths:keyPaths document:document] count]);
+        }
+    }];
+}
+
+- (void) testReadNumericFieldsAsObjectsPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    [self measureBlock:^{
+        double total = 0;
+        for (int i = 0; i < 10; ++i) @autoreleasepool {
+            for (BSONDocument *document in documents) {
+                BSONIterator *iterator = [document iterator];
+                total += [[iterator objectForKey:@"rating"] doubleValue];
+                total += [[iterator objectForKey:@"wordCount"] longLongValue];
+                total += [[iterator objectForKey:@"revision"] intValue];
+            }
+        }
+        XCTAssertTrue(total > 0);
+    }];
+}
+
+- (void) testReadNumericFieldsAsColumnsPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    BSONColumnarDecoder *decoder = [[BSONColumnarDecoder alloc] init];
+    BSONColumn *rating = [decoder addColumnWithKeyPath:@"rating" type:BSONTypeDouble];
+    BSONColumn *wordCount = [decoder addColumnWithKeyPath:@"wordCount" type:BSONTypeLong];
+    BSONColumn *revision = [decoder addColumnWithKeyPath:@"revision" type:BSONTypeInteger];
+    [self measureBlock:^{
+        double total = 0;
+        for (int i = 0; i < 10; ++i) {
+            [decoder removeAllRows];
+            NSUInteger count = [decoder appendDocuments:documents];
+            for (NSUInteger row = 0; row < count; ++row)
+                total += [rating doubleValues][row] + [wordCount int64Values][row] + [revision int32Values][row];
+        }
+        XCTAssertTrue(total > 0);
+    }];
+    maybe_release(decoder);
+}
+
+- (void) testDecodeWithKeyPathDelegatePerformance {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[[self class] mixedTypePayload]];
+    BSONPerformanceTestKeyPathDelegate *delegate = [[BSONPerformanceTestKeyPathDelegate alloc] init];
+    [self measureBlock:^{
+        for (int i = 0; i < 100; ++i) @autoreleasepool {
+            BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document];
+            decoder.delegate = delegate;
+            [decoder decodeDictionary];
+            maybe_release(decoder);
+        }
+    }];
+    maybe_release(delegate);
+}
+
++ (BSONDocument *) deeplyNestedDocument {
+    return [BSONEncoder documentForDictionary:[self nestedPayloadWithDepth:8 width:20]];
+}
+
+- (void) testReadKeyPathUsingSubIteratorsPerformance {
+    BSONDocument *document = [[self class] deeplyNestedDocument];
+    [self measureBlock:^{
+        for (int i = 0; i < 10000; ++i) @autoreleasepool {
+            BSONIterator *iterator = [document iterator];
+            for (int level = 0; level < 8; ++level) {
+                [iterator valueTypeForKey:@"next"];
+                iterator = [iterator embeddedDocumentIteratorValue];
+            }
+            XCTAssertTrue([[iterator objectForKey:@"leaf"] boolValue]);
+        }
+    }];
+}
+
+- (void) testReadKeyPathPerformance {
+    BSONDocument *document = [[self class] deeplyNestedDocument];
+    NSString *keyPath = @"next.next.next.next.next.next.next.next.leaf";
+    [self measureBlock:^{
+        for (int i = 0; i < 10000; ++i) @autoreleasepool {
+            XCTAssertTrue([[document objectForKeyPath:keyPath] boolValue]);
+        }
+    }];
+}
+
+- (void) testReadCompiledKeyPathPerformance {
+    BSONDocument *document = [[self class] deeplyNestedDocument];
+    BSONCompiledKeyPath *keyPath = [BSONCompiledKeyPath keyPathWithString:@"next.next.next.next.next.next.next.next.leaf"];
+    [self measureBlock:^{
+        for (int i = 0; i < 10000; ++i) @autoreleasepool {
+            XCTAssertTrue([[document objectForCompiledKeyPath:keyPath] boolValue]);
+        }
+    }];
+}
+
+#pragma mark - Extended JSON
+
+// The baseline: -description prints through the driver under a global lock
+- (void) testDescribeResultSetPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    [self measureBlock:^{
+        @autoreleasepool {
+            for (BSONDocument *document in documents) [document description];
+        }
+    }];
+}
+
+- (void) testWriteResultSetAsExtendedJSONPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    [self measureBlock:^{
+        @autoreleasepool {
+            for (BSONDocument *document in documents)
+                [document extendedJSONStringWithMode:BSONExtendedJSONModeRelaxed];
+        }
+    }];
+}
+
+- (void) testWriteResultSetAsCanonicalExtendedJSONPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    [self measureBlock:^{
+        @autoreleasepool {
+            for (BSONDocument *document in documents)
+                [document extendedJSONStringWithMode:BSONExtendedJSONModeCanonical];
+        }
+    }];
+}
+
+- (void) testWriteResultSetAsExtendedJSONIntoReusedDataPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    NSMutableData *data = [NSMutableData dataWithCapacity:1024];
+    [self measureBlock:^{
+        for (BSONDocument *document in documents) {
+            [data setLength:0];
+            [BSONExtendedJSONWriter appendDocument:document mode:BSONExtendedJSONModeRelaxed toData:data];
+        }
+    }];
+}
+
+- (void) testDescribeResultSetOn8ThreadsPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    [self measureBlock:^{
+        dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+            @autoreleasepool {
+                for (BSONDocument *document in documents) [document description];
+            }
+        });
+    }];
+}
+
+- (void) testWriteResultSetAsExtendedJSONOn8ThreadsPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    [self measureBlock:^{
+        dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+            @autoreleasepool {
+                for (BSONDocument *document in documents)
+                    [document extendedJSONStringWithMode:BSONExtendedJSONModeRelaxed];
+            }
+        });
+    }];
+}
+
+- (void) testExportResultSetAsExtendedJSONPerformance {
+    NSArray *documents = [[self class] resultSetDocuments];
+    int fd = open("/dev/null", O_WRONLY);
+    BSONExtendedJSONWriter *writer = [[BSONExtendedJSONWriter alloc] initWithFileDescriptor:fd closeOnDealloc:YES];
+    [self measureBlock:^{
+        for (BSONDocument *document in documents)
+            [writer writeDocument:document error:NULL];
+        XCTAssertTrue([writer flush:NULL]);
+    }];
+    maybe_release(writer);
+}
+
+@end
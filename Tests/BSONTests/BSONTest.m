@@ -24,6 +24,8 @@
 #import "BSONDocument.h"
 #import "BSONTypes.h"
 #import "BSONCoding.h"
+#import "BSONCompiledKeyPath.h"
+#import "OrderedDictionary.h"
 
 @interface Person : NSObject
 @property (retain) NSString * name;
@@ -162,6 +164,66 @@
 
 @end
 
+@interface EqualToEveryNode : NSObject <NSCoding>
+@property (retain) EqualToEveryNode *child;
+@end
+@implementation EqualToEveryNode
+-(void)dealloc {
+    maybe_release(_child);
+    super_dealloc;
+}
+-(BOOL)isEqual:(id)object {
+    return [object isKindOfClass:[EqualToEveryNode class]];
+}
+-(NSUInteger)hash {
+    return 0;
+}
+-(void)encodeWithCoder:(NSCoder *)coder {
+    [coder encodeObject:self.child forKey:@"child"];
+}
+-(id)initWithCoder:(NSCoder *)coder {
+    return [super init];
+}
+@end
+
+/**
+ A dictionary which is encoded as a string summarizing it.
+ */
+@interface DictionaryWithReplacement : NSDictionary
+@end
+@implementation DictionaryWithReplacement {
+    NSDictionary *_dictionary;
+}
+- (id) initWithObjects:(const id [])objects forKeys:(const id <NSCopying> [])keys count:(NSUInteger) count {
+    if (self = [super init]) {
+        _dictionary = [[NSDictionary alloc] initWithObjects:objects forKeys:keys count:count];
+    }
+    return self;
+}
+- (void) dealloc {
+    maybe_release(_dictionary);
+    super_dealloc;
+}
+- (NSUInteger) count { return [_dictionary count]; }
+- (id) objectForKey:(id) key { return [_dictionary objectForKey:key]; }
+- (NSEnumerator *) keyEnumerator { return [_dictionary keyEnumerator]; }
+- (id) replacementObjectForCoder:(NSCoder *) encoder {
+    return [NSString stringWithFormat:@"%lu entries", (unsigned long) self.count];
+}
+@end
+
+/**
+ Encodes a document built with the convenience methods while it's being encoded itself.
+ */
+@interface NestedDocumentEncoder : NSObject <BSONCoding>
+@end
+@implementation NestedDocumentEncoder
+- (void) encodeWithBSONEncoder:(BSONEncoder *) encoder {
+    BSONDocument *document = [BSONEncoder documentForDictionary:[NSDictionary dictionaryWithObject:@"inner" forKey:@"name"]];
+    [encoder encodeBSONDocument:document forKey:@"document"];
+}
+@end
+
 @interface TestEncoderDelegate : NSObject <BSONEncoderDelegate>
 @property (retain) NSMutableArray *encodedObjects;
 @property (retain) NSMutableArray *willEncodeKeyPaths;
@@ -520,6 +582,384 @@
     maybe_release(encoder2);
 }
 
+- (void) testEncodingWithoutDelegate {
+    NSDictionary *sample = [NSDictionary dictionaryWithObjectsAndKeys:
+                            [NSNumber numberWithInt:1], @"one",
+                            [NSNumber numberWithDouble:2.0], @"two",
+                            [NSNumber numberWithLongLong:3000000000LL], @"three",
+                            [NSNumber numberWithBool:YES], @"four",
+                            @"five", @"five",
+                            [NSDate dateWithTimeIntervalSince1970:6.0], @"six",
+                            [@"seven" dataUsingEncoding:NSUTF8StringEncoding], @"seven",
+                            [NSNull null], @"eight",
+                            [BSONIterator objectForUndefined], @"nine",
+                            [BSONObjectID objectID], @"ten",
+                            [NSArray arrayWithObjects:@"zero", [NSNumber numberWithInt:1],
+                             [NSArray arrayWithObject:@"two"],
+                             [NSDictionary dictionaryWithObject:@"three" forKey:@"three"], nil], @"eleven",
+                            [NSDictionary dictionaryWithObject:[NSDictionary dictionaryWithObject:@"deep" forKey:@"deeper"]
+                                                        forKey:@"deep"], @"twelve",
+                            nil];
+    
+    BSONDocument *fastDocument = [BSONEncoder documentForDictionary:sample];
+    
+    BSONEncoder *encoder = [[BSONEncoder alloc] init];
+    TestEncoderDelegate *delegate = [[TestEncoderDelegate alloc] init];
+    encoder.delegate = delegate;
+    [encoder encodeDictionary:sample];
+    
+    XCTAssertEqualObjects([fastDocument dictionaryValue],
+                          [[encoder BSONDocument] dictionaryValue],
+                          @"Encoding without a delegate should produce the same document");
+    XCTAssertEqualObjects([[fastDocument dictionaryValue] objectForKey:@"nine"],
+                          [BSONIterator objectForUndefined]);
+    
+    NSDictionary *badKey = [NSDictionary dictionaryWithObject:[NSArray array] forKey:@"$bad"];
+    XCTAssertThrows([BSONEncoder documentForDictionary:badKey]);
+    NSDictionary *badNestedKey = [NSDictionary dictionaryWithObject:[NSArray arrayWithObject:badKey] forKey:@"good"];
+    XCTAssertThrows([BSONEncoder documentForDictionary:badNestedKey]);
+    XCTAssertNoThrow([BSONEncoder documentForDictionary:badNestedKey restrictingKeyNamesForMongoDB:NO]);
+    
+    maybe_release(encoder);
+    maybe_release(delegate);
+}
+
+- (void) testEncodingWithoutDelegateReplacesObjects {
+    DictionaryWithReplacement *replaced = [[DictionaryWithReplacement alloc] initWithObjectsAndKeys:@1, @"a", @2, @"b", nil];
+    NSDictionary *sample = @{ @"dictionary" : replaced, @"array" : @[ replaced ] };
+    
+    NSDictionary *expected = @{ @"dictionary" : @"2 entries", @"array" : @[ @"2 entries" ] };
+    XCTAssertEqualObjects([[BSONEncoder documentForDictionary:sample] dictionaryValue], expected,
+                          @"The fast path should still encode replacement objects");
+    
+    BSONEncoder *encoder = [[BSONEncoder alloc] init];
+    TestEncoderDelegate *delegate = [[TestEncoderDelegate alloc] init];
+    encoder.delegate = delegate;
+    [encoder encodeDictionary:sample];
+    XCTAssertEqualObjects([[encoder BSONDocument] dictionaryValue], expected);
+    
+    maybe_release(encoder);
+    maybe_release(delegate);
+    maybe_release(replaced);
+}
+
+- (void) testEncodeLongArray {
+    NSMutableArray *array = [NSMutableArray array];
+    for (int i = 0; i < 2500; ++i)
+        [array addObject:(i % 2) ? [NSNumber numberWithInt:i] : [NSArray arrayWithObject:[NSNumber numberWithInt:i]]];
+    NSDictionary *sample = [NSDictionary dictionaryWithObject:array forKey:@"array"];
+    
+    BSONDocument *fastDocument = [BSONEncoder documentForDictionary:sample];
+    XCTAssertEqualObjects(sample, [fastDocument dictionaryValue]);
+    
+    BSONEncoder *encoder = [[BSONEncoder alloc] init];
+    TestEncoderDelegate *delegate = [[TestEncoderDelegate alloc] init];
+    encoder.delegate = delegate;
+    [encoder encodeDictionary:sample];
+    XCTAssertEqualObjects([fastDocument dataValue], [[encoder BSONDocument] dataValue]);
+    
+    BSONIterator *documentIterator = [fastDocument iterator];
+    [documentIterator next];
+    BSONIterator *iterator = [documentIterator sequentialSubIteratorValue];
+    NSUInteger i = 0;
+    while ([iterator next])
+        XCTAssertEqualObjects([NSString stringWithFormat:@"%lu", (unsigned long) i++], [iterator key]);
+    XCTAssertEqual((NSUInteger) 2500, i);
+    
+    maybe_release(encoder);
+    maybe_release(delegate);
+}
+
+- (void) testEncodeClassClusterMembers {
+    NSMutableString *mutableString = [NSMutableString stringWithString:@"mutable"];
+    NSMutableArray *mutableArray = [NSMutableArray arrayWithObject:@"element"];
+    NSMutableDictionary *mutableDictionary = [NSMutableDictionary dictionaryWithObject:@"value" forKey:@"key"];
+    NSMutableData *mutableData = [NSMutableData dataWithLength:4];
+    NSArray *values = [NSArray arrayWithObjects:
+                       @"literal", [NSString stringWithFormat:@"%d", 1], mutableString,
+                       [NSNumber numberWithInt:1], [NSNumber numberWithDouble:1.5],
+                       [NSArray array], [NSArray arrayWithObjects:@"a", @"b", nil], mutableArray,
+                       [NSDictionary dictionary], mutableDictionary,
+                       [NSData data], mutableData,
+                       nil];
+    
+    for (NSUInteger round = 0; round < 2; ++round) {
+        NSDictionary *sample = [NSDictionary dictionaryWithObject:values forKey:@"values"];
+        XCTAssertEqualObjects(sample, [[BSONEncoder documentForDictionary:sample] dictionaryValue]);
+        
+        BSONEncoder *encoder = [[BSONEncoder alloc] init];
+        TestEncoderDelegate *delegate = [[TestEncoderDelegate alloc] init];
+        encoder.delegate = delegate;
+        [encoder encodeDictionary:sample];
+        XCTAssertEqualObjects(sample, [[encoder BSONDocument] dictionaryValue]);
+        maybe_release(encoder);
+        maybe_release(delegate);
+    }
+    
+    NSOrderedSet *orderedSet = [NSOrderedSet orderedSetWithObjects:@"one", @"two", nil];
+    BSONEncoder *encoder = [[BSONEncoder alloc] init];
+    [encoder encodeObject:orderedSet forKey:@"set"];
+    [encoder encodeObject:[BSONCode code:@"x = 1"] forKey:@"code"];
+    NSDictionary *decoded = [[encoder BSONDocument] dictionaryValue];
+    XCTAssertEqualObjects([orderedSet array], [decoded objectForKey:@"set"]);
+    XCTAssertEqualObjects(@"x = 1", [[decoded objectForKey:@"code"] code]);
+    maybe_release(encoder);
+    
+    encoder = [[BSONEncoder alloc] init];
+    XCTAssertThrows([encoder encodeObject:mutableString]);
+    XCTAssertThrows([encoder encodeObject:mutableArray]);
+    XCTAssertNoThrow([encoder encodeObject:mutableDictionary]);
+    maybe_release(encoder);
+}
+
+- (void) testResetEncoder {
+    BSONEncoder *encoder = [[BSONEncoder alloc] init];
+    [encoder encodeString:@"first" forKey:@"name"];
+    BSONDocument *first = [encoder BSONDocument];
+    
+    [encoder reset];
+    [encoder encodeString:@"discarded" forKey:@"name"];
+    [encoder reset];
+    [encoder encodeString:@"second" forKey:@"name"];
+    [encoder encodeInt:2 forKey:@"number"];
+    BSONDocument *second = [encoder BSONDocument];
+    
+    XCTAssertEqualObjects([NSDictionary dictionaryWithObject:@"first" forKey:@"name"],
+                          [first dictionaryValue]);
+    XCTAssertEqualObjects(([NSDictionary dictionaryWithObjectsAndKeys:
+                            @"second", @"name", [NSNumber numberWithInt:2], @"number", nil]),
+                          [second dictionaryValue]);
+    
+    [encoder reset];
+    XCTAssertThrows([encoder encodeObject:@"value" forKey:@"$bad"]);
+    [encoder reset];
+    NSDictionary *nested = [NSDictionary dictionaryWithObject:[NSArray arrayWithObject:@"value"] forKey:@"key"];
+    [encoder encodeDictionary:nested];
+    XCTAssertEqualObjects(nested, [[encoder BSONDocument] dictionaryValue]);
+    
+    maybe_release(encoder);
+}
+
+- (void) testConvenienceMethodsWhileEncoding {
+    NestedDocumentEncoder *object = [[NestedDocumentEncoder alloc] init];
+    NSDictionary *sample = [NSDictionary dictionaryWithObject:object forKey:@"outer"];
+    for (int i = 0; i < 3; ++i) {
+        NSDictionary *decoded = [[BSONEncoder documentForDictionary:sample] dictionaryValue];
+        XCTAssertEqualObjects(@"inner", [[[decoded objectForKey:@"outer"] objectForKey:@"document"] objectForKey:@"name"]);
+    }
+    XCTAssertThrows([BSONEncoder documentForDictionary:[NSDictionary dictionaryWithObject:@"value" forKey:@"$bad"]]);
+    XCTAssertEqualObjects(@"value",
+                          [[[BSONEncoder documentForDictionary:[NSDictionary dictionaryWithObject:@"value" forKey:@"good"]]
+                            dictionaryValue] objectForKey:@"good"]);
+    maybe_release(object);
+}
+
+- (void) testDocumentsForObjects {
+    NSMutableArray *objects = [NSMutableArray array];
+    for (int i = 0; i < 500; ++i)
+        [objects addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                            [NSNumber numberWithInt:i], @"index",
+                            [NSString stringWithFormat:@"object %d", i], @"name",
+                            nil]];
+    BSONDocument *existing = [BSONEncoder documentForDictionary:[NSDictionary dictionaryWithObject:@"existing" forKey:@"name"]];
+    [objects replaceObjectAtIndex:250 withObject:existing];
+    
+    NSArray *concurrent = [BSONEncoder documentsForObjects:objects options:BSONBatchEncodingDefault];
+    NSArray *serial = [BSONEncoder documentsForObjects:objects options:BSONBatchEncodingSerially];
+    XCTAssertEqual(objects.count, concurrent.count);
+    XCTAssertEqualObjects(serial, concurrent);
+    XCTAssertEqual(existing, [concurrent objectAtIndex:250], @"Documents should be passed through");
+    for (NSUInteger i = 0; i < objects.count; ++i) {
+        if (i == 250) continue;
+        XCTAssertEqualObjects([objects objectAtIndex:i], [[concurrent objectAtIndex:i] dictionaryValue]);
+    }
+    
+    XCTAssertEqualObjects([NSArray array], [BSONEncoder documentsForObjects:[NSArray array] options:BSONBatchEncodingDefault]);
+    
+    [objects replaceObjectAtIndex:400 withObject:[NSDictionary dictionaryWithObject:@"value" forKey:@"$bad"]];
+    XCTAssertThrows([BSONEncoder documentsForObjects:objects options:BSONBatchEncodingDefault]);
+    NSArray *unrestricted = [BSONEncoder documentsForObjects:objects options:BSONBatchEncodingUnrestrictedKeyNames];
+    XCTAssertEqualObjects(@"value", [[[unrestricted objectAtIndex:400] dictionaryValue] objectForKey:@"$bad"]);
+}
+
+- (void) testDecodeObjectsWithDocuments {
+    NSMutableArray *dictionaries = [NSMutableArray array];
+    NSMutableArray *people = [NSMutableArray array];
+    for (int i = 0; i < 500; ++i) {
+        [dictionaries addObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                                 [NSNumber numberWithInt:i], @"index",
+                                 [NSString stringWithFormat:@"object %d", i], @"name",
+                                 [NSArray arrayWithObject:[NSNumber numberWithInt:i]], @"list",
+                                 nil]];
+        PersonWithCoding *person = [[PersonWithCoding alloc] init];
+        person.name = [NSString stringWithFormat:@"Person %d", i];
+        person.numberOfVisits = i;
+        [people addObject:person];
+        maybe_release(person);
+    }
+    NSArray *documents = [BSONEncoder documentsForObjects:dictionaries options:BSONBatchEncodingDefault];
+    NSArray *personDocuments = [BSONEncoder documentsForObjects:people options:BSONBatchEncodingDefault];
+    
+    XCTAssertEqualObjects(dictionaries, [BSONDecoder decodeDictionariesWithDocuments:documents]);
+    XCTAssertEqualObjects(dictionaries, [BSONDecoder decodeObjectsWithClass:nil documents:documents maximumConcurrency:1]);
+    XCTAssertEqualObjects(dictionaries, [BSONDecoder decodeObjectsWithClass:nil documents:documents maximumConcurrency:3]);
+    
+    NSArray *decodedPeople = [BSONDecoder decodeObjectsWithClass:[PersonWithCoding class]
+                                                       documents:personDocuments
+                                              maximumConcurrency:0];
+    XCTAssertEqualObjects(people, decodedPeople);
+    XCTAssertTrue([[decodedPeople lastObject] isKindOfClass:[PersonWithCoding class]]);
+    
+    XCTAssertEqualObjects([NSArray array], [BSONDecoder decodeDictionariesWithDocuments:[NSArray array]]);
+    
+    NSMutableArray *badDocuments = [NSMutableArray arrayWithArray:personDocuments];
+    [badDocuments replaceObjectAtIndex:300
+                            withObject:[BSONEncoder documentForDictionary:[NSDictionary dictionaryWithObject:@5 forKey:@"name"]]];
+    XCTAssertThrows([BSONDecoder decodeObjectsWithClass:[PersonWithCoding class] documents:badDocuments maximumConcurrency:0]);
+}
+
+- (void) testDocumentWithValidatedData {
+    // The offsets below depend on the name coming first
+    OrderedDictionary *sample = [OrderedDictionary dictionary];
+    [sample setObject:@"caf\u00e9" forKey:@"name"];
+    [sample setObject:[NSArray arrayWithObjects:@1, @"two", [NSNull null], nil] forKey:@"list"];
+    [sample setObject:[NSDictionary dictionaryWithObject:[NSData dataWithBytes:"abc" length:3] forKey:@"blob"] forKey:@"nested"];
+    [sample setObject:[BSONCodeWithScope code:@"x" withScope:[BSONEncoder documentForDictionary:@{ @"x" : @1 }]] forKey:@"code"];
+    [sample setObject:[BSONRegularExpression regularExpressionWithPattern:@"^a" options:@"i"] forKey:@"pattern"];
+    [sample setObject:[BSONObjectID objectID] forKey:@"_id"];
+    NSData *data = [[BSONEncoder documentForDictionary:sample] dataValue];
+    NSError *error = nil;
+    BSONDocument *document = [BSONDocument documentWithValidatedData:data options:BSONValidationCheckUTF8 error:&error];
+    XCTAssertNotNil(document);
+    XCTAssertNil(error);
+    XCTAssertEqualObjects(data, [document dataValue]);
+    
+    for (NSUInteger length = 0; length < data.length; ++length) {
+        error = nil;
+        XCTAssertNil([BSONDocument documentWithValidatedData:[data subdataWithRange:NSMakeRange(0, length)]
+                                                     options:BSONValidationDefault
+                                                       error:&error]);
+        XCTAssertEqual(BSONDocumentErrorMalformed, error.code);
+        XCTAssertEqualObjects(BSONErrorDomain, error.domain);
+    }
+    
+    // The length of the first string overruns the document
+    NSMutableData *corrupt = [NSMutableData dataWithData:data];
+    int32_t hugeLength = NSSwapHostIntToLittle(0x7fffffff);
+    [corrupt replaceBytesInRange:NSMakeRange(4 + 1 + strlen("name") + 1, 4) withBytes:&hugeLength];
+    XCTAssertNil([BSONDocument documentWithValidatedData:corrupt options:BSONValidationDefault error:&error]);
+    XCTAssertTrue([error.localizedDescription rangeOfString:@"out of bounds"].location != NSNotFound);
+    
+    NSMutableData *badUTF8 = [NSMutableData dataWithData:data];
+    const char invalid = (char) 0xff;
+    [badUTF8 replaceBytesInRange:NSMakeRange(4 + 1 + strlen("name") + 1 + 4, 1) withBytes:&invalid];
+    XCTAssertNotNil([BSONDocument documentWithValidatedData:badUTF8 options:BSONValidationDefault error:NULL]);
+    XCTAssertNil([BSONDocument documentWithValidatedData:badUTF8 options:BSONValidationCheckUTF8 error:&error]);
+    XCTAssertTrue([error.localizedDescription rangeOfString:@"UTF-8"].location != NSNotFound);
+    
+    NSDictionary *deep = [NSDictionary dictionary];
+    for (int i = 0; i <= BSONIteratorMaximumDepth; ++i)
+        deep = [NSDictionary dictionaryWithObject:deep forKey:@"a"];
+    XCTAssertNil([BSONDocument documentWithValidatedData:[[BSONEncoder documentForDictionary:deep] dataValue]
+                                                 options:BSONValidationDefault
+                                                   error:NULL]);
+}
+
+- (void) testKeyedSearchOnWideDocument {
+    NSMutableDictionary *sample = [NSMutableDictionary dictionary];
+    for (int i = 0; i < 60; ++i)
+        [sample setObject:[NSNumber numberWithInt:i] forKey:[NSString stringWithFormat:@"field%d", i]];
+    [sample setObject:[NSDictionary dictionaryWithDictionary:sample] forKey:@"nested"];
+    BSONDocument *document = [BSONEncoder documentForDictionary:sample];
+    
+    BSONIterator *iterator = [document iterator];
+    for (int i = 59; i >= 0; --i)
+        XCTAssertEqualObjects([NSNumber numberWithInt:i],
+                              [iterator objectForKey:[NSString stringWithFormat:@"field%d", i]]);
+    XCTAssertFalse([iterator containsValueForKey:@"missing"]);
+    XCTAssertFalse([iterator containsValueForKey:@"field"]);
+    XCTAssertTrue([iterator containsValueForKey:@"nested"]);
+    
+    // Sequential iteration picks up after a keyed search, as it does after bson_find()
+    NSMutableSet *keys = [NSMutableSet set];
+    BSONIterator *fromStart = [document iterator];
+    [fromStart valueTypeForKey:@"field30"];
+    while ([fromStart next]) [keys addObject:[fromStart key]];
+    NSMutableSet *expectedKeys = [NSMutableSet set];
+    BSONIterator *reference = [document iterator];
+    BOOL found = NO;
+    while ([reference next]) {
+        if (found) [expectedKeys addObject:[reference key]];
+        if ([[reference key] isEqualToString:@"field30"]) found = YES;
+    }
+    XCTAssertEqualObjects(expectedKeys, keys);
+    
+    BSONIterator *outer = [document iterator];
+    [outer valueTypeForKey:@"nested"];
+    BSONIterator *nested = [outer embeddedDocumentIteratorValue];
+    XCTAssertEqualObjects([NSNumber numberWithInt:42], [nested objectForKey:@"field42"]);
+    XCTAssertNil([nested objectForKey:@"nested"]);
+}
+
+- (void) testEnterEmbeddedObjects {
+    NSMutableDictionary *wide = [NSMutableDictionary dictionary];
+    for (int i = 0; i < 20; ++i)
+        [wide setObject:[NSNumber numberWithInt:i] forKey:[NSString stringWithFormat:@"field%d", i]];
+    OrderedDictionary *sample = [OrderedDictionary dictionary];
+    [sample setObject:@"first" forKey:@"a"];
+    [sample setObject:[NSDictionary dictionaryWithObjectsAndKeys:
+                       wide, @"wide",
+                       [NSArray arrayWithObjects:@"x", @"y", nil], @"list", nil] forKey:@"b"];
+    [sample setObject:@"last" forKey:@"c"];
+    BSONDocument *document = [BSONEncoder documentForDictionary:sample];
+    
+    BSONIterator *iterator = [document iterator];
+    XCTAssertEqual(BSONTypeString, [iterator next]);
+    XCTAssertThrows([iterator enterEmbeddedObject]);
+    XCTAssertThrows([iterator leaveEmbeddedObject]);
+    
+    XCTAssertEqual(BSONTypeEmbeddedDocument, [iterator next]);
+    [iterator enterEmbeddedObject];
+    XCTAssertEqual((NSUInteger) 1, iterator.depth);
+    XCTAssertEqual(BSONTypeArray, [iterator valueTypeForKey:@"list"]);
+    [iterator enterEmbeddedObject];
+    XCTAssertEqual(BSONTypeString, [iterator next]);
+    XCTAssertEqualObjects(@"x", [iterator objectValue]);
+    NSArray *expectedKeyPath = [NSArray arrayWithObjects:@"b", @"list", @"0", nil];
+    XCTAssertEqualObjects(expectedKeyPath, [iterator keyPathComponents]);
+    XCTAssertEqualObjects(@"y", [iterator nextObject]);
+    XCTAssertEqual(BSONTypeEndOfObject, [iterator next]);
+    [iterator leaveEmbeddedObject];
+    XCTAssertEqualObjects(@"list", [iterator key]);
+    
+    XCTAssertEqual(BSONTypeEmbeddedDocument, [iterator valueTypeForKey:@"wide"]);
+    [iterator enterEmbeddedObject];
+    for (int i = 19; i >= 0; --i)
+        XCTAssertEqualObjects([NSNumber numberWithInt:i],
+                              [iterator objectForKey:[NSString stringWithFormat:@"field%d", i]]);
+    XCTAssertFalse([iterator containsValueForKey:@"list"]);
+    [iterator leaveEmbeddedObject];
+    [iterator leaveEmbeddedObject];
+    
+    XCTAssertEqual((NSUInteger) 0, iterator.depth);
+    XCTAssertEqualObjects(@"b", [iterator key]);
+    XCTAssertEqualObjects(@"last", [iterator nextObject]);
+    XCTAssertEqualObjects(@"first", [iterator objectForKey:@"a"]);
+}
+
+- (void) testEnterEmbeddedObjectsTooDeep {
+    NSDictionary *sample = [NSDictionary dictionary];
+    for (int i = 0; i <= BSONIteratorMaximumDepth; ++i)
+        sample = [NSDictionary dictionaryWithObject:sample forKey:@"a"];
+    BSONIterator *iterator = [[BSONEncoder documentForDictionary:sample] iterator];
+    for (int i = 0; i < BSONIteratorMaximumDepth; ++i) {
+        [iterator next];
+        [iterator enterEmbeddedObject];
+    }
+    [iterator next];
+    XCTAssertThrows([iterator enterEmbeddedObject]);
+}
+
 - (void) testUnequal {
     NSDictionary *sample1 = [NSDictionary dictionaryWithObjectsAndKeys:
                             [NSNumber numberWithInt:1], @"one",
@@ -1173,6 +1613,23 @@
     maybe_release(littlerRicky);
 }
 
+- (void)testObjectLoopComparesIdentity {
+    EqualToEveryNode *parent = [[EqualToEveryNode alloc] init];
+    EqualToEveryNode *child = [[EqualToEveryNode alloc] init];
+    parent.child = child;
+    
+    XCTAssertNoThrow([BSONEncoder documentForObject:parent],
+                     @"Equal but distinct objects are not a loop");
+    
+    child.child = parent;
+    XCTAssertThrows([BSONEncoder documentForObject:parent],
+                    @"Encoding a loop should raise an exception");
+    
+    child.child = nil;
+    maybe_release(parent);
+    maybe_release(child);
+}
+
 - (void)testEncodeObjectsByInclusionAndByReference {
     PersonWithCoding *lucy = [[PersonWithCoding alloc] init];
     lucy.name = @"Lucy Ricardo";
@@ -1511,6 +1968,229 @@
     maybe_release(delegate2);
 }
 
+- (void) testDecodeWithoutHooksMatchesDecodeWithDelegate {
+    NSDictionary *sample = [NSDictionary dictionaryWithObjectsAndKeys:
+                            [NSNumber numberWithInt:1], @"one",
+                            @"2", @"two",
+                            [NSNull null], @"three",
+                            [BSONObjectID objectID], @"_id",
+                            [NSArray arrayWithObjects:@"zero", [NSNull null],
+                             [NSDictionary dictionaryWithObject:@"b" forKey:@"a"], [NSArray array], nil], @"four",
+                            [NSDictionary dictionaryWithObjectsAndKeys:
+                             [NSArray arrayWithObject:@"c"], @"b",
+                             [NSDictionary dictionary], @"empty", nil], @"five",
+                            nil];
+    BSONDocument *document = [BSONEncoder documentForDictionary:sample];
+    
+    BSONDecoder *decoder1 = [[BSONDecoder alloc] initWithDocument:document];
+    NSDictionary *withoutHooks = [decoder1 decodeDictionary];
+    
+    BSONDecoder *decoder2 = [[BSONDecoder alloc] initWithDocument:document];
+    TestDecoderDelegate *delegate = [[TestDecoderDelegate alloc] init];
+    decoder2.delegate = delegate;
+    NSDictionary *withDelegate = [decoder2 decodeDictionary];
+    
+    XCTAssertEqualObjects(withoutHooks, sample);
+    XCTAssertEqualObjects(withoutHooks, withDelegate);
+    XCTAssertEqualObjects([withoutHooks allKeys], [withDelegate allKeys]);
+    XCTAssertTrue([[withoutHooks objectForKey:@"five"] isKindOfClass:[OrderedDictionary class]]);
+    XCTAssertTrue(delegate.willFinish, @"Delegate did not receive -decoderWillFinish");
+    XCTAssertTrue(delegate.decodedObjects.count > sample.count);
+    
+    BSONDecoder *decoder3 = [[BSONDecoder alloc] initWithDocument:document];
+    decoder3.behaviorOnNull = BSONRaiseExceptionOnNull;
+    XCTAssertThrows([decoder3 decodeDictionary]);
+    
+    maybe_release(decoder1);
+    maybe_release(decoder2);
+    maybe_release(decoder3);
+    maybe_release(delegate);
+}
+
+- (void) testDecodeDictionaryWithKeyPaths {
+    NSDictionary *sample = [NSDictionary dictionaryWithObjectsAndKeys:
+                            [NSNumber numberWithInt:1], @"one",
+                            @"2", @"two",
+                            [NSNull null], @"three",
+                            [NSArray arrayWithObjects:@"zero", @"first",
+                             [NSDictionary dictionaryWithObjectsAndKeys:@"b", @"a", @"d", @"c", nil], nil], @"four",
+                            [NSDictionary dictionaryWithObjectsAndKeys:
+                             [NSArray arrayWithObject:@"c"], @"b",
+                             [NSDictionary dictionaryWithObject:@"f" forKey:@"e"], @"d", nil], @"five",
+                            nil];
+    BSONDocument *document = [BSONEncoder documentForDictionary:sample];
+    NSArray *keyPaths = [NSArray arrayWithObjects:@"one", @"three", @"four.1", @"four.2.c",
+                         [BSONCompiledKeyPath keyPathWithString:@"five.d"], @"five.d.e",
+                         @"two.x", @"missing", nil];
+    NSDictionary *expected = [NSDictionary dictionaryWithObjectsAndKeys:
+                              [NSNumber numberWithInt:1], @"one",
+                              [NSNull null], @"three",
+                              [NSArray arrayWithObjects:@"first",
+                               [NSDictionary dictionaryWithObject:@"d" forKey:@"c"], nil], @"four",
+                              [NSDictionary dictionaryWithObject:
+                               [NSDictionary dictionaryWithObject:@"f" forKey:@"e"] forKey:@"d"], @"five",
+                              nil];
+    
+    NSDictionary *withoutHooks = [BSONDecoder decodeDictionaryWithKeyPaths:keyPaths document:document];
+    XCTAssertEqualObjects(withoutHooks, expected);
+    // In document order
+    NSMutableArray *expectedKeys = [NSMutableArray array];
+    for (NSString *key in [[BSONDecoder decodeDictionaryWithDocument:document] allKeys])
+        if ([expected objectForKey:key]) [expectedKeys addObject:key];
+    XCTAssertEqualObjects([withoutHooks allKeys], expectedKeys);
+    XCTAssertEqualObjects([BSONDecoder decodeDictionaryWithKeyPaths:[NSSet setWithObject:@"five"] document:document],
+                          [NSDictionary dictionaryWithObject:[sample objectForKey:@"five"] forKey:@"five"]);
+    XCTAssertEqualObjects([BSONDecoder decodeDictionaryWithKeyPaths:[NSArray array] document:document],
+                          [NSDictionary dictionary]);
+    
+    BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document];
+    TestDecoderDelegate *delegate = [[TestDecoderDelegate alloc] init];
+    decoder.delegate = delegate;
+    XCTAssertEqualObjects([decoder decodeDictionaryWithKeyPaths:keyPaths], expected);
+    XCTAssertTrue(delegate.willFinish, @"Delegate did not receive -decoderWillFinish");
+    XCTAssertTrue([delegate.decodedKeyPaths containsObject:[NSArray arrayWithObjects:@"four", @"2", @"c", nil]]);
+    XCTAssertFalse([delegate.decodedKeyPaths containsObject:[NSArray arrayWithObject:@"two"]]);
+    
+    maybe_release(decoder);
+    maybe_release(delegate);
+}
+
+- (void) testReferencesDocumentBytes {
+    NSMutableString *longString = [NSMutableString string];
+    while (longString.length < 200) [longString appendString:@"A long string "];
+    NSMutableData *blob = [NSMutableData dataWithLength:1000];
+    memset(blob.mutableBytes, 'x', blob.length);
+    NSDictionary *sample = [NSDictionary dictionaryWithObjectsAndKeys:
+                            longString, @"text",
+                            @"short", @"title",
+                            blob, @"blob",
+                            [NSArray arrayWithObjects:longString, [NSNumber numberWithInt:2], nil], @"list",
+                            nil];
+    // BSONSymbol doesn't implement equality, so it's compared separately
+    NSMutableDictionary *withSymbol = [NSMutableDictionary dictionaryWithDictionary:sample];
+    [withSymbol setObject:[BSONSymbol symbol:longString] forKey:@"symbol"];
+    NSData *data = [[BSONEncoder documentForDictionary:withSymbol] dataValue];
+    const char *start = data.bytes, *end = start + data.length;
+    BSONDocument *document = [BSONDocument documentWithData:data];
+    
+    BSONIterator *iterator = [document iterator];
+    iterator.referencesDocumentBytes = YES;
+    [iterator valueTypeForKey:@"blob"];
+    NSData *blobValue = [iterator dataValue];
+    XCTAssertEqualObjects(blobValue, blob);
+    XCTAssertTrue((const char *) blobValue.bytes >= start && (const char *) blobValue.bytes < end);
+    [iterator valueTypeForKey:@"text"];
+    XCTAssertEqualObjects([iterator stringValue], longString);
+    
+    BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document];
+    decoder.referencesDocumentBytes = YES;
+    NSDictionary *decoded = [decoder decodeDictionary];
+    XCTAssertEqualObjects([[decoded objectForKey:@"symbol"] symbol], longString);
+    NSMutableDictionary *withoutSymbol = [NSMutableDictionary dictionaryWithDictionary:decoded];
+    [withoutSymbol removeObjectForKey:@"symbol"];
+    XCTAssertEqualObjects(withoutSymbol, sample);
+    XCTAssertTrue([[decoded objectForKey:@"blob"] bytes] >= (const void *) start
+                  && [[decoded objectForKey:@"blob"] bytes] < (const void *) end);
+    
+    NSDictionary *detached = [BSONDecoder detachedObject:decoded];
+    XCTAssertEqualObjects([[detached objectForKey:@"symbol"] symbol], longString);
+    XCTAssertEqualObjects([detached objectForKey:@"list"], [sample objectForKey:@"list"]);
+    XCTAssertEqualObjects([detached objectForKey:@"blob"], blob);
+    XCTAssertTrue([detached isKindOfClass:[OrderedDictionary class]]);
+    XCTAssertTrue([[detached objectForKey:@"blob"] bytes] < (const void *) start
+                  || [[detached objectForKey:@"blob"] bytes] >= (const void *) end);
+    XCTAssertTrue([detached objectForKey:@"text"] != [decoded objectForKey:@"text"]);
+    XCTAssertTrue([[detached objectForKey:@"list"] objectAtIndex:0] != [[decoded objectForKey:@"list"] objectAtIndex:0]);
+    XCTAssertTrue([[detached objectForKey:@"symbol"] symbol] != [[decoded objectForKey:@"symbol"] symbol]);
+    XCTAssertEqual([detached objectForKey:@"title"], [decoded objectForKey:@"title"]);
+    XCTAssertEqual(detached, [BSONDecoder detachedObject:detached]);
+    maybe_release(decoder);
+}
+
+- (void) testReferencesDocumentBytesOnlyForPlainASCII {
+    NSString *padding = [@"" stringByPaddingToLength:100 withString:@"p" startingAtIndex:0];
+    NSString *accented = [padding stringByAppendingString:@"\u00e9"];
+    NSString *withNUL = [NSString stringWithFormat:@"%@%C%@", padding, (unichar) 0, padding];
+    BSONEncoder *encoder = [[BSONEncoder alloc] initForWriting];
+    [encoder encodeString:padding forKey:@"ascii"];
+    [encoder encodeString:accented forKey:@"accented"];
+    [encoder encodeString:withNUL forKey:@"withNUL"];
+    BSONDocument *document = [encoder BSONDocument];
+    maybe_release(encoder);
+    
+    NSDictionary *copied = [BSONDecoder decodeDictionaryWithDocument:document];
+    BSONDecoder *decoder = [[BSONDecoder alloc] initWithDocument:document];
+    decoder.referencesDocumentBytes = YES;
+    NSDictionary *referencing = [decoder decodeDictionary];
+    maybe_release(decoder);
+    
+    XCTAssertEqualObjects(referencing, copied, @"Referencing shouldn't change what strings decode to");
+    XCTAssertEqualObjects([referencing objectForKey:@"accented"], accented);
+    XCTAssertTrue([BSONDecoder detachedObject:[referencing objectForKey:@"ascii"]] != [referencing objectForKey:@"ascii"]);
+    XCTAssertEqual([BSONDecoder detachedObject:[referencing objectForKey:@"accented"]], [referencing objectForKey:@"accented"],
+                   @"Non-ASCII text is copied, so it shouldn't refer to the document");
+    XCTAssertEqual([BSONDecoder detachedObject:[referencing objectForKey:@"withNUL"]], [referencing objectForKey:@"withNUL"]);
+}
+
+- (void) testObjectIDGeneration {
+    NSArray *objectIDs = [BSONObjectID objectIDsWithCount:1000];
+    XCTAssertEqual((NSUInteger) 1000, objectIDs.count);
+    XCTAssertEqual((NSUInteger) 1000, [[NSSet setWithArray:objectIDs] count]);
+    
+    // One byte in, so that the object IDs aren't aligned
+    char *buffer = malloc(12 * 300 + 1);
+    [BSONObjectID generateObjectIDBytes:buffer + 1 count:300];
+    NSMutableArray *generated = [NSMutableArray arrayWithArray:objectIDs];
+    for (NSUInteger i = 0; i < 300; ++i)
+        [generated addObject:[BSONObjectID objectIDWithData:[NSData dataWithBytes:buffer + 1 + 12 * i length:12]]];
+    free(buffer);
+    [generated addObject:[BSONObjectID objectID]];
+    // Created on one thread, so each is greater than the one before
+    for (NSUInteger i = 1; i < generated.count; ++i)
+        XCTAssertTrue(memcmp([[[generated objectAtIndex:i - 1] dataValue] bytes],
+                             [[[generated objectAtIndex:i] dataValue] bytes], 12) < 0);
+    
+    NSMutableSet *concurrent = [NSMutableSet set];
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+        NSMutableArray *ids = [NSMutableArray array];
+        for (int i = 0; i < 1000; ++i) [ids addObject:[BSONObjectID objectID]];
+        @synchronized (concurrent) {
+            [concurrent addObjectsFromArray:ids];
+        }
+    });
+    XCTAssertEqual((NSUInteger) 8000, concurrent.count);
+    
+    [BSONObjectID generateIncrementUsingBlock:^int{ return 42; }];
+    const char *bytes = [[[BSONObjectID objectID] dataValue] bytes];
+    XCTAssertTrue(0 == bytes[8] && 0 == bytes[9] && 0 == bytes[10] && 42 == bytes[11]);
+    [BSONObjectID generateIncrementUsingBlock:nil];
+}
+
+- (void) testObjectIDStringValue {
+    NSString *hex = @"0123456789abcdefABCDEF00";
+    BSONObjectID *objectID = [BSONObjectID objectIDWithString:hex];
+    const unsigned char expected[12] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0xab, 0xcd, 0xef, 0x00 };
+    XCTAssertEqual(0, memcmp([objectID.dataValue bytes], expected, 12));
+    XCTAssertEqualObjects(objectID.stringValue, [hex lowercaseString]);
+    XCTAssertEqualObjects([BSONObjectID objectIDWithString:objectID.stringValue], objectID);
+    
+    XCTAssertNil([BSONObjectID objectIDWithString:@"0123456789abcdefABCDEF0g"]);
+    XCTAssertNil([BSONObjectID objectIDWithString:@"0123456789abcdefABCDEF0"]);
+    XCTAssertNil([BSONObjectID objectIDWithString:@"0123456789abcdefABCDEF0\u00e9"]);
+    XCTAssertNil([BSONObjectID objectIDWithString:@"0123456789abcdef ABCDEF0"]);
+    
+    BSONObjectID *other = [BSONObjectID objectIDWithString:@"0123456789abcdefabcdef00"];
+    XCTAssertEqualObjects(objectID, other);
+    XCTAssertEqual(objectID.hash, other.hash);
+    XCTAssertEqual([objectID compare:other], NSOrderedSame);
+    // Bytes compare unsigned, so 0x80 sorts after 0x7f
+    BSONObjectID *low = [BSONObjectID objectIDWithString:@"7f0000000000000000000000"];
+    BSONObjectID *high = [BSONObjectID objectIDWithString:@"800000000000000000000000"];
+    XCTAssertEqual([low compare:high], NSOrderedAscending);
+    XCTAssertEqual([high compare:low], NSOrderedDescending);
+    XCTAssertFalse([low isEqual:high]);
+}
+
 - (void) testAwakeAfterUsingCoder {
     PersonWithCoding *lucy = [[PersonWithCoding alloc] init];
     lucy.name = @"Lucy Ricardo";
@@ -0,0 +1,140 @@
+//
+//  OrderedDictionaryTest.m
+//  ObjCMongoDB
+//
+//  Copyright 2013 Paul Melnikow and other contributors
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#import <XCTest/XCTest.h>
+#import "BSON_Helper.h"
+#import "OrderedDictionary.h"
+
+@interface OrderedDictionaryTest : XCTestCase
+
+@end
+
+@implementation OrderedDictionaryTest
+
+- (NSArray *) keysOf:(OrderedDictionary *) dictionary {
+    NSMutableArray *result = [NSMutableArray array];
+    for (id key in dictionary) [result addObject:key];
+    XCTAssertEqualObjects(result, [[dictionary keyEnumerator] allObjects]);
+    return result;
+}
+
+- (void) testKeepsInsertionOrder {
+    OrderedDictionary *dictionary = [OrderedDictionary dictionary];
+    [dictionary setObject:@1 forKey:@"c"];
+    [dictionary setObject:@2 forKey:@"a"];
+    [dictionary setObject:@3 forKey:@"b"];
+    [dictionary setObject:@4 forKey:@"a"];
+    XCTAssertEqual((NSUInteger) 3, dictionary.count);
+    XCTAssertEqualObjects(@4, [dictionary objectForKey:@"a"]);
+    XCTAssertEqualObjects((@[ @"c", @"a", @"b" ]), [self keysOf:dictionary]);
+    XCTAssertEqualObjects((@[ @"b", @"a", @"c" ]), [[dictionary reverseKeyEnumerator] allObjects]);
+    XCTAssertEqualObjects(@"a", [dictionary keyAtIndex:1]);
+
+    [dictionary removeObjectForKey:@"c"];
+    [dictionary removeObjectForKey:@"missing"];
+    XCTAssertNil([dictionary objectForKey:@"c"]);
+    XCTAssertEqualObjects((@[ @"a", @"b" ]), [self keysOf:dictionary]);
+    XCTAssertEqualObjects(@"b", [dictionary keyAtIndex:1]);
+
+    [dictionary insertObject:@5 forKey:@"d" atIndex:0];
+    [dictionary insertObject:@6 forKey:@"b" atIndex:1];
+    XCTAssertEqualObjects((@[ @"d", @"b", @"a" ]), [self keysOf:dictionary]);
+    XCTAssertEqualObjects(@6, [dictionary objectForKey:@"b"]);
+    XCTAssertThrows([dictionary insertObject:@7 forKey:@"e" atIndex:5]);
+    XCTAssertThrows([dictionary keyAtIndex:3]);
+    XCTAssertThrows([dictionary setObject:nil forKey:@"f"]);
+
+    NSDictionary *expected = @{ @"a" : @4, @"b" : @6, @"d" : @5 };
+    XCTAssertEqualObjects(expected, dictionary);
+    XCTAssertEqualObjects(dictionary, expected);
+
+    [dictionary removeAllObjects];
+    XCTAssertEqual((NSUInteger) 0, dictionary.count);
+    XCTAssertEqualObjects(@[], [self keysOf:dictionary]);
+}
+
+- (void) testManyInsertionsAndRemovals {
+    OrderedDictionary *dictionary = [OrderedDictionary dictionary];
+    NSMutableArray *expectedKeys = [NSMutableArray array];
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            NSString *key = [NSString stringWithFormat:@"%d-%d", round, i];
+            [dictionary setObject:[NSNumber numberWithInt:i] forKey:key];
+            [expectedKeys addObject:key];
+        }
+        // Remove every other key, and then add one and remove it, so that the removals leave
+        // holes and the table fills up with tombstones
+        for (int i = 0; i < 100; i += 2) {
+            NSString *key = [NSString stringWithFormat:@"%d-%d", round, i];
+            [dictionary removeObjectForKey:key];
+            [expectedKeys removeObject:key];
+            [dictionary setObject:@0 forKey:@"transient"];
+            [dictionary removeObjectForKey:@"transient"];
+        }
+        XCTAssertEqual(expectedKeys.count, dictionary.count);
+    }
+    XCTAssertEqualObjects(expectedKeys, [self keysOf:dictionary]);
+    for (NSString *key in expectedKeys)
+        XCTAssertEqualObjects([NSNumber numberWithInt:[[[key componentsSeparatedByString:@"-"] lastObject] intValue]],
+                              [dictionary objectForKey:key]);
+    XCTAssertEqualObjects([expectedKeys objectAtIndex:500], [dictionary keyAtIndex:500]);
+}
+
+- (void) testReadsStepOverHolesFromSeveralThreads {
+    OrderedDictionary *dictionary = [OrderedDictionary dictionary];
+    NSMutableArray *expectedKeys = [NSMutableArray array];
+    for (int i = 0; i < 100; ++i) {
+        NSString *key = [NSString stringWithFormat:@"%d", i];
+        [dictionary setObject:@(i) forKey:key];
+        [expectedKeys addObject:key];
+    }
+    // Few enough removals that they stay holes, which the readers below mustn't sweep away
+    for (int i = 5; i < 100; i += 10) {
+        NSString *key = [NSString stringWithFormat:@"%d", i];
+        [dictionary removeObjectForKey:key];
+        [expectedKeys removeObject:key];
+    }
+    dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+        for (int round = 0; round < 100; ++round) {
+            NSMutableArray *keys = [NSMutableArray array];
+            for (id key in dictionary) [keys addObject:key];
+            XCTAssertEqualObjects(expectedKeys, keys);
+            XCTAssertEqualObjects(expectedKeys, [[dictionary keyEnumerator] allObjects]);
+            XCTAssertEqualObjects([expectedKeys objectAtIndex:50], [dictionary keyAtIndex:50]);
+        }
+    });
+}
+
+- (void) testCopiesKeys {
+    OrderedDictionary *dictionary = [OrderedDictionary dictionary];
+    NSMutableString *key = [NSMutableString stringWithString:@"key"];
+    [dictionary setObject:@1 forKey:key];
+    [key appendString:@"changed"];
+    XCTAssertEqualObjects(@1, [dictionary objectForKey:@"key"]);
+    XCTAssertNil([dictionary objectForKey:key]);
+}
+
+- (void) testMutationDuringEnumerationRaises {
+    OrderedDictionary *dictionary = [OrderedDictionary dictionaryWithObjectsAndKeys:@1, @"a", @2, @"b", nil];
+    XCTAssertThrows({
+        for (id key in dictionary) [dictionary setObject:key forKey:@"c"];
+    });
+}
+
+@end